@@ -0,0 +1,182 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+// small benchmark harness in the spirit of Google Benchmark: body of benchmark runs
+// its loop while State::KeepRunning() returns true, that is until MIN_TIME passes.
+// Results are printed as a table or as JSON if --json is passed, --filter=<text>
+// runs only benchmarks whose names contain the text
+namespace bench {
+
+    class State {
+    public:
+        // time which one benchmark runs at least
+        static constexpr std::chrono::milliseconds MIN_TIME{ 500 };
+
+        bool KeepRunning() {
+            auto now = Clock::now();
+            if (iterations_ == 0 && !running_) {
+                running_ = true;
+                start_ = now;
+                return true;
+            }
+            ++iterations_;
+            if (elapsed_ + (now - start_) < MIN_TIME) {
+                return true;
+            }
+            elapsed_ += now - start_;
+            running_ = false;
+            return false;
+        }
+
+        // time of code between PauseTiming and ResumeTiming is not measured
+        void PauseTiming() {
+            elapsed_ += Clock::now() - start_;
+        }
+
+        void ResumeTiming() {
+            start_ = Clock::now();
+        }
+
+        // add processed items, their rate per second is reported as <name>_per_second
+        void AddItems(std::string_view name, double count) {
+            for (auto& [item, total] : items_) {
+                if (item == name) {
+                    total += count;
+                    return;
+                }
+            }
+            items_.emplace_back(std::string(name), count);
+        }
+
+        // set value which is reported as is
+        void SetCounter(std::string_view name, double value) {
+            for (auto& [counter, current] : counters_) {
+                if (counter == name) {
+                    current = value;
+                    return;
+                }
+            }
+            counters_.emplace_back(std::string(name), value);
+        }
+
+        [[nodiscard]] size_t Iterations() const {
+            return iterations_;
+        }
+
+        [[nodiscard]] double Seconds() const {
+            return std::chrono::duration<double>(elapsed_).count();
+        }
+
+        [[nodiscard]] const std::vector<std::pair<std::string, double>>& Items() const {
+            return items_;
+        }
+
+        [[nodiscard]] const std::vector<std::pair<std::string, double>>& Counters() const {
+            return counters_;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        Clock::time_point start_;
+        Clock::duration elapsed_{};
+        size_t iterations_ = 0;
+        bool running_ = false;
+        std::vector<std::pair<std::string, double>> items_;
+        std::vector<std::pair<std::string, double>> counters_;
+    };
+
+    // peak resident memory of process in kilobytes
+    inline long PeakResidentKilobytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    class Runner {
+    public:
+        Runner(int argc, char* argv[]) {
+            for (int i = 1; i < argc; ++i) {
+                std::string_view arg = argv[i];
+                if (arg == "--json") {
+                    json_ = true;
+                }
+                else if (arg.substr(0, FILTER.size()) == FILTER) {
+                    filter_ = std::string(arg.substr(FILTER.size()));
+                }
+            }
+        }
+
+        Runner(const Runner&) = delete;
+        Runner& operator=(const Runner&) = delete;
+
+        ~Runner() {
+            if (json_) {
+                if (reported_ == 0) {
+                    std::cout << "{\n  \"benchmarks\": [";
+                }
+                std::cout << "\n  ],\n  \"context\": {\"peak_resident_kb\": " << PeakResidentKilobytes() << "}\n}\n";
+            }
+        }
+
+        template <typename Body>
+        void Run(const std::string& name, Body body) {
+            if (name.find(filter_) == std::string::npos) {
+                return;
+            }
+            State state;
+            body(state);
+            Report(name, state);
+        }
+
+    private:
+        static constexpr std::string_view FILTER = "--filter=";
+
+        void Report(const std::string& name, const State& state) {
+            double seconds = state.Seconds();
+            size_t iterations = state.Iterations();
+            double ns_per_iteration = iterations > 0 ? seconds * 1e9 / static_cast<double>(iterations) : 0;
+
+            if (json_) {
+                std::cout << (reported_ == 0 ? "{\n  \"benchmarks\": [\n" : ",\n");
+                std::cout << "    {\"name\": \"" << name << "\", \"iterations\": " << iterations
+                    << ", \"ns_per_iteration\": " << std::fixed << std::setprecision(1) << ns_per_iteration;
+                for (const auto& [item, count] : state.Items()) {
+                    std::cout << ", \"" << item << "_per_second\": " << count / seconds
+                        << ", \"" << item << "_per_iteration\": " << count / static_cast<double>(iterations);
+                }
+                for (const auto& [counter, value] : state.Counters()) {
+                    std::cout << ", \"" << counter << "\": " << value;
+                }
+                std::cout << "}" << std::defaultfloat;
+            }
+            else {
+                std::cout << std::left << std::setw(40) << name << std::right << std::setw(10) << iterations
+                    << std::setw(16) << std::fixed << std::setprecision(0) << ns_per_iteration << " ns";
+                for (const auto& [item, count] : state.Items()) {
+                    std::cout << "  " << item << "/s=" << std::setprecision(0) << count / seconds;
+                }
+                for (const auto& [counter, value] : state.Counters()) {
+                    std::cout << "  " << counter << '=' << std::setprecision(2) << value;
+                }
+                std::cout << std::defaultfloat << std::endl;
+            }
+            ++reported_;
+        }
+
+        bool json_ = false;
+        std::string filter_;
+        size_t reported_ = 0;
+    };
+
+}  // namespace bench
@@ -0,0 +1,103 @@
+// benchmark of one parsed program which is executed by many threads at once
+//
+// build from the root of repository with sources of interpreter except main.cpp and tests:
+//   g++ -std=c++17 -O2 -pthread -I. bench/concurrency_bench.cpp bytecode.cpp collector.cpp heap.cpp image.cpp interpreter.cpp lexer.cpp output.cpp parse.cpp profiler.cpp runtime.cpp statement.cpp string_value.cpp -o concurrency_bench
+// run: ./concurrency_bench [--json] [--filter=<text>]
+
+#include "bench/bench_runner.h"
+
+#include "interpreter.h"
+
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+    // operations in one run of the program
+    constexpr size_t OPERATIONS_PER_RUN = 1000;
+    // runs of the program by every thread in one iteration of benchmark
+    constexpr size_t RUNS_PER_ITERATION = 20;
+
+    // method calls, field updates, calls of __add__ and __lt__ and string constants,
+    // so threads share classes, constants and inline caches of the program
+    string MakeProgram() {
+        ostringstream out;
+        out << R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(step):
+    self.value = self.value + step
+
+  def __add__(other):
+    return self.value + other.value
+
+  def __lt__(other):
+    return self.value < other.value
+
+class Bench:
+  def run(a, b):
+)";
+        for (size_t i = 0; i < OPERATIONS_PER_RUN; ++i) {
+            out << "    a.add(1)\n    c = a + b\n    d = b < a\n    s = 'x'\n";
+        }
+        out << "    return c\n\na = Counter()\nb = Counter()\nbench = Bench()\nr = bench.run(a, b)\n";
+        return out.str();
+    }
+
+    // ops_per_second of the run with one thread, speedup of other runs is measured against it
+    double single_thread_rate = 0;
+
+    void BenchmarkThreads(bench::Runner& runner, const interpreter::Program& program, size_t thread_count) {
+        const string mode = program.GetMode() == interpreter::ExecutionMode::Bytecode ? "bytecode"s : "tree"s;
+        runner.Run(mode + "/threads_"s + to_string(thread_count), [&](bench::State& state) {
+            size_t operations = 0;
+            while (state.KeepRunning()) {
+                vector<thread> threads;
+                for (size_t t = 0; t < thread_count; ++t) {
+                    threads.emplace_back([&program] {
+                        // output of programs is discarded
+                        ostream output(nullptr);
+                        interpreter::Interpreter interpreter(program, output);
+                        for (size_t run = 0; run < RUNS_PER_ITERATION; ++run) {
+                            interpreter.Run();
+                        }
+                    });
+                }
+                for (thread& worker : threads) {
+                    worker.join();
+                }
+                operations += thread_count * RUNS_PER_ITERATION * OPERATIONS_PER_RUN;
+            }
+            state.AddItems("ops", static_cast<double>(operations));
+
+            const double rate = static_cast<double>(operations) / state.Seconds();
+            if (thread_count == 1) {
+                single_thread_rate = rate;
+            }
+            if (single_thread_rate > 0) {
+                state.SetCounter("speedup", rate / single_thread_rate);
+            }
+        });
+    }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const string text = MakeProgram();
+    bench::Runner runner(argc, argv);
+    for (auto mode : { interpreter::ExecutionMode::TreeWalking, interpreter::ExecutionMode::Bytecode }) {
+        const interpreter::Program program = interpreter::Program::Parse(text, mode);
+        single_thread_rate = 0;
+        for (size_t thread_count : { 1, 2, 4, 8 }) {
+            BenchmarkThreads(runner, program, thread_count);
+        }
+    }
+    return 0;
+}
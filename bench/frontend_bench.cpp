@@ -0,0 +1,289 @@
+// benchmarks of lexer, parser, loader of program images and loader of modules on big generated programs
+//
+// build from the root of repository with sources of interpreter except main.cpp and tests:
+//   g++ -std=c++17 -O2 -pthread -I. bench/frontend_bench.cpp bytecode.cpp collector.cpp heap.cpp image.cpp interpreter.cpp lexer.cpp loader.cpp output.cpp parse.cpp profiler.cpp runtime.cpp statement.cpp string_value.cpp -o frontend_bench
+// run: ./frontend_bench [--json] [--filter=<text>]
+
+#include "bench/bench_runner.h"
+
+#include "heap.h"
+#include "image.h"
+#include "lexer.h"
+#include "loader.h"
+#include "parse.h"
+#include "runtime.h"
+#include "statement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+    // chain of classes where every class derives from the previous one
+    // and its method calls the method of the base class
+    string MakeDeepHierarchy(size_t depth) {
+        ostringstream out;
+        out << "class C0:\n  def m0(x):\n    return x + 1\n\n";
+        for (size_t i = 1; i < depth; ++i) {
+            out << "class C" << i << "(C" << i - 1 << "):\n"
+                << "  def m" << i << "(x):\n"
+                << "    y = self.m" << i - 1 << "(x) * 2\n"
+                << "    if y > " << i << " and not x == 0:\n"
+                << "      return y - 1\n"
+                << "    return y\n\n";
+        }
+        out << "c = C" << depth - 1 << "()\nprint c.m" << depth - 1 << "(1)\n";
+        return out.str();
+    }
+
+    // one class with many methods which have locals, conditions and string literals
+    string MakeManyMethods(size_t count) {
+        ostringstream out;
+        out << "class Big:\n  def __init__():\n    self.total = 0\n\n";
+        for (size_t i = 0; i < count; ++i) {
+            out << "  def method_" << i << "(a, b):\n"
+                << "    # method number " << i << "\n"
+                << "    c = a + b * " << i << "\n"
+                << "    if c > " << i << ":\n"
+                << "      self.total = self.total + c\n"
+                << "      return 'big ' + str(c)\n"
+                << "    else:\n"
+                << "      return \"small\"\n\n";
+        }
+        out << "b = Big()\nprint b.method_0(1, 2)\n";
+        return out.str();
+    }
+
+    // top-level assignments with long chains of arithmetic and nested parentheses
+    string MakeLongExpressions(size_t lines, size_t terms) {
+        ostringstream out;
+        out << "x = 1\ny = 2\n";
+        for (size_t i = 0; i < lines; ++i) {
+            out << "v" << i << " = ";
+            for (size_t j = 0; j < terms; ++j) {
+                if (j > 0) {
+                    out << (j % 3 == 0 ? " - " : j % 3 == 1 ? " + " : " * ");
+                }
+                if (j % 5 == 0) {
+                    out << "(x + (y * " << j << "))";
+                }
+                else {
+                    out << (j % 2 == 0 ? "x" : "y") << " / " << j;
+                }
+            }
+            out << '\n';
+        }
+        return out.str();
+    }
+
+    // modules which import the first one, every module has a class with many methods.
+    // Files are written into temporary directory, the program is the last file
+    class ModuleProject {
+    public:
+        ModuleProject(size_t modules, size_t methods) {
+            char path[] = "/tmp/mython_frontend_benchXXXXXX";
+            if (!mkdtemp(path)) {
+                throw runtime_error("Can not create directory for modules"s);
+            }
+            directory_ = path;
+
+            ostringstream main;
+            for (size_t i = 0; i < modules; ++i) {
+                ostringstream out;
+                if (i > 0) {
+                    out << "import module_0\n\n";
+                }
+                out << "class Module" << i << (i > 0 ? "(Module0)" : "") << ":\n";
+                for (size_t j = 0; j < methods; ++j) {
+                    out << "  def method_" << j << "(a, b):\n"
+                        << "    c = a + b * " << j << "\n"
+                        << "    if c > " << i << ":\n"
+                        << "      return 'big ' + str(c)\n"
+                        << "    return \"small\"\n\n";
+                }
+                out << "m" << i << " = Module" << i << "()\n";
+                Write("module_"s + to_string(i), out.str());
+                main << "import module_" << i << "\n";
+            }
+            main << "print m0.method_0(1, 2)\n";
+            main_ = Write("main"s, main.str());
+        }
+
+        ModuleProject(const ModuleProject&) = delete;
+        ModuleProject& operator=(const ModuleProject&) = delete;
+
+        ~ModuleProject() {
+            for (const string& file : files_) {
+                std::remove(file.c_str());
+                std::remove((file + "c"s).c_str());
+            }
+            rmdir(directory_.c_str());
+        }
+
+        [[nodiscard]] const string& GetMain() const {
+            return main_;
+        }
+
+        [[nodiscard]] size_t GetSourceBytes() const {
+            return source_bytes_;
+        }
+
+        [[nodiscard]] size_t GetModules() const {
+            return files_.size();
+        }
+
+    private:
+        string Write(const string& name, const string& text) {
+            const string path = directory_ + "/"s + name + ".my"s;
+            ofstream(path) << text;
+            files_.push_back(path);
+            source_bytes_ += text.size();
+            return path;
+        }
+
+        string directory_;
+        string main_;
+        vector<string> files_;
+        size_t source_bytes_ = 0;
+    };
+
+    void BenchmarkLexer(bench::Runner& runner, const string& name, const string& program) {
+        runner.Run("lexer/"s + name, [&](bench::State& state) {
+            while (state.KeepRunning()) {
+                parse::Lexer lexer(string_view{ program });
+                size_t tokens = 1;
+                while (!lexer.NextToken().Is<parse::token_type::Eof>()) {
+                    ++tokens;
+                }
+                state.AddItems("tokens", static_cast<double>(tokens));
+                state.AddItems("bytes", static_cast<double>(program.size()));
+            }
+            state.SetCounter("source_bytes", static_cast<double>(program.size()));
+        });
+    }
+
+    // with lazy_methods bodies of methods are only skipped, parsed program keeps a copy of text
+    void BenchmarkParser(bench::Runner& runner, const string& name, const string& program,
+                         const ParseOptions& options = {}) {
+        runner.Run((options.lazy_methods ? "parser_lazy/"s : "parser/"s) + name, [&](bench::State& state) {
+            runtime::Arena arena;
+            size_t peak_bytes = 0;
+            while (state.KeepRunning()) {
+                const runtime::AllocationStats before = runtime::ObjectPool::ForCurrentThread().GetStats();
+                unique_ptr<runtime::Executable> tree;
+                {
+                    runtime::ArenaScope scope(arena);
+                    parse::Lexer lexer(string_view{ program });
+                    tree = ParseProgram(lexer, nullptr, options);
+                }
+                // nodes are allocated in arena and classes in pool of objects
+                const runtime::AllocationStats& objects = runtime::ObjectPool::ForCurrentThread().GetStats();
+                state.AddItems("nodes", static_cast<double>(arena.GetStats().allocations));
+                peak_bytes = std::max(peak_bytes, arena.GetStats().bytes_reserved
+                    + objects.bytes_in_use - before.bytes_in_use
+                    + (options.lazy_methods ? program.size() : 0));
+
+                state.PauseTiming();
+                tree.reset();
+                arena.Reset();
+                state.ResumeTiming();
+            }
+            state.SetCounter("peak_tree_bytes", static_cast<double>(peak_bytes));
+        });
+    }
+
+    // loading of image replaces lexing and parsing when program did not change
+    void BenchmarkImage(bench::Runner& runner, const string& name, const string& program) {
+        runner.Run("image/"s + name, [&](bench::State& state) {
+            runtime::Arena arena;
+            string program_image;
+            {
+                runtime::ArenaScope scope(arena);
+                parse::Lexer lexer(string_view{ program });
+                program_image = image::SaveProgram(*ast::Optimize(ParseProgram(lexer)), program);
+            }
+            arena.Reset();
+
+            while (state.KeepRunning()) {
+                unique_ptr<runtime::Executable> tree;
+                {
+                    runtime::ArenaScope scope(arena);
+                    tree = image::LoadProgram(program_image, program);
+                }
+                state.AddItems("nodes", static_cast<double>(arena.GetStats().allocations));
+
+                state.PauseTiming();
+                tree.reset();
+                arena.Reset();
+                state.ResumeTiming();
+            }
+            state.SetCounter("image_bytes", static_cast<double>(program_image.size()));
+            state.SetCounter("source_bytes", static_cast<double>(program.size()));
+        });
+    }
+
+    // modules which import only the first one are parsed by threads at once, images of modules
+    // are written by the first load and are read by the rest
+    void BenchmarkModules(bench::Runner& runner, const string& name, const ModuleProject& project, size_t threads,
+                          bool use_images) {
+        runner.Run("modules/"s + name, [&](bench::State& state) {
+            interpreter::LoadOptions options;
+            options.mode = interpreter::ExecutionMode::TreeWalking;
+            options.use_images = use_images;
+            options.threads = threads;
+            if (use_images) {
+                interpreter::LoadProgramFile(project.GetMain(), options);
+            }
+            while (state.KeepRunning()) {
+                interpreter::Program program = interpreter::LoadProgramFile(project.GetMain(), options);
+                state.AddItems("bytes", static_cast<double>(project.GetSourceBytes()));
+                state.PauseTiming();
+                {
+                    interpreter::Program destroyed = std::move(program);
+                }
+                state.ResumeTiming();
+            }
+            state.SetCounter("modules", static_cast<double>(project.GetModules()));
+            state.SetCounter("threads", static_cast<double>(threads != 0 ? threads : thread::hardware_concurrency()));
+        });
+    }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const string deep_hierarchy = MakeDeepHierarchy(2000);
+    const string many_methods = MakeManyMethods(5000);
+    const string long_expressions = MakeLongExpressions(2000, 60);
+
+    {
+        bench::Runner runner(argc, argv);
+        BenchmarkLexer(runner, "deep_hierarchy"s, deep_hierarchy);
+        BenchmarkLexer(runner, "many_methods"s, many_methods);
+        BenchmarkLexer(runner, "long_expressions"s, long_expressions);
+        BenchmarkParser(runner, "deep_hierarchy"s, deep_hierarchy);
+        BenchmarkParser(runner, "many_methods"s, many_methods);
+        BenchmarkParser(runner, "long_expressions"s, long_expressions);
+        BenchmarkParser(runner, "deep_hierarchy"s, deep_hierarchy, { true });
+        BenchmarkParser(runner, "many_methods"s, many_methods, { true });
+        BenchmarkImage(runner, "deep_hierarchy"s, deep_hierarchy);
+        BenchmarkImage(runner, "many_methods"s, many_methods);
+        BenchmarkImage(runner, "long_expressions"s, long_expressions);
+
+        const ModuleProject project(32, 200);
+        BenchmarkModules(runner, "one_thread"s, project, 1, false);
+        BenchmarkModules(runner, "all_cores"s, project, 0, false);
+        BenchmarkModules(runner, "images"s, project, 0, true);
+    }
+    return 0;
+}
@@ -0,0 +1,289 @@
+// benchmarks of execution of programs in both modes of interpreter
+//
+// build from the root of repository with sources of interpreter except main.cpp and tests:
+//   g++ -std=c++17 -O2 -pthread -I. bench/runtime_bench.cpp bytecode.cpp collector.cpp heap.cpp image.cpp lexer.cpp output.cpp parse.cpp profiler.cpp runtime.cpp statement.cpp string_value.cpp -o runtime_bench
+// run: ./runtime_bench [--json] [--filter=<text>]
+
+#include "bench/bench_runner.h"
+
+#include "bytecode.h"
+#include "heap.h"
+#include "lexer.h"
+#include "parse.h"
+#include "profiler.h"
+#include "runtime.h"
+#include "statement.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    // number of blocks which were taken from global heap
+    size_t global_heap_allocations = 0;
+}  // namespace
+
+// global operators are replaced to count allocations per operation
+void* operator new(size_t size) {
+    ++global_heap_allocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+    // statements of body are repeated in method Bench.run(a, b) which is called
+    // once per iteration, globals a and b are made by definitions
+    struct Scenario {
+        string name;
+        string definitions;
+        // statements which are executed once at the beginning of run
+        vector<string> prologue;
+        // statements of one operation
+        vector<string> operation;
+    };
+
+    // operations in one call of Bench.run
+    constexpr size_t OPERATIONS_PER_RUN = 1000;
+
+    vector<Scenario> MakeScenarios() {
+        vector<Scenario> scenarios;
+
+        // counter from TestVariablesArePointers: two method calls and field update per operation
+        scenarios.push_back({ "counter"s, R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add():
+    self.value = self.value + 1
+
+class Dummy:
+  def do_add(counter):
+    counter.add()
+
+a = Counter()
+b = Dummy()
+)"s, {}, { "b.do_add(a)"s } });
+
+        // accumulator: increments and copies of fields, comparison with number, calls of methods of self
+        scenarios.push_back({ "field_updates"s, R"(
+class Account:
+  def __init__():
+    self.balance = 0
+    self.operations = 0
+    self.last = 0
+
+  def deposit():
+    self.balance = self.balance + 5
+    self.operations = self.operations + 1
+    self.last = self.balance
+    if self.balance > 1000000:
+      self.balance = 0
+
+  def withdraw():
+    self.balance = self.balance - 3
+    self.count()
+
+  def count():
+    self.operations = self.operations + 1
+
+a = Account()
+b = 0
+)"s, {}, { "a.deposit()"s, "a.withdraw()"s } });
+
+        scenarios.push_back({ "arithmetic"s, "a = 7\nb = 3\n"s, {},
+            { "c = a * b + a / b - (a - b) * 2"s } });
+
+        // Add, Equal and Less on objects call __add__, __eq__ and __lt__, Greater calls both of the last
+        scenarios.push_back({ "dunder_dispatch"s, R"(
+class Vec:
+  def __init__(v):
+    self.v = v
+
+  def __add__(other):
+    return self.v + other.v
+
+  def __lt__(other):
+    return self.v < other.v
+
+  def __eq__(other):
+    return self.v == other.v
+
+a = Vec(1)
+b = Vec(2)
+)"s, {}, { "c = a + b"s, "d = a < b"s, "e = a == b"s, "f = b > a"s } });
+
+        // result grows to long rope of pieces
+        scenarios.push_back({ "string_concat"s, "a = ''\nb = 'xy'\n"s, { "s = a"s },
+            { "s = s + b"s } });
+
+        // chain of additions to temporary string, which is extended in place
+        scenarios.push_back({ "string_chain"s, "a = 12\nb = 'xy'\n"s, {},
+            { "s = str(a) + b + b + b + b"s } });
+
+        scenarios.push_back({ "stringify"s, R"(
+class Named:
+  def __str__():
+    return 'named'
+
+a = 12345
+b = Named()
+)"s, {}, { "s = str(a)"s, "t = str(b)"s, "u = str(True)"s } });
+
+        // every operation leaves a pair of instances which reference each other, the pairs are
+        // freed by cycle collector
+        scenarios.push_back({ "cycles"s, R"(
+class Link:
+  def __init__():
+    self.other = None
+
+a = 0
+b = 0
+)"s, {}, { "p = Link()"s, "q = Link()"s, "p.other = q"s, "q.other = p"s } });
+
+        // every operation is a chain of nested calls
+        scenarios.push_back({ "recursion"s, R"(
+class Deep:
+  def down(n):
+    if n > 0:
+      return self.down(n - 1)
+    return 0
+
+a = Deep()
+b = 0
+)"s, {}, { "c = a.down(20)"s } });
+
+        // numbers, strings and logical values are written into output sink
+        scenarios.push_back({ "print"s, "a = 12345\nb = 'text'\n"s, {},
+            { "print a, b, -7, True, None"s } });
+
+        return scenarios;
+    }
+
+    // stream buffer which discards output, it does not allocate memory
+    class NullBuffer : public streambuf {
+    protected:
+        int_type overflow(int_type c) override {
+            return traits_type::not_eof(c);
+        }
+
+        streamsize xsputn(const char*, streamsize size) override {
+            return size;
+        }
+    };
+
+    string MakeBenchClass(const Scenario& scenario) {
+        ostringstream out;
+        out << scenario.definitions << "\nclass Bench:\n  def run(a, b):\n";
+        for (const string& statement : scenario.prologue) {
+            out << "    " << statement << '\n';
+        }
+        for (size_t i = 0; i < OPERATIONS_PER_RUN; ++i) {
+            for (const string& statement : scenario.operation) {
+                out << "    " << statement << '\n';
+            }
+        }
+        out << "    return 0\n\nbench = Bench()\n";
+        return out.str();
+    }
+
+    unique_ptr<runtime::Executable> Parse(const string& program, bool compile) {
+        parse::Lexer lexer(string_view{ program });
+        unique_ptr<runtime::Executable> tree = ast::Optimize(ParseProgram(lexer));
+        return compile ? bytecode::Compile(std::move(tree)) : std::move(tree);
+    }
+
+    // with profile calls and statements are measured by runtime::Profiler, with budget
+    // calls, time and memory are checked against runtime::ExecutionBudget which is never exceeded
+    void BenchmarkScenario(bench::Runner& runner, const Scenario& scenario, bool compile, bool profile = false,
+                           bool budget = false) {
+        const string name = scenario.name + (compile ? "/bytecode"s : "/tree"s) + (profile ? "_profiled"s : ""s)
+            + (budget ? "_budgeted"s : ""s);
+        runner.Run(name, [&](bench::State& state) {
+            runtime::Arena arena;
+            unique_ptr<runtime::Executable> definitions;
+            unique_ptr<runtime::Executable> call;
+            {
+                runtime::ArenaScope scope(arena);
+                definitions = Parse(MakeBenchClass(scenario), compile);
+                call = Parse("r = bench.run(a, b)\n"s, compile);
+            }
+
+            // output of programs is discarded
+            NullBuffer discarded;
+            ostream output(&discarded);
+            runtime::SimpleContext context(output);
+            runtime::Profiler profiler;
+            if (profile) {
+                context.SetProfiler(&profiler);
+            }
+            if (budget) {
+                runtime::ExecutionBudget limits;
+                limits.calls = UINT64_MAX / 2;
+                limits.time = chrono::hours(1);
+                limits.memory = SIZE_MAX / 2;
+                context.SetBudget(limits);
+            }
+            runtime::Closure closure;
+            definitions->Execute(closure, context);
+
+            size_t heap_allocations = global_heap_allocations;
+            size_t pool_allocations = context.GetHeapStats().objects.allocations;
+            size_t operations = 0;
+            while (state.KeepRunning()) {
+                call->Execute(closure, context);
+                operations += OPERATIONS_PER_RUN;
+            }
+            heap_allocations = global_heap_allocations - heap_allocations;
+            pool_allocations = context.GetHeapStats().objects.allocations - pool_allocations;
+
+            state.AddItems("ops", static_cast<double>(operations));
+            state.SetCounter("heap_allocations_per_op",
+                static_cast<double>(heap_allocations) / static_cast<double>(operations));
+            state.SetCounter("pool_allocations_per_op",
+                static_cast<double>(pool_allocations) / static_cast<double>(operations));
+            state.SetCounter("live_instances", static_cast<double>(context.GetHeapStats().instances.instances));
+
+            closure.clear();
+            definitions.reset();
+            call.reset();
+        });
+    }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const vector<Scenario> scenarios = MakeScenarios();
+    bench::Runner runner(argc, argv);
+    for (const Scenario& scenario : scenarios) {
+        BenchmarkScenario(runner, scenario, false);
+        BenchmarkScenario(runner, scenario, true);
+    }
+    // cost of profiling of method calls and statements
+    BenchmarkScenario(runner, scenarios.front(), false, true);
+    BenchmarkScenario(runner, scenarios.front(), true, true);
+    // cost of checks of execution budget
+    BenchmarkScenario(runner, scenarios.front(), false, false, true);
+    BenchmarkScenario(runner, scenarios.front(), true, false, true);
+    return 0;
+}
@@ -0,0 +1,643 @@
+#include "bytecode.h"
+
+#include "profiler.h"
+
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+#if defined(__GNUC__) || defined(__clang__)
+// labels as values let each instruction jump directly to the handler of next one
+#define MYTHON_COMPUTED_GOTO 1
+#endif
+
+namespace runtime {
+
+    // default compilation falls back to tree-walking of the node
+    void Executable::Compile(bytecode::Compiler& compiler) {
+        compiler.Emit(bytecode::OpCode::ExecuteNode, compiler.AddNode(*this));
+    }
+
+}  // namespace runtime
+
+namespace bytecode {
+
+    using runtime::Closure;
+    using runtime::CompareOp;
+    using runtime::Context;
+    using runtime::ObjectHolder;
+
+    namespace {
+        // change of stack depth after execution of instruction
+        int StackEffect(OpCode op, std::uint16_t b) {
+            switch (op) {
+            case OpCode::PushConst:
+            case OpCode::PushNone:
+            case OpCode::LoadName:
+            case OpCode::LoadSlot:
+            case OpCode::PrintEnd:
+            case OpCode::NewInstance:
+            case OpCode::DefineClass:
+            case OpCode::ExecuteNode:
+                return 1;
+            case OpCode::StoreName:
+            case OpCode::StoreSlot:
+            case OpCode::LoadField:
+            case OpCode::EqualConst:
+            case OpCode::NotEqualConst:
+            case OpCode::LessConst:
+            case OpCode::GreaterConst:
+            case OpCode::LessOrEqualConst:
+            case OpCode::GreaterOrEqualConst:
+            case OpCode::Not:
+            case OpCode::Stringify:
+            case OpCode::PrintSeparator:
+            case OpCode::Jump:
+            // return statement is compiled as expression, its value is left for the following code
+            // which is unreachable, so the depth is kept consistent
+            case OpCode::Return:
+                return 0;
+            case OpCode::CallMethod:
+                return -static_cast<int>(b);
+            case OpCode::NewInstanceInit:
+                return 1 - static_cast<int>(b);
+            default:
+                // binary operations, stores, updates of fields, pops and conditional jumps
+                return -1;
+            }
+        }
+
+        const char* OpCodeName(OpCode op) {
+            switch (op) {
+#define MYTHON_OPCODE_NAME(name) \
+            case OpCode::name:   \
+                return #name;
+                MYTHON_OPCODES(MYTHON_OPCODE_NAME)
+#undef MYTHON_OPCODE_NAME
+            }
+            return "Unknown";
+        }
+
+        ObjectHolder MakeBool(bool value) {
+            return ObjectHolder::Own(runtime::Bool(value));
+        }
+    }  // namespace
+
+    /* --- Compiler --- */
+    void Compiler::Emit(OpCode op, std::uint32_t a, std::uint16_t b) {
+        function_.code.push_back({ op, b, a });
+
+        int effect = StackEffect(op, b);
+        assert(effect >= 0 || stack_depth_ >= static_cast<size_t>(-effect));
+        stack_depth_ += effect;
+        function_.max_stack = std::max(function_.max_stack, stack_depth_);
+    }
+
+    JumpLabel Compiler::EmitJump(OpCode op) {
+        Emit(op);
+        return { function_.code.size() - 1, stack_depth_ };
+    }
+
+    void Compiler::PatchJump(JumpLabel label) {
+        function_.code[label.index].a = static_cast<std::uint32_t>(function_.code.size());
+        // code after unconditional jump is reachable only through the patched jump
+        stack_depth_ = label.stack_depth;
+    }
+
+    std::uint32_t Compiler::AddConstant(ObjectHolder value) {
+        function_.constants.push_back(std::move(value));
+        return static_cast<std::uint32_t>(function_.constants.size() - 1);
+    }
+
+    std::uint32_t Compiler::AddName(const std::string& name) {
+        auto [it, inserted] = name_indexes_.emplace(name, static_cast<std::uint32_t>(function_.names.size()));
+        if (inserted) {
+            function_.names.push_back(name);
+        }
+        return it->second;
+    }
+
+    std::uint32_t Compiler::AddClass(const runtime::Class& cls) {
+        function_.classes.push_back(&cls);
+        return static_cast<std::uint32_t>(function_.classes.size() - 1);
+    }
+
+    std::uint32_t Compiler::AddNode(runtime::Executable& node) {
+        function_.nodes.push_back(&node);
+        return static_cast<std::uint32_t>(function_.nodes.size() - 1);
+    }
+
+    std::uint32_t Compiler::AddCallSite(const std::string& method) {
+        function_.call_sites.push_back({ method, {} });
+        return static_cast<std::uint32_t>(function_.call_sites.size() - 1);
+    }
+
+    std::uint32_t Compiler::AddFieldSite(const std::string& field) {
+        function_.field_sites.push_back({ field, {} });
+        return static_cast<std::uint32_t>(function_.field_sites.size() - 1);
+    }
+
+    namespace {
+        void CompileMethod(runtime::Method& method) {
+            if (auto* compiled = dynamic_cast<CompiledCode*>(method.body.get())) {
+                method.code = &compiled->GetFunction();
+                return;
+            }
+            Compiler method_compiler;
+            method.body->Compile(method_compiler);
+            method_compiler.Emit(OpCode::Return);
+            auto compiled = std::make_unique<CompiledCode>(method_compiler.Finish(), std::move(method.body));
+            method.code = &compiled->GetFunction();
+            method.body = std::move(compiled);
+        }
+    }  // namespace
+
+    void Compiler::CompileClass(runtime::Class& cls) {
+        for (runtime::Method* method : cls.GetOwnMethods()) {
+            // lazy body is compiled when it is parsed
+            if (method->source) {
+                method->source->Defer(*method, &CompileMethod);
+                continue;
+            }
+            CompileMethod(*method);
+        }
+    }
+
+    Function Compiler::Finish() {
+        return std::move(function_);
+    }
+
+    /* --- CompiledCode --- */
+    CompiledCode::CompiledCode(Function function, std::unique_ptr<runtime::Executable> source)
+        : function_(std::move(function))
+        , source_(std::move(source))
+    {
+
+    }
+
+    ObjectHolder CompiledCode::Execute(Closure& closure, Context& context) {
+        return Run(function_, closure, context);
+    }
+
+    const Function& CompiledCode::GetFunction() const {
+        return function_;
+    }
+
+    runtime::Executable& CompiledCode::GetSource() const {
+        return *source_;
+    }
+
+    std::unique_ptr<CompiledCode> Compile(std::unique_ptr<runtime::Executable> program) {
+        Compiler compiler;
+        program->Compile(compiler);
+        compiler.Emit(OpCode::Return);
+        return std::make_unique<CompiledCode>(compiler.Finish(), std::move(program));
+    }
+
+    /* --- VM --- */
+    namespace {
+        // start call of compiled method which VM executes in its loop: frame and stack of the method
+        // are allocated in ValueStack, arguments are moved into the frame. Caller fills state
+        // which is restored on return
+        runtime::CallRecord& PushCall(runtime::ClassInstance& instance, const runtime::Method& method,
+            ObjectHolder* args, size_t arg_count, Context& context) {
+
+            runtime::CallStack& calls = context.GetCallStack();
+            const size_t value_count = method.frame_size + method.code->max_stack;
+            context.EnterCall(false);
+            runtime::CallRecord* pushed = nullptr;
+            try {
+                pushed = &calls.Push();
+                pushed->values = context.GetValueStack().Allocate(value_count);
+            }
+            catch (...) {
+                if (pushed) {
+                    calls.Pop();
+                }
+                context.LeaveCall(false);
+                throw;
+            }
+            runtime::CallRecord& record = *pushed;
+            record.value_count = value_count;
+
+            record.frame.Attach(record.values, method.frame_size);
+            record.frame.Set(0, ObjectHolder::Reference(instance));
+            for (size_t i = 0; i < arg_count; ++i) {
+                record.frame.Set(i + 1, std::move(args[i]));
+            }
+            record.profiler = context.GetProfiler();
+            if (record.profiler) {
+                record.profiler->EnterMethod(instance.GetClass(), method);
+            }
+            record.caller_frame = context.SetCurrentFrame(&record.frame);
+            return record;
+        }
+
+        // finish call on the top of call stack, its result is already taken
+        void PopCall(Context& context) noexcept {
+            runtime::CallStack& calls = context.GetCallStack();
+            runtime::CallRecord& record = calls.Top();
+            if (record.profiler) {
+                record.profiler->LeaveMethod();
+            }
+            context.SetCurrentFrame(record.caller_frame);
+            context.GetValueStack().Free(record.values, record.value_count);
+            record.values = nullptr;
+            if (!record.closure.empty()) {
+                record.closure.clear();
+            }
+            context.LeaveCall(false);
+            calls.Pop();
+        }
+    }  // namespace
+
+    ObjectHolder Run(const Function& function, Closure& closure, Context& context) {
+        // calls of compiled methods continue in this loop, their records are above records
+        // of outer runs, so this run returns when the call stack is back at base depth
+        runtime::CallStack& calls = context.GetCallStack();
+        const size_t base_depth = calls.Size();
+        // stack of values is taken from context, so nested calls do not allocate memory
+        runtime::StackValues stack(context.GetValueStack(), function.max_stack);
+
+        // registers of the executed function, calls switch them to the called method
+        const Function* fn = &function;
+        const Instruction* code = function.code.data();
+        const Instruction* ip = code;
+        ObjectHolder* sp = stack.Data();
+        runtime::Frame* frame = context.GetCurrentFrame();
+        Closure* names = &closure;
+
+        // computed goto out of block does not destroy its variables, so values which
+        // opcodes release are kept in slots of stack, variables are moved-from or trivial
+#ifdef MYTHON_COMPUTED_GOTO
+#define MYTHON_OPCODE_LABEL(name) &&op_##name,
+        static const void* const dispatch_table[] = { MYTHON_OPCODES(MYTHON_OPCODE_LABEL) };
+#undef MYTHON_OPCODE_LABEL
+#define TARGET(name) op_##name:
+#define DISPATCH() goto *dispatch_table[static_cast<std::size_t>(ip->op)]
+#else
+#define TARGET(name) case OpCode::name:
+#define DISPATCH() continue
+#endif
+        try {
+#ifdef MYTHON_COMPUTED_GOTO
+        DISPATCH();
+#else
+        for (;;) switch (ip->op) {
+#endif
+
+        TARGET(PushConst) {
+            *sp++ = fn->constants[ip->a];
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(PushNone) {
+            *sp++ = ObjectHolder::None();
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(LoadName) {
+            auto it = names->find(fn->names[ip->a]);
+            if (it == names->end()) {
+                throw std::runtime_error("Unknown variable"s);
+            }
+            *sp++ = it->second;
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(StoreName) {
+            (*names)[fn->names[ip->a]] = sp[-1];
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(LoadSlot) {
+            *sp++ = frame->Get(ip->a);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(StoreSlot) {
+            frame->Set(ip->a, sp[-1]);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(LoadField) {
+            runtime::ClassInstance* instance = sp[-1].TryAs<runtime::ClassInstance>();
+            if (!instance) {
+                throw std::runtime_error("Wrong type"s);
+            }
+            const FieldSite& site = fn->field_sites[ip->a];
+            ObjectHolder* field = instance->FindField(site.field, site.cache);
+            if (!field) {
+                throw std::runtime_error("Unknown variable"s);
+            }
+            // field is copied before the instance, which may own it, is replaced
+            ObjectHolder value = *field;
+            sp[-1] = std::move(value);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(StoreField) {
+            runtime::ClassInstance* instance = sp[-2].TryAs<runtime::ClassInstance>();
+            if (!instance) {
+                throw std::runtime_error("Object is not a class instance"s);
+            }
+            const FieldSite& site = fn->field_sites[ip->a];
+            instance->SetField(site.field, sp[-1], site.cache);
+            --sp;
+            sp[-1] = std::move(*sp);
+            ++ip;
+            DISPATCH();
+        }
+#define MYTHON_FIELD_UPDATE(name, subtract)                                                     \
+        TARGET(name) {                                                                          \
+            runtime::ClassInstance* instance = sp[-2].TryAs<runtime::ClassInstance>();          \
+            if (!instance) {                                                                    \
+                throw std::runtime_error("Object is not a class instance"s);                    \
+            }                                                                                   \
+            const FieldSite& site = fn->field_sites[ip->a];                                     \
+            sp[-2] = runtime::AddToField(*instance, site.field, site.cache, sp[-1], subtract, context); \
+            *--sp = ObjectHolder::None();                                                       \
+            ++ip;                                                                               \
+            DISPATCH();                                                                         \
+        }
+
+        MYTHON_FIELD_UPDATE(AddToField, false)
+        MYTHON_FIELD_UPDATE(SubFromField, true)
+
+#undef MYTHON_FIELD_UPDATE
+
+        TARGET(Pop) {
+            *--sp = ObjectHolder::None();
+            if (runtime::Profiler* profiler = context.GetProfiler()) {
+                profiler->OnStatement(ip->a);
+            }
+            ++ip;
+            DISPATCH();
+        }
+
+#define MYTHON_BINARY_OPERATION(name, expression)   \
+        TARGET(name) {                              \
+            const ObjectHolder& rhs = *--sp;        \
+            const ObjectHolder& lhs = sp[-1];       \
+            sp[-1] = expression;                    \
+            *sp = ObjectHolder::None();             \
+            ++ip;                                   \
+            DISPATCH();                             \
+        }
+
+        // temporary lhs is not referenced by other slots, so it is changed in place
+        TARGET(Add) {
+            const ObjectHolder& rhs = *--sp;
+            sp[-1] = runtime::Add(std::move(sp[-1]), rhs, context);
+            *sp = ObjectHolder::None();
+            ++ip;
+            DISPATCH();
+        }
+        MYTHON_BINARY_OPERATION(Sub, runtime::Sub(lhs, rhs, context))
+        MYTHON_BINARY_OPERATION(Mult, runtime::Mult(lhs, rhs, context))
+        MYTHON_BINARY_OPERATION(Div, runtime::Div(lhs, rhs, context))
+        MYTHON_BINARY_OPERATION(Equal, MakeBool(runtime::Compare<CompareOp::Equal>(lhs, rhs, context)))
+        MYTHON_BINARY_OPERATION(NotEqual, MakeBool(runtime::Compare<CompareOp::NotEqual>(lhs, rhs, context)))
+        MYTHON_BINARY_OPERATION(Less, MakeBool(runtime::Compare<CompareOp::Less>(lhs, rhs, context)))
+        MYTHON_BINARY_OPERATION(Greater, MakeBool(runtime::Compare<CompareOp::Greater>(lhs, rhs, context)))
+        MYTHON_BINARY_OPERATION(LessOrEqual, MakeBool(runtime::Compare<CompareOp::LessOrEqual>(lhs, rhs, context)))
+        MYTHON_BINARY_OPERATION(GreaterOrEqual, MakeBool(runtime::Compare<CompareOp::GreaterOrEqual>(lhs, rhs, context)))
+
+#undef MYTHON_BINARY_OPERATION
+
+#define MYTHON_CONSTANT_COMPARISON(name, op)                                            \
+        TARGET(name) {                                                                  \
+            sp[-1] = MakeBool(runtime::Compare<op>(sp[-1], fn->constants[ip->a], context)); \
+            ++ip;                                                                       \
+            DISPATCH();                                                                 \
+        }
+
+        MYTHON_CONSTANT_COMPARISON(EqualConst, CompareOp::Equal)
+        MYTHON_CONSTANT_COMPARISON(NotEqualConst, CompareOp::NotEqual)
+        MYTHON_CONSTANT_COMPARISON(LessConst, CompareOp::Less)
+        MYTHON_CONSTANT_COMPARISON(GreaterConst, CompareOp::Greater)
+        MYTHON_CONSTANT_COMPARISON(LessOrEqualConst, CompareOp::LessOrEqual)
+        MYTHON_CONSTANT_COMPARISON(GreaterOrEqualConst, CompareOp::GreaterOrEqual)
+
+#undef MYTHON_CONSTANT_COMPARISON
+
+        TARGET(Not) {
+            sp[-1] = MakeBool(!runtime::IsTrue(sp[-1]));
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(Stringify) {
+            sp[-1] = runtime::Stringify(std::move(sp[-1]), context);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(PrintSeparator) {
+            context.GetOutput().Write(' ');
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(PrintValue) {
+            runtime::PrintObject(*--sp, context);
+            *sp = ObjectHolder::None();
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(PrintEnd) {
+            context.GetOutput().Write('\n');
+            *sp++ = ObjectHolder::None();
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(Jump) {
+            ip = code + ip->a;
+            DISPATCH();
+        }
+        TARGET(JumpIfFalse) {
+            const bool condition = runtime::IsTrue(*--sp);
+            *sp = ObjectHolder::None();
+            ip = condition ? ip + 1 : code + ip->a;
+            DISPATCH();
+        }
+        TARGET(JumpIfTrue) {
+            const bool condition = runtime::IsTrue(*--sp);
+            *sp = ObjectHolder::None();
+            ip = condition ? code + ip->a : ip + 1;
+            DISPATCH();
+        }
+        TARGET(CallMethod) {
+            const CallSite& site = fn->call_sites[ip->a];
+            // arguments are moved into frame of method right from the stack
+            ObjectHolder* object = sp - 1;
+            ObjectHolder* args_begin = object - ip->b;
+
+            auto* instance = object->TryAs<runtime::ClassInstance>();
+            const runtime::Method* method = instance ? site.cache.Find(instance->GetClass(), site.method) : nullptr;
+            if (!method || method->formal_params.size() != ip->b) {
+                throw std::runtime_error("Wrong method call"s);
+            }
+            if (method->source) {
+                method->source->Load(*method);
+            }
+            if (method->code && method->frame_size > 0) {
+                runtime::CallRecord& record = PushCall(*instance, *method, args_begin, ip->b, context);
+                record.caller = fn;
+                record.return_ip = ip + 1;
+                record.caller_sp = args_begin + 1;
+                record.caller_closure = names;
+                record.result = args_begin;
+                // self slot of the frame keeps the object
+                *object = ObjectHolder::None();
+
+                fn = method->code;
+                code = fn->code.data();
+                ip = code;
+                sp = record.values + method->frame_size;
+                frame = &record.frame;
+                names = &record.closure;
+                DISPATCH();
+            }
+            // object stays on stack while the method runs, then its slot gets the result
+            *object = instance->Call(*method, args_begin, ip->b, context);
+            if (args_begin != object) {
+                *args_begin = std::move(*object);
+            }
+            sp = args_begin + 1;
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(NewInstance) {
+            *sp++ = ObjectHolder::Own(runtime::ClassInstance(*fn->classes[ip->a]));
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(NewInstanceInit) {
+            ObjectHolder* args_begin = sp - ip->b;
+            sp = args_begin;
+
+            // compiler has checked that __init__ takes ip->b arguments
+            const runtime::Class& cls = *fn->classes[ip->a];
+            const runtime::Method& init = *cls.GetSpecialMethod(runtime::SpecialMethod::Init);
+            if (init.source) {
+                init.source->Load(init);
+            }
+            ObjectHolder instance = ObjectHolder::Own(runtime::ClassInstance(cls));
+            if (init.code && init.frame_size > 0) {
+                runtime::CallRecord& record = PushCall(*instance.TryAs<runtime::ClassInstance>(), init, args_begin, ip->b, context);
+                record.caller = fn;
+                record.return_ip = ip + 1;
+                record.caller_sp = args_begin + 1;
+                record.caller_closure = names;
+                record.result = nullptr;
+                // arguments are in the frame already, the slot of the first one keeps the instance
+                *args_begin = std::move(instance);
+
+                fn = init.code;
+                code = fn->code.data();
+                ip = code;
+                sp = record.values + init.frame_size;
+                frame = &record.frame;
+                names = &record.closure;
+                DISPATCH();
+            }
+            instance.TryAs<runtime::ClassInstance>()->Call(init, args_begin, ip->b, context);
+            *sp++ = std::move(instance);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(DefineClass) {
+            const ObjectHolder& cls = fn->constants[ip->a];
+            (*names)[cls.TryAs<runtime::Class>()->GetName()] = cls;
+            *sp++ = ObjectHolder::None();
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(ExecuteNode) {
+            *sp++ = fn->nodes[ip->a]->Execute(*names, context);
+            ++ip;
+            DISPATCH();
+        }
+        TARGET(Return) {
+            // implicit return at the end of code has no line
+            if (runtime::Profiler* profiler = context.GetProfiler(); profiler && ip->a != 0) {
+                profiler->OnStatement(ip->a);
+            }
+            if (calls.Size() == base_depth) {
+                return std::move(sp[-1]);
+            }
+            runtime::CallRecord& record = calls.Top();
+            if (record.result) {
+                *record.result = std::move(sp[-1]);
+            }
+            fn = record.caller;
+            code = fn->code.data();
+            ip = record.return_ip;
+            sp = record.caller_sp;
+            frame = record.caller_frame;
+            names = record.caller_closure;
+            PopCall(context);
+            DISPATCH();
+        }
+
+#ifndef MYTHON_COMPUTED_GOTO
+        }
+#endif
+        }
+        catch (...) {
+            // calls of this run are finished in order, deeper runs have finished theirs
+            while (calls.Size() > base_depth) {
+                PopCall(context);
+            }
+            throw;
+        }
+#undef TARGET
+#undef DISPATCH
+    }
+
+    void Disassemble(const Function& function, std::ostream& os) {
+        for (size_t i = 0; i < function.code.size(); ++i) {
+            const Instruction& instruction = function.code[i];
+            os << i << ": "sv << OpCodeName(instruction.op);
+            switch (instruction.op) {
+            case OpCode::LoadName:
+            case OpCode::StoreName:
+                os << ' ' << function.names[instruction.a];
+                break;
+            case OpCode::LoadField:
+            case OpCode::StoreField:
+            case OpCode::AddToField:
+            case OpCode::SubFromField:
+                os << ' ' << function.field_sites[instruction.a].field;
+                break;
+            case OpCode::CallMethod:
+                os << ' ' << function.call_sites[instruction.a].method << '/' << instruction.b;
+                break;
+            case OpCode::NewInstance:
+            case OpCode::NewInstanceInit:
+                os << ' ' << function.classes[instruction.a]->GetName() << '/' << instruction.b;
+                break;
+            case OpCode::PushConst:
+            case OpCode::EqualConst:
+            case OpCode::NotEqualConst:
+            case OpCode::LessConst:
+            case OpCode::GreaterConst:
+            case OpCode::LessOrEqualConst:
+            case OpCode::GreaterOrEqualConst:
+            case OpCode::LoadSlot:
+            case OpCode::StoreSlot:
+            case OpCode::DefineClass:
+            case OpCode::ExecuteNode:
+            case OpCode::Jump:
+            case OpCode::JumpIfFalse:
+            case OpCode::JumpIfTrue:
+                os << ' ' << instruction.a;
+                break;
+            default:
+                break;
+            }
+            os << '\n';
+        }
+    }
+
+}  // namespace bytecode
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace bytecode {
+
+    // list of all instructions of the VM, comment describes the action over the stack of values
+#define MYTHON_OPCODES(X)                                                                           \
+    X(PushConst)       /* push constants[a] */                                                      \
+    X(PushNone)        /* push None */                                                              \
+    X(LoadName)        /* push closure[names[a]] */                                                 \
+    X(StoreName)       /* closure[names[a]] = top, value stays on stack */                          \
+    X(LoadSlot)        /* push slot a of current frame */                                           \
+    X(StoreSlot)       /* slot a of current frame = top, value stays on stack */                    \
+    X(LoadField)       /* replace instance on top by its field, field_sites[a] */                   \
+    X(StoreField)      /* instance, value -> value; instance.field = value, field_sites[a] */       \
+    X(AddToField)      /* instance, rhs -> value; instance.field += rhs, field_sites[a] */          \
+    X(SubFromField)    /* instance, rhs -> value; instance.field -= rhs, field_sites[a] */          \
+    X(Pop)             /* remove value of statement on line a, profiler may take sample */          \
+    X(Add)             /* lhs, rhs -> lhs + rhs */                                                  \
+    X(Sub)             /* lhs, rhs -> lhs - rhs */                                                  \
+    X(Mult)            /* lhs, rhs -> lhs * rhs */                                                  \
+    X(Div)             /* lhs, rhs -> lhs / rhs */                                                  \
+    X(Equal)           /* lhs, rhs -> Bool */                                                       \
+    X(NotEqual)        /* lhs, rhs -> Bool */                                                       \
+    X(Less)            /* lhs, rhs -> Bool */                                                       \
+    X(Greater)         /* lhs, rhs -> Bool */                                                       \
+    X(LessOrEqual)     /* lhs, rhs -> Bool */                                                       \
+    X(GreaterOrEqual)  /* lhs, rhs -> Bool */                                                       \
+    X(EqualConst)      /* lhs -> Bool of lhs == constants[a] */                                     \
+    X(NotEqualConst)   /* lhs -> Bool of lhs != constants[a] */                                     \
+    X(LessConst)       /* lhs -> Bool of lhs < constants[a] */                                      \
+    X(GreaterConst)    /* lhs -> Bool of lhs > constants[a] */                                      \
+    X(LessOrEqualConst) /* lhs -> Bool of lhs <= constants[a] */                                    \
+    X(GreaterOrEqualConst) /* lhs -> Bool of lhs >= constants[a] */                                 \
+    X(Not)             /* arg -> Bool */                                                            \
+    X(Stringify)       /* arg -> String */                                                          \
+    X(PrintSeparator)  /* output " " */                                                             \
+    X(PrintValue)      /* pop value and output it */                                                \
+    X(PrintEnd)        /* output "\n" and push None */                                              \
+    X(Jump)            /* go to instruction a */                                                    \
+    X(JumpIfFalse)     /* pop value, go to instruction a if it is not true */                       \
+    X(JumpIfTrue)      /* pop value, go to instruction a if it is true */                           \
+    X(CallMethod)      /* b args, object -> result of object.method(args), call_sites[a] */         \
+    X(NewInstance)     /* push new instance of classes[a] without __init__ call */                  \
+    X(NewInstanceInit) /* b args -> new instance of classes[a] initialised by __init__(args) */     \
+    X(DefineClass)     /* closure[name of class] = constants[a], push None */                       \
+    X(ExecuteNode)     /* push nodes[a]->Execute(closure, context) */                               \
+    X(Return)          /* finish execution with top value as result, a is line of return */
+
+    enum class OpCode : std::uint8_t {
+#define MYTHON_OPCODE_ENUM(name) name,
+        MYTHON_OPCODES(MYTHON_OPCODE_ENUM)
+#undef MYTHON_OPCODE_ENUM
+    };
+
+    // one instruction of VM, meaning of operands a and b depends on the opcode
+    struct Instruction {
+        OpCode op;
+        std::uint16_t b = 0;
+        std::uint32_t a = 0;
+    };
+
+    // place of method call in code, VM remembers found methods in its cache
+    struct CallSite {
+        std::string method;
+        mutable runtime::MethodCache cache;
+    };
+
+    // place of access to field in code
+    struct FieldSite {
+        std::string field;
+        mutable runtime::FieldCache cache;
+    };
+
+    // compiled code of a program or of a method body with pools of its operands
+    struct Function {
+        std::vector<Instruction> code;
+        std::vector<runtime::ObjectHolder> constants;
+        std::vector<std::string> names;
+        std::vector<const runtime::Class*> classes;
+        std::vector<CallSite> call_sites;
+        std::vector<FieldSite> field_sites;
+        // statements which are executed by tree-walking (see OpCode::ExecuteNode)
+        std::vector<runtime::Executable*> nodes;
+        // maximal depth of value stack which code needs
+        std::size_t max_stack = 0;
+    };
+
+    // position of emitted jump which target is set later by Compiler::PatchJump
+    struct JumpLabel {
+        std::size_t index;
+        std::size_t stack_depth;
+    };
+
+    // builds Function, AST nodes emit their instructions through runtime::Executable::Compile
+    class Compiler {
+    public:
+        // add instruction to the end of code
+        void Emit(OpCode op, std::uint32_t a = 0, std::uint16_t b = 0);
+
+        // add jump instruction (Jump, JumpIfFalse or JumpIfTrue) with unknown target
+        JumpLabel EmitJump(OpCode op);
+        // set target of jump to the position of next emitted instruction
+        void PatchJump(JumpLabel label);
+
+        // line of statement which is compiled now, instructions which end statements refer to it
+        void SetLine(std::uint32_t line) {
+            line_ = line;
+        }
+
+        [[nodiscard]] std::uint32_t GetLine() const {
+            return line_;
+        }
+
+        // return indexes of operands in pools of Function
+        std::uint32_t AddConstant(runtime::ObjectHolder value);
+        std::uint32_t AddName(const std::string& name);
+        std::uint32_t AddClass(const runtime::Class& cls);
+        std::uint32_t AddNode(runtime::Executable& node);
+        // every call gets its own site even if the method name repeats
+        std::uint32_t AddCallSite(const std::string& method);
+        std::uint32_t AddFieldSite(const std::string& field);
+
+        // replace bodies of methods declared in cls by their compiled versions
+        void CompileClass(runtime::Class& cls);
+
+        // return compiled code, compiler must not be used after that
+        Function Finish();
+
+    private:
+        Function function_;
+        std::unordered_map<std::string, std::uint32_t> name_indexes_;
+        std::size_t stack_depth_ = 0;
+        std::uint32_t line_ = 0;
+    };
+
+    // Executable which runs Function on VM instead of tree-walking of source
+    class CompiledCode : public runtime::Executable {
+    public:
+        // source is the tree which function was compiled from,
+        // it is kept because function refers to its nodes and constants
+        CompiledCode(Function function, std::unique_ptr<runtime::Executable> source);
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+        [[nodiscard]] const Function& GetFunction() const;
+
+        // return tree which was compiled, it can be executed as reference implementation
+        [[nodiscard]] runtime::Executable& GetSource() const;
+
+    private:
+        Function function_;
+        std::unique_ptr<runtime::Executable> source_;
+    };
+
+    // compile tree (for example, result of ParseProgram) into bytecode
+    // method bodies of classes defined in the program are compiled as well
+    std::unique_ptr<CompiledCode> Compile(std::unique_ptr<runtime::Executable> program);
+
+    // execute function with variables from closure
+    runtime::ObjectHolder Run(const Function& function, runtime::Closure& closure, runtime::Context& context);
+
+    // output human readable listing of function
+    void Disassemble(const Function& function, std::ostream& os);
+
+}  // namespace bytecode
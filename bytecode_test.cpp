@@ -0,0 +1,438 @@
+#include "bytecode.h"
+#include "lexer.h"
+#include "parse.h"
+#include "statement.h"
+#include "test_runner_p.h"
+
+using namespace std;
+
+namespace bytecode {
+
+    namespace {
+
+        unique_ptr<runtime::Executable> ParseProgramFromString(const string& program) {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            return ParseProgram(lexer);
+        }
+
+        // execute program by tree-walking and on VM, check that outputs are equal and return output
+        string ExecuteInBothModes(const string& program) {
+            runtime::DummyContext reference_context;
+            runtime::Closure reference_closure;
+            ParseProgramFromString(program)->Execute(reference_closure, reference_context);
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            Compile(ParseProgramFromString(program))->Execute(closure, context);
+
+            ASSERT_EQUAL(context.output.str(), reference_context.output.str());
+            return context.output.str();
+        }
+
+        bool HasInstruction(const Function& function, OpCode op) {
+            for (const Instruction& instruction : function.code) {
+                if (instruction.op == op) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool HasTreeWalkingFallback(const Function& function) {
+            return HasInstruction(function, OpCode::ExecuteNode);
+        }
+
+        void TestExpressions() {
+            const string program = R"(
+x = 7
+y = 'abc'
+print x + 3 * 2, x / 2 - 1, -x, str(x) + y
+print x < 8, x > 8, x == 7, x != 7, x <= 7, x >= 8, y < 'abd'
+print x and y, x or 0, not x, not None
+)"s;
+
+            ASSERT_EQUAL(ExecuteInBothModes(program),
+                "13 2 -7 7abc\nTrue False True False True False True\nTrue True False True\n"s);
+        }
+
+        void TestTemporaryStrings() {
+            const string program = R"(
+class Name:
+  def __init__(v):
+    self.v = v
+
+  def get():
+    return self.v
+
+  def __str__():
+    return self.v + '!'
+
+s = 'x'
+t = s + 'a' + 'b'
+u = str(t) + 'c'
+print s, t, u
+n = Name('n')
+m = n.get() + 'm'
+print n.v, m, str(n) + '?', n.v
+)"s;
+
+            // temporaries are changed in place, values of variables and fields are not
+            ASSERT_EQUAL(ExecuteInBothModes(program), "x xab xabc\nn nm n!? n\n"s);
+        }
+
+        void TestClassesAndMethods() {
+            const string program = R"(
+class Counter:
+  def __init__(start):
+    self.value = start
+
+  def add(delta):
+    self.value = self.value + delta
+
+  def __str__():
+    return 'Counter(' + str(self.value) + ')'
+
+  def __eq__(other):
+    return self.value == other.value
+
+  def __lt__(other):
+    return self.value < other.value
+
+class NamedCounter(Counter):
+  def __init__(name):
+    self.value = 0
+    self.name = name
+
+  def __str__():
+    return self.name + ':' + str(self.value)
+
+c = Counter(10)
+c.add(1)
+c.add(2)
+n = NamedCounter('n')
+n.add(13)
+print c, n, c == n, c < n, c > n, str(n)
+)"s;
+
+            ASSERT_EQUAL(ExecuteInBothModes(program), "Counter(13) n:13 True False False n:13\n"s);
+        }
+
+        void TestReturnFromNestedBlocks() {
+            const string program = R"(
+class Sign:
+  def of(n):
+    if n > 0:
+      if n > 100:
+        return 'big'
+      return 'positive'
+    else:
+      if n == 0:
+        return 'zero'
+    return 'negative'
+
+s = Sign()
+print s.of(1000), s.of(5), s.of(0), s.of(-5)
+)"s;
+
+            ASSERT_EQUAL(ExecuteInBothModes(program), "big positive zero negative\n"s);
+        }
+
+        void TestPrintEvaluationOrder() {
+            const string program = R"(
+class Noisy:
+  def get(x):
+    print 'get', x
+    return x
+
+n = Noisy()
+print n.get(1), n.get(2)
+)"s;
+
+            ASSERT_EQUAL(ExecuteInBothModes(program), "get 1\n1 get 2\n2\n"s);
+        }
+
+        void TestPolymorphicCallSite() {
+            const string program = R"(
+class A:
+  def name():
+    return 'a'
+
+class B(A):
+  def name():
+    return 'b'
+
+class C(A):
+  def tag(x):
+    return x
+
+class D:
+  def name():
+    return 'd'
+
+class E:
+  def name():
+    return 'e'
+
+class F:
+  def name():
+    return 'f'
+
+class Describer:
+  def describe(o):
+    return o.name()
+
+d = Describer()
+print d.describe(A()), d.describe(B()), d.describe(C()), d.describe(D()), d.describe(E()), d.describe(F())
+print d.describe(F()), d.describe(A()), d.describe(B())
+)"s;
+
+            ASSERT_EQUAL(ExecuteInBothModes(program), "a b a d e f\nf a b\n"s);
+        }
+
+        void TestParsedProgramIsFullyCompiled() {
+            const string program = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+  def __str__():
+    return '(' + str(self.x) + ', ' + str(self.y) + ')'
+
+p = Point(1, 2)
+if p.x < p.y:
+  print p
+)"s;
+
+            auto compiled = Compile(ParseProgramFromString(program));
+            ASSERT(!HasTreeWalkingFallback(compiled->GetFunction()));
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            compiled->Execute(closure, context);
+            ASSERT_EQUAL(context.output.str(), "(1, 2)\n"s);
+
+            const auto* cls = closure.at("Point"s).TryAs<runtime::Class>();
+            ASSERT(cls != nullptr);
+            for (const string& name : { "__init__"s, "__str__"s }) {
+                const auto* body = dynamic_cast<const CompiledCode*>(cls->GetMethod(name)->body.get());
+                ASSERT(body != nullptr);
+                ASSERT(!HasTreeWalkingFallback(body->GetFunction()));
+                // variables of methods are resolved to slots by parser
+                ASSERT(!HasInstruction(body->GetFunction(), OpCode::LoadName));
+                ASSERT(HasInstruction(body->GetFunction(), OpCode::LoadSlot));
+            }
+        }
+
+        void TestFallbackToTreeWalking() {
+            struct CountingStatement : runtime::Executable {
+                int* counter;
+
+                explicit CountingStatement(int* counter)
+                    : counter(counter) {
+                }
+
+                runtime::ObjectHolder Execute(runtime::Closure& /*closure*/,
+                    runtime::Context& /*context*/) override {
+                    return runtime::ObjectHolder::Own(runtime::Number(++*counter));
+                }
+            };
+
+            int counter = 0;
+            auto compound = make_unique<ast::Compound>();
+            compound->AddStatement(make_unique<ast::Assignment>("x"s, make_unique<CountingStatement>(&counter)));
+            compound->AddStatement(make_unique<ast::Print>(make_unique<CountingStatement>(&counter)));
+
+            auto compiled = Compile(std::move(compound));
+            ASSERT(HasTreeWalkingFallback(compiled->GetFunction()));
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            compiled->Execute(closure, context);
+
+            ASSERT_EQUAL(counter, 2);
+            ASSERT_EQUAL(closure.at("x"s).TryAs<runtime::Number>()->GetValue(), 1);
+            ASSERT_EQUAL(context.output.str(), "2\n"s);
+        }
+
+        void TestRuntimeErrors() {
+            runtime::DummyContext context;
+            {
+                runtime::Closure closure;
+                ASSERT_THROWS(Compile(ParseProgramFromString("print x\n"s))->Execute(closure, context),
+                    runtime_error);
+            }
+            {
+                runtime::Closure closure;
+                ASSERT_THROWS(Compile(ParseProgramFromString("print 1 / 0\n"s))->Execute(closure, context),
+                    runtime_error);
+            }
+            {
+                runtime::Closure closure;
+                ASSERT_THROWS(Compile(ParseProgramFromString("x = 1\nx.foo()\n"s))->Execute(closure, context),
+                    runtime_error);
+            }
+        }
+
+        const string RECURSION = R"(
+class Counter:
+  def __init__(n):
+    self.n = n
+
+  def __str__():
+    return 'Counter ' + str(self.n)
+
+class Recursion:
+  def down(n, counter):
+    if n > 0:
+      return self.down(n - 1, Counter(counter.n + 1))
+    print counter
+    return 10 / counter.n
+
+r = Recursion()
+print r.down(depth, Counter(0))
+)"s;
+
+        // run RECURSION with given number of nested calls of down
+        void ExecuteRecursion(runtime::Executable& program, int depth, runtime::Context& context) {
+            runtime::Closure closure;
+            closure["depth"s] = runtime::ObjectHolder::Own(runtime::Number(depth));
+            program.Execute(closure, context);
+        }
+
+        void TestDeepRecursion() {
+            auto compiled = Compile(ParseProgramFromString(RECURSION));
+            runtime::DummyContext context;
+            // calls of compiled methods do not nest native frames
+            ExecuteRecursion(*compiled, 50000, context);
+            ASSERT_EQUAL(context.output.str(), "Counter 50000\n0\n"s);
+            ASSERT_EQUAL(context.GetCallDepth(), 0U);
+            ASSERT_EQUAL(context.GetCallStack().Size(), 0U);
+
+            // division by zero in the deepest call unwinds every call, context can run the next program
+            const string failing = RECURSION.substr(0, RECURSION.find("r = "s))
+                + "r = Recursion()\nprint r.down(depth, Counter(0 - depth))\n"s;
+            auto compiled_failing = Compile(ParseProgramFromString(failing));
+            ASSERT_THROWS(ExecuteRecursion(*compiled_failing, 20000, context), runtime_error);
+            ASSERT_EQUAL(context.GetCallDepth(), 0U);
+            ASSERT_EQUAL(context.GetCallStack().Size(), 0U);
+            ASSERT(context.GetCurrentFrame() == nullptr);
+            ASSERT_EQUAL(context.GetValueStack().Size(), 0U);
+
+            context.output.str({});
+            ExecuteRecursion(*compiled, 10, context);
+            ASSERT_EQUAL(context.output.str(), "Counter 10\n1\n"s);
+        }
+
+        void TestCallDepthLimit() {
+            for (const bool compile : { false, true }) {
+                unique_ptr<runtime::Executable> program = ParseProgramFromString(RECURSION);
+                if (compile) {
+                    program = Compile(std::move(program));
+                }
+                runtime::DummyContext context;
+                context.SetMaxCallDepth(100);
+                // the first call of down and the call of __str__ in the deepest one are counted too
+                ExecuteRecursion(*program, 98, context);
+                ASSERT_THROWS(ExecuteRecursion(*program, 99, context), runtime_error);
+                ASSERT_EQUAL(context.GetCallDepth(), 0U);
+                ASSERT_EQUAL(context.GetCallStack().Size(), 0U);
+
+                // methods of tree-walking mode nest native frames, so their limit is lower by default
+                context.SetMaxCallDepth(runtime::Context::DEFAULT_MAX_CALL_DEPTH);
+                const int native_depth = static_cast<int>(runtime::Context::DEFAULT_MAX_NATIVE_CALL_DEPTH);
+                if (compile) {
+                    ExecuteRecursion(*program, native_depth * 2, context);
+                }
+                else {
+                    ASSERT_THROWS(ExecuteRecursion(*program, native_depth * 2, context), runtime_error);
+                }
+                ASSERT_EQUAL(context.GetCallDepth(), 0U);
+            }
+        }
+
+        void TestFusedNodes() {
+            const string program = R"(
+class Counter:
+  def __init__():
+    self.value = 0
+    self.last = 0
+
+  def step():
+    self.value = self.value + 3
+    self.value = self.value - 1
+    self.last = self.value
+    return self.value > 5
+
+  def run():
+    if self.step():
+      return 'big'
+    return self.run()
+
+c = Counter()
+print c.run(), c.value, c.last, c.value == 6, c.value >= 7
+c.value = 'text'
+print c.value < 1
+)"s;
+
+            runtime::DummyContext reference_context;
+            runtime::Closure reference_closure;
+            ASSERT_THROWS(ParseProgramFromString(program)->Execute(reference_closure, reference_context), runtime_error);
+
+            auto compiled = Compile(ast::Optimize(ParseProgramFromString(program)));
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            ASSERT_THROWS(compiled->Execute(closure, context), runtime_error);
+            ASSERT_EQUAL(context.output.str(), reference_context.output.str());
+            ASSERT_EQUAL(context.output.str(), "big 6 6 True False\n"s);
+
+            const auto* cls = closure.at("Counter"s).TryAs<runtime::Class>();
+            const Function& step = dynamic_cast<const CompiledCode&>(*cls->GetMethod("step"s)->body).GetFunction();
+            ASSERT(HasInstruction(step, OpCode::AddToField));
+            ASSERT(HasInstruction(step, OpCode::SubFromField));
+            ASSERT(HasInstruction(step, OpCode::GreaterConst));
+            ASSERT(HasInstruction(compiled->GetFunction(), OpCode::EqualConst));
+        }
+
+        void TestDisassemble() {
+            auto compiled = Compile(ParseProgramFromString("x = 1 + y\nprint x, 'a'\n"s));
+
+            ostringstream os;
+            Disassemble(compiled->GetFunction(), os);
+            ASSERT_EQUAL(os.str(),
+                "0: PushConst 0\n"
+                "1: LoadName y\n"
+                "2: Add\n"
+                "3: StoreName x\n"
+                "4: Pop\n"
+                "5: LoadName x\n"
+                "6: PrintValue\n"
+                "7: PrintSeparator\n"
+                "8: PushConst 1\n"
+                "9: PrintValue\n"
+                "10: PrintEnd\n"
+                "11: Pop\n"
+                "12: PushNone\n"
+                "13: Return\n"s);
+        }
+
+    }  // namespace
+
+    void RunBytecodeTests(TestRunner& tr) {
+        RUN_TEST(tr, bytecode::TestExpressions);
+        RUN_TEST(tr, bytecode::TestTemporaryStrings);
+        RUN_TEST(tr, bytecode::TestClassesAndMethods);
+        RUN_TEST(tr, bytecode::TestReturnFromNestedBlocks);
+        RUN_TEST(tr, bytecode::TestPrintEvaluationOrder);
+        RUN_TEST(tr, bytecode::TestPolymorphicCallSite);
+        RUN_TEST(tr, bytecode::TestParsedProgramIsFullyCompiled);
+        RUN_TEST(tr, bytecode::TestFallbackToTreeWalking);
+        RUN_TEST(tr, bytecode::TestRuntimeErrors);
+        RUN_TEST(tr, bytecode::TestDeepRecursion);
+        RUN_TEST(tr, bytecode::TestCallDepthLimit);
+        RUN_TEST(tr, bytecode::TestFusedNodes);
+        RUN_TEST(tr, bytecode::TestDisassemble);
+    }
+
+}  // namespace bytecode
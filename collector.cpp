@@ -0,0 +1,192 @@
+#include "collector.h"
+
+#include "runtime.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <unordered_map>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        // counter of instance which is reachable from outside of instances
+        constexpr uint32_t REACHABLE = numeric_limits<uint32_t>::max();
+    }  // namespace
+
+    // deletes or orphans the collector when its thread finishes
+    class CycleCollector::ThreadOwner {
+    public:
+        ThreadOwner()
+            : collector_(new CycleCollector()) {
+        }
+
+        ThreadOwner(const ThreadOwner&) = delete;
+        ThreadOwner& operator=(const ThreadOwner&) = delete;
+
+        ~ThreadOwner() {
+            collector_->Orphan();
+        }
+
+        [[nodiscard]] CycleCollector& Get() const {
+            return *collector_;
+        }
+
+    private:
+        CycleCollector* collector_;
+    };
+
+    CycleCollector& CycleCollector::ForCurrentThread() {
+        thread_local ThreadOwner owner;
+        return owner.Get();
+    }
+
+    void CycleCollector::Track(ClassInstance& instance) {
+        instance.collector_ = this;
+        instance.next_tracked_ = first_;
+        if (first_) {
+            first_->previous_tracked_ = &instance;
+        }
+        first_ = &instance;
+        ++stats_.instances;
+
+        if (min_threshold_ != 0 && stats_.instances >= threshold_ && !collecting_) {
+            Collect();
+            threshold_ = max(min_threshold_, stats_.instances * 2);
+        }
+    }
+
+    void CycleCollector::Untrack(ClassInstance& instance) noexcept {
+        if (instance.previous_tracked_) {
+            instance.previous_tracked_->next_tracked_ = instance.next_tracked_;
+        }
+        else {
+            first_ = instance.next_tracked_;
+        }
+        if (instance.next_tracked_) {
+            instance.next_tracked_->previous_tracked_ = instance.previous_tracked_;
+        }
+        instance.collector_ = nullptr;
+        --stats_.instances;
+
+        if (orphaned_ && stats_.instances == 0) {
+            delete this;
+        }
+    }
+
+    ClassInstance* CycleCollector::GetTrackedInstance(const ObjectHolder& value) const {
+        const auto* owned = get_if<ObjectHolder::Owned>(&value.data_);
+        if (!owned || owned->object->GetKind() != ObjectKind::ClassInstance) {
+            return nullptr;
+        }
+        auto* instance = static_cast<ClassInstance*>(owned->object);
+        // instances of other threads are not changed
+        return instance->collector_ == this ? instance : nullptr;
+    }
+
+    size_t CycleCollector::Collect() {
+        if (collecting_) {
+            return 0;
+        }
+        collecting_ = true;
+        ++stats_.collections;
+
+        // references from fields of tracked instances are subtracted, the rest come from outside.
+        // Instances which are shared between threads may be referenced by other threads
+        for (ClassInstance* instance = first_; instance; instance = instance->next_tracked_) {
+            const Object::Header& header = instance->GetHeader();
+            instance->collector_refs_ = header.shared_between_threads
+                ? REACHABLE
+                : header.refs.load(memory_order_relaxed);
+        }
+        for (ClassInstance* instance = first_; instance; instance = instance->next_tracked_) {
+            for (const ObjectHolder& value : instance->values_) {
+                ClassInstance* child = GetTrackedInstance(value);
+                if (child && child->collector_refs_ != REACHABLE) {
+                    assert(child->collector_refs_ > 0);
+                    --child->collector_refs_;
+                }
+            }
+        }
+
+        vector<ClassInstance*> reachable;
+        for (ClassInstance* instance = first_; instance; instance = instance->next_tracked_) {
+            if (instance->collector_refs_ > 0) {
+                instance->collector_refs_ = REACHABLE;
+                reachable.push_back(instance);
+            }
+        }
+        while (!reachable.empty()) {
+            ClassInstance* instance = reachable.back();
+            reachable.pop_back();
+            for (const ObjectHolder& value : instance->values_) {
+                ClassInstance* child = GetTrackedInstance(value);
+                if (child && child->collector_refs_ != REACHABLE) {
+                    child->collector_refs_ = REACHABLE;
+                    reachable.push_back(child);
+                }
+            }
+        }
+
+        // garbage is kept alive by holders while fields are cleared, so the instances
+        // are freed when the last holder is destroyed and not while their fields are released
+        vector<ObjectHolder> garbage;
+        for (ClassInstance* instance = first_; instance; instance = instance->next_tracked_) {
+            if (instance->collector_refs_ != REACHABLE) {
+                garbage.push_back(ObjectHolder::Reference(*instance));
+            }
+        }
+        for (ObjectHolder& holder : garbage) {
+            auto& instance = static_cast<ClassInstance&>(*holder);
+            instance.shape_ = &instance.class_.GetRootShape();
+            instance.values_.clear();
+        }
+        const size_t collected = garbage.size();
+        garbage.clear();
+
+        stats_.collected += collected;
+        collecting_ = false;
+        return collected;
+    }
+
+    void CycleCollector::SetMinThreshold(size_t min_threshold) {
+        min_threshold_ = min_threshold;
+        threshold_ = max(min_threshold_, stats_.instances * 2);
+    }
+
+    InstanceStats CycleCollector::GetStats() const {
+        return stats_;
+    }
+
+    vector<ClassHeapStats> CycleCollector::GetClassStats() const {
+        vector<ClassHeapStats> classes;
+        unordered_map<const Class*, size_t> indexes;
+        for (const ClassInstance* instance = first_; instance; instance = instance->next_tracked_) {
+            const Class& cls = instance->GetClass();
+            auto [it, inserted] = indexes.try_emplace(&cls, classes.size());
+            if (inserted) {
+                classes.push_back({ cls.GetName(), 0, 0 });
+            }
+            ClassHeapStats& stats = classes[it->second];
+            ++stats.instances;
+            stats.bytes += sizeof(Object::Header) + sizeof(ClassInstance)
+                + instance->values_.capacity() * sizeof(ObjectHolder);
+        }
+        sort(classes.begin(), classes.end(), [](const ClassHeapStats& lhs, const ClassHeapStats& rhs) {
+            return lhs.bytes != rhs.bytes ? lhs.bytes > rhs.bytes : lhs.name < rhs.name;
+        });
+        return classes;
+    }
+
+    void CycleCollector::Orphan() {
+        if (stats_.instances == 0) {
+            delete this;
+        }
+        else {
+            orphaned_ = true;
+        }
+    }
+
+}  // namespace runtime
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace runtime {
+
+    class ClassInstance;
+    class ObjectHolder;
+
+    // class instances of one thread and work of its collector
+    struct InstanceStats {
+        // instances which are owned by holders (see ObjectHolder::Own) and are alive
+        size_t instances = 0;
+        size_t collections = 0;
+        // instances which were freed by collector because they were only referenced by each other
+        size_t collected = 0;
+    };
+
+    // live instances of one class
+    struct ClassHeapStats {
+        std::string name;
+        size_t instances = 0;
+        // memory of instances with their headers and arrays of fields
+        size_t bytes = 0;
+    };
+
+    // collector of cycles of references between class instances of one thread. Counters of
+    // references free everything else, fields of instances can form cycles which counters
+    // never free. Collection is trial deletion: references between instances are subtracted
+    // from their counters, instances with references from outside (variables, stacks of
+    // calls, other objects) and everything reachable from them survive, fields of the rest
+    // are cleared, so their counters free them.
+    // Collection starts automatically when number of instances reaches threshold, then threshold
+    // becomes twice the number of survivors, so the cost of collections per instance is constant
+    class CycleCollector {
+    public:
+        static constexpr size_t DEFAULT_MIN_THRESHOLD = 10000;
+
+        CycleCollector(const CycleCollector&) = delete;
+        CycleCollector& operator=(const CycleCollector&) = delete;
+
+        // return collector of instances of current thread. It is destroyed with the thread
+        // when all its instances are freed
+        [[nodiscard]] static CycleCollector& ForCurrentThread();
+
+        // free instances which are not reachable from outside of instances, return their number
+        size_t Collect();
+
+        // 0 disables automatic collection
+        void SetMinThreshold(size_t min_threshold);
+
+        [[nodiscard]] InstanceStats GetStats() const;
+
+        // return statistics of classes which have instances, the biggest by memory first
+        [[nodiscard]] std::vector<ClassHeapStats> GetClassStats() const;
+
+    private:
+        friend class ClassInstance;
+        friend class ObjectHolder;
+
+        class ThreadOwner;
+
+        CycleCollector() = default;
+        ~CycleCollector() = default;
+
+        // instance is owned by holders, it may start collection
+        void Track(ClassInstance& instance);
+        void Untrack(ClassInstance& instance) noexcept;
+
+        // return instance which is owned by value and is tracked by this collector or nullptr
+        [[nodiscard]] ClassInstance* GetTrackedInstance(const ObjectHolder& value) const;
+
+        // collector whose thread is finished deletes itself when the last instance is freed
+        void Orphan();
+
+        // list of tracked instances, they are linked through their fields
+        ClassInstance* first_ = nullptr;
+        size_t min_threshold_ = DEFAULT_MIN_THRESHOLD;
+        size_t threshold_ = DEFAULT_MIN_THRESHOLD;
+        InstanceStats stats_;
+        bool collecting_ = false;
+        bool orphaned_ = false;
+    };
+
+}  // namespace runtime
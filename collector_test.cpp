@@ -0,0 +1,144 @@
+#include "collector.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "test_runner_p.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+
+        const string NODES = R"(
+class Node:
+  def __init__(name):
+    self.name = name
+    self.other = None
+
+  def link(other):
+    self.other = other
+    other.other = self
+
+a = Node('a')
+b = Node('b')
+a.link(b)
+c = Node('c')
+c.other = c
+)";
+
+        const ClassHeapStats* FindClass(const vector<ClassHeapStats>& classes, const string& name) {
+            auto it = find_if(classes.begin(), classes.end(), [&name](const ClassHeapStats& stats) {
+                return stats.name == name;
+            });
+            return it != classes.end() ? &*it : nullptr;
+        }
+
+        void TestCollectsCycles() {
+            for (auto mode : { interpreter::ExecutionMode::TreeWalking, interpreter::ExecutionMode::Bytecode }) {
+                const interpreter::Program program = interpreter::Program::Parse(NODES, mode);
+                ostringstream output;
+                interpreter::Interpreter interpreter(program, output);
+                Context& context = interpreter.GetContext();
+                // garbage of other tests
+                context.CollectCycles();
+                const InstanceStats before = context.GetHeapStats().instances;
+
+                interpreter.Run();
+                ASSERT_EQUAL(context.GetHeapStats().instances.instances, before.instances + 3);
+                // instances are reachable from globals
+                ASSERT_EQUAL(context.CollectCycles(), 0U);
+
+                const vector<ClassHeapStats> classes = context.GetClassHeapStats();
+                const ClassHeapStats* nodes = FindClass(classes, "Node"s);
+                ASSERT(nodes != nullptr);
+                ASSERT_EQUAL(nodes->instances, 3U);
+                ASSERT(nodes->bytes >= 3 * sizeof(ClassInstance));
+
+                // a and b reference each other through self of link, c references itself
+                ObjectHolder a = interpreter.GetGlobals().at("a"s);
+                interpreter.GetGlobals().clear();
+                ASSERT_EQUAL(context.GetHeapStats().instances.instances, before.instances + 3);
+                // the cycle of a is referenced from outside
+                ASSERT_EQUAL(context.CollectCycles(), 1U);
+                ASSERT_EQUAL(a.TryAs<ClassInstance>()->Fields().at("name"s).TryAs<String>()->GetValue(), "a"s);
+
+                a = ObjectHolder::None();
+                ASSERT_EQUAL(context.CollectCycles(), 2U);
+                const InstanceStats after = context.GetHeapStats().instances;
+                ASSERT_EQUAL(after.instances, before.instances);
+                ASSERT_EQUAL(after.collected, before.collected + 3);
+                ASSERT_EQUAL(after.collections, before.collections + 3);
+                ASSERT(FindClass(context.GetClassHeapStats(), "Node"s) == nullptr);
+            }
+        }
+
+        void TestAutomaticCollection() {
+            const string program_text = R"(
+class Link:
+  def __init__():
+    self.other = None
+
+class Maker:
+  def make(n):
+    if n > 0:
+      a = Link()
+      b = Link()
+      a.other = b
+      b.other = a
+      a = None
+      b = None
+      return self.make(n - 1)
+    return 0
+
+m = Maker()
+x = m.make(500)
+)";
+            CycleCollector& collector = CycleCollector::ForCurrentThread();
+            collector.Collect();
+            const InstanceStats before = collector.GetStats();
+            collector.SetMinThreshold(before.instances + 100);
+
+            const interpreter::Program program = interpreter::Program::Parse(program_text);
+            ostringstream output;
+            interpreter::Interpreter interpreter(program, output);
+            interpreter.Run();
+            const InstanceStats after = collector.GetStats();
+            collector.SetMinThreshold(CycleCollector::DEFAULT_MIN_THRESHOLD);
+
+            ASSERT(after.collections > before.collections);
+            ASSERT(after.collected >= 800U + before.collected);
+            // garbage does not grow beyond threshold
+            ASSERT(after.instances < before.instances + 100);
+            ASSERT_EQUAL(collector.Collect(), after.instances - before.instances - 1);
+        }
+
+        void TestSelfIsReference() {
+            Class cls("Test"s, {}, nullptr);
+            ObjectHolder owned = ObjectHolder::Own(ClassInstance(cls));
+            ObjectHolder self = ObjectHolder::Reference(*owned);
+            owned = ObjectHolder::None();
+            // object is kept alive by reference
+            ASSERT_EQUAL(&self.TryAs<ClassInstance>()->GetClass(), &cls);
+
+            // instances which are not owned by holders are not counted and are not tracked
+            const size_t instances = CycleCollector::ForCurrentThread().GetStats().instances;
+            ClassInstance copy(*self.TryAs<ClassInstance>());
+            ObjectHolder shared = ObjectHolder::Reference(copy);
+            shared.TryAs<ClassInstance>()->Fields()["me"s] = shared;
+            ASSERT_EQUAL(CycleCollector::ForCurrentThread().GetStats().instances, instances);
+            ASSERT_EQUAL(CycleCollector::ForCurrentThread().Collect(), 0U);
+            ASSERT_EQUAL(copy.Fields().at("me"s).Get(), &copy);
+        }
+
+    }  // namespace
+
+    void RunCollectorTests(TestRunner& tr) {
+        RUN_TEST(tr, runtime::TestCollectsCycles);
+        RUN_TEST(tr, runtime::TestAutomaticCollection);
+        RUN_TEST(tr, runtime::TestSelfIsReference);
+    }
+
+}  // namespace runtime
@@ -0,0 +1,217 @@
+#include "heap.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        thread_local Arena* current_arena = nullptr;
+
+        size_t AlignUp(size_t value, size_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        void CountAllocation(AllocationStats& stats, size_t size) {
+            ++stats.allocations;
+            stats.bytes_in_use += size;
+            stats.peak_bytes_in_use = std::max(stats.peak_bytes_in_use, stats.bytes_in_use);
+        }
+
+        void CountDeallocation(AllocationStats& stats, size_t size) {
+            ++stats.deallocations;
+            stats.bytes_in_use -= size;
+        }
+    }  // namespace
+
+    /* --- Arena --- */
+    Arena::Arena(size_t block_size)
+        : block_size_(block_size) {
+
+    }
+
+    Arena::~Arena() {
+        assert(stats_.allocations == stats_.deallocations);
+        if (current_arena == this) {
+            current_arena = nullptr;
+        }
+    }
+
+    void* Arena::Allocate(size_t size, size_t alignment) {
+        size_t padding = AlignUp(reinterpret_cast<uintptr_t>(position_), alignment)
+            - reinterpret_cast<uintptr_t>(position_);
+        if (position_ == nullptr || left_ < size + padding) {
+            AddBlock(size + alignment);
+            padding = AlignUp(reinterpret_cast<uintptr_t>(position_), alignment)
+                - reinterpret_cast<uintptr_t>(position_);
+        }
+
+        std::byte* result = position_ + padding;
+        position_ = result + size;
+        left_ -= size + padding;
+        CountAllocation(stats_, size);
+        return result;
+    }
+
+    void Arena::Deallocate([[maybe_unused]] void* ptr, size_t size) noexcept {
+        CountDeallocation(stats_, size);
+    }
+
+    void Arena::Reset() {
+        if (stats_.allocations != stats_.deallocations) {
+            throw runtime_error("Arena can not be reset while it has live objects"s);
+        }
+        if (blocks_.empty()) {
+            return;
+        }
+
+        blocks_.resize(1);
+        block_sizes_.resize(1);
+        position_ = blocks_.front().get();
+        left_ = block_sizes_.front();
+        stats_.allocations = 0;
+        stats_.deallocations = 0;
+        stats_.bytes_reserved = left_;
+    }
+
+    const AllocationStats& Arena::GetStats() const {
+        return stats_;
+    }
+
+    Arena* Arena::Current() {
+        return current_arena;
+    }
+
+    void Arena::AddBlock(size_t min_size) {
+        size_t size = std::max(block_size_, min_size);
+        blocks_.push_back(std::make_unique<std::byte[]>(size));
+        block_sizes_.push_back(size);
+        position_ = blocks_.back().get();
+        left_ = size;
+        stats_.bytes_reserved += size;
+    }
+
+    /* --- ArenaScope --- */
+    ArenaScope::ArenaScope(Arena& arena)
+        : previous_(current_arena) {
+        current_arena = &arena;
+    }
+
+    ArenaScope::~ArenaScope() {
+        current_arena = previous_;
+    }
+
+    /* --- ObjectPool --- */
+    // deletes or orphans the pool when its thread finishes
+    class ObjectPool::ThreadOwner {
+    public:
+        ThreadOwner()
+            : pool_(new ObjectPool()) {
+        }
+
+        ThreadOwner(const ThreadOwner&) = delete;
+        ThreadOwner& operator=(const ThreadOwner&) = delete;
+
+        ~ThreadOwner() {
+            pool_->Orphan();
+        }
+
+        [[nodiscard]] ObjectPool& Get() const {
+            return *pool_;
+        }
+
+    private:
+        ObjectPool* pool_;
+    };
+
+    ObjectPool::~ObjectPool() {
+        assert(IsUnused());
+    }
+
+    void* ObjectPool::Allocate(size_t size) {
+        size = AlignUp(std::max<size_t>(size, 1), GRANULARITY);
+        CountAllocation(stats_, size);
+        if (size > MAX_POOLED_SIZE) {
+            stats_.bytes_reserved += size;
+            return ::operator new(size);
+        }
+
+        FreeBlock*& free_list = free_lists_[size / GRANULARITY - 1];
+        if (free_list != nullptr) {
+            FreeBlock* block = free_list;
+            free_list = block->next;
+            return block;
+        }
+
+        if (left_ < size) {
+            // the rest of chunk is lost, it is smaller than the biggest block
+            chunks_.push_back(std::make_unique<std::byte[]>(CHUNK_SIZE));
+            position_ = chunks_.back().get();
+            left_ = CHUNK_SIZE;
+            stats_.bytes_reserved += CHUNK_SIZE;
+        }
+        void* result = position_;
+        position_ += size;
+        left_ -= size;
+        return result;
+    }
+
+    void ObjectPool::Deallocate(void* ptr, size_t size) noexcept {
+        size = AlignUp(std::max<size_t>(size, 1), GRANULARITY);
+        CountDeallocation(stats_, size);
+        if (size > MAX_POOLED_SIZE) {
+            stats_.bytes_reserved -= size;
+            ::operator delete(ptr);
+        }
+        else {
+            FreeBlock*& free_list = free_lists_[size / GRANULARITY - 1];
+            free_list = new (ptr) FreeBlock{ free_list };
+        }
+
+        if (orphaned_ && IsUnused()) {
+            delete this;
+        }
+    }
+
+    void ObjectPool::Charge(size_t size) noexcept {
+        stats_.bytes_charged += size;
+        stats_.bytes_in_use += size;
+        stats_.peak_bytes_in_use = std::max(stats_.peak_bytes_in_use, stats_.bytes_in_use);
+    }
+
+    void ObjectPool::Discharge(size_t size) noexcept {
+        stats_.bytes_charged -= size;
+        stats_.bytes_in_use -= size;
+        if (orphaned_ && IsUnused()) {
+            delete this;
+        }
+    }
+
+    const AllocationStats& ObjectPool::GetStats() const {
+        return stats_;
+    }
+
+    ObjectPool& ObjectPool::ForCurrentThread() {
+        thread_local ThreadOwner owner;
+        return owner.Get();
+    }
+
+    void ObjectPool::Orphan() {
+        if (IsUnused()) {
+            delete this;
+        }
+        else {
+            orphaned_ = true;
+        }
+    }
+
+    bool ObjectPool::IsUnused() const {
+        return stats_.allocations == stats_.deallocations && stats_.bytes_charged == 0;
+    }
+
+}  // namespace runtime
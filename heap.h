@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace runtime {
+
+    // counters of allocator
+    struct AllocationStats {
+        // number of Allocate and Deallocate calls
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        // bytes which are given to objects now and the maximum of this value
+        size_t bytes_in_use = 0;
+        size_t peak_bytes_in_use = 0;
+        // bytes which allocator took from the system
+        size_t bytes_reserved = 0;
+        // bytes which objects took from global heap themselves, they are included in bytes_in_use
+        // (see ObjectPool::Charge)
+        size_t bytes_charged = 0;
+    };
+
+    // allocator of objects with the same lifetime, AST nodes for example.
+    // Memory is taken by big blocks and is not returned until Reset, so deallocation
+    // costs nothing and all memory is released at once
+    class Arena {
+    public:
+        explicit Arena(size_t block_size = 64 * 1024);
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        [[nodiscard]] void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+        // only statistics is changed, memory is reused after Reset
+        void Deallocate(void* ptr, size_t size) noexcept;
+
+        // make arena empty, so it can be reused for next program, the first block is kept.
+        // All objects of arena must be destroyed, otherwise throws runtime_error
+        void Reset();
+
+        [[nodiscard]] const AllocationStats& GetStats() const;
+
+        // return arena which is used for AST nodes in this thread or nullptr (see ArenaScope)
+        [[nodiscard]] static Arena* Current();
+
+    private:
+        friend class ArenaScope;
+
+        void AddBlock(size_t min_size);
+
+        size_t block_size_;
+        std::vector<std::unique_ptr<std::byte[]>> blocks_;
+        std::vector<size_t> block_sizes_;
+        std::byte* position_ = nullptr;
+        size_t left_ = 0;
+        AllocationStats stats_;
+    };
+
+    // AST nodes (runtime::Executable) which are created while scope exists are allocated in arena
+    class ArenaScope {
+    public:
+        explicit ArenaScope(Arena& arena);
+        ~ArenaScope();
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+        Arena* previous_;
+    };
+
+    // pools of blocks of small sizes for runtime objects of one thread. Freed blocks are
+    // kept in free lists of their size class, so the objects of the same size reuse memory.
+    // Objects must be freed by the thread which created them
+    class ObjectPool {
+    public:
+        // sizes of blocks are multiples of GRANULARITY, bigger blocks are taken from global heap
+        static constexpr size_t GRANULARITY = alignof(std::max_align_t);
+        static constexpr size_t MAX_POOLED_SIZE = 256;
+        static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+        ObjectPool() = default;
+        ~ObjectPool();
+
+        ObjectPool(const ObjectPool&) = delete;
+        ObjectPool& operator=(const ObjectPool&) = delete;
+
+        [[nodiscard]] void* Allocate(size_t size);
+        void Deallocate(void* ptr, size_t size) noexcept;
+
+        // count memory which objects of pool own outside of it (text of strings, vectors of fields)
+        // as bytes in use. It is discharged to the same pool, which is not destroyed until then
+        void Charge(size_t size) noexcept;
+        void Discharge(size_t size) noexcept;
+
+        [[nodiscard]] const AllocationStats& GetStats() const;
+
+        // return pool of current thread. It is destroyed with the thread when all its blocks are freed
+        [[nodiscard]] static ObjectPool& ForCurrentThread();
+
+    private:
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        class ThreadOwner;
+
+        // pool whose thread is finished deletes itself when the last block is freed
+        // and the last charge is discharged
+        void Orphan();
+        [[nodiscard]] bool IsUnused() const;
+
+        std::array<FreeBlock*, MAX_POOLED_SIZE / GRANULARITY> free_lists_{};
+        std::vector<std::unique_ptr<std::byte[]>> chunks_;
+        std::byte* position_ = nullptr;
+        size_t left_ = 0;
+        AllocationStats stats_;
+        bool orphaned_ = false;
+    };
+
+    // standard allocator which takes memory from ObjectPool of current thread
+    // and returns it to the same pool
+    template <typename T>
+    class PoolAllocator {
+    public:
+        using value_type = T;
+
+        PoolAllocator()
+            : pool_(&ObjectPool::ForCurrentThread()) {
+        }
+
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U>& other) noexcept  // NOLINT(google-explicit-constructor)
+            : pool_(other.GetPool()) {
+        }
+
+        [[nodiscard]] T* allocate(size_t n) {
+            static_assert(alignof(T) <= ObjectPool::GRANULARITY);
+            return static_cast<T*>(pool_->Allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* ptr, size_t n) noexcept {
+            pool_->Deallocate(ptr, n * sizeof(T));
+        }
+
+        [[nodiscard]] ObjectPool* GetPool() const {
+            return pool_;
+        }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U>& other) const {
+            return pool_ == other.GetPool();
+        }
+
+        template <typename U>
+        bool operator!=(const PoolAllocator<U>& other) const {
+            return pool_ != other.GetPool();
+        }
+
+    private:
+        ObjectPool* pool_;
+    };
+
+}  // namespace runtime
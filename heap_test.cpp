@@ -0,0 +1,279 @@
+#include "bytecode.h"
+#include "heap.h"
+#include "lexer.h"
+#include "parse.h"
+#include "runtime.h"
+#include "statement.h"
+#include "test_runner_p.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace {
+    // number of blocks which were taken from global heap by this thread
+    thread_local size_t global_heap_allocations = 0;
+}  // namespace
+
+// global operators are replaced to count allocations in tests
+void* operator new(size_t size) {
+    ++global_heap_allocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+// used by standard algorithms for temporary buffers, memory is freed by the replaced delete
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    ++global_heap_allocations;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace runtime {
+
+    namespace {
+
+        void TestArena() {
+            Arena arena(1024);
+            void* first = arena.Allocate(10);
+            void* second = arena.Allocate(100, 64);
+            void* big = arena.Allocate(4000);
+            ASSERT(first != second && second != big);
+            ASSERT_EQUAL(reinterpret_cast<uintptr_t>(second) % 64, 0U);
+            ASSERT_EQUAL(arena.GetStats().allocations, 3U);
+            ASSERT_EQUAL(arena.GetStats().bytes_in_use, 4110U);
+            ASSERT(arena.GetStats().bytes_reserved >= 1024U + 4000U);
+
+            arena.Deallocate(first, 10);
+            arena.Deallocate(second, 100);
+            // objects of arena are alive
+            ASSERT_THROWS(arena.Reset(), runtime_error);
+
+            arena.Deallocate(big, 4000);
+            arena.Reset();
+            ASSERT_EQUAL(arena.GetStats().allocations, 0U);
+            ASSERT_EQUAL(arena.GetStats().bytes_in_use, 0U);
+            ASSERT_EQUAL(arena.GetStats().bytes_reserved, 1024U);
+            // memory of the first block is reused
+            ASSERT_EQUAL(arena.Allocate(10), first);
+            arena.Deallocate(first, 10);
+        }
+
+        void TestNodesInArena() {
+            Arena arena;
+            ASSERT(Arena::Current() == nullptr);
+            unique_ptr<Executable> program;
+            {
+                ArenaScope scope(arena);
+                ASSERT_EQUAL(Arena::Current(), &arena);
+                istringstream input("class A:\n  def f(x):\n    return x + 1\n\na = A()\nprint a.f(1)\n"s);
+                parse::Lexer lexer(input);
+                program = ParseProgram(lexer);
+            }
+            ASSERT(Arena::Current() == nullptr);
+            ASSERT(arena.GetStats().allocations > 0U);
+            ASSERT(arena.GetStats().bytes_in_use > 0U);
+
+            // nodes which are created outside of scope are not in arena
+            size_t allocations = arena.GetStats().allocations;
+            auto node = make_unique<ast::None>();
+            ASSERT_EQUAL(arena.GetStats().allocations, allocations);
+
+            {
+                DummyContext context;
+                context.SetNodeArena(&arena);
+                Closure closure;
+                program->Execute(closure, context);
+                ASSERT_EQUAL(context.output.str(), "2\n"s);
+                ASSERT_EQUAL(context.GetHeapStats().nodes.allocations, allocations);
+            }
+
+            program.reset();
+            ASSERT_EQUAL(arena.GetStats().deallocations, allocations);
+            ASSERT_EQUAL(arena.GetStats().bytes_in_use, 0U);
+            arena.Reset();
+        }
+
+        void TestObjectPool() {
+            ObjectPool pool;
+            void* first = pool.Allocate(24);
+            void* second = pool.Allocate(32);
+            ASSERT_EQUAL(reinterpret_cast<uintptr_t>(first) % ObjectPool::GRANULARITY, 0U);
+            ASSERT_EQUAL(pool.GetStats().bytes_in_use, 64U);
+
+            // freed block is reused for block of the same size class
+            pool.Deallocate(first, 24);
+            ASSERT_EQUAL(pool.Allocate(20), first);
+
+            void* big = pool.Allocate(ObjectPool::MAX_POOLED_SIZE + 1);
+            ASSERT(big != nullptr);
+            pool.Deallocate(big, ObjectPool::MAX_POOLED_SIZE + 1);
+            pool.Deallocate(first, 20);
+            pool.Deallocate(second, 32);
+
+            const AllocationStats& stats = pool.GetStats();
+            ASSERT_EQUAL(stats.allocations, 4U);
+            ASSERT_EQUAL(stats.deallocations, 4U);
+            ASSERT_EQUAL(stats.bytes_in_use, 0U);
+            ASSERT(stats.peak_bytes_in_use > ObjectPool::MAX_POOLED_SIZE);
+
+            // memory which objects own outside of pool is counted as in use
+            pool.Charge(1000);
+            ASSERT_EQUAL(stats.bytes_in_use, 1000U);
+            ASSERT_EQUAL(stats.bytes_charged, 1000U);
+            pool.Discharge(1000);
+            ASSERT_EQUAL(stats.bytes_in_use, 0U);
+            ASSERT_EQUAL(stats.bytes_charged, 0U);
+        }
+
+        void TestObjectStatsInContext() {
+            DummyContext context;
+            HeapStats before = context.GetHeapStats();
+            {
+                ObjectHolder str = ObjectHolder::Own(String{ "pooled"s });
+                Class cls{ "A"s, {}, nullptr };
+                ObjectHolder instance = ObjectHolder::Own(ClassInstance{ cls });
+                // numbers and booleans are stored in holder without allocation
+                ObjectHolder number = ObjectHolder::Own(Number{ 1 });
+                ObjectHolder boolean = ObjectHolder::Own(Bool{ true });
+
+                HeapStats stats = context.GetHeapStats();
+                ASSERT_EQUAL(stats.objects.allocations - before.objects.allocations, 2U);
+                ASSERT(stats.objects.bytes_in_use > before.objects.bytes_in_use);
+                ASSERT_EQUAL(stats.nodes.allocations, 0U);
+
+                // text of string and fields of instance are charged to the pool
+                const StringValue text(string(1000, 'x'));
+                instance.TryAs<ClassInstance>()->SetField("field"s, number);
+                stats = context.GetHeapStats();
+                ASSERT(stats.objects.bytes_charged - before.objects.bytes_charged
+                       >= 1000 + sizeof(ObjectHolder));
+            }
+            HeapStats after = context.GetHeapStats();
+            ASSERT_EQUAL(after.objects.deallocations - before.objects.deallocations, 2U);
+            ASSERT_EQUAL(after.objects.bytes_in_use, before.objects.bytes_in_use);
+        }
+
+        void TestValueStack() {
+            ValueStack stack;
+            ObjectHolder* first = stack.Allocate(10);
+            first[0] = ObjectHolder::Own(Number{ 1 });
+            ObjectHolder* second = stack.Allocate(ValueStack::CHUNK_SIZE);
+            ObjectHolder* third = stack.Allocate(5);
+            // values do not move when stack grows
+            ASSERT_EQUAL(first[0].TryAs<Number>()->GetValue(), 1);
+            third[4] = ObjectHolder::Own(Number{ 3 });
+            ASSERT(second + ValueStack::CHUNK_SIZE <= third || third + 5 <= second);
+            ASSERT_EQUAL(stack.Size(), ValueStack::CHUNK_SIZE + 15);
+            stack.Free(third, 5);
+            stack.Free(second, ValueStack::CHUNK_SIZE);
+
+            // freed values are None and they are reused
+            size_t capacity = stack.Capacity();
+            ObjectHolder* again = stack.Allocate(ValueStack::CHUNK_SIZE / 2);
+            ASSERT(!again[0]);
+            ASSERT_EQUAL(stack.Capacity(), capacity);
+            stack.Free(again, ValueStack::CHUNK_SIZE / 2);
+            stack.Free(first, 10);
+            ASSERT_EQUAL(stack.Size(), 0U);
+            ASSERT(stack.Allocate(0) == nullptr);
+        }
+
+        // output into fixed buffer, it does not allocate memory unlike ostringstream
+        class OutputBuffer : public streambuf {
+        public:
+            OutputBuffer() {
+                setp(buffer_.data(), buffer_.data() + buffer_.size());
+            }
+
+            [[nodiscard]] string Str() const {
+                return string(pbase(), pptr());
+            }
+
+        private:
+            array<char, 1024> buffer_{};
+        };
+
+        // number of allocations of global heap while the program is executed the second time
+        size_t CountCallAllocations(bool compile) {
+            Arena arena;
+            unique_ptr<Executable> definitions;
+            unique_ptr<Executable> calls;
+            {
+                ArenaScope scope(arena);
+                istringstream definitions_input(R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+class Counter:
+  def count(n, point):
+    result = 0
+    if n > 0 and not point.x == 0 or n < 0:
+      result = self.count(n - 1, point) + point.x
+    return result
+
+c = Counter()
+p = Point(1, 2)
+)"s);
+                parse::Lexer definitions_lexer(definitions_input);
+                definitions = ParseProgram(definitions_lexer);
+                istringstream calls_input("x = c.count(50, p)\nprint x, True, None\n"s);
+                parse::Lexer calls_lexer(calls_input);
+                calls = ParseProgram(calls_lexer);
+                if (compile) {
+                    definitions = bytecode::Compile(std::move(definitions));
+                    calls = bytecode::Compile(std::move(calls));
+                }
+            }
+
+            size_t allocations = 0;
+            {
+                OutputBuffer output;
+                ostream output_stream(&output);
+                SimpleContext context(output_stream);
+                Closure closure;
+                definitions->Execute(closure, context);
+                // the first run makes stack of context, pools and output buffer grow
+                calls->Execute(closure, context);
+                size_t before = global_heap_allocations;
+                calls->Execute(closure, context);
+                allocations = global_heap_allocations - before;
+                context.GetOutput().Flush();
+                ASSERT_EQUAL(output.Str(), "50 True None\n50 True None\n"s);
+            }
+            definitions.reset();
+            calls.reset();
+            return allocations;
+        }
+
+        void TestCallsDoNotAllocate() {
+            ASSERT_EQUAL(CountCallAllocations(false), 0U);
+            ASSERT_EQUAL(CountCallAllocations(true), 0U);
+        }
+
+    }  // namespace
+
+    void RunHeapTests(TestRunner& tr) {
+        RUN_TEST(tr, runtime::TestArena);
+        RUN_TEST(tr, runtime::TestNodesInArena);
+        RUN_TEST(tr, runtime::TestObjectPool);
+        RUN_TEST(tr, runtime::TestObjectStatsInContext);
+        RUN_TEST(tr, runtime::TestValueStack);
+        RUN_TEST(tr, runtime::TestCallsDoNotAllocate);
+    }
+
+}  // namespace runtime
@@ -0,0 +1,538 @@
+#include "image.h"
+
+#include "statement.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace runtime {
+
+    void Executable::Save(image::Writer& /*writer*/) const {
+        throw runtime_error("Node can not be saved into image"s);
+    }
+
+}  // namespace runtime
+
+namespace image {
+
+    using runtime::ObjectHolder;
+    using Statement = runtime::Executable;
+
+    namespace {
+        constexpr string_view MAGIC = "MYTHONIM"sv;
+
+        void AppendFixed(string& out, uint64_t value, int size) {
+            for (int i = 0; i < size; ++i) {
+                out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+            }
+        }
+
+        void AppendVarint(string& out, uint32_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        [[noreturn]] void ThrowDamaged() {
+            throw runtime_error("Image of program is damaged"s);
+        }
+
+        // reads image in place, strings of nodes are copied only into the nodes themselves
+        class Reader {
+        public:
+            explicit Reader(string_view data)
+                : data_(data) {
+            }
+
+            uint8_t ReadU8() {
+                return static_cast<uint8_t>(ReadBytes(1)[0]);
+            }
+
+            // numbers of header have fixed size
+            uint64_t ReadFixed(int size) {
+                string_view bytes = ReadBytes(static_cast<size_t>(size));
+                uint64_t value = 0;
+                for (int i = size - 1; i >= 0; --i) {
+                    value = (value << 8) | static_cast<uint8_t>(bytes[i]);
+                }
+                return value;
+            }
+
+            // numbers of nodes are written by 7 bits, the high bit of byte means that more bytes follow
+            uint32_t ReadU32() {
+                uint32_t value = 0;
+                for (int shift = 0; shift < 35; shift += 7) {
+                    uint8_t byte = ReadU8();
+                    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                    if ((byte & 0x80) == 0) {
+                        return value;
+                    }
+                }
+                ThrowDamaged();
+            }
+
+            int32_t ReadI32() {
+                // zigzag encoding keeps small negative numbers short
+                uint32_t value = ReadU32();
+                return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+            }
+
+            string_view ReadBytes(size_t size) {
+                if (data_.size() - position_ < size) {
+                    ThrowDamaged();
+                }
+                string_view result = data_.substr(position_, size);
+                position_ += size;
+                return result;
+            }
+
+            // number of elements which follow, each of them takes at least one byte
+            uint32_t ReadCount() {
+                uint32_t count = ReadU32();
+                if (count > data_.size() - position_) {
+                    ThrowDamaged();
+                }
+                return count;
+            }
+
+            void ReadStrings() {
+                uint32_t count = ReadCount();
+                strings_.reserve(count);
+                for (uint32_t i = 0; i < count; ++i) {
+                    strings_.push_back(ReadBytes(ReadU32()));
+                }
+            }
+
+            string_view ReadString() {
+                uint32_t index = ReadU32();
+                if (index >= strings_.size()) {
+                    ThrowDamaged();
+                }
+                return strings_[index];
+            }
+
+            [[nodiscard]] bool AtEnd() const {
+                return position_ == data_.size();
+            }
+
+            [[nodiscard]] const vector<ObjectHolder>& GetClasses() const {
+                return classes_;
+            }
+
+            // return false if imported has no class which image imports
+            bool ReadImportedClasses(const runtime::ClassTable* imported) {
+                uint32_t count = ReadCount();
+                imported_classes_.reserve(count);
+                for (uint32_t i = 0; i < count; ++i) {
+                    string name(ReadString());
+                    if (!imported) {
+                        return false;
+                    }
+                    auto it = imported->find(name);
+                    if (it == imported->end()) {
+                        return false;
+                    }
+                    imported_classes_.push_back(it->second);
+                }
+                return true;
+            }
+
+            unique_ptr<Statement> ReadNode() {
+                uint8_t tag = ReadU8();
+                if (tag > static_cast<uint8_t>(NodeTag::SelfMethodCall)) {
+                    ThrowDamaged();
+                }
+
+                switch (static_cast<NodeTag>(tag)) {
+                case NodeTag::NumericConst:
+                    return make_unique<ast::NumericConst>(runtime::Number(ReadI32()));
+                case NodeTag::StringConst:
+                    return make_unique<ast::StringConst>(
+                        runtime::String(runtime::StringInterner::Global().Intern(ReadString())));
+                case NodeTag::BoolConst:
+                    return make_unique<ast::BoolConst>(runtime::Bool(ReadU8() != 0));
+                case NodeTag::None:
+                    return make_unique<ast::None>();
+                case NodeTag::VariableValue:
+                    return make_unique<ast::VariableValue>(ReadVariableValue());
+                case NodeTag::Assignment: {
+                    string name(ReadString());
+                    optional<size_t> slot = ReadSlot();
+                    unique_ptr<Statement> value = ReadNode();
+                    return slot ? make_unique<ast::Assignment>(std::move(name), *slot, std::move(value))
+                        : make_unique<ast::Assignment>(std::move(name), std::move(value));
+                }
+                case NodeTag::FieldAssignment: {
+                    ast::VariableValue object = ReadTaggedVariableValue();
+                    string field(ReadString());
+                    return make_unique<ast::FieldAssignment>(std::move(object), std::move(field), ReadNode());
+                }
+                case NodeTag::Print:
+                    return make_unique<ast::Print>(ReadNodes());
+                case NodeTag::MethodCall: {
+                    unique_ptr<Statement> object = ReadNode();
+                    string method(ReadString());
+                    return make_unique<ast::MethodCall>(std::move(object), std::move(method), ReadNodes());
+                }
+                case NodeTag::NewInstance: {
+                    const runtime::Class& cls = ReadClass();
+                    return make_unique<ast::NewInstance>(cls, ReadNodes());
+                }
+                case NodeTag::Stringify:
+                    return make_unique<ast::Stringify>(ReadNode());
+                case NodeTag::Add:
+                    return ReadBinary<ast::Add>();
+                case NodeTag::Sub:
+                    return ReadBinary<ast::Sub>();
+                case NodeTag::Mult:
+                    return ReadBinary<ast::Mult>();
+                case NodeTag::Div:
+                    return ReadBinary<ast::Div>();
+                case NodeTag::Or:
+                    return ReadBinary<ast::Or>();
+                case NodeTag::And:
+                    return ReadBinary<ast::And>();
+                case NodeTag::Not:
+                    return make_unique<ast::Not>(ReadNode());
+                case NodeTag::Comparison:
+                    return ReadComparison();
+                case NodeTag::Compound: {
+                    auto compound = make_unique<ast::Compound>();
+                    uint32_t count = ReadCount();
+                    for (uint32_t i = 0; i < count; ++i) {
+                        uint32_t line = ReadU32();
+                        compound->AddStatement(ReadNode(), line);
+                    }
+                    return compound;
+                }
+                case NodeTag::MethodBody:
+                    return make_unique<ast::MethodBody>(ReadNode());
+                case NodeTag::Return:
+                    return make_unique<ast::Return>(ReadNode());
+                case NodeTag::ClassDefinition:
+                    return ReadClassDefinition();
+                case NodeTag::IfElse: {
+                    unique_ptr<Statement> condition = ReadNode();
+                    unique_ptr<Statement> if_body = ReadNode();
+                    unique_ptr<Statement> else_body = ReadU8() != 0 ? ReadNode() : nullptr;
+                    return make_unique<ast::IfElse>(std::move(condition), std::move(if_body), std::move(else_body));
+                }
+                case NodeTag::FieldIncrement: {
+                    ast::VariableValue object = ReadTaggedVariableValue();
+                    string field(ReadString());
+                    const runtime::Number constant(ReadI32());
+                    const bool subtract = ReadU8() != 0;
+                    return make_unique<ast::FieldIncrement>(std::move(object), std::move(field), constant, subtract);
+                }
+                case NodeTag::FieldCopy: {
+                    ast::VariableValue object = ReadTaggedVariableValue();
+                    string field(ReadString());
+                    return make_unique<ast::FieldCopy>(std::move(object), std::move(field), ReadTaggedVariableValue());
+                }
+                case NodeTag::ConstantComparison: {
+                    const uint8_t op = ReadU8();
+                    if (op > static_cast<uint8_t>(runtime::CompareOp::GreaterOrEqual)) {
+                        ThrowDamaged();
+                    }
+                    unique_ptr<Statement> lhs = ReadNode();
+                    return ast::MakeConstantComparison(static_cast<runtime::CompareOp>(op), std::move(lhs),
+                        runtime::Number(ReadI32()));
+                }
+                case NodeTag::SelfMethodCall: {
+                    // self is taken from slot 0
+                    if (frame_size_ == 0) {
+                        ThrowDamaged();
+                    }
+                    string method(ReadString());
+                    return make_unique<ast::SelfMethodCall>(std::move(method), ReadNodes());
+                }
+                }
+                ThrowDamaged();
+            }
+
+        private:
+            vector<unique_ptr<Statement>> ReadNodes() {
+                uint32_t count = ReadCount();
+                vector<unique_ptr<Statement>> nodes;
+                for (uint32_t i = 0; i < count; ++i) {
+                    nodes.push_back(ReadNode());
+                }
+                return nodes;
+            }
+
+            // slots are checked here because Frame does not check them
+            optional<size_t> ReadSlot() {
+                if (ReadU8() == 0) {
+                    return nullopt;
+                }
+                const uint32_t slot = ReadU32();
+                if (slot >= frame_size_) {
+                    ThrowDamaged();
+                }
+                return slot;
+            }
+
+            // fields of VariableValue after its tag
+            ast::VariableValue ReadVariableValue() {
+                uint32_t count = ReadCount();
+                if (count == 0) {
+                    ThrowDamaged();
+                }
+                vector<string> dotted_ids;
+                for (uint32_t i = 0; i < count; ++i) {
+                    dotted_ids.emplace_back(ReadString());
+                }
+                optional<size_t> slot = ReadSlot();
+                return slot ? ast::VariableValue(std::move(dotted_ids), *slot) : ast::VariableValue(std::move(dotted_ids));
+            }
+
+            // VariableValue which is written as node
+            ast::VariableValue ReadTaggedVariableValue() {
+                if (ReadU8() != static_cast<uint8_t>(NodeTag::VariableValue)) {
+                    ThrowDamaged();
+                }
+                return ReadVariableValue();
+            }
+
+            template <typename Operation>
+            unique_ptr<Statement> ReadBinary() {
+                unique_ptr<Statement> lhs = ReadNode();
+                return make_unique<Operation>(std::move(lhs), ReadNode());
+            }
+
+            unique_ptr<Statement> ReadComparison() {
+                using runtime::CompareOp;
+
+                uint8_t op = ReadU8();
+                switch (static_cast<CompareOp>(op)) {
+                case CompareOp::Equal:
+                    return ReadBinary<ast::Equal>();
+                case CompareOp::NotEqual:
+                    return ReadBinary<ast::NotEqual>();
+                case CompareOp::Less:
+                    return ReadBinary<ast::Less>();
+                case CompareOp::Greater:
+                    return ReadBinary<ast::Greater>();
+                case CompareOp::LessOrEqual:
+                    return ReadBinary<ast::LessOrEqual>();
+                case CompareOp::GreaterOrEqual:
+                    return ReadBinary<ast::GreaterOrEqual>();
+                }
+                ThrowDamaged();
+            }
+
+            // imported classes are numbered before classes of the image
+            const runtime::Class& ReadClass() {
+                uint32_t index = ReadU32();
+                if (index < imported_classes_.size()) {
+                    return *imported_classes_[index];
+                }
+                index -= static_cast<uint32_t>(imported_classes_.size());
+                if (index >= classes_.size()) {
+                    ThrowDamaged();
+                }
+                return *classes_[index].TryAs<runtime::Class>();
+            }
+
+            unique_ptr<Statement> ReadClassDefinition() {
+                string name(ReadString());
+                const runtime::Class* parent = ReadU8() != 0 ? &ReadClass() : nullptr;
+
+                uint32_t method_count = ReadCount();
+                vector<runtime::Method> methods(method_count);
+                for (runtime::Method& method : methods) {
+                    method.name = ReadString();
+                    uint32_t param_count = ReadCount();
+                    for (uint32_t i = 0; i < param_count; ++i) {
+                        method.formal_params.emplace_back(ReadString());
+                    }
+                    // frame has slots of self and parameters, other slots are assigned by nodes of body
+                    method.frame_size = ReadU32();
+                    const size_t params_size = method.formal_params.size() + 1;
+                    if (method.frame_size != 0
+                        && (method.frame_size < params_size || method.frame_size - params_size > data_.size() - position_)) {
+                        ThrowDamaged();
+                    }
+                    const size_t outer_frame_size = std::exchange(frame_size_, method.frame_size);
+                    method.body = ReadNode();
+                    frame_size_ = outer_frame_size;
+                }
+
+                ObjectHolder cls = ObjectHolder::Own(runtime::Class(std::move(name), std::move(methods), parent));
+                classes_.push_back(cls);
+                return make_unique<ast::ClassDefinition>(std::move(cls));
+            }
+
+            string_view data_;
+            size_t position_ = 0;
+            vector<string_view> strings_;
+            vector<const runtime::Class*> imported_classes_;
+            // classes which were defined by the nodes read so far
+            vector<ObjectHolder> classes_;
+            // number of slots of method whose body is read, 0 outside of methods with frames
+            size_t frame_size_ = 0;
+        };
+    }  // namespace
+
+    uint64_t HashSource(string_view source) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : source) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    /* --- Writer --- */
+    void Writer::WriteTag(NodeTag tag) {
+        WriteU8(static_cast<uint8_t>(tag));
+    }
+
+    void Writer::WriteU8(uint8_t value) {
+        nodes_.push_back(static_cast<char>(value));
+    }
+
+    void Writer::WriteU32(uint32_t value) {
+        AppendVarint(nodes_, value);
+    }
+
+    void Writer::WriteI32(int32_t value) {
+        auto bits = static_cast<uint32_t>(value);
+        AppendVarint(nodes_, (bits << 1) ^ (value < 0 ? ~0U : 0U));
+    }
+
+    void Writer::WriteString(string_view value) {
+        WriteU32(AddString(value));
+    }
+
+    uint32_t Writer::AddString(string_view value) {
+        auto [it, inserted] = string_indexes_.emplace(string(value), static_cast<uint32_t>(strings_.size()));
+        if (inserted) {
+            strings_.push_back(it->first);
+        }
+        return it->second;
+    }
+
+    void Writer::WriteNode(const runtime::Executable& node) {
+        node.Save(*this);
+    }
+
+    void Writer::WriteOptionalNode(const runtime::Executable* node) {
+        WriteU8(node ? 1 : 0);
+        if (node) {
+            WriteNode(*node);
+        }
+    }
+
+    void Writer::AddClass(const runtime::Class& cls) {
+        class_indexes_.emplace(&cls, static_cast<uint32_t>(class_indexes_.size()));
+    }
+
+    void Writer::AddImportedClass(const runtime::Class& cls) {
+        imported_classes_.push_back(AddString(cls.GetName()));
+        AddClass(cls);
+    }
+
+    uint32_t Writer::GetClassIndex(const runtime::Class& cls) const {
+        auto it = class_indexes_.find(&cls);
+        if (it == class_indexes_.end()) {
+            throw runtime_error("Class "s + cls.GetName() + " is not defined in image"s);
+        }
+        return it->second;
+    }
+
+    string Writer::Finish(string_view source) const {
+        string image(MAGIC);
+        AppendFixed(image, VERSION, 4);
+        AppendFixed(image, HashSource(source), 8);
+        AppendVarint(image, static_cast<uint32_t>(strings_.size()));
+        for (string_view str : strings_) {
+            AppendVarint(image, static_cast<uint32_t>(str.size()));
+            image += str;
+        }
+        AppendVarint(image, static_cast<uint32_t>(imported_classes_.size()));
+        for (uint32_t index : imported_classes_) {
+            AppendVarint(image, index);
+        }
+        image += nodes_;
+        return image;
+    }
+
+    string SaveProgram(const runtime::Executable& program, string_view source, const runtime::ClassTable* imported) {
+        Writer writer;
+        if (imported) {
+            // order of table is not stable, image of the same program is the same
+            vector<pair<string_view, const runtime::Class*>> classes(imported->begin(), imported->end());
+            sort(classes.begin(), classes.end());
+            for (const auto& [name, cls] : classes) {
+                writer.AddImportedClass(*cls);
+            }
+        }
+        writer.WriteNode(program);
+        return writer.Finish(source);
+    }
+
+    unique_ptr<runtime::Executable> LoadProgram(string_view image, string_view source, runtime::Closure* classes,
+                                                const runtime::ClassTable* imported) {
+        Reader reader(image);
+        if (image.size() < MAGIC.size() || reader.ReadBytes(MAGIC.size()) != MAGIC) {
+            return nullptr;
+        }
+        if (reader.ReadFixed(4) != VERSION || reader.ReadFixed(8) != HashSource(source)) {
+            return nullptr;
+        }
+        reader.ReadStrings();
+        if (!reader.ReadImportedClasses(imported)) {
+            return nullptr;
+        }
+        unique_ptr<runtime::Executable> program = reader.ReadNode();
+        if (!reader.AtEnd()) {
+            ThrowDamaged();
+        }
+        if (classes) {
+            classes->clear();
+            for (const ObjectHolder& cls : reader.GetClasses()) {
+                (*classes)[cls.TryAs<runtime::Class>()->GetName()] = cls;
+            }
+        }
+        return program;
+    }
+
+    void WriteImageFile(const string& path, string_view image) {
+        // name is unique for every call, so threads and processes which write the same image
+        // do not write into one temporary file
+        string temporary = path + ".XXXXXX"s;
+        const int fd = mkstemp(temporary.data());
+        if (fd < 0) {
+            throw runtime_error("Can not write file "s + path);
+        }
+        bool written = fchmod(fd, 0644) == 0;
+        for (size_t offset = 0; written && offset < image.size();) {
+            const ssize_t size = write(fd, image.data() + offset, image.size() - offset);
+            written = size > 0;
+            offset += written ? static_cast<size_t>(size) : 0;
+        }
+        written = close(fd) == 0 && written;
+        if (!written) {
+            std::remove(temporary.c_str());
+            throw runtime_error("Can not write file "s + temporary);
+        }
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            throw runtime_error("Can not write file "s + path);
+        }
+    }
+
+}  // namespace image
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "runtime.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// binary image of parsed program which lets skip lexing and parsing when the same
+// program is run again, like .pyc files of Python. Image consists of header
+// (magic, VERSION, hash of program text), table of strings, names of imported classes
+// and tree of nodes in prefix order.
+// Numbers of header are little-endian, other ones are varints, so image is compact
+// and it is read right from mapped file
+namespace image {
+
+    // images of other versions are not loaded
+    inline constexpr std::uint32_t VERSION = 4;
+
+    // kind of node in image, each node writes its tag and then its operands
+    enum class NodeTag : std::uint8_t {
+        NumericConst,
+        StringConst,
+        BoolConst,
+        None,
+        VariableValue,
+        Assignment,
+        FieldAssignment,
+        Print,
+        MethodCall,
+        NewInstance,
+        Stringify,
+        Add,
+        Sub,
+        Mult,
+        Div,
+        Or,
+        And,
+        Not,
+        Comparison,
+        Compound,
+        MethodBody,
+        Return,
+        ClassDefinition,
+        IfElse,
+        // fused nodes of ast::Optimize
+        FieldIncrement,
+        FieldCopy,
+        ConstantComparison,
+        SelfMethodCall,
+    };
+
+    // hash of program text which is stored in image
+    std::uint64_t HashSource(std::string_view source);
+
+    // collects nodes of image, nodes write themselves through runtime::Executable::Save
+    class Writer {
+    public:
+        void WriteTag(NodeTag tag);
+        void WriteU8(std::uint8_t value);
+        void WriteU32(std::uint32_t value);
+        void WriteI32(std::int32_t value);
+        // equal strings are stored once in table of strings
+        void WriteString(std::string_view value);
+        void WriteNode(const runtime::Executable& node);
+        // write flag and node if it is not nullptr
+        void WriteOptionalNode(const runtime::Executable* node);
+
+        // classes are numbered in order of their definitions, so instances of a class
+        // can be created only by code after definition of the class
+        void AddClass(const runtime::Class& cls);
+        [[nodiscard]] std::uint32_t GetClassIndex(const runtime::Class& cls) const;
+        // class of imported module, image keeps its name and reader finds it by the name.
+        // Imported classes are added before nodes are written
+        void AddImportedClass(const runtime::Class& cls);
+
+        // return image of program which was written into writer
+        [[nodiscard]] std::string Finish(std::string_view source) const;
+
+    private:
+        std::uint32_t AddString(std::string_view value);
+
+        std::string nodes_;
+        std::vector<std::string_view> strings_;
+        std::unordered_map<std::string, std::uint32_t> string_indexes_;
+        std::unordered_map<const runtime::Class*, std::uint32_t> class_indexes_;
+        // indexes of names of imported classes in table of strings
+        std::vector<std::uint32_t> imported_classes_;
+    };
+
+    // return image of program which was parsed from source, the program must not be compiled
+    // into bytecode or executed. Imported are classes which the program was parsed with
+    // (see ParseOptions::imported_classes). Throws runtime_error if some node can not be saved
+    std::string SaveProgram(const runtime::Executable& program, std::string_view source,
+                            const runtime::ClassTable* imported = nullptr);
+
+    // restore program from image, nodes are allocated as usual (see runtime::Arena).
+    // Return nullptr if image has other version, was made from other source or imported
+    // has no class which the image imports, throw runtime_error if image is damaged.
+    // If classes is not nullptr, classes of the program are put there by their names,
+    // as ParseProgram does
+    std::unique_ptr<runtime::Executable> LoadProgram(std::string_view image, std::string_view source,
+                                                     runtime::Closure* classes = nullptr,
+                                                     const runtime::ClassTable* imported = nullptr);
+
+    // write image into file through temporary one, so concurrent readers do not see
+    // partially written image. Throws runtime_error on failure
+    void WriteImageFile(const std::string& path, std::string_view image);
+
+}  // namespace image
@@ -0,0 +1,184 @@
+#include "bytecode.h"
+#include "image.h"
+#include "lexer.h"
+#include "parse.h"
+#include "statement.h"
+#include "test_runner_p.h"
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace image {
+
+    namespace {
+
+        const string PROGRAM = R"(
+class Shape:
+  def __init__(name):
+    self.name = name
+
+  def area():
+    return 0
+
+  def __str__():
+    return self.name + ' ' + str(self.area())
+
+  def __lt__(other):
+    return self.area() < other.area()
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.name = 'rect'
+    self.w = w
+    self.h = h
+
+  def grow():
+    self.w = self.w + 1
+    self.h = self.w
+
+  def area():
+    result = self.w * self.h
+    if result > 100 and not self.w == self.h:
+      return 100
+    else:
+      return result
+
+r = Rect(3, 4)
+s = Shape("shape")
+print r, s, s < r, r < s, 'a' != "b" or None
+print str(2 * 3 - 1) + "x", r.w, -7 * 300, 2000000000
+r.grow()
+print r
+)";
+
+        const string OUTPUT = "rect 12 shape 0 True False True\n5x 3 -2100 2000000000\nrect 16\n";
+
+        unique_ptr<runtime::Executable> Parse(const string& program) {
+            parse::Lexer lexer(string_view{ program });
+            return ast::Optimize(ParseProgram(lexer));
+        }
+
+        string Execute(runtime::Executable& program) {
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            program.Execute(closure, context);
+            return context.output.str();
+        }
+
+        void TestRoundTrip() {
+            const string image = SaveProgram(*Parse(PROGRAM), PROGRAM);
+
+            runtime::Closure classes;
+            unique_ptr<runtime::Executable> loaded = LoadProgram(image, PROGRAM, &classes);
+            ASSERT(loaded);
+            ASSERT_EQUAL(Execute(*loaded), OUTPUT);
+            ASSERT_EQUAL(classes.size(), 2U);
+            ASSERT_EQUAL(classes.at("Rect"s).TryAs<runtime::Class>()->GetParent(), classes.at("Shape"s).TryAs<runtime::Class>());
+
+            unique_ptr<runtime::Executable> compiled = bytecode::Compile(LoadProgram(image, PROGRAM));
+            ASSERT_EQUAL(Execute(*compiled), OUTPUT);
+
+            // loaded tree can be saved again
+            const string second_image = SaveProgram(*LoadProgram(image, PROGRAM), PROGRAM);
+            ASSERT_EQUAL(second_image.size(), image.size());
+            ASSERT_EQUAL(Execute(*LoadProgram(second_image, PROGRAM)), OUTPUT);
+        }
+
+        void TestStaleImages() {
+            const string image = SaveProgram(*Parse(PROGRAM), PROGRAM);
+
+            // image is made for exact text of program
+            ASSERT(!LoadProgram(image, PROGRAM + " "s));
+            ASSERT(!LoadProgram("print 1\n"sv, "print 1\n"sv));
+            ASSERT(!LoadProgram(""sv, PROGRAM));
+
+            string other_version = image;
+            other_version[8] = static_cast<char>(VERSION + 1);
+            ASSERT(!LoadProgram(other_version, PROGRAM));
+
+            // damaged image throws
+            ASSERT_THROWS(LoadProgram(string_view(image).substr(0, image.size() - 1), PROGRAM), runtime_error);
+            ASSERT_THROWS(LoadProgram(image + "x"s, PROGRAM), runtime_error);
+            Writer unknown_node;
+            unknown_node.WriteU8(0xFF);
+            ASSERT_THROWS(LoadProgram(unknown_node.Finish(PROGRAM), PROGRAM), runtime_error);
+        }
+
+        // image of class whose method put(a, b) assigns 1 to slot
+        string MethodImage(size_t frame_size, size_t slot) {
+            vector<runtime::Method> methods(1);
+            methods[0].name = "put"s;
+            methods[0].formal_params = { "a"s, "b"s };
+            methods[0].frame_size = frame_size;
+            methods[0].body = make_unique<ast::MethodBody>(
+                make_unique<ast::Assignment>("c"s, slot, make_unique<ast::NumericConst>(runtime::Number(1))));
+            const ast::ClassDefinition definition(runtime::ObjectHolder::Own(runtime::Class("P"s, std::move(methods), nullptr)));
+            return SaveProgram(definition, PROGRAM);
+        }
+
+        void TestDamagedSlots() {
+            ASSERT(LoadProgram(MethodImage(4, 3), PROGRAM));
+            // frame is smaller than self and parameters or than slot
+            ASSERT_THROWS(LoadProgram(MethodImage(1, 0), PROGRAM), runtime_error);
+            ASSERT_THROWS(LoadProgram(MethodImage(4, 4), PROGRAM), runtime_error);
+            ASSERT_THROWS(LoadProgram(MethodImage(0, 0), PROGRAM), runtime_error);
+            ASSERT_THROWS(LoadProgram(MethodImage(1000, 3), PROGRAM), runtime_error);
+
+            // code outside of methods has no slots
+            const ast::Assignment global("x"s, 0, make_unique<ast::NumericConst>(runtime::Number(1)));
+            ASSERT_THROWS(LoadProgram(SaveProgram(global, PROGRAM), PROGRAM), runtime_error);
+            const ast::SelfMethodCall self_call("f"s, {});
+            ASSERT_THROWS(LoadProgram(SaveProgram(self_call, PROGRAM), PROGRAM), runtime_error);
+        }
+
+        void TestCompiledProgramIsNotSaved() {
+            unique_ptr<runtime::Executable> compiled = bytecode::Compile(Parse("print 1\n"s));
+            ASSERT_THROWS(SaveProgram(*compiled, "print 1\n"sv), runtime_error);
+        }
+
+        void TestImageFile() {
+            const string path = "/tmp/mython_image_test.myc"s;
+            const string image = SaveProgram(*Parse(PROGRAM), PROGRAM);
+            WriteImageFile(path, image);
+            unique_ptr<runtime::Executable> loaded;
+            {
+                parse::MappedFile file(path);
+                ASSERT_EQUAL(file.Text(), string_view(image));
+                loaded = LoadProgram(file.Text(), PROGRAM);
+            }
+            std::remove(path.c_str());
+            // nodes do not refer to the mapped file
+            ASSERT(loaded);
+            ASSERT_EQUAL(Execute(*loaded), OUTPUT);
+
+            // threads which write the same image do not share temporary file
+            vector<thread> writers;
+            for (int i = 0; i < 4; ++i) {
+                writers.emplace_back([&path, &image] {
+                    for (int j = 0; j < 20; ++j) {
+                        WriteImageFile(path, image);
+                    }
+                });
+            }
+            for (thread& writer : writers) {
+                writer.join();
+            }
+            ASSERT_EQUAL(parse::MappedFile(path).Text(), string_view(image));
+            std::remove(path.c_str());
+            ASSERT_THROWS(WriteImageFile("/nonexistent/dir/image.myc"s, image), runtime_error);
+        }
+
+    }  // namespace
+
+    void RunImageTests(TestRunner& tr) {
+        RUN_TEST(tr, image::TestRoundTrip);
+        RUN_TEST(tr, image::TestStaleImages);
+        RUN_TEST(tr, image::TestDamagedSlots);
+        RUN_TEST(tr, image::TestCompiledProgramIsNotSaved);
+        RUN_TEST(tr, image::TestImageFile);
+    }
+
+}  // namespace image
@@ -0,0 +1,95 @@
+#include "interpreter.h"
+
+#include "bytecode.h"
+#include "lexer.h"
+#include "parse.h"
+#include "statement.h"
+
+using namespace std;
+
+namespace interpreter {
+
+    namespace {
+        vector<unique_ptr<runtime::Arena>> MakeArenas(unique_ptr<runtime::Arena> arena) {
+            vector<unique_ptr<runtime::Arena>> arenas;
+            arenas.push_back(std::move(arena));
+            return arenas;
+        }
+    }  // namespace
+
+    Program::Program(unique_ptr<runtime::Arena> arena, unique_ptr<runtime::Executable> tree,
+                     runtime::Closure classes, ExecutionMode mode)
+        : Program(MakeArenas(std::move(arena)), std::move(tree), std::move(classes), mode) {
+    }
+
+    Program::Program(vector<unique_ptr<runtime::Arena>> arenas, unique_ptr<runtime::Executable> tree,
+                     runtime::Closure classes, ExecutionMode mode)
+        : arenas_(std::move(arenas))
+        , tree_(std::move(tree))
+        , classes_(std::move(classes))
+        , mode_(mode) {
+        // classes are the only objects of program which are owned by globals of executions
+        for (const auto& [name, cls] : classes_) {
+            cls.ShareBetweenThreads();
+        }
+        if (mode_ == ExecutionMode::Bytecode) {
+            runtime::ArenaScope scope(*arenas_.front());
+            tree_ = bytecode::Compile(std::move(tree_));
+        }
+    }
+
+    Program Program::Parse(parse::Lexer& lexer, ExecutionMode mode, const ParseOptions& options) {
+        auto arena = make_unique<runtime::Arena>();
+        unique_ptr<runtime::Executable> tree;
+        runtime::Closure classes;
+        {
+            runtime::ArenaScope scope(*arena);
+            tree = ast::Optimize(ParseProgram(lexer, &classes, options));
+        }
+        return Program(std::move(arena), std::move(tree), std::move(classes), mode);
+    }
+
+    Program Program::Parse(string_view text, ExecutionMode mode, const ParseOptions& options) {
+        parse::Lexer lexer(text);
+        return Parse(lexer, mode, options);
+    }
+
+    void Program::Execute(runtime::Closure& globals, runtime::Context& context) const {
+        context.SetNodeArena(arenas_.front().get());
+        tree_->Execute(globals, context);
+    }
+
+    const runtime::Class* Program::GetClass(string_view name) const {
+        auto it = classes_.find(string(name));
+        return it != classes_.end() ? it->second.TryAs<runtime::Class>() : nullptr;
+    }
+
+    Interpreter::Interpreter(const Program& program, ostream& output)
+        : program_(program)
+        , context_(output) {
+    }
+
+    Interpreter::Interpreter(const Program& program, runtime::OutputSink& output)
+        : program_(program)
+        , context_(output) {
+    }
+
+    void Interpreter::Run(const runtime::Closure& inputs) {
+        // clear keeps buckets of the table, so globals of the next run do not allocate it again
+        globals_.clear();
+        globals_.insert(inputs.begin(), inputs.end());
+        // return at the top level of the previous run does not stop this one
+        context_.SetCompletion(runtime::Completion::Normal);
+        context_.StartBudget();
+        try {
+            program_.Execute(globals_, context_);
+        }
+        catch (...) {
+            // output printed before error is kept
+            context_.GetOutput().Flush();
+            throw;
+        }
+        context_.GetOutput().Flush();
+    }
+
+}  // namespace interpreter
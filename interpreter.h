@@ -0,0 +1,113 @@
+#pragma once
+
+#include "heap.h"
+#include "parse.h"
+#include "runtime.h"
+
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace parse {
+    class Lexer;
+}
+
+// API for embedding of the interpreter: program is parsed once and then executed
+// any number of times with different globals
+namespace interpreter {
+
+    enum class ExecutionMode {
+        // reference mode, AST is executed directly
+        TreeWalking,
+        // AST is compiled and executed by VM
+        Bytecode,
+    };
+
+    // parsed program, it owns tree of the program with arena of its nodes and classes
+    // of the program. Executions do not change the program, so classes and caches
+    // of the tree are made once and are reused by every execution.
+    // Program can be executed by many threads at once, each thread needs its own globals
+    // and context (see Interpreter). Classes of program are shared between threads
+    // (see runtime::ObjectHolder::ShareBetweenThreads), other runtime objects belong to the thread
+    // which made them, so program is destroyed by the thread which parsed it after all executions
+    // (modules which are parsed by threads of LoadProgramFile are destroyed by any thread)
+    class Program {
+    public:
+        // tree must be allocated in arena (see runtime::ArenaScope) and must not be compiled,
+        // classes are classes declared by the tree (see ParseProgram). The tree is compiled
+        // into bytecode if mode is Bytecode
+        Program(std::unique_ptr<runtime::Arena> arena, std::unique_ptr<runtime::Executable> tree,
+                runtime::Closure classes, ExecutionMode mode = ExecutionMode::Bytecode);
+        // program of modules which were parsed into their own arenas. Nodes of compiled code
+        // are allocated in the first arena, statistics of nodes is taken from it
+        Program(std::vector<std::unique_ptr<runtime::Arena>> arenas, std::unique_ptr<runtime::Executable> tree,
+                runtime::Closure classes, ExecutionMode mode = ExecutionMode::Bytecode);
+
+        // parse and optimise program, throws ParseError or parse::LexerError on wrong text
+        static Program Parse(parse::Lexer& lexer, ExecutionMode mode = ExecutionMode::Bytecode,
+                             const ParseOptions& options = {});
+        static Program Parse(std::string_view text, ExecutionMode mode = ExecutionMode::Bytecode,
+                             const ParseOptions& options = {});
+
+        Program(Program&&) = default;
+        Program& operator=(Program&&) = default;
+
+        // execute program with globals, output of print goes to context
+        void Execute(runtime::Closure& globals, runtime::Context& context) const;
+
+        // return class declared by the program or nullptr
+        [[nodiscard]] const runtime::Class* GetClass(std::string_view name) const;
+
+        [[nodiscard]] const runtime::Closure& GetClasses() const {
+            return classes_;
+        }
+
+        [[nodiscard]] ExecutionMode GetMode() const {
+            return mode_;
+        }
+
+        [[nodiscard]] const runtime::Arena& GetArena() const {
+            return *arenas_.front();
+        }
+
+    private:
+        // nodes are destroyed before their arenas
+        std::vector<std::unique_ptr<runtime::Arena>> arenas_;
+        std::unique_ptr<runtime::Executable> tree_;
+        runtime::Closure classes_;
+        ExecutionMode mode_;
+    };
+
+    // executes one program many times with the same output. Context (with stack of values)
+    // is reused between runs and globals are reset before every run, so a run costs
+    // only execution of the program. Interpreter is used by one thread, threads which
+    // execute the same program have their own interpreters
+    class Interpreter {
+    public:
+        // output of print is buffered, it is written into stream at the end of every run
+        Interpreter(const Program& program, std::ostream& output);
+        // output of print goes into sink which is owned by caller
+        Interpreter(const Program& program, runtime::OutputSink& output);
+
+        // execute program, globals of the run are inputs at first. Budget of context
+        // (see runtime::Context::SetBudget) is counted from the start of every run.
+        // Output is flushed when run finishes, also when it throws
+        void Run(const runtime::Closure& inputs = {});
+
+        // globals after the last run, results of the program are read from there
+        [[nodiscard]] runtime::Closure& GetGlobals() {
+            return globals_;
+        }
+
+        [[nodiscard]] runtime::Context& GetContext() {
+            return context_;
+        }
+
+    private:
+        const Program& program_;
+        runtime::SimpleContext context_;
+        runtime::Closure globals_;
+    };
+
+}  // namespace interpreter
@@ -0,0 +1,483 @@
+#include "interpreter.h"
+#include "lexer.h"
+#include "parse.h"
+#include "string_value.h"
+#include "test_runner_p.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace interpreter {
+
+    namespace {
+
+        const string PROGRAM = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+  def __str__():
+    return '(' + str(self.x) + ', ' + str(self.y) + ')'
+
+class Scaled(Point):
+  def scale(k):
+    return Point(self.x * k, self.y * k)
+
+p = Scaled(n, n + 1)
+q = p.scale(k)
+print p, q
+result = q.x + q.y
+)";
+
+        runtime::Closure MakeInputs(int n, int k) {
+            return { { "n"s, runtime::ObjectHolder::Own(runtime::Number(n)) },
+                     { "k"s, runtime::ObjectHolder::Own(runtime::Number(k)) } };
+        }
+
+        void TestRepeatedRuns(ExecutionMode mode) {
+            Program program = Program::Parse(PROGRAM, mode);
+            ASSERT(program.GetMode() == mode);
+
+            ostringstream output;
+            Interpreter interpreter(program, output);
+            for (int n = 0; n < 3; ++n) {
+                interpreter.Run(MakeInputs(n, 10));
+                ASSERT_EQUAL(interpreter.GetGlobals().at("result"s).TryAs<runtime::Number>()->GetValue(),
+                             20 * n + 10);
+                // classes are made once by parser, runs only bind them to globals
+                ASSERT_EQUAL(interpreter.GetGlobals().at("Point"s).TryAs<runtime::Class>(), program.GetClass("Point"sv));
+            }
+            ASSERT_EQUAL(output.str(), "(0, 1) (0, 10)\n(1, 2) (10, 20)\n(2, 3) (20, 30)\n"s);
+        }
+
+        void TestRepeatedRunsTreeWalking() {
+            TestRepeatedRuns(ExecutionMode::TreeWalking);
+        }
+
+        void TestRepeatedRunsBytecode() {
+            TestRepeatedRuns(ExecutionMode::Bytecode);
+        }
+
+        void TestGlobalsAreReset() {
+            Program program = Program::Parse("y = x + 1\nprint y\n"sv);
+            ostringstream output;
+            Interpreter interpreter(program, output);
+            interpreter.Run({ { "x"s, runtime::ObjectHolder::Own(runtime::Number(1)) } });
+            interpreter.Run({ { "x"s, runtime::ObjectHolder::Own(runtime::Number(5)) } });
+            ASSERT_EQUAL(output.str(), "2\n6\n"s);
+            ASSERT_EQUAL(interpreter.GetGlobals().size(), 2U);
+
+            // variables of the previous run are not visible
+            ASSERT_THROWS(interpreter.Run(), runtime_error);
+        }
+
+        void TestTopLevelReturn() {
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                Program program = Program::Parse("print 1\nprint 2\nreturn 0\nprint 3\n"sv, mode);
+                ostringstream output;
+                Interpreter interpreter(program, output);
+                interpreter.Run();
+                interpreter.Run();
+                ASSERT_EQUAL(output.str(), "1\n2\n1\n2\n"s);
+            }
+        }
+
+        void TestProgramStringsAreFreed() {
+            const size_t strings = runtime::StringInterner::Global().Size();
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                Program program = Program::Parse("x = 'literal of freed program'\nprint x + 'tab\\tfolded'\n"sv, mode);
+                ostringstream output;
+                Interpreter interpreter(program, output);
+                interpreter.Run();
+                ASSERT_EQUAL(output.str(), "literal of freed programtab\tfolded\n"s);
+            }
+            // literals and folded constants are freed with programs
+            ASSERT_EQUAL(runtime::StringInterner::Global().Size(), strings);
+        }
+
+        void TestInstancesOutliveRun() {
+            Program program = Program::Parse(PROGRAM);
+            ostringstream output;
+            Interpreter interpreter(program, output);
+            interpreter.Run(MakeInputs(1, 2));
+            runtime::ObjectHolder point = interpreter.GetGlobals().at("q"s);
+            ASSERT(point.TryAs<runtime::ClassInstance>());
+            interpreter.Run(MakeInputs(3, 4));
+
+            // class of instance made by the first run is kept by program
+            ASSERT(point.TryAs<runtime::ClassInstance>()->HasMethod("__str__"s, 0));
+            runtime::DummyContext context;
+            point->Print(context.output, context);
+            ASSERT_EQUAL(context.output.str(), "(2, 4)"s);
+        }
+
+        // threads share classes, constants and inline caches of the program, instances of the same
+        // class get fields in different orders, so shapes are added by many threads at once
+        const string SHARED_PROGRAM = R"(
+class Counter:
+  def __init__():
+    self.total = 0
+
+  def add(value):
+    self.total = self.total + value
+    return self
+
+  def __add__(other):
+    return self.total + other.total
+
+  def __lt__(other):
+    return self.total < other.total
+
+class Pair:
+  def set(key, value):
+    if key == 'a':
+      self.a = value
+      self.b = key + str(value)
+    else:
+      self.b = key + str(value)
+      self.a = value
+
+  def __str__():
+    return self.b + ':' + str(self.a)
+
+c = Counter()
+d = Counter()
+p = Pair()
+if n > 3:
+  p.set('a', n)
+else:
+  p.set('b', n)
+c.add(n)
+c.add(n * 2)
+d.add(1)
+text = str(p) + ' ' + str(c + d) + ' ' + str(d < c)
+print text
+)";
+
+        string ExpectedSharedOutput(int n) {
+            return (n > 3 ? "a"s : "b"s) + to_string(n) + ":"s + to_string(n) + " "s + to_string(3 * n + 1)
+                + " "s + (1 < 3 * n ? "True"s : "False"s) + "\n"s;
+        }
+
+        // with lazy_methods threads parse bodies of methods at once at their first calls
+        void TestConcurrentRuns(ExecutionMode mode, bool lazy_methods = false) {
+            const Program program = Program::Parse(SHARED_PROGRAM, mode, { lazy_methods });
+            constexpr int THREADS = 8;
+            constexpr int RUNS = 200;
+
+            vector<int> failures(THREADS);
+            // threads start together, so caches and shapes are filled by all of them at once
+            atomic<int> waiting = THREADS;
+            vector<thread> threads;
+            for (int t = 0; t < THREADS; ++t) {
+                threads.emplace_back([&program, &failures, &waiting, t] {
+                    ostringstream output;
+                    Interpreter interpreter(program, output);
+                    waiting.fetch_sub(1);
+                    while (waiting.load() > 0) {
+                        this_thread::yield();
+                    }
+                    for (int run = 0; run < RUNS; ++run) {
+                        const int n = (run + t) % 7;
+                        output.str(""s);
+                        interpreter.Run({ { "n"s, runtime::ObjectHolder::Own(runtime::Number(n)) } });
+                        failures[t] += output.str() != ExpectedSharedOutput(n) ? 1 : 0;
+                    }
+                });
+            }
+            for (thread& worker : threads) {
+                worker.join();
+            }
+            ASSERT_EQUAL(failures, vector<int>(THREADS));
+        }
+
+        void TestConcurrentRunsTreeWalking() {
+            TestConcurrentRuns(ExecutionMode::TreeWalking);
+        }
+
+        void TestConcurrentRunsBytecode() {
+            TestConcurrentRuns(ExecutionMode::Bytecode);
+        }
+
+        void TestConcurrentRunsOfLazyMethods() {
+            TestConcurrentRuns(ExecutionMode::TreeWalking, true);
+            TestConcurrentRuns(ExecutionMode::Bytecode, true);
+        }
+
+        void TestClasses() {
+            Program program = Program::Parse(PROGRAM, ExecutionMode::TreeWalking);
+            ASSERT_EQUAL(program.GetClasses().size(), 2U);
+            ASSERT(program.GetClass("Scaled"sv));
+            ASSERT_EQUAL(program.GetClass("Scaled"sv)->GetParent(), program.GetClass("Point"sv));
+            ASSERT(!program.GetClass("Vector"sv));
+
+            ASSERT_THROWS(Program::Parse("class A(B):\n  def f():\n    return 1\n"sv), ParseError);
+        }
+
+        const string FIBONACCI = R"(
+class Fibonacci:
+  def get(n):
+    if n < 2:
+      return n
+    return self.get(n - 1) + self.get(n - 2)
+
+f = Fibonacci()
+print 'start'
+print f.get(n)
+)";
+
+        // calls of Fibonacci.get(n)
+        uint64_t FibonacciCalls(int n) {
+            return n < 2 ? 1 : 1 + FibonacciCalls(n - 1) + FibonacciCalls(n - 2);
+        }
+
+        runtime::Closure MakeInput(int n) {
+            return { { "n"s, runtime::ObjectHolder::Own(runtime::Number(n)) } };
+        }
+
+        void TestCallBudget() {
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                const Program program = Program::Parse(FIBONACCI, mode);
+                ostringstream output;
+                Interpreter interpreter(program, output);
+                runtime::Context& context = interpreter.GetContext();
+                runtime::ExecutionBudget budget;
+                budget.calls = 100;
+                context.SetBudget(budget);
+
+                // the call after the last one of budget aborts execution
+                ASSERT_THROWS(interpreter.Run(MakeInput(15)), runtime::BudgetExceeded);
+                ASSERT_EQUAL(output.str(), "start\n"s);
+                ASSERT_EQUAL(context.GetBudgetUsage().calls, 101U);
+                ASSERT_EQUAL(context.GetCallDepth(), 0U);
+
+                // budget is counted from the start of every run
+                output.str(""s);
+                interpreter.Run(MakeInput(8));
+                interpreter.Run(MakeInput(8));
+                ASSERT_EQUAL(output.str(), "start\n21\nstart\n21\n"s);
+                ASSERT_EQUAL(context.GetBudgetUsage().calls, FibonacciCalls(8));
+
+                context.SetBudget({});
+                interpreter.Run(MakeInput(15));
+                ASSERT_EQUAL(context.GetBudgetUsage().calls, FibonacciCalls(15));
+            }
+        }
+
+        const string CHAIN = R"(
+class Node:
+  def __init__(next):
+    self.next = next
+
+class Builder:
+  def build(n):
+    if n == 0:
+      return None
+    return Node(self.build(n - 1))
+
+b = Builder()
+chain = b.build(n)
+)";
+
+        void TestTimeAndMemoryBudgets() {
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                const Program fibonacci = Program::Parse(FIBONACCI, mode);
+                ostringstream output;
+                Interpreter slow(fibonacci, output);
+                runtime::ExecutionBudget budget;
+                budget.time = chrono::milliseconds(20);
+                slow.GetContext().SetBudget(budget);
+                const auto start = chrono::steady_clock::now();
+                try {
+                    slow.Run(MakeInput(40));
+                    ASSERT(false);
+                }
+                catch (const runtime::BudgetExceeded& e) {
+                    ASSERT_EQUAL(string(e.what()), "Execution exceeded its budget of time"s);
+                }
+                ASSERT(chrono::steady_clock::now() - start < chrono::seconds(5));
+
+                const Program chain = Program::Parse(CHAIN, mode);
+                Interpreter builder(chain, output);
+                budget = {};
+                budget.memory = 16 * 1024;
+                budget.check_interval = 16;
+                builder.GetContext().SetBudget(budget);
+                try {
+                    builder.Run(MakeInput(500));
+                    ASSERT(false);
+                }
+                catch (const runtime::BudgetExceeded& e) {
+                    ASSERT_EQUAL(string(e.what()), "Execution exceeded its budget of memory"s);
+                }
+                // memory of aborted run is freed
+                builder.GetGlobals().clear();
+                builder.Run(MakeInput(10));
+                ASSERT(builder.GetContext().GetBudgetUsage().memory <= budget.memory);
+            }
+        }
+
+        const string DOUBLING = R"(
+class Doubler:
+  def double(s, n):
+    if n == 0:
+      return s
+    return self.double(s + s, n - 1)
+
+d = Doubler()
+s = d.double('ab', n)
+print s
+)";
+
+        void TestStringMemoryBudget() {
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                const Program program = Program::Parse(DOUBLING, mode);
+                ostringstream output;
+                Interpreter interpreter(program, output);
+                runtime::ExecutionBudget budget;
+                budget.memory = 1024 * 1024;
+                interpreter.GetContext().SetBudget(budget);
+
+                // rope of 2^41 characters would be flattened by print
+                try {
+                    interpreter.Run(MakeInput(40));
+                    ASSERT(false);
+                }
+                catch (const runtime::BudgetExceeded& e) {
+                    ASSERT_EQUAL(string(e.what()), "Execution exceeded its budget of memory"s);
+                }
+                ASSERT(output.str().empty());
+
+                // flattened text is charged to the pool of thread
+                interpreter.Run(MakeInput(15));
+                ASSERT_EQUAL(output.str().size(), (2U << 15) + 1);
+                ASSERT(interpreter.GetContext().GetBudgetUsage().memory >= (2U << 15));
+                interpreter.GetGlobals().clear();
+                ASSERT(interpreter.GetContext().GetBudgetUsage().memory < (2U << 15));
+            }
+        }
+
+        // continues execution given number of times
+        class SliceHandler : public runtime::BudgetHandler {
+        public:
+            explicit SliceHandler(size_t max_slices)
+                : max_slices_(max_slices) {
+            }
+
+            bool OnBudgetExceeded(runtime::Context& /*context*/, const runtime::BudgetUsage& usage) override {
+                calls.push_back(usage.calls);
+                return calls.size() <= max_slices_;
+            }
+
+            vector<uint64_t> calls;
+
+        private:
+            size_t max_slices_;
+        };
+
+        void TestBudgetHandler() {
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                const Program program = Program::Parse(FIBONACCI, mode);
+                ostringstream output;
+                Interpreter interpreter(program, output);
+                runtime::ExecutionBudget budget;
+                budget.calls = 100;
+
+                // every slice has the same number of calls
+                SliceHandler handler(100);
+                interpreter.GetContext().SetBudget(budget, &handler);
+                interpreter.Run(MakeInput(15));
+                ASSERT_EQUAL(output.str(), "start\n610\n"s);
+                ASSERT_EQUAL(handler.calls.size(), (FibonacciCalls(15) - 1) / 100);
+                for (size_t i = 0; i < handler.calls.size(); ++i) {
+                    ASSERT_EQUAL(handler.calls[i], 100 * i + 101);
+                }
+
+                SliceHandler aborting(5);
+                interpreter.GetContext().SetBudget(budget, &aborting);
+                ASSERT_THROWS(interpreter.Run(MakeInput(15)), runtime::BudgetExceeded);
+                ASSERT_EQUAL(aborting.calls.size(), 6U);
+                ASSERT_EQUAL(interpreter.GetContext().GetCallDepth(), 0U);
+            }
+        }
+
+        // handler gives the only core to other threads between slices
+        class CoreHandler : public runtime::BudgetHandler {
+        public:
+            explicit CoreHandler(mutex& core)
+                : core_(core) {
+            }
+
+            bool OnBudgetExceeded(runtime::Context& /*context*/, const runtime::BudgetUsage& /*usage*/) override {
+                core_.unlock();
+                this_thread::yield();
+                core_.lock();
+                ++slices;
+                return true;
+            }
+
+            size_t slices = 0;
+
+        private:
+            mutex& core_;
+        };
+
+        void TestCooperativePreemption() {
+            const Program program = Program::Parse(FIBONACCI);
+            constexpr int THREADS = 4;
+            mutex core;
+            vector<string> outputs(THREADS);
+            vector<size_t> slices(THREADS);
+            vector<thread> threads;
+            for (int t = 0; t < THREADS; ++t) {
+                threads.emplace_back([&, t] {
+                    ostringstream output;
+                    Interpreter interpreter(program, output);
+                    CoreHandler handler(core);
+                    runtime::ExecutionBudget budget;
+                    budget.calls = 50;
+                    interpreter.GetContext().SetBudget(budget, &handler);
+                    lock_guard lock(core);
+                    interpreter.Run(MakeInput(12 + t));
+                    outputs[t] = output.str();
+                    slices[t] = handler.slices;
+                });
+            }
+            for (thread& worker : threads) {
+                worker.join();
+            }
+            const vector<string> expected{ "start\n144\n"s, "start\n233\n"s, "start\n377\n"s, "start\n610\n"s };
+            ASSERT_EQUAL(outputs, expected);
+            for (int t = 0; t < THREADS; ++t) {
+                ASSERT_EQUAL(slices[t], (FibonacciCalls(12 + t) - 1) / 50);
+            }
+        }
+
+    }  // namespace
+
+    void RunInterpreterTests(TestRunner& tr) {
+        RUN_TEST(tr, interpreter::TestRepeatedRunsTreeWalking);
+        RUN_TEST(tr, interpreter::TestRepeatedRunsBytecode);
+        RUN_TEST(tr, interpreter::TestGlobalsAreReset);
+        RUN_TEST(tr, interpreter::TestTopLevelReturn);
+        RUN_TEST(tr, interpreter::TestProgramStringsAreFreed);
+        RUN_TEST(tr, interpreter::TestInstancesOutliveRun);
+        RUN_TEST(tr, interpreter::TestClasses);
+        RUN_TEST(tr, interpreter::TestConcurrentRunsTreeWalking);
+        RUN_TEST(tr, interpreter::TestConcurrentRunsBytecode);
+        RUN_TEST(tr, interpreter::TestConcurrentRunsOfLazyMethods);
+        RUN_TEST(tr, interpreter::TestCallBudget);
+        RUN_TEST(tr, interpreter::TestTimeAndMemoryBudgets);
+        RUN_TEST(tr, interpreter::TestStringMemoryBudget);
+        RUN_TEST(tr, interpreter::TestBudgetHandler);
+        RUN_TEST(tr, interpreter::TestCooperativePreemption);
+    }
+
+}  // namespace interpreter
@@ -2,9 +2,15 @@
 
 #include <algorithm>
 #include <charconv>
+#include <iterator>
 #include <unordered_map>
 #include <iostream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 namespace parse {
@@ -69,6 +75,7 @@ namespace parse {
         UNVALUED_OUTPUT(None);
         UNVALUED_OUTPUT(True);
         UNVALUED_OUTPUT(False);
+        UNVALUED_OUTPUT(Import);
         UNVALUED_OUTPUT(Eof);
 
 #undef UNVALUED_OUTPUT
@@ -76,26 +83,112 @@ namespace parse {
         return os << "Unknown token :("sv;
     }
 
+    /* --- MappedFile --- */
+    MappedFile::MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Can not open file "s + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw runtime_error("Can not read file "s + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        // empty file can not be mapped
+        if (size_ > 0) {
+            data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data_ == MAP_FAILED) {
+                data_ = nullptr;
+                close(fd);
+                throw runtime_error("Can not map file "s + path);
+            }
+            // lexer reads text once from the beginning to the end
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    MappedFile::~MappedFile() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    std::string_view MappedFile::Text() const {
+        return data_ ? std::string_view(static_cast<const char*>(data_), size_) : std::string_view();
+    }
+
+    /* --- Lexer --- */
     Lexer::Lexer(std::istream& input)
-        : in_(input) {
+        : buffer_(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>())
+        , text_(buffer_) {
+        ReadSpaces();
+        NextToken();
+    }
+
+    Lexer::Lexer(std::string_view text)
+        : text_(text) {
         ReadSpaces();
         NextToken();
     }
 
+    Lexer::Lexer(std::string_view text, const TokenPosition& position)
+        : text_(text) {
+        Seek(position);
+    }
+
     const Token& Lexer::CurrentToken() const {
         return current_token_;
     }
 
+    size_t Lexer::CurrentOffset() const {
+        return token_offset_;
+    }
+
+    size_t Lexer::CurrentLine() const {
+        return token_line_;
+    }
+
+    TokenPosition Lexer::CurrentPosition() const {
+        return { token_offset_, token_line_, str_indent_ };
+    }
+
+    std::string_view Lexer::GetText() const {
+        return text_;
+    }
+
+    void Lexer::Seek(const TokenPosition& position) {
+        position_ = position.offset;
+        line_ = position.line;
+        str_indent_ = position.indent;
+        // position is inside of line of the block header, so no indent is pending
+        spaces_in_str_begin = position.indent;
+        current_token_ = token_type::Char{ ':' };
+        NextToken();
+    }
+
+    SourceLocation Lexer::GetLocation(size_t offset) const {
+        SourceLocation location;
+        std::string_view before = text_.substr(0, offset);
+        location.line += static_cast<size_t>(std::count(before.begin(), before.end(), '\n'));
+        size_t line_begin = before.rfind('\n');
+        location.column += line_begin == std::string_view::npos ? offset : offset - line_begin - 1;
+        return location;
+    }
+
     Token Lexer::NextToken() {
+        token_offset_ = position_;
+        token_line_ = line_;
         // comment
-        if (in_.peek() == '#') {
-            std::string comment;
-            getline(in_, comment);
-            in_.putback('\n');
+        if (Peek() == '#') {
+            size_t line_end = text_.find('\n', position_);
+            position_ = line_end == std::string_view::npos ? text_.size() : line_end;
         }
         // new line
-        if (in_.peek() == '\n') {
-            in_.get();
+        if (Peek() == '\n') {
+            Get();
+            ++line_;
             ReadSpaces();
             if (current_token_ != token_type::Newline()) {
                 return current_token_ = token_type::Newline();
@@ -117,7 +210,7 @@ namespace parse {
             return current_token_ = token_type::Dedent();
         }
         // end
-        if (!in_) {
+        if (AtEnd()) {
             if (current_token_ != token_type::Newline() &&
                 current_token_ != token_type::Eof() &&
                 current_token_ != token_type::Dedent()) {
@@ -126,30 +219,33 @@ namespace parse {
             return current_token_ = token_type::Eof();
         }
         // number
-        if (std::isdigit(in_.peek())) {
+        if (std::isdigit(Peek())) {
             return current_token_ = ReadNumber();
         }
         // line
-        if (in_.peek() == '\'' || in_.peek() == '\"') {
-            char quot = in_.get();
+        if (Peek() == '\'' || Peek() == '\"') {
+            char quot = static_cast<char>(Get());
             return current_token_ = ReadString(quot);
         }
         // id, key word
-        if (in_.peek() == '_' || std::isalpha(in_.peek())) {
+        if (Peek() == '_' || std::isalpha(Peek())) {
             return current_token_ = ReadIdentifier();
         }
         // comparison or assignment
-        if ("!=<>"s.find(in_.peek()) != std::string::npos) {
+        if ("!=<>"sv.find(static_cast<char>(Peek())) != std::string_view::npos) {
             return current_token_ = ReadComparison();
         }
         // +-*/:().,
-        if ("+-*/:().,"s.find(in_.peek()) != std::string::npos) {
-            return current_token_ = token_type::Char{ static_cast<char>(in_.get()) };
+        if ("+-*/:().,"sv.find(static_cast<char>(Peek())) != std::string_view::npos) {
+            return current_token_ = token_type::Char{ static_cast<char>(Get()) };
         }
 
         // spaces in line
-        while (in_.peek() == ' ') {
-            in_.get();
+        if (Peek() != ' ') {
+            ThrowError("Unexpected character"s);
+        }
+        while (Peek() == ' ') {
+            Get();
         }
 
         return NextToken();
@@ -158,26 +254,34 @@ namespace parse {
     /*PRIVATE*/
     Token Lexer::ReadNumber() {
         int res = 0;
-        while (std::isdigit(in_.peek())) {
+        while (std::isdigit(Peek())) {
             res *= 10;
-            res += in_.get() - '0';
+            res += Get() - '0';
         }
         return token_type::Number{ res };
     }
 
     Token Lexer::ReadString(char quot) {
+        // string without escape sequences refers to text of program,
+        // otherwise its characters are collected into line
+        size_t begin = position_;
         std::string line;
+        bool escaped = false;
 
         while (true) {
 
-            if (!in_ || in_.peek() == '\n' || in_.peek() == '\r') {
-                throw LexerError("String parsing error"s);
+            if (AtEnd() || Peek() == '\n' || Peek() == '\r') {
+                ThrowError("String parsing error"s);
             }
 
-            if (in_.peek() == '\\') { // for escapable sequences
-                in_.get();
+            if (Peek() == '\\') { // for escapable sequences
+                if (!escaped) {
+                    line.assign(text_.substr(begin, position_ - begin));
+                    escaped = true;
+                }
+                Get();
 
-                switch (static_cast<char>(in_.get())) {
+                switch (Get()) {
                 case 'n':
                     line.push_back('\n');
                     break;
@@ -193,116 +297,133 @@ namespace parse {
                 }
             }
             else {
-                if (in_.peek() == quot) {
-                    in_.get();
+                if (Peek() == quot) {
+                    Get();
                     break;
                 }
 
-                line.push_back(static_cast<char>(in_.get()));
+                char c = static_cast<char>(Get());
+                if (escaped) {
+                    line.push_back(c);
+                }
             }
         }
 
-        return token_type::String{ move(line) };
+        if (!escaped) {
+            return token_type::String{ text_.substr(begin, position_ - 1 - begin) };
+        }
+        // text without escapes is kept by lexer, so token can refer to it
+        return token_type::String{ unescaped_strings_.emplace_back(std::move(line)) };
     }
 
     Token Lexer::ReadIdentifier() {
-        std::string line;
-
-        while (std::isalnum(in_.peek()) || in_.peek() == '_') {
-            line.push_back(static_cast<char>(in_.get()));
+        size_t begin = position_;
+        while (std::isalnum(Peek()) || Peek() == '_') {
+            Get();
         }
+        std::string_view line = text_.substr(begin, position_ - begin);
 
-        if (line == "class"s) {
+        if (line == "class"sv) {
             return token_type::Class();
         }
 
-        if (line == "return"s) {
+        if (line == "return"sv) {
             return token_type::Return();
         }
 
-        if (line == "if"s) {
+        if (line == "if"sv) {
             return token_type::If();
         }
 
-        if (line == "else"s) {
+        if (line == "else"sv) {
             return token_type::Else();
         }
 
-        if (line == "def"s) {
+        if (line == "def"sv) {
             return token_type::Def();
         }
 
-        if (line == "print"s) {
+        if (line == "print"sv) {
             return token_type::Print();
         }
 
-        if (line == "and"s) {
+        if (line == "and"sv) {
             return token_type::And();
         }
 
-        if (line == "or"s) {
+        if (line == "or"sv) {
             return token_type::Or();
         }
 
-        if (line == "not"s) {
+        if (line == "not"sv) {
             return token_type::Not();
         }
 
-        if (line == "True"s) {
+        if (line == "True"sv) {
             return token_type::True();
         }
 
-        if (line == "False"s) {
+        if (line == "False"sv) {
             return token_type::False();
         }
 
-        if (line == "None"s) {
+        if (line == "import"sv) {
+            return token_type::Import();
+        }
+
+        if (line == "None"sv) {
             return token_type::None();
         }
 
-        return token_type::Id{std::move(line)};
+        return token_type::Id{ line };
 
     }
 
     Token Lexer::ReadComparison() {
-        std::string line;
-        line.push_back(static_cast<char>(in_.get()));
-        if (in_.peek() == '=') {
-            line.push_back(static_cast<char>(in_.get()));
+        char first = static_cast<char>(Get());
+        if (Peek() != '=') {
+            if (first == '=' || first == '<' || first == '>') {
+                return token_type::Char{ first };
+            }
+            ThrowError("Operator parsing error"s);
         }
+        Get();
 
-        if (line == "=="s) {
+        switch (first) {
+        case '=':
             return token_type::Eq();
-        }
-
-        if (line == "!="s) {
+        case '!':
             return token_type::NotEq();
-        }
-
-        if (line == "<="s) {
+        case '<':
             return token_type::LessOrEq();
-        }
-
-        if (line == ">="s) {
+        default:
             return token_type::GreaterOrEq();
         }
-
-        if (line == "="s || line == "<"s || line == ">"s) {
-            return token_type::Char{ line[0] };
-        }
-
-        throw LexerError("Operator parsing error"s);
     }
 
     void Lexer::ReadSpaces() {
         spaces_in_str_begin = 0;
-        while (in_.peek() == ' ') {
-            in_.get();
+        while (Peek() == ' ') {
+            Get();
             ++spaces_in_str_begin;
         }
         if (spaces_in_str_begin % 2 == 1) {
-            throw  LexerError("Indent parsing error"s);
+            ThrowError("Indent parsing error"s);
         }
     }
 
-}  // namespace parse
\ No newline at end of file
+    void Lexer::ThrowError(const std::string& message) const {
+        SourceLocation location = GetLocation(position_);
+        throw LexerError(message + " at line "s + to_string(location.line)
+            + ", column "s + to_string(location.column));
+    }
+
+    void Lexer::ThrowUnexpectedToken() const {
+        SourceLocation location = GetLocation(token_offset_);
+        ostringstream message;
+        message << "Unexpected token "sv << current_token_ << " at line "sv << location.line
+            << ", column "sv << location.column;
+        throw LexerError(message.str());
+    }
+
+}  // namespace parse
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <deque>
 #include <iosfwd>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 
 namespace parse {
@@ -14,8 +16,9 @@ namespace parse {
             int value;   
         };
 
+        // values of Id and String refer to text of program (see Lexer)
         struct Id {             
-            std::string value;  // Id name
+            std::string_view value;  // Id name
         };
 
         struct Char {    
@@ -23,7 +26,7 @@ namespace parse {
         };
 
         struct String { 
-            std::string value;
+            std::string_view value;
         };
 
         struct Class {};    
@@ -46,6 +49,7 @@ namespace parse {
         struct None {};         
         struct True {};         
         struct False {};        
+        struct Import {};
     }  // namespace token_type
 
     using TokenBase
@@ -54,7 +58,7 @@ namespace parse {
         token_type::Def, token_type::Newline, token_type::Print, token_type::Indent,
         token_type::Dedent, token_type::And, token_type::Or, token_type::Not,
         token_type::Eq, token_type::NotEq, token_type::LessOrEq, token_type::GreaterOrEq,
-        token_type::None, token_type::True, token_type::False, token_type::Eof>;
+        token_type::None, token_type::True, token_type::False, token_type::Import, token_type::Eof>;
 
     struct Token : TokenBase {
         using TokenBase::TokenBase;
@@ -85,9 +89,48 @@ namespace parse {
         using std::runtime_error::runtime_error;
     };
 
+    // position in text of program, line and column start from 1
+    struct SourceLocation {
+        size_t line = 1;
+        size_t column = 1;
+    };
+
+    // state of lexer at line break after ':' of a block, lexer continues from it
+    // (see Lexer::CurrentPosition)
+    struct TokenPosition {
+        size_t offset = 0;
+        size_t line = 1;
+        size_t indent = 0;
+    };
+
+    // file which is mapped into memory, so its text is given to Lexer without copying.
+    // Throws runtime_error if file can not be read
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        [[nodiscard]] std::string_view Text() const;
+
+    private:
+        void* data_ = nullptr;
+        size_t size_ = 0;
+    };
+
     class Lexer {
     public:
+        // text of stream is read into buffer of lexer
         explicit Lexer(std::istream& input);
+        // text is not copied, it must live as long as the lexer and its tokens
+        explicit Lexer(std::string_view text);
+        // continue lexing of text from position, its current token is the line break
+        Lexer(std::string_view text, const TokenPosition& position);
+
+        Lexer(const Lexer&) = delete;
+        Lexer& operator=(const Lexer&) = delete;
 
 		// return ref to current token or token_type::Eof if flow of tokens ends
         [[nodiscard]] const Token& CurrentToken() const;
@@ -95,32 +138,46 @@ namespace parse {
         // return ref to next token or token_type::Eof if flow of tokens ends
         Token NextToken();
 
+        // return offset of current token in text
+        [[nodiscard]] size_t CurrentOffset() const;
+
+        // return line and column of offset in text
+        [[nodiscard]] SourceLocation GetLocation(size_t offset) const;
+
+        // return line of current token, it is counted while text is read
+        [[nodiscard]] size_t CurrentLine() const;
+
+        // return position of current token, it must be Newline which follows ':'
+        [[nodiscard]] TokenPosition CurrentPosition() const;
+
+        // return text of program which tokens refer to
+        [[nodiscard]] std::string_view GetText() const;
+
+        // continue lexing from position of the same text, its line break becomes current token
+        void Seek(const TokenPosition& position);
+
 		// if type of current token is T, method return ref to iter_swap
 		// else method throws exceptiom LexerError
         template <typename T>
         const T& Expect() const {
-            using namespace std::literals;
-
             if (const T* current_token_ptr = current_token_.TryAs<T>()) {
                 return *current_token_ptr;
             }
 
-            throw LexerError("Not implemented"s);
+            ThrowUnexpectedToken();
         }
 
 		// method checks that type of current token is T, and this token contains value
 		// else methor throws exception LexerError
         template <typename T, typename U>
         void Expect(const U& value) const {
-            using namespace std::literals;
-
             if (const T* current_token_ptr = current_token_.TryAs<T>()) {
                 if (current_token_.As<T>().value == value) {
                     return;
                 }
             }
 
-            throw LexerError("Not implemented"s);
+            ThrowUnexpectedToken();
         }
 
         // if type of next token is T, method return ref to iter_swap
@@ -140,16 +197,48 @@ namespace parse {
         }
 
     private:
-        std::istream& in_;
+        // text of program if lexer was created from stream
+        std::string buffer_;
+        std::string_view text_;
+        size_t position_ = 0;
+        size_t token_offset_ = 0;
+        // line of position_ and of current token
+        size_t line_ = 1;
+        size_t token_line_ = 1;
         Token current_token_ = token_type::Newline();
+        // texts of string literals with escape sequences, deque does not move them
+        std::deque<std::string> unescaped_strings_;
         size_t str_indent_ = 0;
         size_t spaces_in_str_begin = 0;
 
+        // return next character or EOF at the end of text
+        [[nodiscard]] int Peek() const {
+            return position_ < text_.size() ? static_cast<unsigned char>(text_[position_]) : EOF_CHAR;
+        }
+
+        int Get() {
+            int c = Peek();
+            if (c != EOF_CHAR) {
+                ++position_;
+            }
+            return c;
+        }
+
+        [[nodiscard]] bool AtEnd() const {
+            return position_ >= text_.size();
+        }
+
+        static constexpr int EOF_CHAR = -1;
+
         Token ReadNumber();
         Token ReadString(char quot);
         Token ReadIdentifier();
         Token ReadComparison();
         void ReadSpaces();
+
+        // throw LexerError with location of current position
+        [[noreturn]] void ThrowError(const std::string& message) const;
+        [[noreturn]] void ThrowUnexpectedToken() const;
     };
 
 }  // namespace parse
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "lexer.h"
 #include "test_runner_p.h"
 
+#include <cstdio>
+#include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 using namespace std;
 
@@ -349,6 +352,107 @@ abc#
                 ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
             }
         }
+
+        void TestBufferIsNotCopied() {
+            const string text = "name = 'text' + \"esc\\\"aped\"\n"s;
+            Lexer lexer(string_view{ text });
+
+            // ids and strings without escape sequences refer to the buffer
+            const string_view name = lexer.Expect<token_type::Id>().value;
+            ASSERT_EQUAL(name, "name"sv);
+            ASSERT_EQUAL(name.data(), text.data());
+            lexer.ExpectNext<token_type::Char>('=');
+            const string_view str = lexer.ExpectNext<token_type::String>().value;
+            ASSERT_EQUAL(str, "text"sv);
+            ASSERT_EQUAL(str.data(), text.data() + 8);
+            lexer.ExpectNext<token_type::Char>('+');
+            ASSERT_EQUAL(lexer.ExpectNext<token_type::String>().value, "esc\"aped"sv);
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+            ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
+        }
+
+        void TestCurrentLine() {
+            Lexer lexer("# comment\n\nx = 1  # comment\n\n\nif x:\n  y = 2\n"sv);
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ "x"s }));
+            ASSERT_EQUAL(lexer.CurrentLine(), 3U);
+            while (!lexer.CurrentToken().Is<token_type::If>()) {
+                lexer.NextToken();
+            }
+            ASSERT_EQUAL(lexer.CurrentLine(), 6U);
+            while (!lexer.CurrentToken().Is<token_type::Id>()) {
+                lexer.NextToken();
+            }
+            ASSERT_EQUAL(lexer.CurrentLine(), 6U);
+            lexer.NextToken();
+            lexer.NextToken();
+            lexer.NextToken();
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Indent{}));
+            lexer.NextToken();
+            ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Id{ "y"s }));
+            ASSERT_EQUAL(lexer.CurrentLine(), 7U);
+        }
+
+        void TestSourceLocations() {
+            istringstream input("x = 1\nclass A:\n  def f():\n    return 'open\n"s);
+            Lexer lexer(input);
+            ASSERT_EQUAL(lexer.CurrentOffset(), 0U);
+            lexer.NextToken();
+            ASSERT_EQUAL(lexer.CurrentOffset(), 2U);
+
+            while (!lexer.CurrentToken().Is<token_type::Def>()) {
+                lexer.NextToken();
+            }
+            SourceLocation location = lexer.GetLocation(lexer.CurrentOffset());
+            ASSERT_EQUAL(location.line, 3U);
+            ASSERT_EQUAL(location.column, 3U);
+            ASSERT_EQUAL(lexer.CurrentLine(), 3U);
+
+            try {
+                lexer.ExpectNext<token_type::Number>();
+                ASSERT(false);
+            }
+            catch (const LexerError& e) {
+                ASSERT_EQUAL(string(e.what()), "Unexpected token Id{f} at line 3, column 7"s);
+            }
+
+            try {
+                while (!lexer.CurrentToken().Is<token_type::Eof>()) {
+                    lexer.NextToken();
+                }
+                ASSERT(false);
+            }
+            catch (const LexerError& e) {
+                ASSERT_EQUAL(string(e.what()), "String parsing error at line 4, column 17"s);
+            }
+        }
+
+        void TestMappedFile() {
+            const string path = "/tmp/mython_lexer_test.my"s;
+            {
+                ofstream file(path);
+                file << "print 'mapped'\n"s;
+            }
+            {
+                MappedFile file(path);
+                Lexer lexer(file.Text());
+                ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Print{}));
+                ASSERT_EQUAL(lexer.NextToken(), Token(token_type::String{"mapped"s}));
+                ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Newline{}));
+                ASSERT_EQUAL(lexer.NextToken(), Token(token_type::Eof{}));
+            }
+            {
+                // empty file is not mapped, but it has empty text
+                ofstream file(path, ios::trunc);
+            }
+            {
+                MappedFile file(path);
+                ASSERT(file.Text().empty());
+                Lexer lexer(file.Text());
+                ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Eof{}));
+            }
+            remove(path.c_str());
+            ASSERT_THROWS(MappedFile{ path }, runtime_error);
+        }
     }  // namespace
 
     void RunOpenLexerTests(TestRunner& tr) {
@@ -365,6 +469,10 @@ abc#
         RUN_TEST(tr, parse::TestMythonProgram);
         RUN_TEST(tr, parse::TestAlwaysEmitsNewlineAtTheEndOfNonemptyLine);
         RUN_TEST(tr, parse::TestCommentsAreIgnored);
+        RUN_TEST(tr, parse::TestBufferIsNotCopied);
+        RUN_TEST(tr, parse::TestSourceLocations);
+        RUN_TEST(tr, parse::TestCurrentLine);
+        RUN_TEST(tr, parse::TestMappedFile);
     }
 
 }  // namespace parse
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "loader.h"
+
+#include "image.h"
+#include "lexer.h"
+#include "statement.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace interpreter {
+
+    namespace {
+
+        constexpr string_view MODULE_SUFFIX = ".my"sv;
+
+        struct Module {
+            Module(string module_name, const string& module_path)
+                : name(std::move(module_name))
+                , path(module_path)
+                , file(module_path)
+                , lexer(file.Text()) {
+            }
+
+            string name;
+            string path;
+            parse::MappedFile file;
+            // lexer is at the first statement after imports
+            parse::Lexer lexer;
+            vector<Module*> imports;
+            vector<Module*> importers;
+            // all imports are known, module is not on the path of imports which is visited
+            bool visited = false;
+            // imports which are not loaded yet
+            size_t waiting = 0;
+
+            unique_ptr<runtime::Arena> arena = make_unique<runtime::Arena>();
+            unique_ptr<runtime::Executable> tree;
+            runtime::Closure classes;
+            exception_ptr error;
+        };
+
+        // return program from image file or nullptr if the file is missing, damaged
+        // or made from other text, such image is made again
+        unique_ptr<runtime::Executable> LoadImageFile(const string& path, string_view source, runtime::Closure& classes,
+                                                      const runtime::ClassTable& imported) {
+            try {
+                parse::MappedFile image_file(path);
+                return image::LoadProgram(image_file.Text(), source, &classes, &imported);
+            }
+            catch (const runtime_error&) {
+                return nullptr;
+            }
+        }
+
+        class Loader {
+        public:
+            explicit Loader(const LoadOptions& options)
+                : options_(options) {
+            }
+
+            Program Load(const string& path) {
+                const size_t name_begin = path.rfind('/') + 1;
+                directory_ = path.substr(0, name_begin);
+                string name = path.substr(name_begin);
+                if (name.size() > MODULE_SUFFIX.size()
+                    && string_view(name).substr(name.size() - MODULE_SUFFIX.size()) == MODULE_SUFFIX) {
+                    name.resize(name.size() - MODULE_SUFFIX.size());
+                }
+                vector<string> imports;
+                Visit(name, path, imports);
+                LoadModules();
+                return MakeProgram();
+            }
+
+        private:
+            // find imports of module and of modules which it imports, modules are put into
+            // order_ after their imports, the path of imports to module is in imports
+            Module& Visit(const string& name, const string& path, vector<string>& imports) {
+                if (auto it = modules_.find(name); it != modules_.end()) {
+                    if (!it->second->visited) {
+                        string cycle;
+                        for (auto module = find(imports.begin(), imports.end(), name); module != imports.end(); ++module) {
+                            cycle += *module + " -> "s;
+                        }
+                        throw ParseError("Modules import each other: "s + cycle + name);
+                    }
+                    return *it->second;
+                }
+
+                Module& module = *modules_.emplace(name, make_unique<Module>(name, path)).first->second;
+                imports.push_back(name);
+                for (const string& import : ParseImports(module.lexer)) {
+                    Module& imported = Visit(import, directory_ + import + string(MODULE_SUFFIX), imports);
+                    if (find(module.imports.begin(), module.imports.end(), &imported) == module.imports.end()) {
+                        module.imports.push_back(&imported);
+                        imported.importers.push_back(&module);
+                    }
+                }
+                imports.pop_back();
+                module.visited = true;
+                order_.push_back(&module);
+                return module;
+            }
+
+            // modules are loaded when their imports are loaded, by the current thread if one is enough
+            void LoadModules() {
+                size_t threads = options_.threads != 0 ? options_.threads : thread::hardware_concurrency();
+                threads = std::clamp<size_t>(threads, 1, order_.size());
+                for (Module* module : order_) {
+                    module->waiting = module->imports.size();
+                    if (module->waiting == 0) {
+                        ready_.push_back(module);
+                    }
+                }
+
+                if (threads == 1) {
+                    Work();
+                }
+                else {
+                    vector<thread> workers;
+                    workers.reserve(threads);
+                    for (size_t i = 0; i < threads; ++i) {
+                        workers.emplace_back([this] {
+                            Work();
+                        });
+                    }
+                    for (thread& worker : workers) {
+                        worker.join();
+                    }
+                }
+
+                // the same error is thrown whatever thread was the first
+                for (const Module* module : order_) {
+                    if (module->error) {
+                        rethrow_exception(module->error);
+                    }
+                }
+            }
+
+            // load ready modules until all modules are loaded or some of them fails
+            void Work() {
+                unique_lock lock(mutex_);
+                while (true) {
+                    changed_.wait(lock, [this] {
+                        return failed_ || !ready_.empty() || loaded_ == order_.size();
+                    });
+                    if (failed_ || ready_.empty()) {
+                        return;
+                    }
+                    Module* module = ready_.back();
+                    ready_.pop_back();
+
+                    lock.unlock();
+                    try {
+                        LoadModule(*module);
+                    }
+                    catch (...) {
+                        module->error = current_exception();
+                    }
+                    lock.lock();
+
+                    ++loaded_;
+                    if (module->error) {
+                        failed_ = true;
+                    }
+                    else {
+                        for (Module* importer : module->importers) {
+                            if (--importer->waiting == 0) {
+                                ready_.push_back(importer);
+                            }
+                        }
+                    }
+                    changed_.notify_all();
+                }
+            }
+
+            // nodes of module are allocated in its arena, classes in pool of objects of the thread.
+            // Classes of imports are only read, so threads do not change counters of their references
+            void LoadModule(Module& module) const {
+                runtime::ClassTable imported;
+                for (const Module* import : module.imports) {
+                    for (const auto& [name, cls] : import->classes) {
+                        imported.emplace(name, cls.TryAs<runtime::Class>());
+                    }
+                }
+
+                runtime::ArenaScope scope(*module.arena);
+                const bool use_image = options_.use_images && !options_.parse.lazy_methods;
+                const string image_path = module.path + "c"s;
+                if (use_image) {
+                    module.tree = LoadImageFile(image_path, module.file.Text(), module.classes, imported);
+                    if (module.tree) {
+                        return;
+                    }
+                }
+
+                ParseOptions parse_options = options_.parse;
+                parse_options.imported_classes = &imported;
+                module.tree = ast::Optimize(ParseProgram(module.lexer, &module.classes, parse_options));
+                if (use_image) {
+                    try {
+                        image::WriteImageFile(image_path, image::SaveProgram(*module.tree, module.file.Text(), &imported));
+                    }
+                    catch (const runtime_error&) {
+                        // image is only a cache, the program runs without it
+                    }
+                }
+            }
+
+            // tree of program executes modules in order of imports, the program itself is the last
+            Program MakeProgram() {
+                runtime::Closure classes;
+                unordered_map<string_view, string_view> modules_of_classes;
+                for (const Module* module : order_) {
+                    for (const auto& [name, cls] : module->classes) {
+                        auto [it, inserted] = modules_of_classes.emplace(name, module->name);
+                        if (!inserted) {
+                            throw ParseError("Class "s + name + " is declared by modules "s + string(it->second)
+                                + " and "s + module->name);
+                        }
+                        classes.emplace(name, cls);
+                    }
+                }
+
+                Module& main = *order_.back();
+                vector<unique_ptr<runtime::Arena>> arenas;
+                arenas.push_back(std::move(main.arena));
+                if (order_.size() == 1) {
+                    return Program(std::move(arenas), std::move(main.tree), std::move(classes), options_.mode);
+                }
+
+                runtime::ArenaScope scope(*arenas.front());
+                auto tree = make_unique<ast::Compound>();
+                for (Module* module : order_) {
+                    tree->AddStatement(std::move(module->tree));
+                    if (module->arena) {
+                        arenas.push_back(std::move(module->arena));
+                    }
+                }
+                return Program(std::move(arenas), std::move(tree), std::move(classes), options_.mode);
+            }
+
+            const LoadOptions& options_;
+            // modules are looked for in directory of the program
+            string directory_;
+            unordered_map<string, unique_ptr<Module>> modules_;
+            // modules in order of execution
+            vector<Module*> order_;
+
+            mutex mutex_;
+            // modules whose imports are loaded
+            vector<Module*> ready_;
+            size_t loaded_ = 0;
+            bool failed_ = false;
+            condition_variable changed_;
+        };
+
+    }  // namespace
+
+    Program LoadProgramFile(const string& path, const LoadOptions& options) {
+        return Loader(options).Load(path);
+    }
+
+}  // namespace interpreter
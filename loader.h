@@ -0,0 +1,32 @@
+#pragma once
+
+#include "interpreter.h"
+#include "parse.h"
+
+#include <cstddef>
+#include <string>
+
+// loading of program from file together with modules which it imports. Module is imported
+// by statement "import name" at the beginning of program, it is file name.my in the directory
+// of program. Every module is executed once before modules which import it, all modules
+// share globals and a module sees classes of modules which it imports.
+// Modules which do not import each other are lexed and parsed by different threads, each one
+// into its own arena, and tree of every module is cached in its own image (see image.h)
+namespace interpreter {
+
+    struct LoadOptions {
+        ExecutionMode mode = ExecutionMode::Bytecode;
+        // image of module is kept next to it in file with suffix "c" (module.my -> module.myc),
+        // it is loaded instead of parsing while text of the module does not change.
+        // Image keeps the whole tree, so it is not used when methods are parsed lazily
+        bool use_images = true;
+        ParseOptions parse;
+        // number of threads which parse modules, 0 means number of cores
+        size_t threads = 0;
+    };
+
+    // throws ParseError or parse::LexerError on wrong text of a module, ParseError if modules
+    // import each other or declare classes with equal names, runtime_error if file can not be read
+    Program LoadProgramFile(const std::string& path, const LoadOptions& options = {});
+
+}  // namespace interpreter
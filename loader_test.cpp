@@ -0,0 +1,213 @@
+#include "image.h"
+#include "lexer.h"
+#include "loader.h"
+#include "parse.h"
+#include "test_runner_p.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace interpreter {
+
+    namespace {
+
+        const string SHAPES = R"(
+class Shape:
+  def __init__(name):
+    self.name = name
+
+  def describe():
+    return self.name + ' ' + str(self.area())
+
+print 'shapes'
+)";
+
+        const string RECTANGLES = R"(import shapes
+
+class Rectangle(Shape):
+  def __init__(w, h):
+    self.name = 'rectangle'
+    self.w = w
+    self.h = h
+
+  def area():
+    return self.w * self.h
+
+unit = Rectangle(1, 1)
+print 'rectangles'
+)";
+
+        const string SQUARES = R"(
+# squares are drawn by rectangles
+import shapes
+import rectangles
+
+class Square(Rectangle):
+  def __init__(side):
+    self.name = 'square'
+    self.w = side
+    self.h = side
+
+print 'squares'
+)";
+
+        const string MAIN = R"(import squares
+import rectangles
+
+s = Square(3)
+r = Rectangle(2, 5)
+print s.describe(), r.describe(), unit.area()
+)";
+
+        const string OUTPUT = "shapes\nrectangles\nsquares\nsquare 9 rectangle 10 1\n"s;
+
+        // directory with files of modules which is removed with them
+        class ModuleDirectory {
+        public:
+            ModuleDirectory() {
+                char path[] = "/tmp/mython_loader_testXXXXXX";
+                if (!mkdtemp(path)) {
+                    throw runtime_error("Can not create directory for modules"s);
+                }
+                path_ = path;
+            }
+
+            ModuleDirectory(const ModuleDirectory&) = delete;
+            ModuleDirectory& operator=(const ModuleDirectory&) = delete;
+
+            ~ModuleDirectory() {
+                for (const string& file : files_) {
+                    std::remove(file.c_str());
+                    std::remove((file + "c"s).c_str());
+                }
+                rmdir(path_.c_str());
+            }
+
+            // write module and return path of its file
+            string Write(const string& name, const string& text) {
+                const string path = path_ + "/"s + name + ".my"s;
+                ofstream(path) << text;
+                files_.push_back(path);
+                return path;
+            }
+
+        private:
+            string path_;
+            vector<string> files_;
+        };
+
+        string Run(const string& path, const LoadOptions& options) {
+            const Program program = LoadProgramFile(path, options);
+            ostringstream output;
+            Interpreter interpreter(program, output);
+            interpreter.Run();
+            return output.str();
+        }
+
+        void TestImports() {
+            ModuleDirectory directory;
+            directory.Write("shapes"s, SHAPES);
+            directory.Write("rectangles"s, RECTANGLES);
+            directory.Write("squares"s, SQUARES);
+            const string main = directory.Write("main"s, MAIN);
+
+            for (auto mode : { ExecutionMode::TreeWalking, ExecutionMode::Bytecode }) {
+                for (size_t threads : { 1, 4 }) {
+                    LoadOptions options;
+                    options.mode = mode;
+                    options.use_images = false;
+                    options.threads = threads;
+                    // every module is executed once, after modules which it imports
+                    ASSERT_EQUAL(Run(main, options), OUTPUT);
+
+                    options.parse.lazy_methods = true;
+                    ASSERT_EQUAL(Run(main, options), OUTPUT);
+                }
+            }
+
+            // classes of all modules are merged
+            const Program program = LoadProgramFile(main, {});
+            for (const char* name : { "Shape", "Rectangle", "Square" }) {
+                ASSERT(program.GetClass(name) != nullptr);
+            }
+            ASSERT_EQUAL(program.GetClass("Square"sv)->GetParent(), program.GetClass("Rectangle"sv));
+        }
+
+        void TestModuleImages() {
+            ModuleDirectory directory;
+            directory.Write("shapes"s, SHAPES);
+            const string rectangles = directory.Write("rectangles"s, RECTANGLES);
+            directory.Write("squares"s, SQUARES);
+            const string main = directory.Write("main"s, MAIN);
+
+            LoadOptions options;
+            options.threads = 4;
+            ASSERT_EQUAL(Run(main, options), OUTPUT);
+
+            // image of module refers to imported classes by their names
+            parse::MappedFile image_file(rectangles + "c"s);
+            parse::MappedFile source(rectangles);
+            const runtime::Class shape("Shape"s, {}, nullptr);
+            const runtime::ClassTable imported{ { "Shape"s, &shape } };
+            runtime::Closure classes;
+            ASSERT(image::LoadProgram(image_file.Text(), source.Text(), &classes) == nullptr);
+            ASSERT(image::LoadProgram(image_file.Text(), source.Text(), &classes, &imported) != nullptr);
+            ASSERT_EQUAL(classes.at("Rectangle"s).TryAs<runtime::Class>()->GetParent(), &shape);
+
+            // images of unchanged modules are used with the new text of module which they import
+            directory.Write("shapes"s, SHAPES + "print 'changed'\n"s);
+            ASSERT_EQUAL(Run(main, options), "shapes\nchanged\n"s + OUTPUT.substr("shapes\n"s.size()));
+            directory.Write("shapes"s, "print 'no classes'\n"s);
+            ASSERT_THROWS(Run(main, options), ParseError);
+        }
+
+        void TestImportErrors() {
+            ModuleDirectory directory;
+            LoadOptions options;
+            options.use_images = false;
+            options.threads = 2;
+
+            directory.Write("a"s, "import b\nx = 1\n"s);
+            directory.Write("b"s, "import c\n"s);
+            directory.Write("c"s, "import a\n"s);
+            try {
+                LoadProgramFile(directory.Write("main"s, "import a\n"s), options);
+                ASSERT(false);
+            }
+            catch (const ParseError& e) {
+                ASSERT_EQUAL(string(e.what()), "Modules import each other: a -> b -> c -> a"s);
+            }
+
+            ASSERT_THROWS(LoadProgramFile(directory.Write("missing"s, "import nothing\n"s), options), runtime_error);
+            ASSERT_THROWS(LoadProgramFile(directory.Write("late"s, "x = 1\nimport shapes\n"s), options), ParseError);
+
+            directory.Write("shapes"s, SHAPES);
+            directory.Write("other"s, "class Shape:\n  def area():\n    return 0\n"s);
+            ASSERT_THROWS(LoadProgramFile(directory.Write("twice"s, "import shapes\nimport other\n"s), options),
+                          ParseError);
+            ASSERT_THROWS(LoadProgramFile(directory.Write("redeclared"s, "import shapes\n" + SHAPES), options),
+                          ParseError);
+
+            // error of a module whose imports are loaded stops loading of the rest
+            directory.Write("broken"s, "import shapes\nx = f()\n"s);
+            ASSERT_THROWS(LoadProgramFile(directory.Write("uses_broken"s, "import broken\nimport other\n"s), options),
+                          ParseError);
+        }
+
+    }  // namespace
+
+    void RunLoaderTests(TestRunner& tr) {
+        RUN_TEST(tr, interpreter::TestImports);
+        RUN_TEST(tr, interpreter::TestModuleImages);
+        RUN_TEST(tr, interpreter::TestImportErrors);
+    }
+
+}  // namespace interpreter
@@ -1,10 +1,20 @@
+#include "bytecode.h"
+#include "interpreter.h"
 #include "lexer.h"
+#include "loader.h"
+#include "output.h"
 #include "parse.h"
+#include "profiler.h"
 #include "runtime.h"
 #include "statement.h"
 #include "test_runner_p.h"
 
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string_view>
+
+#include <unistd.h>
 
 using namespace std;
 
@@ -16,26 +26,80 @@ namespace ast {
     void RunUnitTests(TestRunner& tr);
 }
 
+namespace bytecode {
+    void RunBytecodeTests(TestRunner& tr);
+}  // namespace bytecode
+
+namespace image {
+    void RunImageTests(TestRunner& tr);
+}  // namespace image
+
+namespace interpreter {
+    void RunInterpreterTests(TestRunner& tr);
+    void RunLoaderTests(TestRunner& tr);
+}  // namespace interpreter
+
 namespace runtime {
+    void RunCollectorTests(TestRunner& tr);
     void RunObjectHolderTests(TestRunner& tr);
     void RunObjectsTests(TestRunner& tr);
+    void RunOutputTests(TestRunner& tr);
+    void RunProfilerTests(TestRunner& tr);
+    void RunHeapTests(TestRunner& tr);
+    void RunStringValueTests(TestRunner& tr);
 }  // namespace runtime
 
 void TestParseProgram(TestRunner& tr);
 
 namespace {
 
-    void RunMythonProgram(istream& input, ostream& output) {
+    using interpreter::ExecutionMode;
+    using interpreter::Program;
+
+    // execute program once, calls and statements are measured by profiler if it is given
+    void RunProgram(const Program& program, runtime::OutputSink& output, runtime::Profiler* profiler) {
+        interpreter::Interpreter interpreter(program, output);
+        interpreter.GetContext().SetProfiler(profiler);
+        interpreter.Run();
+    }
+
+    void RunMythonProgram(parse::Lexer& lexer, runtime::OutputSink& output, ExecutionMode mode = ExecutionMode::Bytecode,
+                          runtime::Profiler* profiler = nullptr, const ParseOptions& options = {}) {
+        RunProgram(Program::Parse(lexer, mode, options), output, profiler);
+    }
+
+    void RunMythonFile(const string& path, runtime::OutputSink& output, const interpreter::LoadOptions& options,
+                       runtime::Profiler* profiler) {
+        RunProgram(interpreter::LoadProgramFile(path, options), output, profiler);
+    }
+
+    void RunMythonProgram(istream& input, runtime::OutputSink& output, ExecutionMode mode = ExecutionMode::Bytecode,
+                          runtime::Profiler* profiler = nullptr, const ParseOptions& options = {}) {
         parse::Lexer lexer(input);
-        auto program = ParseProgram(lexer);
+        RunMythonProgram(lexer, output, mode, profiler, options);
+    }
 
-        runtime::SimpleContext context{output};
-        runtime::Closure closure;
-        program->Execute(closure, context);
+    void RunMythonProgram(istream& input, ostream& output, ExecutionMode mode = ExecutionMode::Bytecode) {
+        runtime::StreamSink sink(output);
+        RunMythonProgram(input, sink, mode);
+    }
+
+    // run program in all modes, check that outputs are equal and return output
+    string RunMythonProgramInAllModes(const string& program) {
+        istringstream reference_input(program);
+        ostringstream reference_output;
+        RunMythonProgram(reference_input, reference_output, ExecutionMode::TreeWalking);
+
+        istringstream input(program);
+        ostringstream output;
+        RunMythonProgram(input, output, ExecutionMode::Bytecode);
+
+        ASSERT_EQUAL(output.str(), reference_output.str());
+        return output.str();
     }
 
     void TestSimplePrints() {
-        istringstream input(R"(
+        const string program = R"(
 print 57
 print 10, 24, -8
 print 'hello'
@@ -43,16 +107,13 @@ print "world"
 print True, False
 print
 print None
-)");
+)";
 
-        ostringstream output;
-        RunMythonProgram(input, output);
-
-        ASSERT_EQUAL(output.str(), "57\n10 24 -8\nhello\nworld\nTrue False\n\nNone\n");
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "57\n10 24 -8\nhello\nworld\nTrue False\n\nNone\n");
     }
 
     void TestAssignments() {
-        istringstream input(R"(
+        const string program = R"(
 x = 57
 print x
 x = 'C++ black belt'
@@ -62,25 +123,19 @@ x = y
 print x
 x = None
 print x, y
-)");
-
-        ostringstream output;
-        RunMythonProgram(input, output);
+)";
 
-        ASSERT_EQUAL(output.str(), "57\nC++ black belt\nFalse\nNone False\n");
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "57\nC++ black belt\nFalse\nNone False\n");
     }
 
     void TestArithmetics() {
-        istringstream input("print 1+2+3+4+5, 1*2*3*4*5, 1-2-3-4-5, 36/4/3, 2*5+10/2");
-
-        ostringstream output;
-        RunMythonProgram(input, output);
+        const string program = "print 1+2+3+4+5, 1*2*3*4*5, 1-2-3-4-5, 36/4/3, 2*5+10/2";
 
-        ASSERT_EQUAL(output.str(), "15 120 -13 3 15\n");
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "15 120 -13 3 15\n");
     }
 
     void TestVariablesArePointers() {
-        istringstream input(R"(
+        const string program = R"(
 class Counter:
   def __init__():
     self.value = 0
@@ -104,12 +159,113 @@ d = Dummy()
 d.do_add(x)
 
 print y.value
-)");
+)";
+
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "2\n3\n");
+    }
+
+    void TestReturnInsideIf() {
+        const string program = R"(
+class Finder:
+  def first_positive(a, b):
+    if a > 0:
+      return a
+    if b > 0:
+      return b
+    return None
+
+  def check(x):
+    if x:
+      return None
+    print 'not returned'
+    return x
+
+f = Finder()
+print f.first_positive(1, 2), f.first_positive(-1, 2), f.first_positive(0, 0)
+print f.check(True)
+print f.check(0)
+)";
+
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "1 2 None\nNone\nnot returned\n0\n");
+    }
 
+    void TestConstantFolding() {
+        const string program = R"(
+class Folded:
+  def run(x):
+    if not not (1 < 2):
+      print 'a' + 'b' + 'c', str(10 * 2 - 5), not not x, 3 >= 4 or False
+    else:
+      print 'never'
+    return str(None) + str(True)
+
+f = Folded()
+print f.run(5)
+print 1 / 0
+)";
+
+        // division by zero is kept until execution
+        ASSERT_THROWS(RunMythonProgramInAllModes(program), runtime_error);
         ostringstream output;
-        RunMythonProgram(input, output);
+        istringstream input(program);
+        try {
+            RunMythonProgram(input, output);
+        }
+        catch (const runtime_error&) {
+        }
+        ASSERT_EQUAL(output.str(), "abc 15 True False\nNoneTrue\n");
+    }
+
+    void TestComparisons() {
+        const string program = R"(
+class Counted:
+  def __init__(v):
+    self.v = v
+    self.lt = 0
+    self.eq = 0
+
+  def __lt__(other):
+    self.lt = self.lt + 1
+    return self.v < other.v
+
+  def __eq__(other):
+    self.eq = self.eq + 1
+    return self.v == other.v
+
+a = Counted(1)
+b = Counted(2)
+x = 3
+s = 'abc'
+print a < b, a > b, a <= b, a >= b, a == b, a != b
+print x < 4, x > 4, x <= 3, x >= 4, x == 3, x != 3
+print s < 'abd', s > 'ab', s <= 'abc', s >= 'b', s == 'abc', s != 'abc'
+print a.lt, a.eq
+)";
+
+        // every operator calls methods of object at most once
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program),
+            "True False True False False True\nTrue False True False True False\n"
+            "True True True False True False\n4 2\n");
+    }
+
+    void TestShortCircuit() {
+        const string program = R"(
+class Guard:
+  def __init__():
+    self.calls = 0
+
+  def ready():
+    self.calls = self.calls + 1
+    return True
+
+g = Guard()
+x = None
+print x and x.ready(), 1 or g.ready(), True and g.ready(), False or g.ready()
+print g.calls
+)";
 
-        ASSERT_EQUAL(output.str(), "2\n3\n");
+        // x.ready() would throw because x is None
+        ASSERT_EQUAL(RunMythonProgramInAllModes(program), "False True True True\n2\n");
     }
 
     void TestAll() {
@@ -117,22 +273,85 @@ print y.value
         parse::RunOpenLexerTests(tr);
         runtime::RunObjectHolderTests(tr);
         runtime::RunObjectsTests(tr);
+        runtime::RunOutputTests(tr);
+        runtime::RunProfilerTests(tr);
+        runtime::RunHeapTests(tr);
+        runtime::RunCollectorTests(tr);
+        runtime::RunStringValueTests(tr);
         ast::RunUnitTests(tr);
         TestParseProgram(tr);
+        bytecode::RunBytecodeTests(tr);
+        image::RunImageTests(tr);
+        interpreter::RunInterpreterTests(tr);
+        interpreter::RunLoaderTests(tr);
 
         RUN_TEST(tr, TestSimplePrints);
         RUN_TEST(tr, TestAssignments);
         RUN_TEST(tr, TestArithmetics);
         RUN_TEST(tr, TestVariablesArePointers);
+        RUN_TEST(tr, TestReturnInsideIf);
+        RUN_TEST(tr, TestConstantFolding);
+        RUN_TEST(tr, TestComparisons);
+        RUN_TEST(tr, TestShortCircuit);
     }
 
 }  // namespace
 
-int main() {
+// usage: mython [--tree-walking] [--no-image] [--lazy-methods] [--profile=<file>] [program file]
+// pass --tree-walking to execute program without compilation into bytecode.
+// Program is read from standard input if file is not given, file is mapped into memory
+// and its parsed tree is cached in image file next to it unless --no-image is passed.
+// Program in file can import modules from its directory (see interpreter::LoadProgramFile).
+// With --lazy-methods bodies of methods are parsed at their first calls, image is not used then.
+// With --profile samples of execution are written into file in collapsed stack format
+// and statistics of methods is written into standard error
+int main(int argc, char* argv[]) {
     try {
         TestAll();
 
-        RunMythonProgram(cin, cout);
+        constexpr string_view PROFILE_OPTION = "--profile="sv;
+        interpreter::LoadOptions load_options;
+        string profile_path;
+        int arg = 1;
+        for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+            const string_view option = argv[arg];
+            if (option == "--tree-walking"sv) {
+                load_options.mode = ExecutionMode::TreeWalking;
+            }
+            else if (option == "--no-image"sv) {
+                load_options.use_images = false;
+            }
+            else if (option == "--lazy-methods"sv) {
+                load_options.parse.lazy_methods = true;
+            }
+            else if (option.substr(0, PROFILE_OPTION.size()) == PROFILE_OPTION && option.size() > PROFILE_OPTION.size()) {
+                profile_path = string(option.substr(PROFILE_OPTION.size()));
+            }
+            else {
+                throw runtime_error("Unknown option "s + argv[arg]);
+            }
+        }
+
+        unique_ptr<runtime::Profiler> profiler;
+        if (!profile_path.empty()) {
+            profiler = make_unique<runtime::Profiler>();
+        }
+        // output of program goes to standard output by writev, without buffers of cout
+        runtime::FileDescriptorSink output(STDOUT_FILENO);
+        if (arg < argc) {
+            RunMythonFile(argv[arg], output, load_options, profiler.get());
+        }
+        else {
+            RunMythonProgram(cin, output, load_options.mode, profiler.get(), load_options.parse);
+        }
+        if (profiler) {
+            ofstream profile(profile_path);
+            if (!profile) {
+                throw runtime_error("Can not write profile "s + profile_path);
+            }
+            profiler->WriteCollapsedStacks(profile);
+            profiler->WriteMethodProfiles(cerr);
+        }
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -0,0 +1,140 @@
+#include "output.h"
+
+#include <cerrno>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        // sign and digits of int
+        constexpr size_t MAX_NUMBER_SIZE = numeric_limits<int>::digits10 + 2;
+    }  // namespace
+
+    /* --- OutputSink --- */
+    OutputSink::OutputSink(size_t buffer_size)
+        : buffer_(make_unique<char[]>(buffer_size))
+        , buffer_size_(buffer_size) {
+    }
+
+    void OutputSink::WriteNumber(int value) {
+        if (buffer_size_ - size_ >= MAX_NUMBER_SIZE) {
+            char* begin = buffer_.get() + size_;
+            size_ += static_cast<size_t>(to_chars(begin, begin + MAX_NUMBER_SIZE, value).ptr - begin);
+            return;
+        }
+        char digits[MAX_NUMBER_SIZE];
+        char* end = to_chars(digits, digits + MAX_NUMBER_SIZE, value).ptr;
+        Write(string_view(digits, static_cast<size_t>(end - digits)));
+    }
+
+    void OutputSink::Flush() {
+        if (size_ > 0) {
+            // buffer is empty even if destination throws, so the text is not written twice
+            const size_t size = size_;
+            size_ = 0;
+            WriteData(string_view(buffer_.get(), size), {});
+        }
+    }
+
+    void OutputSink::WriteLong(string_view text) {
+        if (text.size() < buffer_size_) {
+            Flush();
+            memcpy(buffer_.get(), text.data(), text.size());
+            size_ = text.size();
+            return;
+        }
+        const size_t size = size_;
+        size_ = 0;
+        WriteData(string_view(buffer_.get(), size), text);
+    }
+
+    /* --- StreamSink --- */
+    StreamSink::StreamSink(ostream& output, size_t buffer_size)
+        : OutputSink(buffer_size)
+        , output_(output) {
+    }
+
+    StreamSink::~StreamSink() {
+        Flush();
+    }
+
+    void StreamSink::WriteData(string_view buffered, string_view text) {
+        output_.write(buffered.data(), static_cast<streamsize>(buffered.size()));
+        output_.write(text.data(), static_cast<streamsize>(text.size()));
+    }
+
+    /* --- FileDescriptorSink --- */
+    FileDescriptorSink::FileDescriptorSink(int fd, size_t buffer_size)
+        : OutputSink(buffer_size)
+        , fd_(fd) {
+    }
+
+    FileDescriptorSink::~FileDescriptorSink() {
+        try {
+            Flush();
+        }
+        catch (const runtime_error&) {
+            // destructor can not report that output is lost
+        }
+    }
+
+    void FileDescriptorSink::WriteData(string_view buffered, string_view text) {
+        iovec parts[2] = { { const_cast<char*>(buffered.data()), buffered.size() },
+                           { const_cast<char*>(text.data()), text.size() } };
+        iovec* part = parts;
+        int count = 2;
+        while (count > 0) {
+            if (part->iov_len == 0) {
+                ++part;
+                --count;
+                continue;
+            }
+            const ssize_t written = writev(fd_, part, count);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw runtime_error("Can not write output to file descriptor "s + to_string(fd_));
+            }
+            // the rest of partially written parts is written by the next call
+            auto left = static_cast<size_t>(written);
+            while (count > 0 && left >= part->iov_len) {
+                left -= part->iov_len;
+                ++part;
+                --count;
+            }
+            if (count > 0) {
+                part->iov_base = static_cast<char*>(part->iov_base) + left;
+                part->iov_len -= left;
+            }
+        }
+    }
+
+    /* --- SinkStream --- */
+    SinkStream::SinkStream(OutputSink& sink)
+        : std::ostream(nullptr)
+        , buffer_(sink) {
+        rdbuf(&buffer_);
+    }
+
+    SinkStream::Buffer::int_type SinkStream::Buffer::overflow(int_type c) {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            sink_.Write(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize SinkStream::Buffer::xsputn(const char* data, streamsize size) {
+        sink_.Write(string_view(data, static_cast<size_t>(size)));
+        return size;
+    }
+
+}  // namespace runtime
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+
+namespace runtime {
+
+    // destination of output of program. Text is collected in buffer which is reused and is
+    // written to destination when it is full and at Flush, so print of a value costs
+    // a copy into memory. Text which does not fit into buffer goes to destination
+    // together with buffered text without copying
+    class OutputSink {
+    public:
+        static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+        explicit OutputSink(size_t buffer_size = DEFAULT_BUFFER_SIZE);
+        // buffered text is lost, derived sinks write it in their destructors
+        virtual ~OutputSink() = default;
+
+        OutputSink(const OutputSink&) = delete;
+        OutputSink& operator=(const OutputSink&) = delete;
+
+        void Write(std::string_view text) {
+            if (text.size() <= buffer_size_ - size_) {
+                std::memcpy(buffer_.get() + size_, text.data(), text.size());
+                size_ += text.size();
+            }
+            else {
+                WriteLong(text);
+            }
+        }
+
+        void Write(char c) {
+            if (size_ < buffer_size_) {
+                buffer_[size_++] = c;
+            }
+            else {
+                WriteLong(std::string_view(&c, 1));
+            }
+        }
+
+        // write decimal representation of value, it does not depend on locale
+        void WriteNumber(int value);
+
+        // write buffered text to destination
+        void Flush();
+
+        // return size of text which is not written to destination yet
+        [[nodiscard]] size_t GetBufferedSize() const {
+            return size_;
+        }
+
+    protected:
+        // write buffered text and then text to destination, one of them may be empty
+        virtual void WriteData(std::string_view buffered, std::string_view text) = 0;
+
+    private:
+        void WriteLong(std::string_view text);
+
+        std::unique_ptr<char[]> buffer_;
+        size_t buffer_size_;
+        size_t size_ = 0;
+    };
+
+    // sink which writes into stream, stream is not flushed
+    class StreamSink : public OutputSink {
+    public:
+        // with buffer_size 0 text is written into stream at once
+        explicit StreamSink(std::ostream& output, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+        ~StreamSink() override;
+
+    protected:
+        void WriteData(std::string_view buffered, std::string_view text) override;
+
+    private:
+        std::ostream& output_;
+    };
+
+    // sink which writes into file descriptor by writev without copies into stream buffers,
+    // descriptor is not closed. Throws runtime_error if descriptor can not be written
+    class FileDescriptorSink : public OutputSink {
+    public:
+        explicit FileDescriptorSink(int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+        // buffered text is written, errors are ignored
+        ~FileDescriptorSink() override;
+
+    protected:
+        void WriteData(std::string_view buffered, std::string_view text) override;
+
+    private:
+        int fd_;
+    };
+
+    // std::ostream which writes into sink, so the code which prints to stream (Object::Print)
+    // keeps order of output with the code which prints to sink
+    class SinkStream : public std::ostream {
+    public:
+        explicit SinkStream(OutputSink& sink);
+
+    private:
+        class Buffer : public std::streambuf {
+        public:
+            explicit Buffer(OutputSink& sink)
+                : sink_(sink) {
+            }
+
+        protected:
+            int_type overflow(int_type c) override;
+            std::streamsize xsputn(const char* data, std::streamsize size) override;
+
+        private:
+            OutputSink& sink_;
+        };
+
+        Buffer buffer_;
+    };
+
+}  // namespace runtime
@@ -0,0 +1,180 @@
+#include "interpreter.h"
+#include "output.h"
+#include "runtime.h"
+#include "test_runner_p.h"
+
+#include <climits>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+
+        // sink which records every write to destination
+        class RecordingSink : public OutputSink {
+        public:
+            explicit RecordingSink(size_t buffer_size)
+                : OutputSink(buffer_size) {
+            }
+
+            struct Record {
+                string buffered;
+                const char* text_data;
+                string text;
+            };
+
+            vector<Record> writes;
+
+        protected:
+            void WriteData(string_view buffered, string_view text) override {
+                writes.push_back({ string(buffered), text.data(), string(text) });
+            }
+        };
+
+        void TestBuffering() {
+            RecordingSink sink(8);
+            sink.Write("abc"sv);
+            sink.Write(' ');
+            sink.Write("def"sv);
+            ASSERT(sink.writes.empty());
+            ASSERT_EQUAL(sink.GetBufferedSize(), 7U);
+
+            // text which does not fit into the rest of buffer moves buffer to destination
+            sink.Write("gh"sv);
+            ASSERT_EQUAL(sink.writes.size(), 1U);
+            ASSERT_EQUAL(sink.writes[0].buffered, "abc def"s);
+            ASSERT_EQUAL(sink.writes[0].text, ""s);
+            ASSERT_EQUAL(sink.GetBufferedSize(), 2U);
+
+            sink.Flush();
+            sink.Flush();
+            ASSERT_EQUAL(sink.writes.size(), 2U);
+            ASSERT_EQUAL(sink.writes[1].buffered, "gh"s);
+            ASSERT_EQUAL(sink.GetBufferedSize(), 0U);
+
+            // long text goes to destination without copying
+            const string long_text = "0123456789"s;
+            sink.Write('x');
+            sink.Write(long_text);
+            ASSERT_EQUAL(sink.writes.size(), 3U);
+            ASSERT_EQUAL(sink.writes[2].buffered, "x"s);
+            ASSERT_EQUAL(sink.writes[2].text, long_text);
+            ASSERT_EQUAL(sink.writes[2].text_data, long_text.data());
+            ASSERT_EQUAL(sink.GetBufferedSize(), 0U);
+        }
+
+        void TestWriteNumber() {
+            ostringstream output;
+            {
+                StreamSink sink(output, 16);
+                for (int value : { 0, 7, -7, 1234567890, INT_MAX, INT_MIN }) {
+                    sink.WriteNumber(value);
+                    sink.Write(' ');
+                }
+            }
+            ASSERT_EQUAL(output.str(), "0 7 -7 1234567890 2147483647 -2147483648 "s);
+
+            // number does not fit into the rest of buffer
+            RecordingSink sink(12);
+            sink.Write("abcdef"sv);
+            sink.WriteNumber(-123456);
+            ASSERT_EQUAL(sink.writes.size(), 1U);
+            ASSERT_EQUAL(sink.writes[0].buffered, "abcdef"s);
+            sink.WriteNumber(42);
+            sink.Flush();
+            ASSERT_EQUAL(sink.writes.size(), 2U);
+            ASSERT_EQUAL(sink.writes[1].buffered, "-12345642"s);
+        }
+
+        void TestSinkStreamKeepsOrder() {
+            ostringstream output;
+            StreamSink sink(output, 4);
+            SinkStream stream(sink);
+            sink.Write("a"sv);
+            stream << "bc" << 12 << 'd';
+            sink.Write("e"sv);
+            sink.Flush();
+            ASSERT_EQUAL(output.str(), "abc12de"s);
+
+            // unbuffered sink writes into stream at once
+            ostringstream direct;
+            StreamSink direct_sink(direct, 0);
+            direct_sink.Write("xy"sv);
+            direct_sink.Write('z');
+            ASSERT_EQUAL(direct.str(), "xyz"s);
+        }
+
+        void TestFileDescriptorSink() {
+            FILE* file = tmpfile();
+            ASSERT(file != nullptr);
+            const string long_text(1000, 'x');
+            {
+                FileDescriptorSink sink(fileno(file), 64);
+                sink.Write("head "sv);
+                sink.Write(long_text);
+                sink.WriteNumber(-5);
+                sink.Write('\n');
+            }
+            rewind(file);
+            string text(2000, '\0');
+            text.resize(fread(text.data(), 1, text.size(), file));
+            fclose(file);
+            ASSERT_EQUAL(text, "head "s + long_text + "-5\n"s);
+
+            // closed descriptor
+            FileDescriptorSink sink(-1, 4);
+            sink.Write("text"sv);
+            ASSERT_THROWS(sink.Flush(), runtime_error);
+            ASSERT_EQUAL(sink.GetBufferedSize(), 0U);
+        }
+
+        void TestPrintObject() {
+            DummyContext context;
+            PrintObject(ObjectHolder::Own(Number(-12)), context);
+            PrintObject(ObjectHolder::Own(Bool(true)), context);
+            PrintObject(ObjectHolder::Own(String("str"s)), context);
+            PrintObject(ObjectHolder::None(), context);
+            ASSERT_EQUAL(context.output.str(), "-12Truestr"s + "None"s);
+
+            Class cls("Empty"s, {}, nullptr);
+            ObjectHolder instance = ObjectHolder::Own(ClassInstance(cls));
+            PrintObject(instance, context);
+            ASSERT(context.output.str().size() > "-12TruestrNone"s.size());
+        }
+
+        void TestInterpreterFlushesOutput() {
+            const interpreter::Program program = interpreter::Program::Parse("print 1, 'a', True\nx = 1 / 0\n"sv);
+            ostringstream output;
+            interpreter::Interpreter interpreter(program, output);
+            ASSERT_THROWS(interpreter.Run(), runtime_error);
+            ASSERT_EQUAL(output.str(), "1 a True\n"s);
+
+            const interpreter::Program print = interpreter::Program::Parse("print 'run', n\n"sv);
+            RecordingSink sink(OutputSink::DEFAULT_BUFFER_SIZE);
+            interpreter::Interpreter batched(print, sink);
+            batched.Run({ { "n"s, ObjectHolder::Own(Number(1)) } });
+            batched.Run({ { "n"s, ObjectHolder::Own(Number(2)) } });
+            // every run is one write to destination
+            ASSERT_EQUAL(sink.writes.size(), 2U);
+            ASSERT_EQUAL(sink.writes[1].buffered, "run 2\n"s);
+        }
+
+    }  // namespace
+
+    void RunOutputTests(TestRunner& tr) {
+        RUN_TEST(tr, runtime::TestBuffering);
+        RUN_TEST(tr, runtime::TestWriteNumber);
+        RUN_TEST(tr, runtime::TestSinkStreamKeepsOrder);
+        RUN_TEST(tr, runtime::TestFileDescriptorSink);
+        RUN_TEST(tr, runtime::TestPrintObject);
+        RUN_TEST(tr, runtime::TestInterpreterFlushesOutput);
+    }
+
+}  // namespace runtime
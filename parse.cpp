@@ -3,6 +3,9 @@
 #include "lexer.h"
 #include "statement.h"
 
+#include <unordered_map>
+#include <utility>
+
 using namespace std;
 
 namespace TokenType = parse::token_type;
@@ -17,10 +20,96 @@ namespace {
         return !(token == c);
     }
 
+    // slots of variables of method, see runtime::Frame
+    class MethodScope {
+    public:
+        explicit MethodScope(const vector<string>& formal_params)
+            : size_(formal_params.size() + 1) {
+            slots_["self"s] = 0;
+            // each parameter has its own slot, if names repeat the last parameter is visible
+            for (size_t i = 0; i < formal_params.size(); ++i) {
+                slots_[formal_params[i]] = i + 1;
+            }
+        }
+
+        // return slot of variable, new slot is given to unknown name
+        size_t Resolve(const string& name) {
+            auto [it, inserted] = slots_.emplace(name, size_);
+            if (inserted) {
+                ++size_;
+            }
+            return it->second;
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return size_;
+        }
+
+    private:
+        unordered_map<string, size_t> slots_;
+        size_t size_;
+    };
+
+    // text of program whose methods are parsed lazily and classes which the bodies can instantiate
+    struct LazyProgram {
+        std::string text;
+        // classes by names with their numbers in order of declaration
+        unordered_map<string, pair<const runtime::Class*, size_t>> classes;
+    };
+
+    // body of method which is parsed at the first call, it sees classes which were declared
+    // before the class of the method like the body which is parsed with the program
+    class LazyMethodBody : public runtime::MethodSource {
+    public:
+        LazyMethodBody(shared_ptr<const LazyProgram> program, const parse::TokenPosition& position,
+                       size_t visible_classes)
+            : program_(std::move(program))
+            , position_(position)
+            , visible_classes_(visible_classes) {
+        }
+
+    protected:
+        void Parse(runtime::Method& method) override;
+
+    private:
+        shared_ptr<const LazyProgram> program_;
+        parse::TokenPosition position_;
+        size_t visible_classes_;
+    };
+
     class Parser {
     public:
-        explicit Parser(parse::Lexer& lexer)
-            : lexer_(lexer) {
+        Parser(parse::Lexer& lexer, const ParseOptions& options)
+            : lexer_(lexer)
+            , imported_classes_(options.imported_classes) {
+            if (options.lazy_methods) {
+                lazy_program_ = make_shared<LazyProgram>();
+                lazy_program_->text = string(lexer.GetText());
+                // imported classes are visible to every method
+                if (imported_classes_) {
+                    for (const auto& [name, cls] : *imported_classes_) {
+                        const size_t number = lazy_program_->classes.size();
+                        lazy_program_->classes.emplace(name, pair{ cls, number });
+                    }
+                }
+            }
+        }
+
+        // parser of body of lazy method, lexer is at the line break before the body
+        Parser(parse::Lexer& lexer, const LazyProgram& program, size_t visible_classes)
+            : lexer_(lexer)
+            , visible_program_(&program)
+            , visible_classes_(visible_classes) {
+        }
+
+        // set body and frame_size of method, lexer is at the line break before the body
+        void ParseMethodBody(runtime::Method& method) {
+            MethodScope scope(method.formal_params);
+            // body may declare class whose methods are parsed in their own scopes
+            MethodScope* outer = std::exchange(scope_, &scope);
+            method.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+            scope_ = outer;
+            method.frame_size = scope.Size();
         }
 
         // Program -> eps
@@ -28,12 +117,17 @@ namespace {
         unique_ptr<ast::Statement> ParseProgram() {
             auto result = make_unique<ast::Compound>();
             while (!lexer_.CurrentToken().Is<TokenType::Eof>()) {
-                result->AddStatement(ParseStatement());
+                const auto line = static_cast<std::uint32_t>(lexer_.CurrentLine());
+                result->AddStatement(ParseStatement(), line);
             }
 
             return result;
         }
 
+        runtime::Closure& GetDeclaredClasses() {
+            return declared_classes_;
+        }
+
     private:
         // Suite -> NEWLINE INDENT (Statement)+ DEDENT
         unique_ptr<ast::Statement> ParseSuite()  // NOLINT
@@ -45,7 +139,8 @@ namespace {
 
             auto result = make_unique<ast::Compound>();
             while (!lexer_.CurrentToken().Is<TokenType::Dedent>()) {
-                result->AddStatement(ParseStatement());  // NOLINT
+                const auto line = static_cast<std::uint32_t>(lexer_.CurrentLine());
+                result->AddStatement(ParseStatement(), line);  // NOLINT
             }
 
             lexer_.Expect<TokenType::Dedent>();
@@ -54,6 +149,27 @@ namespace {
             return result;
         }
 
+        // skip Suite by its indents, return false if it has class definition
+        bool SkipSuite() {
+            lexer_.Expect<TokenType::Newline>();
+            lexer_.ExpectNext<TokenType::Indent>();
+
+            for (size_t depth = 1; depth > 0;) {
+                const parse::Token& token = lexer_.NextToken();
+                if (token.Is<TokenType::Indent>()) {
+                    ++depth;
+                }
+                else if (token.Is<TokenType::Dedent>()) {
+                    --depth;
+                }
+                else if (token.Is<TokenType::Class>()) {
+                    return false;
+                }
+            }
+            lexer_.NextToken();
+            return true;
+        }
+
         // Methods -> [def id(Params) : Suite]*
         vector<runtime::Method> ParseMethods()  // NOLINT
         {
@@ -66,9 +182,9 @@ namespace {
                 lexer_.ExpectNext<TokenType::Char>('(');
 
                 if (lexer_.NextToken().Is<TokenType::Id>()) {
-                    m.formal_params.push_back(lexer_.Expect<TokenType::Id>().value);
+                    m.formal_params.emplace_back(lexer_.Expect<TokenType::Id>().value);
                     while (lexer_.NextToken() == ',') {
-                        m.formal_params.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+                        m.formal_params.emplace_back(lexer_.ExpectNext<TokenType::Id>().value);
                     }
                 }
 
@@ -76,7 +192,20 @@ namespace {
                 lexer_.ExpectNext<TokenType::Char>(':');
                 lexer_.NextToken();
 
-                m.body = std::make_unique<ast::MethodBody>(ParseSuite());  // NOLINT
+                if (lazy_program_) {
+                    const parse::TokenPosition body = lexer_.CurrentPosition();
+                    if (SkipSuite()) {
+                        m.source = make_unique<LazyMethodBody>(lazy_program_, body, lazy_program_->classes.size());
+                    }
+                    else {
+                        // classes which are declared in the body are visible to the code after it
+                        lexer_.Seek(body);
+                        ParseMethodBody(m);
+                    }
+                }
+                else {
+                    ParseMethodBody(m);
+                }
 
                 result.push_back(std::move(m));
             }
@@ -86,21 +215,20 @@ namespace {
         // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
         unique_ptr<ast::Statement> ParseClassDefinition()  // NOLINT
         {
-            string class_name = lexer_.Expect<TokenType::Id>().value;
+            string class_name(lexer_.Expect<TokenType::Id>().value);
 
             lexer_.NextToken();
 
             const runtime::Class* base_class = nullptr;
             if (lexer_.CurrentToken() == '(') {
-                auto name = lexer_.ExpectNext<TokenType::Id>().value;
+                string name(lexer_.ExpectNext<TokenType::Id>().value);
                 lexer_.ExpectNext<TokenType::Char>(')');
                 lexer_.NextToken();
 
-                auto it = declared_classes_.find(name);
-                if (it == declared_classes_.end()) {
+                base_class = FindClass(name);
+                if (!base_class) {
                     throw ParseError("Base class "s + name + " not found for class "s + class_name);
                 }
-                base_class = static_cast<const runtime::Class*>(it->second.Get());  // NOLINT
             }
 
             lexer_.Expect<TokenType::Char>(':');
@@ -117,23 +245,54 @@ namespace {
                 runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class)),
                 });
 
-            if (!inserted) {
+            if (!inserted || (imported_classes_ && imported_classes_->count(class_name) > 0)) {
                 throw ParseError("Class "s + class_name + " already exists"s);
             }
+            if (lazy_program_) {
+                const size_t number = lazy_program_->classes.size();
+                lazy_program_->classes.emplace(class_name, pair{ it->second.TryAs<runtime::Class>(), number });
+            }
 
             return make_unique<ast::ClassDefinition>(it->second);
         }
 
+        // return class which is declared before the parsed code or nullptr
+        [[nodiscard]] const runtime::Class* FindClass(const string& name) const {
+            if (visible_program_) {
+                auto it = visible_program_->classes.find(name);
+                return it != visible_program_->classes.end() && it->second.second < visible_classes_
+                    ? it->second.first
+                    : nullptr;
+            }
+            if (auto it = declared_classes_.find(name); it != declared_classes_.end()) {
+                return it->second.TryAs<runtime::Class>();
+            }
+            if (imported_classes_) {
+                auto it = imported_classes_->find(name);
+                return it != imported_classes_->end() ? it->second : nullptr;
+            }
+            return nullptr;
+        }
+
         vector<string> ParseDottedIds() {
-            vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+            vector<string> result(1, string(lexer_.Expect<TokenType::Id>().value));
 
             while (lexer_.NextToken() == '.') {
-                result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
+                result.emplace_back(lexer_.ExpectNext<TokenType::Id>().value);
             }
 
             return result;
         }
 
+        // variables of methods are resolved to slots, top-level ones are looked up by name
+        ast::VariableValue CreateVariableValue(vector<string> dotted_ids) {
+            if (scope_) {
+                size_t slot = scope_->Resolve(dotted_ids.front());
+                return ast::VariableValue(std::move(dotted_ids), slot);
+            }
+            return ast::VariableValue(std::move(dotted_ids));
+        }
+
         //  AssgnOrCall -> DottedIds = Expr
         //               | DottedIds '(' ExprList ')'
         unique_ptr<ast::Statement> ParseAssignmentOrCall() {
@@ -147,9 +306,13 @@ namespace {
                 lexer_.NextToken();
 
                 if (id_list.empty()) {
+                    if (scope_) {
+                        size_t slot = scope_->Resolve(last_name);
+                        return make_unique<ast::Assignment>(std::move(last_name), slot, ParseTest());
+                    }
                     return make_unique<ast::Assignment>(std::move(last_name), ParseTest());
                 }
-                return make_unique<ast::FieldAssignment>(ast::VariableValue{std::move(id_list)},
+                return make_unique<ast::FieldAssignment>(CreateVariableValue(std::move(id_list)),
                     std::move(last_name), ParseTest());
             }
             lexer_.Expect<TokenType::Char>('(');
@@ -166,7 +329,8 @@ namespace {
             lexer_.Expect<TokenType::Char>(')');
             lexer_.NextToken();
 
-            return make_unique<ast::MethodCall>(make_unique<ast::VariableValue>(std::move(id_list)),
+            return make_unique<ast::MethodCall>(
+                make_unique<ast::VariableValue>(CreateVariableValue(std::move(id_list))),
                 std::move(last_name), std::move(args));
         }
 
@@ -234,9 +398,10 @@ namespace {
                 return make_unique<ast::NumericConst>(result);
             }
             if (const auto* str = lexer_.CurrentToken().TryAs<TokenType::String>()) {
-                string result = str->value;
+                // equal literals of programs share one string
+                runtime::StringValue result = runtime::StringInterner::Global().Intern(str->value);
                 lexer_.NextToken();
-                return make_unique<ast::StringConst>(std::move(result));
+                return make_unique<ast::StringConst>(runtime::String(std::move(result)));
             }
             if (lexer_.CurrentToken().Is<TokenType::True>()) {
                 lexer_.NextToken();
@@ -271,12 +436,11 @@ namespace {
 
                 if (!names.empty()) {
                     return make_unique<ast::MethodCall>(
-                        make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
-                        std::move(args));
+                        make_unique<ast::VariableValue>(CreateVariableValue(std::move(names))),
+                        std::move(method_name), std::move(args));
                 }
-                if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
-                    return make_unique<ast::NewInstance>(
-                        static_cast<const runtime::Class&>(*it->second), std::move(args));  // NOLINT
+                if (const runtime::Class* cls = FindClass(method_name)) {
+                    return make_unique<ast::NewInstance>(*cls, std::move(args));
                 }
                 if (method_name == "str"sv) {
                     if (args.size() != 1) {
@@ -286,7 +450,7 @@ namespace {
                 }
                 throw ParseError("Unknown call to "s + method_name + "()"s);
             }
-            return make_unique<ast::VariableValue>(std::move(names));
+            return make_unique<ast::VariableValue>(CreateVariableValue(std::move(names)));
         }
 
         vector<unique_ptr<ast::Statement>> ParseTestList()  // NOLINT
@@ -367,32 +531,32 @@ namespace {
 
             if (tok == '<') {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Less, std::move(result),
+                return make_unique<ast::Less>(std::move(result),
                     ParseExpression());
             }
             if (tok == '>') {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Greater, std::move(result),
+                return make_unique<ast::Greater>(std::move(result),
                     ParseExpression());
             }
             if (tok.Is<TokenType::Eq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::Equal, std::move(result),
+                return make_unique<ast::Equal>(std::move(result),
                     ParseExpression());
             }
             if (tok.Is<TokenType::NotEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::NotEqual, std::move(result),
+                return make_unique<ast::NotEqual>(std::move(result),
                     ParseExpression());
             }
             if (tok.Is<TokenType::LessOrEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::LessOrEqual, std::move(result),
+                return make_unique<ast::LessOrEqual>(std::move(result),
                     ParseExpression());
             }
             if (tok.Is<TokenType::GreaterOrEq>()) {
                 lexer_.NextToken();
-                return make_unique<ast::Comparison>(runtime::GreaterOrEqual, std::move(result),
+                return make_unique<ast::GreaterOrEqual>(std::move(result),
                     ParseExpression());
             }
             return result;
@@ -412,6 +576,9 @@ namespace {
             if (tok.Is<TokenType::If>()) {
                 return ParseCondition();
             }
+            if (tok.Is<TokenType::Import>()) {
+                throw ParseError("Imports must be at the beginning of module"s);
+            }
             auto result = ParseSimpleStatement();
             lexer_.Expect<TokenType::Newline>();
             lexer_.NextToken();
@@ -441,10 +608,42 @@ namespace {
 
         parse::Lexer& lexer_;
         runtime::Closure declared_classes_;
+        // classes of imported modules or nullptr
+        const runtime::ClassTable* imported_classes_ = nullptr;
+        MethodScope* scope_ = nullptr;
+        // program whose methods are parsed lazily or nullptr
+        shared_ptr<LazyProgram> lazy_program_;
+        // classes which body of lazy method sees, then declared_classes_ are not used
+        const LazyProgram* visible_program_ = nullptr;
+        size_t visible_classes_ = 0;
     };
 
+    void LazyMethodBody::Parse(runtime::Method& method) {
+        parse::Lexer lexer(program_->text, position_);
+        Parser parser(lexer, *program_, visible_classes_);
+        parser.ParseMethodBody(method);
+    }
+
 }  // namespace
 
-unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{ lexer }.ParseProgram();
+// Imports -> eps
+//          | import Id \n Imports
+vector<string> ParseImports(parse::Lexer& lexer) {
+    vector<string> modules;
+    while (lexer.CurrentToken().Is<TokenType::Import>()) {
+        modules.emplace_back(lexer.ExpectNext<TokenType::Id>().value);
+        lexer.ExpectNext<TokenType::Newline>();
+        lexer.NextToken();
+    }
+    return modules;
+}
+
+unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, runtime::Closure* classes,
+                                             const ParseOptions& options) {
+    Parser parser{ lexer, options };
+    unique_ptr<runtime::Executable> program = parser.ParseProgram();
+    if (classes) {
+        *classes = std::move(parser.GetDeclaredClasses());
+    }
+    return program;
 }
\ No newline at end of file
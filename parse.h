@@ -1,18 +1,35 @@
 #pragma once
 
+#include "runtime.h"
+
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace parse {
     class Lexer;
 }
 
-namespace runtime {
-    class Executable;
-}
-
 struct ParseError : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
\ No newline at end of file
+struct ParseOptions {
+    // bodies of methods are not parsed with the program, parser only finds where they end.
+    // A body is parsed at the first call of its method (see runtime::MethodSource), so errors
+    // in its text are thrown by that call. Parsed program keeps a copy of the text
+    bool lazy_methods = false;
+    // classes of modules which the program imports (see interpreter::LoadProgramFile),
+    // the program creates their instances and derives its classes from them
+    const runtime::ClassTable* imported_classes = nullptr;
+};
+
+// read import statements at the beginning of program and return names of imported modules,
+// lexer is left at the first statement. Imports are resolved by interpreter::LoadProgramFile,
+// ParseProgram throws ParseError on import statements
+std::vector<std::string> ParseImports(parse::Lexer& lexer);
+
+// if classes is not nullptr, classes which are declared by the program are put there by their names
+std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer, runtime::Closure* classes = nullptr,
+                                                  const ParseOptions& options = {});
\ No newline at end of file
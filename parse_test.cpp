@@ -266,6 +266,221 @@ x = X(xh)
         ASSERT_EQUAL(xh->Fields().at("x"s).Get(), closure.at("x"s).Get());
     }
 
+    void TestMethodLocalVariables() {
+        const string program = R"--(
+class Calc:
+  def __init__(base):
+    self.base = base
+
+  def sum(a, b):
+    tmp = a + b
+    if tmp > 10:
+      big = 'big'
+    else:
+      big = 'small'
+    return str(self.base + tmp) + ' ' + big
+
+  def unknown(a):
+    if a:
+      x = 1
+    return x
+
+c = Calc(100)
+tmp = 'global'
+print c.sum(1, 2), c.sum(5, 6), tmp, c.unknown(True)
+)--";
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        auto tree = ParseProgramFromString(program);
+        tree->Execute(closure, context);
+
+        ASSERT_EQUAL(context.output.str(), "103 small 111 big global 1\n"s);
+        ASSERT(closure.find("big"s) == closure.end());
+
+        runtime::Closure failed_closure;
+        auto failed_tree = ParseProgramFromString(program + "print c.unknown(False)\n"s);
+        ASSERT_THROWS(failed_tree->Execute(failed_closure, context), std::runtime_error);
+    }
+
+    void TestClassInMethod() {
+        const string program = R"--(
+class Maker:
+  def make(a):
+    b = a + 1
+    class Made:
+      def value(x):
+        c = x * 2
+        return c
+    print b
+    return a - 1
+
+m = Maker()
+print m.make(3)
+)--"s;
+
+        for (bool lazy_methods : { false, true }) {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            auto tree = ParseProgram(lexer, nullptr, { lazy_methods });
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            // locals of make are seen after methods of Made are parsed
+            tree->Execute(closure, context);
+            ASSERT_EQUAL(context.output.str(), "4\n2\n"s);
+        }
+    }
+
+    void TestLazyMethods() {
+        const string program = R"--(
+class Shape:
+  def __init__(name):
+    self.name = name
+
+  def area():
+    return 0
+
+  def broken():
+    x = = 1
+
+  # comment between methods
+  def __str__():
+    return self.name + ' ' + str(self.area())
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.name = 'rect'
+    self.w = w
+    self.h = h
+
+  def area():
+    # comment in body
+    if self.w > 0:
+      if self.h > 0:
+        return self.w * self.h
+    return 0
+
+  def declare():
+    class Inner:
+      def value():
+        return 7
+    return Inner()
+
+s = Shape('dot')
+r = Rect(2, 3)
+print s, r
+i = Inner()
+print i.value()
+)--"s;
+
+        // eager parser rejects the whole program because of broken method
+        const string broken_method = "  def broken():\n    x = = 1\n\n"s;
+        ASSERT_THROWS(ParseProgramFromString(program), parse::LexerError);
+        runtime::DummyContext eager_context;
+        runtime::Closure eager_closure;
+        ParseProgramFromString(string(program).erase(program.find(broken_method), broken_method.size()))
+            ->Execute(eager_closure, eager_context);
+
+        // lexer and its text are destroyed before the program is executed
+        runtime::Closure classes;
+        unique_ptr<runtime::Executable> tree;
+        {
+            istringstream is(program);
+            parse::Lexer lexer(is);
+            tree = ParseProgram(lexer, &classes, { true });
+        }
+        const auto& rect = *classes.at("Rect"s).TryAs<runtime::Class>();
+        const runtime::Method& area = *rect.GetMethod("area"s);
+        ASSERT(area.source != nullptr && !area.source->IsLoaded());
+        ASSERT(area.body == nullptr);
+        // the body declares class, so it is parsed with the program
+        ASSERT(rect.GetMethod("declare"s)->source == nullptr);
+
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        tree->Execute(closure, context);
+        ASSERT_EQUAL(context.output.str(), eager_context.output.str());
+        ASSERT_EQUAL(context.output.str(), "dot 0 rect 6\n7\n"s);
+        ASSERT(area.source->IsLoaded());
+        ASSERT_EQUAL(area.frame_size, 1U);
+
+        // error in text of body is found by the first call
+        const runtime::Method& broken = *classes.at("Shape"s).TryAs<runtime::Class>()->GetMethod("broken"s);
+        ASSERT(!broken.source->IsLoaded());
+        auto* instance = closure.at("s"s).TryAs<runtime::ClassInstance>();
+        ASSERT_THROWS(instance->Call("broken"s, {}, context), parse::LexerError);
+        ASSERT_THROWS(instance->Call("broken"s, {}, context), parse::LexerError);
+    }
+
+    void TestLazyMethodsSeeEarlierClasses() {
+        const string program = R"--(
+class A:
+  def make():
+    return B()
+
+class B:
+  def make():
+    return A()
+
+b = B()
+a = b.make()
+print 'made'
+a.make()
+)--"s;
+        ASSERT_THROWS(ParseProgramFromString(program), ParseError);
+
+        istringstream is(program);
+        parse::Lexer lexer(is);
+        auto tree = ParseProgram(lexer, nullptr, { true });
+        runtime::DummyContext context;
+        runtime::Closure closure;
+        // B is declared after A, so body of A.make can not create it
+        ASSERT_THROWS(tree->Execute(closure, context), ParseError);
+        ASSERT_EQUAL(context.output.str(), "made\n"s);
+    }
+
+    void TestImportedClasses() {
+        const string program = R"--(
+import base
+import base
+
+class Derived(Base):
+  def make():
+    return Base()
+
+d = Derived()
+b = d.make()
+print b.value
+)--"s;
+        parse::Lexer lexer(program);
+        ASSERT_EQUAL(ParseImports(lexer), (vector<string>{ "base"s, "base"s }));
+        // classes are not known without module
+        ASSERT_THROWS(ParseProgramFromString(program), ParseError);
+
+        vector<runtime::Method> methods;
+        methods.push_back({ "__init__"s, {}, make_unique<ast::FieldAssignment>(
+            ast::VariableValue("self"s), "value"s, make_unique<ast::NumericConst>(7)) });
+        const runtime::Class base("Base"s, std::move(methods), nullptr);
+        const runtime::ClassTable imported{ { "Base"s, &base } };
+        for (bool lazy_methods : { false, true }) {
+            parse::Lexer module_lexer(program);
+            ParseImports(module_lexer);
+            runtime::Closure classes;
+            auto tree = ParseProgram(module_lexer, &classes, { lazy_methods, &imported });
+            // imported classes are not declared by the program
+            ASSERT_EQUAL(classes.size(), 1U);
+            ASSERT_EQUAL(classes.at("Derived"s).TryAs<runtime::Class>()->GetParent(), &base);
+
+            runtime::DummyContext context;
+            runtime::Closure closure;
+            tree->Execute(closure, context);
+            ASSERT_EQUAL(context.output.str(), "7\n"s);
+        }
+
+        parse::Lexer redeclared("class Base:\n  def f():\n    return 1\n"sv);
+        ASSERT_THROWS(ParseProgram(redeclared, nullptr, { false, &imported }), ParseError);
+    }
+
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -278,4 +493,9 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
     RUN_TEST(tr, parse::TestSelfInConstructor);
+    RUN_TEST(tr, parse::TestMethodLocalVariables);
+    RUN_TEST(tr, parse::TestClassInMethod);
+    RUN_TEST(tr, parse::TestLazyMethods);
+    RUN_TEST(tr, parse::TestLazyMethodsSeeEarlierClasses);
+    RUN_TEST(tr, parse::TestImportedClasses);
 }
\ No newline at end of file
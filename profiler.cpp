@@ -0,0 +1,162 @@
+#include "profiler.h"
+
+#include "heap.h"
+#include "runtime.h"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+        constexpr uint64_t Pack(uint32_t high, uint32_t low) {
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
+
+        double ToMicroseconds(chrono::nanoseconds time) {
+            return static_cast<double>(time.count()) / 1000.0;
+        }
+    }  // namespace
+
+    size_t Profiler::MethodKeyHasher::operator()(const MethodKey& key) const {
+        return hash<const void*>{}(key.cls) * 37 + hash<const void*>{}(key.method);
+    }
+
+    Profiler::Profiler(chrono::nanoseconds sample_interval)
+        : pool_(ObjectPool::ForCurrentThread())
+        , sample_interval_(chrono::duration_cast<Clock::duration>(sample_interval))
+        , next_sample_(Clock::now() + sample_interval_)
+        // root of call stacks, its method is not used
+        , nodes_{ { 0, 0 } } {
+    }
+
+    void Profiler::EnterMethod(const Class& cls, const Method& method) {
+        auto [index_it, new_method] = method_indexes_.try_emplace(MethodKey{ &cls, &method },
+            static_cast<uint32_t>(methods_.size()));
+        if (new_method) {
+            MethodEntry entry;
+            entry.profile.name = cls.GetName() + "."s + method.name;
+            methods_.push_back(std::move(entry));
+        }
+        const uint32_t index = index_it->second;
+
+        const uint32_t parent = calls_.empty() ? 0 : calls_.back().node;
+        auto [node_it, new_node] = children_.try_emplace(Pack(parent, index), static_cast<uint32_t>(nodes_.size()));
+        if (new_node) {
+            nodes_.push_back({ parent, index });
+        }
+
+        MethodEntry& entry = methods_[index];
+        ++entry.profile.calls;
+        ++entry.active_calls;
+        // clock is read the last, so the work of profiler is not counted in time of the call
+        calls_.push_back({ index, node_it->second, {}, CurrentAllocations() });
+        calls_.back().start = Clock::now();
+    }
+
+    void Profiler::LeaveMethod() {
+        const Clock::time_point now = Clock::now();
+        const ActiveCall call = calls_.back();
+        calls_.pop_back();
+
+        const auto time = chrono::duration_cast<chrono::nanoseconds>(now - call.start);
+        const uint64_t allocations = CurrentAllocations() - call.allocations_at_start;
+        MethodEntry& entry = methods_[call.method];
+        if (--entry.active_calls == 0) {
+            entry.profile.inclusive_time += time;
+            entry.profile.inclusive_allocations += allocations;
+        }
+        entry.profile.exclusive_time += time - chrono::duration_cast<chrono::nanoseconds>(call.nested_time);
+        entry.profile.exclusive_allocations += allocations - call.nested_allocations;
+
+        if (!calls_.empty()) {
+            calls_.back().nested_time += now - call.start;
+            calls_.back().nested_allocations += allocations;
+        }
+    }
+
+    void Profiler::TakeSample(uint32_t line, Clock::time_point now) {
+        const uint32_t node = calls_.empty() ? 0 : calls_.back().node;
+        ++samples_[Pack(node, line)];
+        ++sample_count_;
+        next_sample_ = now + sample_interval_;
+    }
+
+    uint64_t Profiler::CurrentAllocations() const {
+        return pool_.GetStats().allocations;
+    }
+
+    vector<MethodProfile> Profiler::GetMethodProfiles() const {
+        vector<MethodProfile> profiles;
+        profiles.reserve(methods_.size());
+        for (const MethodEntry& entry : methods_) {
+            profiles.push_back(entry.profile);
+        }
+        stable_sort(profiles.begin(), profiles.end(), [](const MethodProfile& lhs, const MethodProfile& rhs) {
+            return lhs.exclusive_time > rhs.exclusive_time;
+        });
+        return profiles;
+    }
+
+    uint64_t Profiler::GetSampleCount() const {
+        return sample_count_;
+    }
+
+    void Profiler::WriteCollapsedStacks(ostream& os) const {
+        vector<string> stacks;
+        stacks.reserve(samples_.size());
+        vector<uint32_t> frames;
+        for (const auto& [key, count] : samples_) {
+            const auto line = static_cast<uint32_t>(key);
+            frames.clear();
+            for (auto node = static_cast<uint32_t>(key >> 32); node != 0; node = nodes_[node].parent) {
+                frames.push_back(nodes_[node].method);
+            }
+
+            string stack = "<program>"s;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+                stack += ';';
+                stack += methods_[*it].profile.name;
+            }
+            if (line != 0) {
+                stack += ";line "s + to_string(line);
+            }
+            stack += ' ' + to_string(count);
+            stacks.push_back(std::move(stack));
+        }
+        sort(stacks.begin(), stacks.end());
+        for (const string& stack : stacks) {
+            os << stack << '\n';
+        }
+    }
+
+    void Profiler::WriteMethodProfiles(ostream& os) const {
+        const vector<MethodProfile> profiles = GetMethodProfiles();
+        const ios_base::fmtflags flags = os.flags();
+        const streamsize precision = os.precision();
+        size_t name_width = "method"sv.size();
+        for (const MethodProfile& profile : profiles) {
+            name_width = max(name_width, profile.name.size());
+        }
+
+        os << left << setw(static_cast<int>(name_width)) << "method"sv << right
+           << setw(10) << "calls"sv << setw(14) << "inclusive_us"sv << setw(14) << "exclusive_us"sv
+           << setw(14) << "inclusive_obj"sv << setw(14) << "exclusive_obj"sv << '\n';
+        os << fixed << setprecision(1);
+        for (const MethodProfile& profile : profiles) {
+            os << left << setw(static_cast<int>(name_width)) << profile.name << right
+               << setw(10) << profile.calls
+               << setw(14) << ToMicroseconds(profile.inclusive_time)
+               << setw(14) << ToMicroseconds(profile.exclusive_time)
+               << setw(14) << profile.inclusive_allocations
+               << setw(14) << profile.exclusive_allocations << '\n';
+        }
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+}  // namespace runtime
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace runtime {
+
+    class Class;
+    class ObjectPool;
+    struct Method;
+
+    // statistics of calls of one method for instances of one class. Time is measured
+    // by steady clock, allocations are objects which were taken from ObjectPool of the thread
+    struct MethodProfile {
+        // "<class>.<method>", class is the class of instance which the method was called for
+        std::string name;
+        std::uint64_t calls = 0;
+        // time and allocations of calls with nested calls, recursive calls are counted once
+        std::chrono::nanoseconds inclusive_time{ 0 };
+        std::uint64_t inclusive_allocations = 0;
+        // time and allocations of calls without nested calls
+        std::chrono::nanoseconds exclusive_time{ 0 };
+        std::uint64_t exclusive_allocations = 0;
+    };
+
+    // profiler of execution in one thread, it is enabled for context by Context::SetProfiler.
+    // Every method call (ClassInstance::Call) is measured. Statements are sampled: when
+    // a statement finishes and sample interval has passed since the previous sample,
+    // the sample records stack of calls and line of the statement.
+    // Context without profiler checks only one pointer per call and per statement
+    class Profiler {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr std::chrono::nanoseconds DEFAULT_SAMPLE_INTERVAL = std::chrono::microseconds(100);
+
+        // with interval 0 every statement is sampled. Profiler must be used by the thread
+        // which created it, because allocations are counted by the pool of this thread
+        explicit Profiler(std::chrono::nanoseconds sample_interval = DEFAULT_SAMPLE_INTERVAL);
+
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+
+        // measures call of method while it exists
+        class CallScope {
+        public:
+            CallScope(Profiler& profiler, const Class& cls, const Method& method)
+                : profiler_(profiler) {
+                profiler_.EnterMethod(cls, method);
+            }
+
+            ~CallScope() {
+                profiler_.LeaveMethod();
+            }
+
+            CallScope(const CallScope&) = delete;
+            CallScope& operator=(const CallScope&) = delete;
+
+        private:
+            Profiler& profiler_;
+        };
+
+        // start and finish measurement of call, calls are nested. Bytecode VM uses them
+        // for calls which it executes in its loop, the rest is measured by CallScope
+        void EnterMethod(const Class& cls, const Method& method);
+        void LeaveMethod();
+
+        // called when statement on line finishes, line 0 means that it is unknown
+        void OnStatement(std::uint32_t line) {
+            if (const Clock::time_point now = Clock::now(); now >= next_sample_) {
+                TakeSample(line, now);
+            }
+        }
+
+        // return statistics of called methods, the most expensive by exclusive time first
+        [[nodiscard]] std::vector<MethodProfile> GetMethodProfiles() const;
+
+        [[nodiscard]] std::uint64_t GetSampleCount() const;
+
+        // output samples in collapsed stack format of flame graph tools, one stack per line:
+        // "<program>;Bench.run;Counter.add;line 7 12" - callers first, the last frame is line
+        // of sampled statement and the number is count of samples. Lines are sorted
+        void WriteCollapsedStacks(std::ostream& os) const;
+
+        // output table of GetMethodProfiles, times are in microseconds
+        void WriteMethodProfiles(std::ostream& os) const;
+
+    private:
+        struct MethodKey {
+            const Class* cls;
+            const Method* method;
+
+            bool operator==(const MethodKey& other) const {
+                return cls == other.cls && method == other.method;
+            }
+        };
+
+        struct MethodKeyHasher {
+            size_t operator()(const MethodKey& key) const;
+        };
+
+        struct MethodEntry {
+            MethodProfile profile;
+            // calls of the method which are not finished, it is more than 1 for recursion
+            size_t active_calls = 0;
+        };
+
+        // node of tree of call stacks, node 0 is the code outside of methods
+        struct StackNode {
+            std::uint32_t parent;
+            std::uint32_t method;
+        };
+
+        struct ActiveCall {
+            std::uint32_t method;
+            std::uint32_t node;
+            Clock::time_point start;
+            std::uint64_t allocations_at_start;
+            Clock::duration nested_time{};
+            std::uint64_t nested_allocations = 0;
+        };
+
+        void TakeSample(std::uint32_t line, Clock::time_point now);
+
+        [[nodiscard]] std::uint64_t CurrentAllocations() const;
+
+        const ObjectPool& pool_;
+        Clock::duration sample_interval_;
+        Clock::time_point next_sample_;
+
+        std::vector<MethodEntry> methods_;
+        std::unordered_map<MethodKey, std::uint32_t, MethodKeyHasher> method_indexes_;
+        std::vector<StackNode> nodes_;
+        // (node << 32 | method) -> child node
+        std::unordered_map<std::uint64_t, std::uint32_t> children_;
+        std::vector<ActiveCall> calls_;
+        // (node << 32 | line) -> number of samples
+        std::unordered_map<std::uint64_t, std::uint64_t> samples_;
+        std::uint64_t sample_count_ = 0;
+    };
+
+}  // namespace runtime
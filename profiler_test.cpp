@@ -0,0 +1,183 @@
+#include "image.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "parse.h"
+#include "profiler.h"
+#include "statement.h"
+#include "test_runner_p.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+
+        const string PROGRAM = R"(
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(step):
+    self.value = self.value + step
+    return self.value
+
+class Bench:
+  def make():
+    return Counter()
+
+  def down(n):
+    if n > 0:
+      return self.down(n - 1)
+    return 0
+
+  def run(counter, n):
+    counter.add(n)
+    if n > 1:
+      return counter.add(1)
+    return self.down(n)
+
+b = Bench()
+c = b.make()
+x = b.run(c, 2)
+y = b.run(c, 1)
+)";
+
+        // profile of one execution of program, every statement is sampled
+        string CollapsedStacks(const interpreter::Program& program, vector<MethodProfile>* methods = nullptr) {
+            Profiler profiler(chrono::nanoseconds(0));
+            ostringstream output;
+            interpreter::Interpreter interpreter(program, output);
+            interpreter.GetContext().SetProfiler(&profiler);
+            interpreter.Run();
+
+            if (methods) {
+                *methods = profiler.GetMethodProfiles();
+            }
+            ostringstream stacks;
+            profiler.WriteCollapsedStacks(stacks);
+            return stacks.str();
+        }
+
+        const MethodProfile& FindProfile(const vector<MethodProfile>& methods, const string& name) {
+            auto it = find_if(methods.begin(), methods.end(), [&name](const MethodProfile& profile) {
+                return profile.name == name;
+            });
+            ASSERT(it != methods.end());
+            return *it;
+        }
+
+        void TestMethodProfiles() {
+            for (auto mode : { interpreter::ExecutionMode::TreeWalking, interpreter::ExecutionMode::Bytecode }) {
+                const interpreter::Program program = interpreter::Program::Parse(PROGRAM, mode);
+                vector<MethodProfile> methods;
+                CollapsedStacks(program, &methods);
+                ASSERT_EQUAL(methods.size(), 5U);
+
+                ASSERT_EQUAL(FindProfile(methods, "Counter.add"s).calls, 3U);
+                ASSERT_EQUAL(FindProfile(methods, "Counter.__init__"s).calls, 1U);
+                ASSERT_EQUAL(FindProfile(methods, "Bench.run"s).calls, 2U);
+                // down(1) calls down(0)
+                ASSERT_EQUAL(FindProfile(methods, "Bench.down"s).calls, 2U);
+
+                // instance is allocated by make, its __init__ is called after that
+                const MethodProfile& make = FindProfile(methods, "Bench.make"s);
+                ASSERT_EQUAL(make.inclusive_allocations, 1U);
+                ASSERT_EQUAL(make.exclusive_allocations, 1U);
+                ASSERT_EQUAL(FindProfile(methods, "Counter.__init__"s).inclusive_allocations, 0U);
+
+                const MethodProfile& run = FindProfile(methods, "Bench.run"s);
+                const MethodProfile& down = FindProfile(methods, "Bench.down"s);
+                for (const MethodProfile& profile : methods) {
+                    ASSERT(profile.exclusive_time <= profile.inclusive_time);
+                }
+                // time of recursive calls is counted once
+                ASSERT(down.inclusive_time <= run.inclusive_time);
+                ASSERT(down.exclusive_time <= down.inclusive_time);
+                ASSERT(is_sorted(methods.begin(), methods.end(), [](const MethodProfile& lhs, const MethodProfile& rhs) {
+                    return lhs.exclusive_time > rhs.exclusive_time;
+                }));
+            }
+        }
+
+        void TestCollapsedStacks() {
+            const string tree = CollapsedStacks(interpreter::Program::Parse(PROGRAM, interpreter::ExecutionMode::TreeWalking));
+            const string bytecode = CollapsedStacks(interpreter::Program::Parse(PROGRAM, interpreter::ExecutionMode::Bytecode));
+            ASSERT_EQUAL(tree, bytecode);
+            ASSERT_EQUAL(tree,
+                "<program>;Bench.make;Counter.__init__;line 4 1\n"
+                "<program>;Bench.make;line 12 1\n"
+                "<program>;Bench.run;Bench.down;Bench.down;line 15 1\n"
+                "<program>;Bench.run;Bench.down;Bench.down;line 17 1\n"
+                "<program>;Bench.run;Bench.down;line 16 1\n"
+                "<program>;Bench.run;Counter.add;line 7 3\n"
+                "<program>;Bench.run;Counter.add;line 8 3\n"
+                "<program>;Bench.run;line 20 2\n"
+                "<program>;Bench.run;line 21 1\n"
+                "<program>;Bench.run;line 22 1\n"
+                "<program>;Bench.run;line 23 1\n"
+                "<program>;line 10 1\n"
+                "<program>;line 2 1\n"
+                "<program>;line 25 1\n"
+                "<program>;line 26 1\n"
+                "<program>;line 27 1\n"
+                "<program>;line 28 1\n"s);
+        }
+
+        void TestLinesAreKeptInImage() {
+            unique_ptr<Executable> tree;
+            {
+                parse::Lexer lexer(string_view{ PROGRAM });
+                tree = ast::Optimize(ParseProgram(lexer));
+            }
+            const string image = image::SaveProgram(*tree, PROGRAM);
+            auto arena = make_unique<Arena>();
+            Closure classes;
+            unique_ptr<Executable> loaded;
+            {
+                ArenaScope scope(*arena);
+                loaded = image::LoadProgram(image, PROGRAM, &classes);
+            }
+            ASSERT(loaded);
+
+            const string expected = CollapsedStacks(interpreter::Program::Parse(PROGRAM, interpreter::ExecutionMode::TreeWalking));
+            const interpreter::Program program(std::move(arena), std::move(loaded), std::move(classes),
+                                               interpreter::ExecutionMode::Bytecode);
+            ASSERT_EQUAL(CollapsedStacks(program), expected);
+        }
+
+        void TestSampleInterval() {
+            const interpreter::Program program = interpreter::Program::Parse(PROGRAM);
+            // the first sample is taken only after the interval
+            Profiler profiler(chrono::hours(1));
+            ostringstream output;
+            interpreter::Interpreter interpreter(program, output);
+            interpreter.GetContext().SetProfiler(&profiler);
+            interpreter.Run();
+            ASSERT_EQUAL(profiler.GetSampleCount(), 0U);
+            ASSERT_EQUAL(profiler.GetMethodProfiles().size(), 5U);
+
+            ostringstream table;
+            profiler.WriteMethodProfiles(table);
+            const string text = table.str();
+            ASSERT(text.find("Counter.add "s) != string::npos);
+            ASSERT_EQUAL(count(text.begin(), text.end(), '\n'), 6);
+
+            // profiler is not used after it is removed from context
+            interpreter.GetContext().SetProfiler(nullptr);
+            interpreter.Run();
+            ASSERT_EQUAL(FindProfile(profiler.GetMethodProfiles(), "Bench.run"s).calls, 2U);
+        }
+
+    }  // namespace
+
+    void RunProfilerTests(TestRunner& tr) {
+        RUN_TEST(tr, runtime::TestMethodProfiles);
+        RUN_TEST(tr, runtime::TestCollapsedStacks);
+        RUN_TEST(tr, runtime::TestLinesAreKeptInImage);
+        RUN_TEST(tr, runtime::TestSampleInterval);
+    }
+
+}  // namespace runtime
@@ -1,32 +1,67 @@
 #include "runtime.h"
 
+#include "profiler.h"
+
+#include <algorithm>
 #include <cassert>
 #include <optional>
 #include <sstream>
 #include <iostream>
+#include <utility>
 
 using namespace std;
 
 namespace runtime {
 
+    /* --- Object --- */
+    void* Object::operator new(size_t size) {
+        ObjectPool& pool = ObjectPool::ForCurrentThread();
+        return new (pool.Allocate(sizeof(Header) + size)) Header{ &pool, 0, false } + 1;
+    }
+
+    void Object::operator delete(void* ptr, size_t size) noexcept {
+        Header* header = static_cast<Header*>(ptr) - 1;
+        ObjectPool* pool = header->pool;
+        header->~Header();
+        pool->Deallocate(header, sizeof(Header) + size);
+    }
+
     /* --- ObjectHolder --- */
-    ObjectHolder::ObjectHolder(std::shared_ptr<Object> data)
+    ObjectHolder::ObjectHolder(Data data)
         : data_(std::move(data)) {
     }
 
     void ObjectHolder::AssertIsValid() const {
-        assert(data_ != nullptr);
+        assert(Get() != nullptr);
     }
 
     ObjectHolder ObjectHolder::Share(Object& object) {
-		// return shared_ptr that does not own object (its deleted does nothing)
-        return ObjectHolder(std::shared_ptr<Object>(&object, [](auto* /*p*/) { /* do nothing */ }));
+        // raw pointer does not own object
+        return ObjectHolder(Data(&object));
+    }
+
+    ObjectHolder ObjectHolder::Reference(Object& object) {
+        if (!object.counted_) {
+            return Share(object);
+        }
+        Data data(Owned{ &object });
+        AddRef(data);
+        return ObjectHolder(std::move(data));
     }
 
     ObjectHolder ObjectHolder::None() {
         return ObjectHolder();
     }
 
+    ObjectHolder ObjectHolder::Unassigned() {
+        return ObjectHolder(Data(static_cast<Object*>(nullptr)));
+    }
+
+    bool ObjectHolder::IsUnassigned() const {
+        const auto* pointer = std::get_if<Object*>(&data_);
+        return pointer != nullptr && *pointer == nullptr;
+    }
+
     Object& ObjectHolder::operator*() const {
         AssertIsValid();
         return *Get();
@@ -38,38 +73,394 @@ namespace runtime {
     }
 
     Object* ObjectHolder::Get() const {
-        return data_.get();
+        // the boxed object is counted by this holder, the immediate value needs no release
+        ObjectHolder boxed;
+        if (const int* number = std::get_if<int>(&data_)) {
+            boxed = OwnObject(Number(*number));
+        }
+        else if (const bool* boolean = std::get_if<bool>(&data_)) {
+            boxed = OwnObject(Bool(*boolean));
+        }
+        if (boxed) {
+            data_ = std::exchange(boxed.data_, std::monostate{});
+        }
+        return GetObject();
     }
 
     ObjectHolder::operator bool() const {
-        return Get() != nullptr;
+        return std::holds_alternative<int>(data_) || std::holds_alternative<bool>(data_) || GetObject() != nullptr;
     }
 
-    /* --- IsTrue() --- */
-    bool IsTrue(const ObjectHolder& object) {
+    void ObjectHolder::ShareBetweenThreads() const noexcept {
+        if (const Owned* owned = std::get_if<Owned>(&data_)) {
+            owned->object->GetHeader().shared_between_threads = true;
+        }
+    }
+
+    bool ObjectHolder::IsSharedBetweenThreads() const noexcept {
+        const Owned* owned = std::get_if<Owned>(&data_);
+        return owned != nullptr && owned->object->GetHeader().shared_between_threads;
+    }
+
+    bool ObjectHolder::IsUnique() const noexcept {
+        const Owned* owned = std::get_if<Owned>(&data_);
+        if (!owned) {
+            return false;
+        }
+        const Object::Header& header = owned->object->GetHeader();
+        return !header.shared_between_threads && header.refs.load(std::memory_order_relaxed) == 1;
+    }
+
+    /* --- Frame --- */
+    Frame::Frame(size_t size)
+        : own_slots_(std::make_unique<ObjectHolder[]>(size))
+        , slots_(own_slots_.get())
+        , size_(size) {
+        std::fill(slots_, slots_ + size_, ObjectHolder::Unassigned());
+    }
+
+    Frame::Frame(ObjectHolder* slots, size_t size)
+        : slots_(slots)
+        , size_(size) {
+        std::fill(slots_, slots_ + size_, ObjectHolder::Unassigned());
+    }
+
+    const ObjectHolder& Frame::Get(size_t slot) const {
+        if (slots_[slot].IsUnassigned()) {
+            throw runtime_error("Unknown variable"s);
+        }
+        return slots_[slot];
+    }
+
+    void Frame::Set(size_t slot, ObjectHolder value) {
+        slots_[slot] = std::move(value);
+    }
+
+    void Frame::Attach(ObjectHolder* slots, size_t size) {
+        slots_ = slots;
+        size_ = size;
+        std::fill(slots_, slots_ + size_, ObjectHolder::Unassigned());
+    }
+
+    size_t Frame::Size() const {
+        return size_;
+    }
+
+    /* --- ValueStack --- */
+    ObjectHolder* ValueStack::Allocate(size_t count) {
+        if (count == 0) {
+            return nullptr;
+        }
+        if (chunks_.empty()) {
+            chunks_.push_back(Chunk{ std::make_unique<ObjectHolder[]>(std::max(count, CHUNK_SIZE)),
+                std::max(count, CHUNK_SIZE) });
+        }
+        else if (chunks_[current_].used + count > chunks_[current_].capacity) {
+            // the next chunk is empty, it is replaced if it is too small
+            ++current_;
+            if (current_ == chunks_.size()) {
+                chunks_.emplace_back();
+            }
+            Chunk& next = chunks_[current_];
+            if (next.capacity < count) {
+                next.capacity = std::max(count, CHUNK_SIZE);
+                next.values = std::make_unique<ObjectHolder[]>(next.capacity);
+            }
+        }
+
+        Chunk& chunk = chunks_[current_];
+        ObjectHolder* result = chunk.values.get() + chunk.used;
+        chunk.used += count;
+        size_ += count;
+        return result;
+    }
+
+    void ValueStack::Free(ObjectHolder* values, size_t count) noexcept {
+        if (count == 0) {
+            return;
+        }
+        Chunk& chunk = chunks_[current_];
+        assert(values + count == chunk.values.get() + chunk.used);
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = ObjectHolder::None();
+        }
+        chunk.used -= count;
+        size_ -= count;
+        if (chunk.used == 0 && current_ > 0) {
+            --current_;
+        }
+    }
+
+    size_t ValueStack::Size() const {
+        return size_;
+    }
+
+    size_t ValueStack::Capacity() const {
+        size_t capacity = 0;
+        for (const Chunk& chunk : chunks_) {
+            capacity += chunk.capacity;
+        }
+        return capacity;
+    }
+
+    /* --- Context --- */
+    /* --- SimpleContext --- */
+    SimpleContext::SimpleContext(std::ostream& output, size_t buffer_size)
+        : own_sink_(std::in_place, output, buffer_size)
+        , stream_(*own_sink_) {
+        SetOutput(*own_sink_);
+    }
+
+    SimpleContext::SimpleContext(OutputSink& output)
+        : stream_(output) {
+        SetOutput(output);
+    }
+
+    HeapStats Context::GetHeapStats() const {
+        HeapStats stats;
+        stats.objects = ObjectPool::ForCurrentThread().GetStats();
+        if (node_arena_) {
+            stats.nodes = node_arena_->GetStats();
+        }
+        stats.instances = CycleCollector::ForCurrentThread().GetStats();
+        return stats;
+    }
+
+    std::vector<ClassHeapStats> Context::GetClassHeapStats() const {
+        return CycleCollector::ForCurrentThread().GetClassStats();
+    }
+
+    size_t Context::CollectCycles() {
+        return CycleCollector::ForCurrentThread().Collect();
+    }
+
+    void Context::ThrowCallDepthExceeded() {
+        throw runtime_error("Maximum depth of method calls is exceeded"s);
+    }
+
+    namespace {
+        // bytes of runtime objects of current thread above base
+        size_t GetMemoryAbove(size_t base) {
+            const size_t in_use = ObjectPool::ForCurrentThread().GetStats().bytes_in_use;
+            return in_use > base ? in_use - base : 0;
+        }
+    }  // namespace
+
+    void Context::SetBudget(const ExecutionBudget& budget, BudgetHandler* handler) {
+        budget_ = budget;
+        budget_handler_ = handler;
+        StartBudget();
+    }
+
+    void Context::StartBudget() {
+        budget_calls_ = 0;
+        slice_calls_ = 0;
+        ArmBudget();
+        if (!HasBudget()) {
+            return;
+        }
+        budget_start_ = chrono::steady_clock::now();
+        slice_start_ = budget_start_;
+        budget_memory_base_ = ObjectPool::ForCurrentThread().GetStats().bytes_in_use;
+    }
+
+    BudgetUsage Context::GetBudgetUsage() const {
+        BudgetUsage usage;
+        usage.calls = budget_calls_ + (budget_countdown_start_ - budget_countdown_);
+        if (HasBudget()) {
+            usage.time = chrono::steady_clock::now() - budget_start_;
+            usage.memory = GetMemoryAbove(budget_memory_base_);
+        }
+        return usage;
+    }
+
+    bool Context::HasBudget() const {
+        return budget_.calls != 0 || budget_.time != chrono::steady_clock::duration::zero() || budget_.memory != 0;
+    }
+
+    void Context::ArmBudget() {
+        uint64_t countdown = UINT64_MAX;
+        if (budget_.time != chrono::steady_clock::duration::zero() || budget_.memory != 0) {
+            countdown = max<uint64_t>(budget_.check_interval, 1);
+        }
+        if (budget_.calls != 0) {
+            // the call after the last one of slice is checked
+            const uint64_t used = budget_calls_ - slice_calls_;
+            countdown = min(countdown, used < budget_.calls ? budget_.calls - used + 1 : 1);
+        }
+        budget_countdown_ = countdown;
+        budget_countdown_start_ = countdown;
+    }
 
-        if (Bool* bool_ptr = object.TryAs<Bool>()) {
-            return bool_ptr->GetValue();
+    void Context::CheckStringMemory(size_t size) const {
+        if (size > budget_.memory || GetMemoryAbove(budget_memory_base_) > budget_.memory - size) {
+            throw BudgetExceeded("Execution exceeded its budget of memory"s);
         }
+    }
+
+    void Context::CheckBudget() {
+        // the call which checks budget is counted
+        budget_calls_ += budget_countdown_start_;
+        budget_countdown_start_ = 0;
+        const char* exceeded = nullptr;
+        if (budget_.calls != 0 && budget_calls_ - slice_calls_ > budget_.calls) {
+            exceeded = "calls";
+        }
+        else if (budget_.time != chrono::steady_clock::duration::zero()
+                 && chrono::steady_clock::now() - slice_start_ > budget_.time) {
+            exceeded = "time";
+        }
+        else if (budget_.memory != 0 && GetMemoryAbove(budget_memory_base_) > budget_.memory) {
+            exceeded = "memory";
+        }
+
+        if (exceeded) {
+            if (!budget_handler_ || !budget_handler_->OnBudgetExceeded(*this, GetBudgetUsage())) {
+                // the next execution in context is checked from the same point
+                ArmBudget();
+                throw BudgetExceeded("Execution exceeded its budget of "s + exceeded);
+            }
+            // the call which exceeded budget is the first one of the next slice
+            slice_calls_ = budget_calls_ - 1;
+            slice_start_ = chrono::steady_clock::now();
+        }
+        ArmBudget();
+    }
+
+    /* --- Executable --- */
+    namespace {
+        // arena which node was allocated in or nullptr, it precedes the node in memory
+        struct NodeHeader {
+            alignas(std::max_align_t) Arena* arena;
+        };
+    }
+
+    void* Executable::operator new(size_t size) {
+        size_t full_size = sizeof(NodeHeader) + size;
+        Arena* arena = Arena::Current();
+        void* memory = arena ? arena->Allocate(full_size) : ::operator new(full_size);
+        return new (memory) NodeHeader{ arena } + 1;
+    }
 
-        if (Number* number_ptr = object.TryAs<Number>()) {
-            return number_ptr->GetValue() != 0;
+    void Executable::operator delete(void* ptr, size_t size) noexcept {
+        NodeHeader* header = static_cast<NodeHeader*>(ptr) - 1;
+        if (header->arena) {
+            header->arena->Deallocate(header, sizeof(NodeHeader) + size);
+        }
+        else {
+            ::operator delete(header);
+        }
+    }
+
+    // by default node has nothing to simplify
+    std::unique_ptr<Executable> Executable::Optimize() {
+        return nullptr;
+    }
+
+    /* --- IsTrue() --- */
+    bool IsTrue(const ObjectHolder& object) {
+        if (const optional<bool> value = object.TryAsValue<Bool>()) {
+            return *value;
+        }
+        if (const optional<int> value = object.TryAsValue<Number>()) {
+            return *value != 0;
         }
+        const String* str = object.TryAs<String>();
+        return str != nullptr && !str->GetValue().empty();
+    }
+
+    /* --- MethodSource --- */
+    namespace {
+        // nodes are allocated in arena of program, so bodies of all programs are loaded one by one
+        std::mutex method_load_mutex;
+    }
 
-        if (String* str_ptr = object.TryAs<String>()) {
-            return !str_ptr->GetValue().empty();
+    MethodSource::MethodSource()
+        : arena_(Arena::Current()) {
+    }
+
+    void MethodSource::Defer(Method& method, Transform transform) {
+        std::lock_guard lock(method_load_mutex);
+        if (!loaded_.load(std::memory_order_relaxed)) {
+            transforms_.push_back(transform);
+            return;
         }
+        std::optional<ArenaScope> scope;
+        if (arena_) {
+            scope.emplace(*arena_);
+        }
+        transform(method);
+    }
 
-        return false;
+    void MethodSource::LoadOnce(const Method& method) {
+        std::lock_guard lock(method_load_mutex);
+        if (loaded_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::optional<ArenaScope> scope;
+        if (arena_) {
+            scope.emplace(*arena_);
+        }
+        // fields of method are changed once before its first execution, other threads
+        // read them after they see loaded_
+        auto& loaded_method = const_cast<Method&>(method);  // NOLINT
+        Parse(loaded_method);
+        for (Transform transform : transforms_) {
+            transform(loaded_method);
+        }
+        loaded_.store(true, std::memory_order_release);
     }
 
     /* --- ClassInstance --- */
+    namespace {
+        // frame is current in context while guard exists
+        class FrameGuard {
+        public:
+            FrameGuard(Context& context, Frame& frame)
+                : context_(context)
+                , previous_(context.SetCurrentFrame(&frame)) {
+            }
+
+            FrameGuard(const FrameGuard&) = delete;
+            FrameGuard& operator=(const FrameGuard&) = delete;
+
+            ~FrameGuard() {
+                context_.SetCurrentFrame(previous_);
+            }
+
+        private:
+            Context& context_;
+            Frame* previous_;
+        };
+
+        // native call is counted in depth of calls of context while guard exists
+        class NativeCallGuard {
+        public:
+            explicit NativeCallGuard(Context& context)
+                : context_(context) {
+                context_.EnterCall(true);
+            }
+
+            NativeCallGuard(const NativeCallGuard&) = delete;
+            NativeCallGuard& operator=(const NativeCallGuard&) = delete;
+
+            ~NativeCallGuard() {
+                context_.LeaveCall(true);
+            }
+
+        private:
+            Context& context_;
+        };
+    }
+
+
     void ClassInstance::Print(std::ostream& os, Context& context) {
-        if (!HasMethod("__str__", 0)) {
+        const Method* str_method = class_.GetSpecialMethod(SpecialMethod::Str);
+        if (!str_method) {
             os << this;
             return;
         }
-        ObjectHolder str = Call("__str__", {}, context);
+        ObjectHolder str = Call(*str_method, nullptr, 0, context);
         os << str.TryAs<String>()->GetValue();
     }
 
@@ -81,67 +472,416 @@ namespace runtime {
         return true;
     }
 
-    Closure& ClassInstance::Fields() {
+    const Class& ClassInstance::GetClass() const {
+        return class_;
+    }
+
+    const Shape& ClassInstance::GetShape() const {
+        return *shape_;
+    }
+
+    ObjectHolder* ClassInstance::FindField(const std::string& name) {
+        std::optional<size_t> offset = shape_->FindField(name);
+        return offset ? &values_[*offset] : nullptr;
+    }
+
+    ObjectHolder* ClassInstance::FindField(const std::string& name, FieldCache& cache) {
+        const FieldCacheEntry entry = cache.Load();
+        if (entry.shape == shape_ && entry.next_shape == shape_) {
+            return &values_[entry.offset];
+        }
+        std::optional<size_t> offset = shape_->FindField(name);
+        if (!offset) {
+            return nullptr;
+        }
+        cache.Store({ shape_, shape_, *offset });
+        return &values_[*offset];
+    }
+
+    ObjectHolder& ClassInstance::SetField(const std::string& name, ObjectHolder value) {
+        FieldCache cache;
+        return SetField(name, std::move(value), cache);
+    }
+
+    ObjectHolder& ClassInstance::SetField(const std::string& name, ObjectHolder value, FieldCache& cache) {
+        FieldCacheEntry entry = cache.Load();
+        if (entry.shape != shape_) {
+            std::optional<size_t> offset = shape_->FindField(name);
+            entry = offset ? FieldCacheEntry{ shape_, shape_, *offset }
+                : FieldCacheEntry{ shape_, &shape_->AddField(name), shape_->Size() };
+            cache.Store(entry);
+        }
+        shape_ = entry.next_shape;
+        if (entry.offset == values_.size()) {
+            const size_t capacity = values_.capacity();
+            values_.push_back(std::move(value));
+            if (values_.capacity() != capacity) {
+                ChargeValues(capacity);
+            }
+        }
+        else {
+            values_[entry.offset] = std::move(value);
+        }
+        return values_[entry.offset];
+    }
+
+    ClassInstance::FieldsView& ClassInstance::Fields() {
         return fields_;
     }
 
-    const Closure& ClassInstance::Fields() const {
+    const ClassInstance::FieldsView& ClassInstance::Fields() const {
         return fields_;
     }
 
     ClassInstance::ClassInstance(const Class& cls)
-        : class_(cls) {
+        : Object(ObjectKind::ClassInstance)
+        , class_(cls)
+        , shape_(&cls.GetRootShape())
+        , fields_(*this) {
+
+    }
+
+    // view is not copied, it must refer to the new instance
+    ClassInstance::ClassInstance(const ClassInstance& other)
+        : Object(other)
+        , class_(other.class_)
+        , shape_(other.shape_)
+        , values_(other.values_)
+        , fields_(*this) {
+        ChargeValues(0);
+    }
+
+    ClassInstance::ClassInstance(ClassInstance&& other) noexcept
+        : Object(other)
+        , class_(other.class_)
+        , shape_(other.shape_)
+        , values_(std::move(other.values_))
+        , fields_(*this)
+        , values_pool_(std::exchange(other.values_pool_, nullptr)) {
+        other.shape_ = &class_.GetRootShape();
+    }
+
+    ClassInstance::~ClassInstance() {
+        if (collector_) {
+            collector_->Untrack(*this);
+        }
+        if (values_pool_) {
+            values_pool_->Discharge(values_.capacity() * sizeof(ObjectHolder));
+        }
+    }
 
+    void ClassInstance::ChargeValues(size_t old_capacity) noexcept {
+        if (!values_pool_) {
+            values_pool_ = &ObjectPool::ForCurrentThread();
+        }
+        const size_t capacity = values_.capacity();
+        if (capacity > old_capacity) {
+            values_pool_->Charge((capacity - old_capacity) * sizeof(ObjectHolder));
+        }
+        else {
+            values_pool_->Discharge((old_capacity - capacity) * sizeof(ObjectHolder));
+        }
+    }
+
+    /* --- ClassInstance::FieldsView --- */
+    ClassInstance::FieldsView::FieldsView(ClassInstance& instance)
+        : instance_(&instance) {
+
+    }
+
+    ObjectHolder& ClassInstance::FieldsView::operator[](const std::string& name) {
+        if (ObjectHolder* value = instance_->FindField(name)) {
+            return *value;
+        }
+        return instance_->SetField(name, ObjectHolder::None());
+    }
+
+    ObjectHolder& ClassInstance::FieldsView::at(const std::string& name) {
+        if (ObjectHolder* value = instance_->FindField(name)) {
+            return *value;
+        }
+        throw out_of_range("Unknown field "s + name);
+    }
+
+    const ObjectHolder& ClassInstance::FieldsView::at(const std::string& name) const {
+        return const_cast<FieldsView*>(this)->at(name);
+    }
+
+    ClassInstance::FieldsView::Iterator ClassInstance::FieldsView::find(const std::string& name) const {
+        std::optional<size_t> offset = instance_->shape_->FindField(name);
+        return offset ? Iterator(*instance_, *offset) : end();
+    }
+
+    size_t ClassInstance::FieldsView::count(const std::string& name) const {
+        return instance_->shape_->FindField(name) ? 1 : 0;
+    }
+
+    size_t ClassInstance::FieldsView::size() const {
+        return instance_->values_.size();
+    }
+
+    bool ClassInstance::FieldsView::empty() const {
+        return instance_->values_.empty();
+    }
+
+    ClassInstance::FieldsView::Iterator ClassInstance::FieldsView::begin() const {
+        return Iterator(*instance_, 0);
+    }
+
+    ClassInstance::FieldsView::Iterator ClassInstance::FieldsView::end() const {
+        return Iterator(*instance_, instance_->values_.size());
+    }
+
+    ClassInstance::FieldsView::Iterator::Iterator(ClassInstance& instance, size_t offset)
+        : instance_(&instance)
+        , offset_(offset) {
+
+    }
+
+    ClassInstance::FieldsView::Iterator::value_type ClassInstance::FieldsView::Iterator::operator*() const {
+        return { instance_->shape_->GetFieldName(offset_), instance_->values_[offset_] };
+    }
+
+    ClassInstance::FieldsView::Iterator::Pointer ClassInstance::FieldsView::Iterator::operator->() const {
+        return { **this };
+    }
+
+    ClassInstance::FieldsView::Iterator& ClassInstance::FieldsView::Iterator::operator++() {
+        ++offset_;
+        return *this;
+    }
+
+    bool ClassInstance::FieldsView::Iterator::operator==(const Iterator& other) const {
+        return instance_ == other.instance_ && offset_ == other.offset_;
+    }
+
+    bool ClassInstance::FieldsView::Iterator::operator!=(const Iterator& other) const {
+        return !(*this == other);
     }
 
     ObjectHolder ClassInstance::Call(const std::string& method,
         const std::vector<ObjectHolder>& actual_args,
         Context& context) {
 
-        if (!HasMethod(method, actual_args.size())) {
+        const Method* method_ptr = class_.GetMethod(method);
+        if (!method_ptr || method_ptr->formal_params.size() != actual_args.size()) {
             throw runtime_error("Method can not be found"s);
         }
+        return Call(*method_ptr, actual_args, context);
+    }
 
-        const Method* method_ptr = class_.GetMethod(method);
+    ObjectHolder ClassInstance::Call(const Method& method,
+        const std::vector<ObjectHolder>& actual_args,
+        Context& context) {
 
-        Closure closure;
-        closure["self"s] = ObjectHolder::Share(*this);
+        StackValues args(context.GetValueStack(), actual_args.size());
+        std::copy(actual_args.begin(), actual_args.end(), args.Data());
+        return Call(method, args.Data(), args.Size(), context);
+    }
+
+    ObjectHolder ClassInstance::Call(const Method& method, ObjectHolder* args, size_t arg_count,
+        Context& context) {
+
+        NativeCallGuard depth(context);
+        if (method.source) {
+            method.source->Load(method);
+        }
+        if (Profiler* profiler = context.GetProfiler()) {
+            Profiler::CallScope scope(*profiler, class_, method);
+            return Invoke(method, args, arg_count, context);
+        }
+        return Invoke(method, args, arg_count, context);
+    }
 
-        auto par = actual_args.begin();
-        for (const std::string& par_name : method_ptr->formal_params) {
-            closure[par_name] = *par;
-            ++par;
+    ObjectHolder ClassInstance::Invoke(const Method& method, ObjectHolder* args, size_t arg_count,
+        Context& context) {
+
+        if (method.frame_size > 0) {
+            StackValues slots(context.GetValueStack(), method.frame_size);
+            Frame frame(slots.Data(), slots.Size());
+            frame.Set(0, ObjectHolder::Reference(*this));
+            for (size_t i = 0; i < arg_count; ++i) {
+                frame.Set(i + 1, std::move(args[i]));
+            }
+
+            // variables of method are in frame, so closure stays empty
+            Closure closure;
+            FrameGuard guard(context, frame);
+            return method.body->Execute(closure, context);
         }
-        return method_ptr->body->Execute(closure, context);
+
+        Closure closure;
+        closure["self"s] = ObjectHolder::Reference(*this);
+        for (size_t i = 0; i < method.formal_params.size(); ++i) {
+            closure[method.formal_params[i]] = std::move(args[i]);
+        }
+        return method.body->Execute(closure, context);
     }
 
     /* --- Class --- */
+    namespace {
+        struct SpecialMethodInfo {
+            std::string_view name;
+            // nullopt for any number
+            std::optional<size_t> param_count;
+        };
+
+        // in order of SpecialMethod
+        constexpr std::array<SpecialMethodInfo, 5> SPECIAL_METHODS = { {
+            { "__init__"sv, std::nullopt },
+            { "__str__"sv, 0 },
+            { "__eq__"sv, 1 },
+            { "__lt__"sv, 1 },
+            { "__add__"sv, 1 },
+        } };
+    }  // namespace
+
     Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
-        : name_(std::move(name)), parent_(parent) {
-        if (parent_) {
-            vtbl_ = parent_->vtbl_;
+        : Object(ObjectKind::Class), name_(std::move(name)), methods_(std::move(methods)), parent_(parent) {
+        static_assert(SPECIAL_METHODS.size() == SPECIAL_METHOD_COUNT);
+
+        std::vector<VtableEntry> own;
+        own.reserve(methods_.size());
+        for (const Method& method : methods_) {
+            own.push_back({ method.name, &method });
         }
-        for (Method& method : methods) {
-            std::shared_ptr<Method> method_ptr = std::make_shared<Method>(std::move(method));
-            vtbl_[method_ptr->name] = std::move(method_ptr);
+        // methods with the same name stay in order of declaration (addresses in methods_),
+        // the last declaration of method with repeated name wins
+        std::sort(own.begin(), own.end(), [](const VtableEntry& lhs, const VtableEntry& rhs) {
+            return lhs.name != rhs.name ? lhs.name < rhs.name : lhs.method < rhs.method;
+        });
+        auto last_of_names = std::unique(own.rbegin(), own.rend(), [](const VtableEntry& lhs, const VtableEntry& rhs) {
+            return lhs.name == rhs.name;
+        });
+        own.erase(own.begin(), last_of_names.base());
+
+        // merge of sorted arrays, own methods override inherited ones
+        static const std::vector<VtableEntry> NO_METHODS;
+        const std::vector<VtableEntry>& inherited = parent_ ? parent_->vtable_ : NO_METHODS;
+        vtable_.reserve(own.size() + inherited.size());
+        auto own_it = own.begin();
+        auto inherited_it = inherited.begin();
+        while (own_it != own.end() || inherited_it != inherited.end()) {
+            if (inherited_it == inherited.end() || (own_it != own.end() && own_it->name <= inherited_it->name)) {
+                if (inherited_it != inherited.end() && own_it->name == inherited_it->name) {
+                    ++inherited_it;
+                }
+                vtable_.push_back(*own_it++);
+            }
+            else {
+                vtable_.push_back(*inherited_it++);
+            }
         }
-    }
 
-    const Method* Class::GetMethod(const std::string& name) const {
-        if (vtbl_.count(name) > 0) {
-            return vtbl_.at(name).get();
+        for (size_t i = 0; i < SPECIAL_METHOD_COUNT; ++i) {
+            const Method* method = GetMethod(SPECIAL_METHODS[i].name);
+            if (method && (!SPECIAL_METHODS[i].param_count
+                || method->formal_params.size() == *SPECIAL_METHODS[i].param_count)) {
+                special_methods_[i] = method;
+            }
         }
-        return nullptr;
+    }
+
+    const Method* Class::GetMethod(std::string_view name) const {
+        auto it = std::lower_bound(vtable_.begin(), vtable_.end(), name, [](const VtableEntry& entry, std::string_view name) {
+            return entry.name < name;
+        });
+        return it != vtable_.end() && it->name == name ? it->method : nullptr;
     }
 
     [[nodiscard]] const std::string& Class::GetName() const {
         return name_;
     }
 
+    const Class* Class::GetParent() const {
+        return parent_;
+    }
+
+    std::vector<Method*> Class::GetOwnMethods() {
+        std::vector<Method*> result;
+        result.reserve(methods_.size());
+        for (Method& method : methods_) {
+            result.push_back(&method);
+        }
+        return result;
+    }
+
+    const Shape& Class::GetRootShape() const {
+        return root_shape_;
+    }
+
     void Class::Print(ostream& os, [[maybe_unused]] Context& context) {
         os << "Class "sv << name_;
     }
 
+    /* --- Shape --- */
+    Shape::Shape(Shape&& other) noexcept
+        : names_(std::move(other.names_))
+        , transitions_(std::move(other.transitions_)) {
+    }
+
+    Shape& Shape::operator=(Shape&& other) noexcept {
+        names_ = std::move(other.names_);
+        transitions_ = std::move(other.transitions_);
+        return *this;
+    }
+
+    std::optional<size_t> Shape::FindField(const std::string& name) const {
+        for (size_t offset = 0; offset < names_.size(); ++offset) {
+            if (names_[offset] == name) {
+                return offset;
+            }
+        }
+        return std::nullopt;
+    }
+
+    const Shape& Shape::AddField(const std::string& name) const {
+        std::lock_guard guard(transitions_mutex_);
+        auto& child = transitions_[name];
+        if (!child) {
+            child = std::make_unique<Shape>();
+            child->names_ = names_;
+            child->names_.push_back(name);
+        }
+        return *child;
+    }
+
+    size_t Shape::Size() const {
+        return names_.size();
+    }
+
+    const std::string& Shape::GetFieldName(size_t offset) const {
+        return names_[offset];
+    }
+
+    /* --- MethodCache --- */
+    MethodCache::MethodCache(const MethodCache& other)
+        : entries_(other.entries_)
+        , next_(other.next_.load(std::memory_order_relaxed)) {
+    }
+
+    MethodCache& MethodCache::operator=(const MethodCache& other) {
+        entries_ = other.entries_;
+        next_.store(other.next_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    const Method* MethodCache::Update(const Class& cls, const std::string& name) {
+        const Method* method = cls.GetMethod(name);
+        if (method) {
+            // threads which miss at once may replace the same entry, it only costs one more miss
+            const std::uint8_t next = next_.load(std::memory_order_relaxed);
+            entries_[next].Store({ &cls, method });
+            next_.store(static_cast<std::uint8_t>((next + 1) % SIZE), std::memory_order_relaxed);
+        }
+        return method;
+    }
+
+    /* --- String --- */
+    void String::Print(std::ostream& os, [[maybe_unused]] Context& context) {
+        os << value_.Str();
+    }
+
     /* --- Bool --- */
     void Bool::Print(std::ostream& os, [[maybe_unused]] Context& context) {
         os << (GetValue() ? "True"sv : "False"sv);
@@ -151,10 +891,19 @@ namespace runtime {
     namespace {
         template <typename T, typename Func>
         std::optional<bool> CheckFunc(const ObjectHolder& lhs, const ObjectHolder& rhs, Func func) {
-            if (lhs.TryAs<T>() && rhs.TryAs<T>()) {
-                auto left = lhs.TryAs<T>()->GetValue();
-                auto right = rhs.TryAs<T>()->GetValue();
-                return func(left, right);
+            if constexpr (ObjectHolder::IS_IMMEDIATE<T>) {
+                const auto left = lhs.TryAsValue<T>();
+                const auto right = rhs.TryAsValue<T>();
+                if (left && right) {
+                    return func(*left, *right);
+                }
+            }
+            else {
+                const T* left = lhs.TryAs<T>();
+                const T* right = rhs.TryAs<T>();
+                if (left && right) {
+                    return func(left->GetValue(), right->GetValue());
+                }
             }
             return std::nullopt;
         }
@@ -168,72 +917,272 @@ namespace runtime {
         bool SimpleLess(T x, T y) {
             return x < y;
         }
-    }
 
-    bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        if (!lhs && !rhs) {
-            return true;
+        // result of lhs.method(rhs) if lhs is object which has the method with one parameter
+        std::optional<bool> CallComparisonMethod(const ObjectHolder& lhs, SpecialMethod method,
+            const ObjectHolder& rhs, Context& context) {
+            ClassInstance* instance = lhs.TryAs<ClassInstance>();
+            if (!instance) {
+                return std::nullopt;
+            }
+            const Method* method_ptr = instance->GetClass().GetSpecialMethod(method);
+            if (!method_ptr) {
+                return std::nullopt;
+            }
+            ObjectHolder argument = rhs;
+            const optional<bool> result = instance->Call(*method_ptr, &argument, 1, context).TryAsValue<Bool>();
+            if (!result) {
+                throw runtime_error("Comparison method must return Bool"s);
+            }
+            return *result;
         }
 
-        if (auto res = CheckFunc<Bool>(lhs, rhs, SimpleEqual<bool>)) {
-            return *res;
+        bool EqualObjects(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+            if (!lhs && !rhs) {
+                return true;
+            }
+
+            if (auto res = CheckFunc<Bool>(lhs, rhs, SimpleEqual<bool>)) {
+                return *res;
+            }
+
+            if (auto res = CheckFunc<Number>(lhs, rhs, SimpleEqual<int>)) {
+                return *res;
+            }
+
+            if (auto res = CheckFunc<String>(lhs, rhs, SimpleEqual<std::string_view>)) {
+                return *res;
+            }
+
+            if (auto res = CallComparisonMethod(lhs, SpecialMethod::Equal, rhs, context)) {
+                return *res;
+            }
+
+            throw std::runtime_error("Objects cannot be compared"s);
         }
 
-        if (auto res = CheckFunc<Number>(lhs, rhs, SimpleEqual<int>)) {
-            return *res;
+        bool LessObjects(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+            if (auto res = CheckFunc<Bool>(lhs, rhs, SimpleLess<bool>)) {
+                return *res;
+            }
+
+            if (auto res = CheckFunc<Number>(lhs, rhs, SimpleLess<int>)) {
+                return *res;
+            }
+
+            if (auto res = CheckFunc<String>(lhs, rhs, SimpleLess<std::string_view>)) {
+                return *res;
+            }
+
+            if (auto res = CallComparisonMethod(lhs, SpecialMethod::Less, rhs, context)) {
+                return *res;
+            }
+
+            throw runtime_error("Objects cannot be compared"s);
         }
+    }
 
-        if (auto res = CheckFunc<String>(lhs, rhs, SimpleEqual<std::string_view>)) {
-            return *res;
+    bool CompareObjects(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        switch (op) {
+        case CompareOp::Equal:
+            return EqualObjects(lhs, rhs, context);
+        case CompareOp::NotEqual:
+            return !EqualObjects(lhs, rhs, context);
+        case CompareOp::Less:
+            return LessObjects(lhs, rhs, context);
+        case CompareOp::Greater:
+            return !(LessObjects(lhs, rhs, context) || EqualObjects(lhs, rhs, context));
+        case CompareOp::LessOrEqual:
+            return LessObjects(lhs, rhs, context) || EqualObjects(lhs, rhs, context);
+        case CompareOp::GreaterOrEqual:
+            return !LessObjects(lhs, rhs, context);
         }
+        throw runtime_error("Unknown comparison"s);
+    }
+
+    bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::Equal>(lhs, rhs, context);
+    }
+
+    bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::Less>(lhs, rhs, context);
+    }
+
+    bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::NotEqual>(lhs, rhs, context);
+    }
+
+    bool Greater(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::Greater>(lhs, rhs, context);
+    }
 
-        if (auto ptr = lhs.TryAs<ClassInstance>()) {
-            if (ptr->HasMethod("__eq__"s, 1)) {
-                ObjectHolder res = ptr->Call("__eq__"s, { rhs }, context);
-                return res.TryAs<Bool>()->GetValue();
+    bool LessOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::LessOrEqual>(lhs, rhs, context);
+    }
+
+    bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return Compare<CompareOp::GreaterOrEqual>(lhs, rhs, context);
+    }
+
+    /* --- Arithmetic operations --- */
+    ObjectHolder Add(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        const optional<int> left_number = lhs.TryAsValue<Number>();
+        const optional<int> right_number = rhs.TryAsValue<Number>();
+        if (left_number && right_number) {
+            return ObjectHolder::Own(Number(*left_number + *right_number));
+        }
+
+        const String* left_string = lhs.TryAs<String>();
+        const String* right_string = rhs.TryAs<String>();
+        if (left_string && right_string) {
+            context.CheckStringSize(left_string->GetStringValue().Size() + right_string->GetStringValue().Size());
+            return ObjectHolder::Own(String(StringValue::Concat(left_string->GetStringValue(),
+                right_string->GetStringValue())));
+        }
+
+        if (ClassInstance* obj_ptr = lhs.TryAs<ClassInstance>()) {
+            if (const Method* add_method = obj_ptr->GetClass().GetSpecialMethod(SpecialMethod::Add)) {
+                ObjectHolder argument = rhs;
+                return obj_ptr->Call(*add_method, &argument, 1, context);
             }
         }
 
-        throw std::runtime_error("Objects cannot be compared"s);
+        throw runtime_error("ADD is unavailable"s);
     }
 
-    bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        if (auto res = CheckFunc<Bool>(lhs, rhs, SimpleLess<bool>)) {
-            return *res;
+    ObjectHolder Add(ObjectHolder&& lhs, const ObjectHolder& rhs, Context& context) {
+        if (lhs.IsUnique()) {
+            String* left_string = lhs.TryAs<String>();
+            const String* right_string = rhs.TryAs<String>();
+            if (left_string && right_string) {
+                context.CheckStringSize(left_string->GetStringValue().Size() + right_string->GetStringValue().Size());
+                left_string->Append(right_string->GetStringValue());
+                return std::move(lhs);
+            }
         }
+        return Add(static_cast<const ObjectHolder&>(lhs), rhs, context);
+    }
 
-        if (auto res = CheckFunc<Number>(lhs, rhs, SimpleLess<int>)) {
-            return *res;
+    ObjectHolder Sub(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        const optional<int> left = lhs.TryAsValue<Number>();
+        const optional<int> right = rhs.TryAsValue<Number>();
+        if (left && right) {
+            return ObjectHolder::Own(Number(*left - *right));
         }
 
-        if (auto res = CheckFunc<String>(lhs, rhs, SimpleLess<std::string_view>)) {
-            return *res;
+        throw runtime_error("SUB is unavailable"s);
+    }
+
+    ObjectHolder Mult(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        const optional<int> left = lhs.TryAsValue<Number>();
+        const optional<int> right = rhs.TryAsValue<Number>();
+        if (left && right) {
+            return ObjectHolder::Own(Number(*left * *right));
         }
 
-        if (auto ptr = lhs.TryAs<ClassInstance>()) {
-            if (ptr->HasMethod("__lt__"s, 1)) {
-                ObjectHolder res = ptr->Call("__lt__"s, { rhs }, context);
-                return res.TryAs<Bool>()->GetValue();
+        throw runtime_error("MULT is unavailable"s);
+    }
+
+    ObjectHolder Div(const ObjectHolder& lhs, const ObjectHolder& rhs, [[maybe_unused]] Context& context) {
+        const optional<int> left = lhs.TryAsValue<Number>();
+        const optional<int> right = rhs.TryAsValue<Number>();
+        if (left && right) {
+            if (int den = *right; den != 0) {
+                int res = *left / den;
+                return ObjectHolder::Own(Number(res));
+            }
+            else {
+                throw runtime_error("Denominator is 0"s);
             }
         }
 
-        throw runtime_error("Objects cannot be compared"s);
+        throw runtime_error("DIV is unavailable"s);
     }
 
-    bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        return !Equal(lhs, rhs, context);
+    ObjectHolder AddToField(ClassInstance& instance, const std::string& field, FieldCache& cache,
+        const ObjectHolder& rhs, bool subtract, Context& context) {
+        ObjectHolder* value = instance.FindField(field, cache);
+        if (!value) {
+            throw runtime_error("Unknown variable"s);
+        }
+        const optional<int> left = value->TryAsValue<Number>();
+        const optional<int> right = rhs.TryAsValue<Number>();
+        if (left && right) {
+            const int result = subtract ? *left - *right : *left + *right;
+            *value = ObjectHolder::Own(Number(result));
+            return *value;
+        }
+        // __add__ may change fields of instance, so the old value is kept and the field is found again
+        ObjectHolder old_value = *value;
+        ObjectHolder result = subtract ? Sub(old_value, rhs, context) : Add(old_value, rhs, context);
+        return instance.SetField(field, std::move(result), cache);
     }
 
-    bool Greater(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        return !(Less(lhs, rhs, context) || Equal(lhs, rhs, context));
+    void PrintObject(const ObjectHolder& object, Context& context) {
+        OutputSink& output = context.GetOutput();
+        if (const optional<int> number = object.TryAsValue<Number>()) {
+            output.WriteNumber(*number);
+            return;
+        }
+        if (const optional<bool> boolean = object.TryAsValue<Bool>()) {
+            output.Write(*boolean ? "True"sv : "False"sv);
+            return;
+        }
+        // values which are not immediate are not boxed
+        Object* res = object.Get();
+        if (!res) {
+            output.Write("None"sv);
+            return;
+        }
+        if (res->GetKind() == ObjectKind::String) {
+            output.Write(static_cast<String*>(res)->GetValue());
+            return;
+        }
+        // adapter of the context writes into the same sink
+        res->Print(context.GetOutputStream(), context);
     }
 
-    bool LessOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        return Less(lhs, rhs, context) || Equal(lhs, rhs, context);
+    ObjectHolder Stringify(const ObjectHolder& object, Context& context) {
+        static const StringValue NONE_STRING = StringInterner::Global().InternPermanent("None"sv);
+        static const StringValue TRUE_STRING = StringInterner::Global().InternPermanent("True"sv);
+        static const StringValue FALSE_STRING = StringInterner::Global().InternPermanent("False"sv);
+
+        ObjectHolder value = object;
+        if (auto obj = object.TryAs<ClassInstance>()) {
+            if (const Method* str_method = obj->GetClass().GetSpecialMethod(SpecialMethod::Str)) {
+                value = obj->Call(*str_method, nullptr, 0, context);
+            }
+        }
+
+        if (const optional<int> number = value.TryAsValue<Number>()) {
+            return ObjectHolder::Own(String(std::to_string(*number)));
+        }
+        if (const optional<bool> boolean = value.TryAsValue<Bool>()) {
+            return ObjectHolder::Own(String(*boolean ? TRUE_STRING : FALSE_STRING));
+        }
+        Object* res = value.Get();
+        if (!res) {
+            return ObjectHolder::Own(String(NONE_STRING));
+        }
+        if (res->GetKind() == ObjectKind::String) {
+            // result of __str__ is returned as it is, otherwise copy shares text with
+            // the original, holder may not own the original
+            if (value.IsUnique()) {
+                return value;
+            }
+            return ObjectHolder::Own(String(*static_cast<String*>(res)));
+        }
+
+        std::ostringstream os;
+        res->Print(os, context);
+        return ObjectHolder::Own(String{ os.str() });
     }
 
-    bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-        return !Less(lhs, rhs, context);
+    ObjectHolder Stringify(ObjectHolder&& object, Context& context) {
+        if (object.IsUnique() && object.TryAs<String>()) {
+            return std::move(object);
+        }
+        return Stringify(static_cast<const ObjectHolder&>(object), context);
     }
 
 }  // namespace runtime
\ No newline at end of file
@@ -1,49 +1,253 @@
 #pragma once
 
+#include "collector.h"
+#include "heap.h"
+#include "output.h"
+#include "string_value.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+namespace bytecode {
+    class Compiler;
+    struct Function;
+    struct Instruction;
+}
+
+namespace image {
+    class Writer;
+}
+
 namespace runtime {
 
-    // context of execution of Mython commands
-    class Context {
-    public:
-        // return output strean for print
-        virtual std::ostream& GetOutputStream() = 0;
+    class Class;
+    class ClassInstance;
+    class Context;
+    class Profiler;
 
-    protected:
-        ~Context() = default;
+    // kind of built-in object, it lets check type of object without RTTI
+    enum class ObjectKind : uint8_t {
+        Other,
+        Number,
+        String,
+        Bool,
+        Class,
+        ClassInstance,
     };
 
 	// base class for all Mython objects
     class Object {
     public:
+        Object() = default;
         virtual ~Object() = default;
+
+        // copy is not owned by holders even if the original object is
+        Object(const Object& other) noexcept
+            : kind_(other.kind_) {
+        }
+
+        Object& operator=(const Object&) noexcept {
+            return *this;
+        }
+
+        // objects which are created by new (see ObjectHolder::Own) are allocated in ObjectPool
+        // of current thread with header of counter of references and are returned to the same pool
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size) noexcept;
+
         // output into os its own string representation
         virtual void Print(std::ostream& os, Context& context) = 0;
+
+        [[nodiscard]] ObjectKind GetKind() const {
+            return kind_;
+        }
+
+    protected:
+        explicit Object(ObjectKind kind)
+            : kind_(kind) {
+        }
+
+    private:
+        friend class CycleCollector;
+        friend class ObjectHolder;
+
+        // precedes object in memory
+        struct alignas(std::max_align_t) Header {
+            ObjectPool* pool;
+            // number of ObjectHolder which own the object
+            std::atomic<std::uint32_t> refs;
+            bool shared_between_threads;
+        };
+
+        [[nodiscard]] Header& GetHeader() const {
+            return *(reinterpret_cast<Header*>(const_cast<Object*>(this)) - 1);  // NOLINT
+        }
+
+        ObjectKind kind_ = ObjectKind::Other;
+        // object was created by ObjectHolder::Own, so it has header and is counted
+        bool counted_ = false;
     };
 
+    // kind of objects of exactly T type, Other means that type is not built-in
+    template <typename T>
+    inline constexpr ObjectKind KIND_OF = ObjectKind::Other;
+
+    // object which stores value of T type
+    template <typename T>
+    class ValueObject : public Object {
+    public:
+        using ValueType = T;
+
+        ValueObject(T v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+            : Object(KIND_OF<ValueObject>)
+            , value_(v) {
+        }
+
+        void Print(std::ostream& os, [[maybe_unused]] Context& context) override {
+            os << value_;
+        }
+
+        [[nodiscard]] const T& GetValue() const {
+            return value_;
+        }
+
+    protected:
+        ValueObject(T v, ObjectKind kind)
+            : Object(kind)
+            , value_(v) {
+        }
+
+    private:
+        T value_;
+    };
+
+    // String value, it is immutable, so its copy is cheap
+    class String : public Object {
+    public:
+        String(std::string v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+            : String(StringValue(std::move(v))) {
+        }
+
+        String(StringValue v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+            : Object(ObjectKind::String)
+            , value_(std::move(v)) {
+        }
+
+        void Print(std::ostream& os, Context& context) override;
+
+        [[nodiscard]] const std::string& GetValue() const {
+            return value_.Str();
+        }
+
+        [[nodiscard]] const StringValue& GetStringValue() const {
+            return value_;
+        }
+
+        // change string in place, it must not be seen through other holders (see ObjectHolder::IsUnique)
+        void Append(const StringValue& tail) {
+            value_.Append(tail);
+        }
+
+    private:
+        StringValue value_;
+    };
+    // Number value
+    using Number = ValueObject<int>;
+
+    // Logical value
+    class Bool : public ValueObject<bool> {
+    public:
+        Bool(bool v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+            : ValueObject(v, ObjectKind::Bool) {
+        }
+
+        void Print(std::ostream& os, Context& context) override;
+    };
+
+    template <>
+    inline constexpr ObjectKind KIND_OF<Number> = ObjectKind::Number;
+    template <>
+    inline constexpr ObjectKind KIND_OF<String> = ObjectKind::String;
+    template <>
+    inline constexpr ObjectKind KIND_OF<Bool> = ObjectKind::Bool;
+
     // special class wrapper for storage object in Mython program 
-	 -,      Mython-
     class ObjectHolder {
     public:
         // create empty value
         ObjectHolder() = default;
 
+        ObjectHolder(const ObjectHolder& other) noexcept
+            : data_(other.data_) {
+            AddRef(data_);
+        }
+
+        ObjectHolder& operator=(const ObjectHolder& other) noexcept {
+            AddRef(other.data_);
+            Assign(other.data_);
+            return *this;
+        }
+
+        // moved-from holder becomes empty
+        ObjectHolder(ObjectHolder&& other) noexcept
+            : data_(std::exchange(other.data_, std::monostate{})) {
+        }
+
+        ObjectHolder& operator=(ObjectHolder&& other) noexcept {
+            if (this != &other) {
+                // other can be owned by old object, so it is emptied before the old one is released
+                Data data = std::exchange(other.data_, std::monostate{});
+                Assign(data);
+            }
+            return *this;
+        }
+
+        ~ObjectHolder() {
+            Release(data_);
+        }
+
+        // true for types which values are stored inside ObjectHolder without heap allocation
+        template <typename T>
+        static constexpr bool IS_IMMEDIATE = std::is_same_v<T, Number> || std::is_same_v<T, Bool>;
+
         // return ObjectHolder that owns object of type T
         // T is derived class from Object.
-        // object is copied or moved into heap
+        // Values of Number and Bool are stored inside holder (see TryAsValue), other objects
+        // are copied or moved into ObjectPool of current thread and are counted by their holders.
+        // Class instances are tracked by CycleCollector of the thread, so this call may collect cycles
         template <typename T>
         [[nodiscard]] static ObjectHolder Own(T&& object) {
-            return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+            using Type = std::decay_t<T>;
+            if constexpr (IS_IMMEDIATE<Type>) {
+                return ObjectHolder(Data(std::in_place_type<typename Type::ValueType>, object.GetValue()));
+            }
+            else {
+                return OwnObject(std::forward<T>(object));
+            }
         }
 
         // create ObjectHolder that does not own object of type T (weak ref)
         [[nodiscard]] static ObjectHolder Share(Object& object);
 
+        // create ObjectHolder that owns object if it is owned by holders (see Own),
+        // otherwise the same as Share. Methods get self so: self which is stored
+        // into field keeps object alive
+        [[nodiscard]] static ObjectHolder Reference(Object& object);
+
         // create empty ObjectHolder which corresponds to None
         [[nodiscard]] static ObjectHolder None();
 
@@ -53,47 +257,549 @@ namespace runtime {
 
         Object* operator->() const;
 
+        // immediate value is boxed into Number or Bool in pool of the current thread which the
+        // holder then owns, so the holder is changed. Values are read without it by TryAsValue
         [[nodiscard]] Object* Get() const;
 
         // return pointer to object of T type or nullptr, if ObjectHolder does not 
         // contain object of T type
+        // built-in types are checked by kind of object, others by dynamic_cast.
+        // Number and Bool are boxed as by Get() for them and their base classes
         template <typename T>
         [[nodiscard]] T* TryAs() const {
-            return dynamic_cast<T*>(this->Get());
+            if constexpr (IS_IMMEDIATE<T>) {
+                if (!TryAsValue<T>()) {
+                    return nullptr;
+                }
+                return static_cast<T*>(Get());
+            }
+            else if constexpr (KIND_OF<T> != ObjectKind::Other) {
+                Object* object = GetObject();
+                return object != nullptr && object->GetKind() == KIND_OF<T> ? static_cast<T*>(object) : nullptr;
+            }
+            else if constexpr (std::is_base_of_v<T, Number> || std::is_base_of_v<T, Bool>) {
+                return dynamic_cast<T*>(Get());
+            }
+            else {
+                return dynamic_cast<T*>(GetObject());
+            }
+        }
+
+        // return value of Number or Bool or nullopt if ObjectHolder does not contain such value
+        template <typename T>
+        [[nodiscard]] std::optional<typename T::ValueType> TryAsValue() const {
+            static_assert(IS_IMMEDIATE<T>, "only values of Number and Bool are immediate");
+            using Value = typename T::ValueType;
+            if (const Value* value = std::get_if<Value>(&data_)) {
+                return *value;
+            }
+            const Object* object = GetObject();
+            if (object != nullptr && object->GetKind() == KIND_OF<T>) {
+                return static_cast<const T*>(object)->GetValue();
+            }
+            return std::nullopt;
         }
 
         // return true, if ObjectHolder is not empty
         explicit operator bool() const;
 
+        // counter of references of owned object is not atomic, so object which is owned by
+        // holders of many threads must be marked before other threads get it, then its counter
+        // becomes atomic. Holders of other objects do not count references
+        void ShareBetweenThreads() const noexcept;
+        [[nodiscard]] bool IsSharedBetweenThreads() const noexcept;
+
+        // return true if holder owns object which no other holder owns and which is not shared
+        // between threads. Such object is a temporary result of operation, it may be changed in place
+        [[nodiscard]] bool IsUnique() const noexcept;
+
     private:
-        explicit ObjectHolder(std::shared_ptr<Object> data);
+        friend class CycleCollector;
+        friend class Frame;
+
+        // object which is counted by holders
+        struct Owned {
+            Object* object;
+        };
+
+        // None, object which is not owned, owned object or values of Number and Bool.
+        // Data is mutable because Get() replaces immediate value with object
+        using Data = std::variant<std::monostate, Object*, Owned, int, bool>;
+
+        explicit ObjectHolder(Data data);
         void AssertIsValid() const;
 
-        std::shared_ptr<Object> data_;
+        template <typename T>
+        [[nodiscard]] static ObjectHolder OwnObject(T&& object) {
+            using Type = std::decay_t<T>;
+            Type* owned = new Type(std::forward<T>(object));
+            owned->counted_ = true;
+            Data data(Owned{ owned });
+            AddRef(data);
+            if constexpr (std::is_base_of_v<ClassInstance, Type>) {
+                CycleCollector::ForCurrentThread().Track(*owned);
+            }
+            return ObjectHolder(std::move(data));
+        }
+
+        // return object without boxing of immediate value, nullptr for it
+        [[nodiscard]] Object* GetObject() const {
+            if (const Owned* owned = std::get_if<Owned>(&data_)) {
+                return owned->object;
+            }
+            if (Object* const* shared = std::get_if<Object*>(&data_)) {
+                return *shared;
+            }
+            return nullptr;
+        }
+
+        // counter of object which is not shared between threads is changed by plain load and store
+        static void AddRef(const Data& data) noexcept {
+            if (const Owned* owned = std::get_if<Owned>(&data)) {
+                Object::Header& header = owned->object->GetHeader();
+                if (header.shared_between_threads) {
+                    header.refs.fetch_add(1, std::memory_order_relaxed);
+                }
+                else {
+                    header.refs.store(header.refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // replace value without change of counter of the new one, object of old value
+        // can own the new one, so it is released after the replacement
+        void Assign(const Data& data) noexcept {
+            if (std::holds_alternative<Owned>(data_)) {
+                Owned old = std::get<Owned>(data_);
+                data_ = data;
+                Release(Data(old));
+            }
+            else {
+                data_ = data;
+            }
+        }
+
+        static void Release(const Data& data) noexcept {
+            if (const Owned* owned = std::get_if<Owned>(&data)) {
+                Object::Header& header = owned->object->GetHeader();
+                std::uint32_t refs = 0;
+                if (header.shared_between_threads) {
+                    refs = header.refs.fetch_sub(1, std::memory_order_acq_rel) - 1;
+                }
+                else {
+                    refs = header.refs.load(std::memory_order_relaxed) - 1;
+                    header.refs.store(refs, std::memory_order_relaxed);
+                }
+                if (refs == 0) {
+                    delete owned->object;
+                }
+            }
+        }
+
+        // slot of frame to which nothing was assigned, it holds null pointer unlike None
+        [[nodiscard]] static ObjectHolder Unassigned();
+        [[nodiscard]] bool IsUnassigned() const;
+
+        mutable Data data_;
     };
 
-    // object which stores value of T type
-    template <typename T>
-    class ValueObject : public Object {
+    // table of symbols which links objects' names and values
+    using Closure = std::unordered_map<std::string, ObjectHolder>;
+
+    // classes by their names which are owned elsewhere, classes of imported modules for example
+    using ClassTable = std::unordered_map<std::string, const Class*>;
+
+    // stack of values which is reused by calls of one context: arguments of calls, frames of
+    // methods and stacks of bytecode are taken from it, so calls do not allocate memory once
+    // the stack has grown to the depth of recursion. Values are kept in chunks, so their
+    // addresses do not change when the stack grows. Values are freed in reverse order of allocation
+    class ValueStack {
     public:
-        ValueObject(T v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
-            : value_(v) {
+        // number of values in chunk, bigger regions get their own chunk
+        static constexpr size_t CHUNK_SIZE = 1024;
+
+        ValueStack() = default;
+        ValueStack(const ValueStack&) = delete;
+        ValueStack& operator=(const ValueStack&) = delete;
+
+        // return count contiguous values which are None
+        [[nodiscard]] ObjectHolder* Allocate(size_t count);
+        // free the last allocated values, objects which they hold are released
+        void Free(ObjectHolder* values, size_t count) noexcept;
+
+        // return number of allocated values
+        [[nodiscard]] size_t Size() const;
+        // return number of values which are kept in chunks
+        [[nodiscard]] size_t Capacity() const;
+
+    private:
+        struct Chunk {
+            std::unique_ptr<ObjectHolder[]> values;
+            size_t capacity = 0;
+            size_t used = 0;
+        };
+
+        // chunks after current one are empty
+        std::vector<Chunk> chunks_;
+        size_t current_ = 0;
+        size_t size_ = 0;
+    };
+
+    // values of ValueStack which are freed when the object is destroyed
+    class StackValues {
+    public:
+        StackValues(ValueStack& stack, size_t count)
+            : stack_(stack)
+            , values_(stack.Allocate(count))
+            , count_(count) {
         }
 
-        void Print(std::ostream& os, [[maybe_unused]] Context& context) override {
-            os << value_;
+        StackValues(const StackValues&) = delete;
+        StackValues& operator=(const StackValues&) = delete;
+
+        ~StackValues() {
+            stack_.Free(values_, count_);
         }
 
-        [[nodiscard]] const T& GetValue() const {
-            return value_;
+        [[nodiscard]] ObjectHolder* Data() const {
+            return values_;
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return count_;
+        }
+
+        ObjectHolder& operator[](size_t index) const {
+            return values_[index];
         }
 
     private:
-        T value_;
+        ValueStack& stack_;
+        ObjectHolder* values_;
+        size_t count_;
     };
 
-    // table of symbols which links objects' names and values
-    using Closure = std::unordered_map<std::string, ObjectHolder>;
+    // variables of one method call. Parser gives every variable of method fixed slot:
+    // self is in slot 0, formal parameters follow it and then local variables
+    class Frame {
+    public:
+        // create frame with its own slots where nothing is assigned
+        explicit Frame(size_t size);
+        // create frame in slots which are owned by caller (see ValueStack), nothing is assigned to them
+        Frame(ObjectHolder* slots, size_t size);
+        // create frame without slots, they are given by Attach
+        Frame() = default;
+
+        Frame(const Frame&) = delete;
+        Frame& operator=(const Frame&) = delete;
+
+        // return value of slot, throws runtime_error if nothing was assigned to it
+        [[nodiscard]] const ObjectHolder& Get(size_t slot) const;
+
+        void Set(size_t slot, ObjectHolder value);
+
+        [[nodiscard]] size_t Size() const;
+
+        // make frame use slots which are owned by caller, nothing is assigned to them.
+        // The frame must not have its own slots
+        void Attach(ObjectHolder* slots, size_t size);
+
+    private:
+        std::unique_ptr<ObjectHolder[]> own_slots_;
+        ObjectHolder* slots_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    // method call which bytecode VM executes in its own loop without native recursion.
+    // Records are reused by the following calls, so their frames and closures keep memory
+    struct CallRecord {
+        // variables of the method, they are at the beginning of values
+        Frame frame;
+        // names of the method, it is empty because inlined methods keep variables in frame
+        Closure closure;
+        // slots of frame and then stack of the method, they are allocated in ValueStack
+        ObjectHolder* values = nullptr;
+        size_t value_count = 0;
+
+        // state of caller which is restored on return
+        const bytecode::Function* caller = nullptr;
+        const bytecode::Instruction* return_ip = nullptr;
+        ObjectHolder* caller_sp = nullptr;
+        Frame* caller_frame = nullptr;
+        Closure* caller_closure = nullptr;
+        // slot of caller which gets the result, nullptr if result is dropped (call of __init__)
+        ObjectHolder* result = nullptr;
+        // profiler which measures the call or nullptr
+        Profiler* profiler = nullptr;
+    };
+
+    // stack of calls which bytecode VM executes without native recursion, nested runs of VM
+    // (calls from tree-walking code, operators) push their calls above the calls of outer runs
+    class CallStack {
+    public:
+        // return record of new call, its fields are set by caller
+        CallRecord& Push() {
+            if (size_ == records_.size()) {
+                records_.push_back(std::make_unique<CallRecord>());
+            }
+            return *records_[size_++];
+        }
+
+        void Pop() noexcept {
+            --size_;
+        }
+
+        [[nodiscard]] CallRecord& Top() const {
+            return *records_[size_ - 1];
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return size_;
+        }
+
+    private:
+        std::vector<std::unique_ptr<CallRecord>> records_;
+        size_t size_ = 0;
+    };
+
+    // allocation statistics of interpreter
+    struct HeapStats {
+        // runtime objects which are allocated by ObjectHolder::Own in the thread of context,
+        // with text of their strings and fields of instances
+        AllocationStats objects;
+        // AST nodes of program if arena of nodes is set for context
+        AllocationStats nodes;
+        // class instances of the thread of context
+        InstanceStats instances;
+    };
+
+    // limits of execution, zero means no limit (see Context::SetBudget). Calls of methods are
+    // the only way for code to run longer than its text, so budget is charged at every call:
+    // calls are counted by a decrement, time and memory are checked every check_interval calls
+    struct ExecutionBudget {
+        static constexpr std::uint32_t DEFAULT_CHECK_INTERVAL = 1024;
+
+        // calls of methods in both execution modes
+        std::uint64_t calls = 0;
+        // wall-clock time
+        std::chrono::steady_clock::duration time{};
+        // bytes of runtime objects in the pool of the thread above their size at the start of budget
+        // with text of strings and fields of instances (see HeapStats::objects). Sum of strings
+        // is aborted at once if its text would exceed the limit (see Context::CheckStringSize)
+        std::size_t memory = 0;
+        std::uint32_t check_interval = DEFAULT_CHECK_INTERVAL;
+    };
+
+    // resources which execution used since the start of budget
+    struct BudgetUsage {
+        std::uint64_t calls = 0;
+        std::chrono::steady_clock::duration time{};
+        std::size_t memory = 0;
+    };
+
+    // execution exceeded its budget and was aborted, stacks of context are unwound as for other errors
+    struct BudgetExceeded : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    // decides whether execution which exceeded its budget goes on. Scheduler of many
+    // interpreters uses it for cooperative preemption: budget is a slice of calls or time,
+    // handler gives the core to other executions (waits) and then continues the execution
+    class BudgetHandler {
+    public:
+        // called by the call which exceeds budget, before the method starts. Return true to go on
+        // with the next slice: limits of calls and time are counted again from now, limit of memory
+        // stays (handler can change budget by Context::SetBudget). False aborts execution
+        // by BudgetExceeded. Handler must not execute code in the context
+        virtual bool OnBudgetExceeded(Context& context, const BudgetUsage& usage) = 0;
+
+    protected:
+        ~BudgetHandler() = default;
+    };
+
+    // how the last executed statement finished: Normal lets the enclosing block go on,
+    // other values make blocks stop until the statement which handles the signal
+    enum class Completion : uint8_t {
+        Normal,
+        // return command was executed, it is handled by MethodBody
+        Return,
+    };
+
+    // context of execution of Mython commands
+    class Context {
+    public:
+        // return output strean for print, it writes into GetOutput()
+        virtual std::ostream& GetOutputStream() = 0;
+
+        // return sink where print writes output of program
+        [[nodiscard]] OutputSink& GetOutput() const {
+            return *output_;
+        }
+
+        [[nodiscard]] HeapStats GetHeapStats() const;
+
+        // return live instances of classes of the thread of context by classes, the biggest by memory first
+        [[nodiscard]] std::vector<ClassHeapStats> GetClassHeapStats() const;
+
+        // free class instances of the thread of context which reference only each other,
+        // return their number (see CycleCollector)
+        size_t CollectCycles();
+
+        // set arena where AST nodes of executed program are allocated, it is used for statistics only
+        void SetNodeArena(const Arena* arena) {
+            node_arena_ = arena;
+        }
+
+        // return frame of method which is executed now or nullptr outside of methods
+        [[nodiscard]] Frame* GetCurrentFrame() const {
+            return current_frame_;
+        }
+
+        // make frame current and return previous current frame
+        Frame* SetCurrentFrame(Frame* frame) {
+            Frame* previous = current_frame_;
+            current_frame_ = frame;
+            return previous;
+        }
+
+        [[nodiscard]] Completion GetCompletion() const {
+            return completion_;
+        }
+
+        void SetCompletion(Completion completion) {
+            completion_ = completion;
+        }
+
+        // return stack where calls keep arguments and frames
+        [[nodiscard]] ValueStack& GetValueStack() {
+            return value_stack_;
+        }
+
+        // return profiler which measures calls and samples statements of context or nullptr
+        [[nodiscard]] Profiler* GetProfiler() const {
+            return profiler_;
+        }
+
+        // enable profiling by profiler or disable it by nullptr, profiler must outlive execution
+        void SetProfiler(Profiler* profiler) {
+            profiler_ = profiler;
+        }
+
+        // return stack of calls which bytecode VM executes in its loop
+        [[nodiscard]] CallStack& GetCallStack() {
+            return call_stack_;
+        }
+
+        static constexpr size_t DEFAULT_MAX_CALL_DEPTH = 100000;
+        static constexpr size_t DEFAULT_MAX_NATIVE_CALL_DEPTH = 1000;
+
+        // limit of depth of all method calls
+        void SetMaxCallDepth(size_t max_depth) {
+            max_call_depth_ = max_depth;
+        }
+
+        [[nodiscard]] size_t GetMaxCallDepth() const {
+            return max_call_depth_;
+        }
+
+        // limit of depth of calls which nest frames of native stack: methods of tree-walking
+        // mode, special methods of operators and calls from them. They count into both limits
+        void SetMaxNativeCallDepth(size_t max_depth) {
+            max_native_call_depth_ = max_depth;
+        }
+
+        [[nodiscard]] size_t GetMaxNativeCallDepth() const {
+            return max_native_call_depth_;
+        }
+
+        [[nodiscard]] size_t GetCallDepth() const {
+            return call_depth_;
+        }
+
+        // limit execution by budget, usage is counted from now and from the start of every
+        // Interpreter::Run. Without handler execution which exceeds budget is aborted
+        void SetBudget(const ExecutionBudget& budget, BudgetHandler* handler = nullptr);
+
+        [[nodiscard]] const ExecutionBudget& GetBudget() const {
+            return budget_;
+        }
+
+        // count usage of budget from now
+        void StartBudget();
+
+        // time and memory are only measured when budget is set, calls are counted always
+        [[nodiscard]] BudgetUsage GetBudgetUsage() const;
+
+        // count call which starts, throws runtime_error if the call exceeds limit of depth
+        // and BudgetExceeded if it exceeds budget
+        void EnterCall(bool native) {
+            if (--budget_countdown_ == 0) {
+                CheckBudget();
+            }
+            if (call_depth_ >= max_call_depth_ || (native && native_call_depth_ >= max_native_call_depth_)) {
+                ThrowCallDepthExceeded();
+            }
+            ++call_depth_;
+            native_call_depth_ += native ? 1 : 0;
+        }
+
+        void LeaveCall(bool native) noexcept {
+            --call_depth_;
+            native_call_depth_ -= native ? 1 : 0;
+        }
+
+        // string of size characters is going to be made, throws BudgetExceeded if its text does not
+        // fit into the rest of memory budget. Rope takes little memory until it is flattened,
+        // so its size is limited when it is made
+        void CheckStringSize(std::size_t size) {
+            if (budget_.memory != 0) {
+                CheckStringMemory(size);
+            }
+        }
+
+    protected:
+        ~Context() = default;
+
+        // derived contexts set their sink at construction
+        void SetOutput(OutputSink& output) {
+            output_ = &output;
+        }
+
+    private:
+        [[noreturn]] static void ThrowCallDepthExceeded();
+
+        // countdown of calls reached zero, call handler or throw if budget is exceeded
+        void CheckBudget();
+        void CheckStringMemory(std::size_t size) const;
+        // set countdown to the next check of budget
+        void ArmBudget();
+        [[nodiscard]] bool HasBudget() const;
+
+        OutputSink* output_ = nullptr;
+        Frame* current_frame_ = nullptr;
+        const Arena* node_arena_ = nullptr;
+        Profiler* profiler_ = nullptr;
+        ValueStack value_stack_;
+        CallStack call_stack_;
+        size_t call_depth_ = 0;
+        size_t native_call_depth_ = 0;
+        size_t max_call_depth_ = DEFAULT_MAX_CALL_DEPTH;
+        size_t max_native_call_depth_ = DEFAULT_MAX_NATIVE_CALL_DEPTH;
+        Completion completion_ = Completion::Normal;
+
+        ExecutionBudget budget_;
+        BudgetHandler* budget_handler_ = nullptr;
+        // calls until the next check of budget, there are no checks without budget
+        std::uint64_t budget_countdown_ = UINT64_MAX;
+        // value of countdown after the last check
+        std::uint64_t budget_countdown_start_ = UINT64_MAX;
+        // calls before the last check since the start of budget and since the start of slice
+        std::uint64_t budget_calls_ = 0;
+        std::uint64_t slice_calls_ = 0;
+        std::chrono::steady_clock::time_point budget_start_;
+        std::chrono::steady_clock::time_point slice_start_;
+        std::size_t budget_memory_base_ = 0;
+    };
 
     // chek if object contains value which can be transformed into True
     // for numbers other than 0 and non-empty strings return True, in other cases return False.
@@ -103,22 +809,70 @@ namespace runtime {
     class Executable {
     public:
         virtual ~Executable() = default;
-        //      closure,  context
-        //     None
+
+        // nodes are allocated in Arena::Current() if it is set, otherwise in global heap
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size) noexcept;
+
+        // execute action under objects inside closure using context
+        // return result value or None
         virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
+
+        // emit bytecode which does the same as Execute
+        // by default the instruction which calls Execute of this object is emitted
+        virtual void Compile(bytecode::Compiler& compiler);
+
+        // simplify the node before execution (see ast::Optimize): children are replaced
+        // in place, return the node which replaces this one or nullptr to keep it
+        virtual std::unique_ptr<Executable> Optimize();
+
+        // write the node into image of program (see image::SaveProgram)
+        // by default the node can not be saved and runtime_error is thrown
+        virtual void Save(image::Writer& writer) const;
     };
 
-    // String value
-    using String = ValueObject<std::string>;
-    // Number value
-    using Number = ValueObject<int>;
+    struct Method;
 
-    // Logical value
-    class Bool : public ValueObject<bool> {
+    // body of method which is parsed at the first call of the method (see ParseProgram).
+    // Transformations of the body (optimisation, compilation into bytecode) which are requested
+    // before are applied when it is parsed. Threads which call the method at once parse it once,
+    // nodes of the body are allocated in arena which was current when the source was created
+    class MethodSource {
     public:
-        using ValueObject<bool>::ValueObject;
+        // transformation of body of method, it may replace the body
+        using Transform = void (*)(Method& method);
 
-        void Print(std::ostream& os, Context& context) override;
+        MethodSource();
+        virtual ~MethodSource() = default;
+
+        MethodSource(const MethodSource&) = delete;
+        MethodSource& operator=(const MethodSource&) = delete;
+
+        // set body and frame_size of method if they are not set yet. Throws ParseError or
+        // parse::LexerError on wrong text, then the next call tries again
+        void Load(const Method& method) {
+            if (!loaded_.load(std::memory_order_acquire)) {
+                LoadOnce(method);
+            }
+        }
+
+        [[nodiscard]] bool IsLoaded() const {
+            return loaded_.load(std::memory_order_acquire);
+        }
+
+        // apply transform to body of method when it is loaded or now if it is loaded already.
+        // Transforms are applied in order of requests, they are requested before execution
+        void Defer(Method& method, Transform transform);
+
+    protected:
+        virtual void Parse(Method& method) = 0;
+
+    private:
+        void LoadOnce(const Method& method);
+
+        Arena* arena_;
+        std::vector<Transform> transforms_;
+        std::atomic<bool> loaded_ = false;
     };
 
     // Method of class
@@ -128,33 +882,283 @@ namespace runtime {
         std::vector<std::string> formal_params;
        
         std::unique_ptr<Executable> body;
+
+        // number of slots in Frame of the method, if it is 0 then body expects
+        // self and parameters in Closure
+        size_t frame_size = 0;
+
+        // bytecode of body if the method is compiled (see bytecode::Compiler), VM executes
+        // such calls in its own loop
+        const bytecode::Function* code = nullptr;
+
+        // source of body which is parsed lazily, body is nullptr until source is loaded
+        std::unique_ptr<MethodSource> source = nullptr;
     };
 
+    // layout of fields of class instances: instance keeps values of fields in vector
+    // and shape gives offset of every field there. Instances which got the same fields
+    // in the same order share one shape. Shapes form a tree, child shape has one field
+    // more than its parent, root is the empty shape of class
+    class Shape {
+    public:
+        Shape() = default;
+        Shape(const Shape&) = delete;
+        Shape& operator=(const Shape&) = delete;
+        // shapes are moved only with their class before it is used
+        Shape(Shape&& other) noexcept;
+        Shape& operator=(Shape&& other) noexcept;
+
+        // return offset of field or nullopt if there is no field with such name
+        [[nodiscard]] std::optional<size_t> FindField(const std::string& name) const;
+
+        // return shape with fields of this one and new field name at offset Size().
+        // It is thread-safe: instances of one class can get fields in many threads
+        [[nodiscard]] const Shape& AddField(const std::string& name) const;
+
+        // return number of fields
+        [[nodiscard]] size_t Size() const;
+
+        [[nodiscard]] const std::string& GetFieldName(size_t offset) const;
+
+    private:
+        // objects have few fields, so linear search is fast enough
+        std::vector<std::string> names_;
+        mutable std::mutex transitions_mutex_;
+        mutable std::unordered_map<std::string, std::unique_ptr<Shape>> transitions_;
+    };
+
+    // value of inline cache, the cache may be used by many threads which execute one program.
+    // It is a seqlock: reading does not write into memory, so threads do not slow down each
+    // other while the cache hits. Cache is only a hint, so writer which competes with other
+    // one skips its update and reader which sees unfinished update gets empty value
+    template <typename T>
+    class SharedCacheValue {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        SharedCacheValue() = default;
+
+        SharedCacheValue(const SharedCacheValue& other) {
+            Store(other.Load());
+        }
+
+        SharedCacheValue& operator=(const SharedCacheValue& other) {
+            Store(other.Load());
+            return *this;
+        }
+
+        [[nodiscard]] T Load() const {
+            const std::uint32_t version = version_.load(std::memory_order_acquire);
+            std::array<std::uintptr_t, WORDS> words;
+            // acquire loads keep the second check of version after reading of words
+            for (size_t i = 0; i < WORDS; ++i) {
+                words[i] = words_[i].load(std::memory_order_acquire);
+            }
+            if ((version & 1) != 0 || version_.load(std::memory_order_relaxed) != version) {
+                return T{};
+            }
+            T value;
+            std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+            return value;
+        }
+
+        void Store(const T& value) {
+            std::uint32_t version = version_.load(std::memory_order_relaxed);
+            if ((version & 1) != 0
+                || !version_.compare_exchange_strong(version, version + 1, std::memory_order_acquire)) {
+                return;
+            }
+            std::array<std::uintptr_t, WORDS> words{};
+            std::memcpy(words.data(), &value, sizeof(T));
+            // release stores keep odd version before new words
+            for (size_t i = 0; i < WORDS; ++i) {
+                words_[i].store(words[i], std::memory_order_release);
+            }
+            version_.store(version + 2, std::memory_order_release);
+        }
+
+    private:
+        static constexpr size_t WORDS = (sizeof(T) + sizeof(std::uintptr_t) - 1) / sizeof(std::uintptr_t);
+
+        // odd while value is being changed
+        std::atomic<std::uint32_t> version_ = 0;
+        std::array<std::atomic<std::uintptr_t>, WORDS> words_{};
+    };
+
+    // entry of inline cache of field access of one place in code, it remembers offset of field
+    // for the last seen shape. When field is added by assignment next_shape is shape
+    // after addition, otherwise next_shape is equal to shape
+    struct FieldCacheEntry {
+        const Shape* shape = nullptr;
+        const Shape* next_shape = nullptr;
+        size_t offset = 0;
+    };
+
+    using FieldCache = SharedCacheValue<FieldCacheEntry>;
+
+    // methods which are called by the interpreter itself: constructor, conversion to string
+    // and operators. Class resolves them once, so operators do not look methods up by name
+    enum class SpecialMethod : std::uint8_t {
+        // __init__ with any number of parameters
+        Init,
+        // __str__()
+        Str,
+        // __eq__(other)
+        Equal,
+        // __lt__(other)
+        Less,
+        // __add__(other)
+        Add,
+    };
 
     class Class : public Object {
     public:
-        //     name    methods,    parent
-        //  parent  nullptr,    
+        // create class with name and set of methods, which is derived from parent class
+        // if parent is nullptr then base class is created. Parent must outlive the class,
+        // methods which are inherited from it are not copied
         explicit Class(std::string name, std::vector<Method> methods, const Class* parent);
 
-        //     name  nullptr,      
-        [[nodiscard]] const Method* GetMethod(const std::string& name) const;
+        // return pointer to method name or nullptr if there is no method with such name
+        [[nodiscard]] const Method* GetMethod(std::string_view name) const;
 
-        //   
+        // return special method or nullptr if the class does not have it or the method
+        // has other number of parameters, inherited methods are taken into account
+        [[nodiscard]] const Method* GetSpecialMethod(SpecialMethod method) const {
+            return special_methods_[static_cast<size_t>(method)];
+        }
+
+        // return class name
         [[nodiscard]] const std::string& GetName() const;
 
-        //   os  "Class < >",  "Class cat"
+        // return parent class or nullptr
+        [[nodiscard]] const Class* GetParent() const;
+
+        // return methods declared in this class in order of declaration (inherited ones are not included)
+        [[nodiscard]] std::vector<Method*> GetOwnMethods();
+
+        // return shape of new instances which do not have fields
+        [[nodiscard]] const Shape& GetRootShape() const;
+
+        // output into os string "Class <class name>", for example "Class cat"
         void Print(std::ostream& os, Context& context) override;
     private:
+        static constexpr size_t SPECIAL_METHOD_COUNT = static_cast<size_t>(SpecialMethod::Add) + 1;
+
+        struct VtableEntry {
+            // refers to name of method
+            std::string_view name;
+            const Method* method;
+        };
+
         std::string name_;
-        std::unordered_map<std::string_view, std::shared_ptr<Method>> vtbl_;
+        std::vector<Method> methods_;
+        // own and inherited methods sorted by name, own methods replace inherited ones
+        std::vector<VtableEntry> vtable_;
+        std::array<const Method*, SPECIAL_METHOD_COUNT> special_methods_{};
         const Class* parent_;
+        Shape root_shape_;
+    };
+
+    template <>
+    inline constexpr ObjectKind KIND_OF<Class> = ObjectKind::Class;
+
+    // inline cache of one call site: it remembers methods which were found
+    // for last classes of called objects, so repeated calls skip lookup by name.
+    // It is thread-safe like SharedCacheValue
+    class MethodCache {
+    public:
+        MethodCache() = default;
+        MethodCache(const MethodCache& other);
+        MethodCache& operator=(const MethodCache& other);
+
+        // return method name of cls or nullptr if cls does not have it
+        [[nodiscard]] const Method* Find(const Class& cls, const std::string& name) {
+            for (const SharedCacheValue<Entry>& cell : entries_) {
+                const Entry entry = cell.Load();
+                if (entry.cls == &cls) {
+                    return entry.method;
+                }
+            }
+            return Update(cls, name);
+        }
+
+    private:
+        // number of classes which are remembered, when it is exceeded the oldest entry is replaced
+        static constexpr size_t SIZE = 4;
+
+        struct Entry {
+            const Class* cls = nullptr;
+            const Method* method = nullptr;
+        };
+
+        const Method* Update(const Class& cls, const std::string& name);
+
+        std::array<SharedCacheValue<Entry>, SIZE> entries_;
+        std::atomic<std::uint8_t> next_ = 0;
     };
 
     class ClassInstance : public Object {
     public:
+        // view of fields of instance by names with interface of Closure
+        class FieldsView {
+        public:
+            // iterator over pairs of field name and value in order of field addition
+            class Iterator {
+            public:
+                using value_type = std::pair<const std::string&, ObjectHolder&>;
+
+                // pair is made on dereference, so arrow gives access through holder of pair
+                struct Pointer {
+                    value_type pair;
+
+                    const value_type* operator->() const {
+                        return &pair;
+                    }
+                };
+
+                Iterator(ClassInstance& instance, size_t offset);
+
+                value_type operator*() const;
+                Pointer operator->() const;
+                Iterator& operator++();
+
+                bool operator==(const Iterator& other) const;
+                bool operator!=(const Iterator& other) const;
+
+            private:
+                ClassInstance* instance_;
+                size_t offset_;
+            };
+
+            explicit FieldsView(ClassInstance& instance);
+
+            // return value of field, field with None value is added if it does not exist
+            ObjectHolder& operator[](const std::string& name);
+
+            // return value of field, throws out_of_range if it does not exist
+            ObjectHolder& at(const std::string& name);
+            const ObjectHolder& at(const std::string& name) const;
+
+            [[nodiscard]] Iterator find(const std::string& name) const;
+            [[nodiscard]] size_t count(const std::string& name) const;
+            [[nodiscard]] size_t size() const;
+            [[nodiscard]] bool empty() const;
+
+            [[nodiscard]] Iterator begin() const;
+            [[nodiscard]] Iterator end() const;
+
+        private:
+            ClassInstance* instance_;
+        };
+
         explicit ClassInstance(const Class& cls);
 
+        ClassInstance(const ClassInstance& other);
+        ClassInstance(ClassInstance&& other) noexcept;
+        ClassInstance& operator=(const ClassInstance&) = delete;
+        ClassInstance& operator=(ClassInstance&&) = delete;
+        ~ClassInstance() override;
+
         /*
          * If object has __str__ method then output its result into os 
          * Else output object's adress
@@ -168,16 +1172,66 @@ namespace runtime {
         ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
             Context& context);
 
+        // call method which was found in class of object, number of arguments is not checked
+        ObjectHolder Call(const Method& method, const std::vector<ObjectHolder>& actual_args,
+            Context& context);
+        // the same, but arg_count arguments are moved from args. Memory is not allocated
+        // for methods which keep variables in frame. Call is measured by profiler of context if it is set
+        ObjectHolder Call(const Method& method, ObjectHolder* args, size_t arg_count, Context& context);
+
         // return true if object has method with argument_count parameters
         [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
 
-        // return ref to Closure which contains attributes of object
-        [[nodiscard]] Closure& Fields();
-        // return const ref to Closure which contains attributes of object
-        [[nodiscard]] const Closure& Fields() const;
+        [[nodiscard]] const Class& GetClass() const;
+
+        [[nodiscard]] const Shape& GetShape() const;
+
+        // return pointer to value of field or nullptr if object does not have such field
+        [[nodiscard]] ObjectHolder* FindField(const std::string& name);
+        // the same, but offset of field is taken from cache when shape of object is there
+        [[nodiscard]] ObjectHolder* FindField(const std::string& name, FieldCache& cache);
+
+        // assign value to field, field is added if object does not have it
+        ObjectHolder& SetField(const std::string& name, ObjectHolder value);
+        ObjectHolder& SetField(const std::string& name, ObjectHolder value, FieldCache& cache);
+
+        // return view of attributes of object
+        [[nodiscard]] FieldsView& Fields();
+        [[nodiscard]] const FieldsView& Fields() const;
     private:
-        Closure fields_;
+        friend class CycleCollector;
+
+        ObjectHolder Invoke(const Method& method, ObjectHolder* args, size_t arg_count, Context& context);
+        // charge memory of values after their capacity has changed
+        void ChargeValues(size_t old_capacity) noexcept;
+
         const Class& class_;
+        const Shape* shape_;
+        std::vector<ObjectHolder> values_;
+        FieldsView fields_;
+        // pool of thread which memory of values is charged to
+        ObjectPool* values_pool_ = nullptr;
+
+        // collector which tracks instance or nullptr, copies are not tracked
+        CycleCollector* collector_ = nullptr;
+        // neighbours in list of tracked instances
+        ClassInstance* previous_tracked_ = nullptr;
+        ClassInstance* next_tracked_ = nullptr;
+        // counter of references during collection
+        std::uint32_t collector_refs_ = 0;
+    };
+
+    template <>
+    inline constexpr ObjectKind KIND_OF<ClassInstance> = ObjectKind::ClassInstance;
+
+    // operators of comparison
+    enum class CompareOp : std::uint8_t {
+        Equal,
+        NotEqual,
+        Less,
+        Greater,
+        LessOrEqual,
+        GreaterOrEqual,
     };
 
     /*
@@ -203,28 +1257,118 @@ namespace runtime {
     // return value opposite to Less(lhs, rhs, context)
     bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
-    // Context for tests
+    // comparison of values which are not both numbers or both strings (see Compare)
+    bool CompareObjects(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+    // lhs <op> rhs for values which have operators == and <
+    template <CompareOp op, typename T>
+    bool ApplyCompareOp(const T& lhs, const T& rhs) {
+        if constexpr (op == CompareOp::Equal) {
+            return lhs == rhs;
+        }
+        else if constexpr (op == CompareOp::NotEqual) {
+            return !(lhs == rhs);
+        }
+        else if constexpr (op == CompareOp::Less) {
+            return lhs < rhs;
+        }
+        else if constexpr (op == CompareOp::Greater) {
+            return rhs < lhs;
+        }
+        else if constexpr (op == CompareOp::LessOrEqual) {
+            return !(rhs < lhs);
+        }
+        else {
+            return !(lhs < rhs);
+        }
+    }
+
+    /*
+     * the same as function of operator op (Equal, Less and so on), but number with number and
+     * string with string are compared inline. Methods __lt__ and __eq__ of object are looked up
+     * once and called without copies of arguments
+     */
+    template <CompareOp op>
+    bool Compare(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        if (const std::optional<int> left_number = lhs.TryAsValue<Number>()) {
+            if (const std::optional<int> right_number = rhs.TryAsValue<Number>()) {
+                return ApplyCompareOp<op>(*left_number, *right_number);
+            }
+        }
+        else if (const String* left_string = lhs.TryAs<String>()) {
+            if (const String* right_string = rhs.TryAs<String>()) {
+                return ApplyCompareOp<op>(left_string->GetStringValue(), right_string->GetStringValue());
+            }
+        }
+        return CompareObjects(op, lhs, rhs, context);
+    }
+
+    /*
+     * Support sum
+     * number + number
+     * string + string
+     * obj1 + obj2 if obj1 has __add__ method
+     * else throws runtime_error
+     */
+    ObjectHolder Add(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+    // the same, but string which is owned only by lhs (see ObjectHolder::IsUnique) is
+    // extended in place and returned, so a + b + c allocates one string
+    ObjectHolder Add(ObjectHolder&& lhs, const ObjectHolder& rhs, Context& context);
+    // return lhs - rhs for numbers else throws runtime_error
+    ObjectHolder Sub(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+    // return lhs * rhs for numbers else throws runtime_error
+    ObjectHolder Mult(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+    // return lhs / rhs for numbers else throws runtime_error, if rhs = 0 throws runtime_error
+    ObjectHolder Div(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
+
+    // instance.field = instance.field + rhs (instance.field - rhs if subtract is true), return
+    // the new value of field. Sum of numbers is stored in place of the old one,
+    // throws runtime_error if instance has no such field
+    ObjectHolder AddToField(ClassInstance& instance, const std::string& field, FieldCache& cache,
+        const ObjectHolder& rhs, bool subtract, Context& context);
+
+    // return String with representation of object as str() does:
+    // result of __str__ method for objects which have it, "None" for empty holder
+    ObjectHolder Stringify(const ObjectHolder& object, Context& context);
+    // the same, but string which is owned only by object is returned without copy
+    ObjectHolder Stringify(ObjectHolder&& object, Context& context);
+
+    // output representation of object into output of context as print does, "None" for empty holder.
+    // Numbers, strings and logical values are written into sink directly
+    void PrintObject(const ObjectHolder& object, Context& context);
+
+    // Context for tests, output is not buffered, so it is in output right after print
     struct DummyContext : Context {
+        DummyContext() {
+            SetOutput(sink_);
+        }
+
         std::ostream& GetOutputStream() override {
             return output;
         }
 
         std::ostringstream output;
+
+    private:
+        StreamSink sink_{ output, 0 };
     };
 
     // Simple context
     class SimpleContext : public runtime::Context {
     public:
-        explicit SimpleContext(std::ostream& output)
-            : output_(output) {
-        }
+        // output is buffered, it is written into stream at Flush of GetOutput()
+        // and when context is destroyed
+        explicit SimpleContext(std::ostream& output, size_t buffer_size = OutputSink::DEFAULT_BUFFER_SIZE);
+        // output goes into sink which is owned by caller
+        explicit SimpleContext(OutputSink& output);
 
         std::ostream& GetOutputStream() override {
-            return output_;
+            return stream_;
         }
 
     private:
-        std::ostream& output_;
+        std::optional<StreamSink> own_sink_;
+        SinkStream stream_;
     };
 
 }  // namespace runtime
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include "test_runner_p.h"
 
 #include <functional>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -19,7 +21,8 @@ namespace runtime {
             }
 
             Logger(const Logger& rhs)
-                : id_(rhs.id_)  //
+                : Object(rhs)
+                , id_(rhs.id_)  //
             {
                 ++instance_count;
             }
@@ -242,12 +245,146 @@ namespace runtime {
             }
         }
 
+        // object which owns other value
+        class Box : public Object {
+        public:
+            explicit Box(ObjectHolder value)
+                : value(std::move(value)) {
+            }
+
+            void Print(ostream& os, Context& context) override {
+                value->Print(os, context);
+            }
+
+            ObjectHolder value;
+        };
+
+        void TestReferenceCounting() {
+            ASSERT_EQUAL(Logger::instance_count, 0);
+            {
+                ObjectHolder one = ObjectHolder::Own(Logger(1));
+                ObjectHolder two = one;
+                ObjectHolder three;
+                three = two;
+                three = three;  // NOLINT
+                one = ObjectHolder::None();
+                two = ObjectHolder::Own(Number{ 2 });
+                ASSERT_EQUAL(Logger::instance_count, 1);
+                ASSERT_EQUAL(static_cast<Logger*>(three.Get())->GetId(), 1);
+                three = std::move(two);
+                ASSERT_EQUAL(Logger::instance_count, 0);
+            }
+
+            // holder can be replaced by value which is owned by its old object
+            {
+                ObjectHolder box = ObjectHolder::Own(Box(ObjectHolder::Own(Logger(3))));
+                box = box.TryAs<Box>()->value;
+                ASSERT_EQUAL(Logger::instance_count, 1);
+                ASSERT_EQUAL(static_cast<Logger*>(box.Get())->GetId(), 3);
+
+                ObjectHolder other = ObjectHolder::Own(Box(ObjectHolder::Own(Logger(4))));
+                other = std::move(other.TryAs<Box>()->value);
+                ASSERT_EQUAL(Logger::instance_count, 2);
+                ASSERT_EQUAL(static_cast<Logger*>(other.Get())->GetId(), 4);
+            }
+            ASSERT_EQUAL(Logger::instance_count, 0);
+
+            // only marked objects are counted by atomic operations, other holders do not count
+            ObjectHolder shared = ObjectHolder::Own(Logger(5));
+            ASSERT(!shared.IsSharedBetweenThreads());
+            shared.ShareBetweenThreads();
+            ASSERT(shared.IsSharedBetweenThreads());
+            ObjectHolder::None().ShareBetweenThreads();
+            ASSERT(!ObjectHolder::Own(Number{ 1 }).IsSharedBetweenThreads());
+
+            vector<thread> threads;
+            for (int t = 0; t < 4; ++t) {
+                threads.emplace_back([&shared] {
+                    for (int i = 0; i < 10000; ++i) {
+                        ObjectHolder copy = shared;
+                        ObjectHolder other = copy;
+                    }
+                });
+            }
+            for (thread& worker : threads) {
+                worker.join();
+            }
+            ASSERT_EQUAL(Logger::instance_count, 1);
+            shared = ObjectHolder::None();
+            ASSERT_EQUAL(Logger::instance_count, 0);
+        }
+
         void TestNullptr() {
             ObjectHolder oh;
             ASSERT(!oh);
             ASSERT(!oh.Get());
         }
 
+        void TestImmediateValues() {
+            ObjectHolder number = ObjectHolder::Own(Number{ 42 });
+            ObjectHolder boolean = ObjectHolder::Own(Bool{ true });
+            ASSERT(number && boolean);
+            ASSERT_EQUAL(*number.TryAsValue<Number>(), 42);
+            ASSERT(*boolean.TryAsValue<Bool>());
+            ASSERT(!number.TryAsValue<Bool>());
+            ASSERT(number.TryAs<String>() == nullptr);
+            ASSERT(!boolean.TryAsValue<Number>());
+            ASSERT(!ObjectHolder::None().TryAsValue<Number>());
+            // holder keeps value instead of object
+            ASSERT_EQUAL(sizeof(ObjectHolder), 2 * sizeof(void*));
+
+            // copy has its own value
+            ObjectHolder copy = number;
+            ASSERT_EQUAL(*copy.TryAsValue<Number>(), 42);
+            ObjectHolder moved = std::move(copy);
+            ASSERT_EQUAL(*moved.TryAsValue<Number>(), 42);
+            ASSERT(!copy);  // NOLINT(bugprone-use-after-move)
+
+            // access through base class pointer boxes value into object which holder owns
+            Object* boxed = number.Get();
+            ASSERT(dynamic_cast<Number*>(boxed) == number.TryAs<Number>());
+            ASSERT_EQUAL(*number.TryAsValue<Number>(), 42);
+            ObjectHolder boxed_copy = number;
+            ASSERT(boxed_copy.Get() == boxed);
+            ASSERT(boxed_copy.TryAs<Bool>() == nullptr);
+            DummyContext context;
+            boolean->Print(context.output, context);
+            ASSERT_EQUAL(context.output.str(), "True"s);
+            ASSERT(*boolean.TryAsValue<Bool>());
+
+            // shared value is not copied
+            Number shared{ 7 };
+            ObjectHolder ref = ObjectHolder::Share(shared);
+            ASSERT(ref.TryAs<Number>() == &shared);
+            ASSERT_EQUAL(*ref.TryAsValue<Number>(), 7);
+        }
+
+        void TestObjectKinds() {
+            Class cls("Test"s, {}, nullptr);
+            ASSERT(ObjectHolder::Own(Number{ 1 })->GetKind() == ObjectKind::Number);
+            ASSERT(ObjectHolder::Own(String{ "a"s })->GetKind() == ObjectKind::String);
+            ASSERT(ObjectHolder::Own(Bool{ true })->GetKind() == ObjectKind::Bool);
+            ASSERT(cls.GetKind() == ObjectKind::Class);
+            ASSERT(ClassInstance(cls).GetKind() == ObjectKind::ClassInstance);
+            ASSERT(Logger().GetKind() == ObjectKind::Other);
+
+            // Bool is not a Number though both of them are value objects
+            ObjectHolder boolean = ObjectHolder::Own(Bool{ true });
+            ASSERT(boolean.TryAs<Number>() == nullptr);
+            ASSERT(boolean.TryAs<ValueObject<bool>>() != nullptr);
+            ASSERT(ObjectHolder::Share(cls).TryAs<ClassInstance>() == nullptr);
+
+            // types derived from built-in ones are checked by dynamic_cast
+            struct Counter : Number {
+                using Number::Number;
+            };
+            ObjectHolder number = ObjectHolder::Own(Number{ 2 });
+            ObjectHolder counter = ObjectHolder::Own(Counter{ 3 });
+            ASSERT(number.TryAs<Counter>() == nullptr);
+            ASSERT(counter.TryAs<Counter>() != nullptr);
+            ASSERT_EQUAL(counter.TryAs<Number>()->GetValue(), 3);
+        }
+
         void TestIsTrue() {
             {
                 ASSERT(!IsTrue(ObjectHolder::Own(Bool{ false })));
@@ -504,6 +641,81 @@ namespace runtime {
             ASSERT_EQUAL(out.str(), "Class Test"s);
         }
 
+        void TestMethodCache() {
+            auto body = [](Closure& /*closure*/, Context& /*context*/) {
+                return ObjectHolder::None();
+            };
+            vector<unique_ptr<Class>> classes;
+            for (int i = 0; i < 6; ++i) {
+                vector<Method> methods;
+                methods.push_back({ "method"s, {}, make_unique<TestMethodBody>(body) });
+                classes.push_back(make_unique<Class>("Test"s + to_string(i), move(methods), nullptr));
+            }
+            Class derived{ "Derived"s, {}, classes[0].get() };
+
+            MethodCache cache;
+            // more classes than cache remembers, old entries are replaced
+            for (int round = 0; round < 2; ++round) {
+                for (const auto& cls : classes) {
+                    ASSERT_EQUAL(cache.Find(*cls, "method"s), cls->GetMethod("method"s));
+                }
+            }
+            ASSERT_EQUAL(cache.Find(derived, "method"s), classes[0]->GetMethod("method"s));
+            ASSERT_EQUAL(cache.Find(derived, "method"s), classes[0]->GetMethod("method"s));
+
+            MethodCache missing_cache;
+            ASSERT_EQUAL(missing_cache.Find(*classes[0], "missing_method"s), nullptr);
+            ASSERT_EQUAL(missing_cache.Find(*classes[0], "missing_method"s), nullptr);
+        }
+
+        void TestSpecialMethods() {
+            auto make_method = [](string name, vector<string> params) {
+                return Method{ std::move(name), std::move(params), make_unique<TestMethodBody>(nullptr) };
+            };
+            vector<Method> base_methods;
+            base_methods.push_back(make_method("__init__"s, { "a"s, "b"s }));
+            base_methods.push_back(make_method("__str__"s, {}));
+            base_methods.push_back(make_method("__eq__"s, { "other"s }));
+            base_methods.push_back(make_method("value"s, {}));
+            Class base{ "Base"s, std::move(base_methods), nullptr };
+            ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::Init), base.GetMethod("__init__"sv));
+            ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::Str), base.GetMethod("__str__"sv));
+            ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::Equal), base.GetMethod("__eq__"sv));
+            ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::Less), nullptr);
+            ASSERT_EQUAL(base.GetSpecialMethod(SpecialMethod::Add), nullptr);
+
+            vector<Method> child_methods;
+            child_methods.push_back(make_method("value"s, { "x"s }));
+            // operator with wrong number of parameters is an ordinary method
+            child_methods.push_back(make_method("__add__"s, { "x"s, "y"s }));
+            child_methods.push_back(make_method("__lt__"s, { "other"s }));
+            child_methods.push_back(make_method("__str__"s, {}));
+            Class child{ "Child"s, std::move(child_methods), &base };
+            ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::Init), base.GetMethod("__init__"sv));
+            ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::Equal), base.GetMethod("__eq__"sv));
+            ASSERT(child.GetSpecialMethod(SpecialMethod::Less));
+            ASSERT_EQUAL(child.GetSpecialMethod(SpecialMethod::Add), nullptr);
+            ASSERT(child.GetMethod("__add__"sv));
+            ASSERT(child.GetSpecialMethod(SpecialMethod::Str) != base.GetSpecialMethod(SpecialMethod::Str));
+            ASSERT_EQUAL(child.GetMethod("value"sv)->formal_params.size(), 1U);
+            ASSERT_EQUAL(base.GetMethod("value"sv)->formal_params.size(), 0U);
+            ASSERT_EQUAL(child.GetMethod("missing"sv), nullptr);
+
+            vector<string> own_names;
+            for (const Method* method : child.GetOwnMethods()) {
+                own_names.push_back(method->name);
+            }
+            ASSERT_EQUAL(own_names, (vector<string>{ "value"s, "__add__"s, "__lt__"s, "__str__"s }));
+
+            // the last declaration of method with repeated name is used
+            vector<Method> repeated_methods;
+            repeated_methods.push_back(make_method("__str__"s, { "x"s }));
+            repeated_methods.push_back(make_method("__str__"s, {}));
+            Class repeated{ "Repeated"s, std::move(repeated_methods), nullptr };
+            ASSERT(repeated.GetSpecialMethod(SpecialMethod::Str));
+            ASSERT_EQUAL(repeated.GetMethod("__str__"sv), repeated.GetSpecialMethod(SpecialMethod::Str));
+        }
+
         void TestClassInstance() {
             vector<Method> methods;
 
@@ -529,6 +741,69 @@ namespace runtime {
             ASSERT_THROWS(instance.Call("missing_method"s, {}, ctx), runtime_error);
         }
 
+        void TestShapes() {
+            Class cls{ "Point"s, {}, nullptr };
+            ClassInstance first{ cls };
+            ClassInstance second{ cls };
+            ClassInstance other_order{ cls };
+            ASSERT_EQUAL(&first.GetShape(), &cls.GetRootShape());
+
+            first.SetField("x"s, ObjectHolder::Own(Number{ 1 }));
+            first.SetField("y"s, ObjectHolder::Own(Number{ 2 }));
+            second.Fields()["x"s] = ObjectHolder::Own(Number{ 3 });
+            second.Fields()["y"s] = ObjectHolder::Own(Number{ 4 });
+            other_order.SetField("y"s, ObjectHolder::Own(Number{ 5 }));
+            other_order.SetField("x"s, ObjectHolder::Own(Number{ 6 }));
+
+            // the same fields in the same order give the same shape
+            ASSERT_EQUAL(&first.GetShape(), &second.GetShape());
+            ASSERT(&first.GetShape() != &other_order.GetShape());
+            ASSERT_EQUAL(first.GetShape().Size(), 2U);
+            ASSERT_EQUAL(*first.GetShape().FindField("y"s), 1U);
+            ASSERT_EQUAL(*other_order.GetShape().FindField("y"s), 0U);
+            ASSERT(!first.GetShape().FindField("z"s));
+
+            // assignment of existing field keeps shape
+            const Shape* shape = &first.GetShape();
+            first.SetField("x"s, ObjectHolder::Own(Number{ 7 }));
+            ASSERT_EQUAL(&first.GetShape(), shape);
+
+            // cache remembers offset for shape and does not confuse shapes
+            FieldCache cache;
+            ASSERT_EQUAL(first.FindField("y"s, cache)->TryAs<Number>()->GetValue(), 2);
+            ASSERT_EQUAL(cache.Load().shape, shape);
+            ASSERT_EQUAL(second.FindField("y"s, cache)->TryAs<Number>()->GetValue(), 4);
+            ASSERT_EQUAL(other_order.FindField("y"s, cache)->TryAs<Number>()->GetValue(), 5);
+            ASSERT(first.FindField("z"s) == nullptr);
+
+            FieldCache store_cache;
+            ClassInstance third{ cls };
+            third.SetField("x"s, ObjectHolder::Own(Number{ 8 }), store_cache);
+            ClassInstance fourth{ cls };
+            fourth.SetField("x"s, ObjectHolder::Own(Number{ 9 }), store_cache);
+            ASSERT_EQUAL(&third.GetShape(), &fourth.GetShape());
+            ASSERT_EQUAL(fourth.Fields().at("x"s).TryAs<Number>()->GetValue(), 9);
+
+            // view of fields works as Closure
+            const auto& fields = other_order.Fields();
+            ASSERT_EQUAL(fields.size(), 2U);
+            ASSERT_EQUAL(fields.count("x"s), 1U);
+            ASSERT(fields.find("z"s) == fields.end());
+            ASSERT_EQUAL(fields.find("x"s)->second.TryAs<Number>()->GetValue(), 6);
+            ASSERT_THROWS(fields.at("z"s), out_of_range);
+            vector<string> names;
+            for (const auto& [name, value] : fields) {
+                names.push_back(name);
+            }
+            ASSERT_EQUAL(names, (vector<string>{ "y"s, "x"s }));
+
+            // copy has its own view and values
+            ClassInstance copy = first;
+            copy.Fields()["x"s] = ObjectHolder::Own(Number{ 10 });
+            ASSERT_EQUAL(first.Fields().at("x"s).TryAs<Number>()->GetValue(), 7);
+            ASSERT_EQUAL(&copy.GetShape(), &first.GetShape());
+        }
+
     }  // namespace
 
     void RunObjectsTests(TestRunner& tr) {
@@ -540,13 +815,19 @@ namespace runtime {
         RUN_TEST(tr, runtime::TestComparison);
         RUN_TEST(tr, runtime::TestClass);
         RUN_TEST(tr, runtime::TestClassInstance);
+        RUN_TEST(tr, runtime::TestMethodCache);
+        RUN_TEST(tr, runtime::TestSpecialMethods);
+        RUN_TEST(tr, runtime::TestShapes);
     }
 
     void RunObjectHolderTests(TestRunner& tr) {
         RUN_TEST(tr, runtime::TestNonowning);
         RUN_TEST(tr, runtime::TestOwning);
         RUN_TEST(tr, runtime::TestMove);
+        RUN_TEST(tr, runtime::TestReferenceCounting);
         RUN_TEST(tr, runtime::TestNullptr);
+        RUN_TEST(tr, runtime::TestImmediateValues);
+        RUN_TEST(tr, runtime::TestObjectKinds);
     }
 
 }  // namespace runtime
\ No newline at end of file
@@ -1,26 +1,178 @@
 #include "statement.h"
 
+#include "profiler.h"
+
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 using namespace std;
 
 namespace ast {
 
+    using bytecode::Compiler;
+    using bytecode::OpCode;
     using runtime::Closure;
+    using runtime::Completion;
     using runtime::Context;
     using runtime::ObjectHolder;
 
     namespace {
-        const string ADD_METHOD = "__add__"s;
-        const string INIT_METHOD = "__init__"s;
-        const string STR_METHOD = "__str__"s;
+        // value of constant node or nullopt if node is not constant
+        std::optional<ObjectHolder> ConstantValue(const Statement& node) {
+            if (const auto* number = dynamic_cast<const NumericConst*>(&node)) {
+                return ObjectHolder::Own(runtime::Number(number->GetValue()));
+            }
+            if (const auto* str = dynamic_cast<const StringConst*>(&node)) {
+                return ObjectHolder::Own(runtime::String(str->GetValue()));
+            }
+            if (const auto* boolean = dynamic_cast<const BoolConst*>(&node)) {
+                return ObjectHolder::Own(runtime::Bool(boolean->GetValue()));
+            }
+            if (dynamic_cast<const None*>(&node)) {
+                return ObjectHolder::None();
+            }
+            return std::nullopt;
+        }
+
+        // node which calculates value or nullptr if value has no literal
+        std::unique_ptr<Statement> MakeConstant(const ObjectHolder& value) {
+            if (!value) {
+                return make_unique<None>();
+            }
+            if (const std::optional<int> number = value.TryAsValue<runtime::Number>()) {
+                return make_unique<NumericConst>(runtime::Number(*number));
+            }
+            if (const auto* str = value.TryAs<runtime::String>()) {
+                return make_unique<StringConst>(*str);
+            }
+            if (const std::optional<bool> boolean = value.TryAsValue<runtime::Bool>()) {
+                return make_unique<BoolConst>(runtime::Bool(*boolean));
+            }
+            return nullptr;
+        }
+
+        // calculate operation on values of constant operands, operation which throws
+        // runtime_error is not folded, so it throws at execution
+        template <typename Operation>
+        std::unique_ptr<Statement> FoldConstants(Operation operation,
+            const Statement& lhs, const Statement& rhs) {
+            std::optional<ObjectHolder> left = ConstantValue(lhs);
+            std::optional<ObjectHolder> right = ConstantValue(rhs);
+            if (!left || !right) {
+                return nullptr;
+            }
+            runtime::DummyContext context;
+            try {
+                return MakeConstant(operation(*left, *right, context));
+            }
+            catch (const std::runtime_error&) {
+                return nullptr;
+            }
+        }
+
+        void OptimizeAll(std::vector<std::unique_ptr<Statement>>& nodes) {
+            for (auto& node : nodes) {
+                OptimizeInPlace(node);
+            }
+        }
+
+        // value of node is always Bool
+        bool IsBoolean(const Statement& node) {
+            return dynamic_cast<const BoolConst*>(&node) || dynamic_cast<const Comparison*>(&node)
+                || dynamic_cast<const Not*>(&node) || dynamic_cast<const And*>(&node)
+                || dynamic_cast<const Or*>(&node);
+        }
+
+        void SaveAll(image::Writer& writer, const std::vector<std::unique_ptr<Statement>>& nodes) {
+            writer.WriteU32(static_cast<std::uint32_t>(nodes.size()));
+            for (const auto& node : nodes) {
+                writer.WriteNode(*node);
+            }
+        }
+
+        // node is the value of object.field
+        bool IsFieldOf(const Statement& node, const VariableValue& object, const std::string& field) {
+            const auto* value = dynamic_cast<const VariableValue*>(&node);
+            if (!value || value->GetSlot() != object.GetSlot()) {
+                return false;
+            }
+            const std::vector<std::string>& ids = value->GetDottedIds();
+            const std::vector<std::string>& object_ids = object.GetDottedIds();
+            return ids.size() == object_ids.size() + 1 && ids.back() == field
+                && std::equal(object_ids.begin(), object_ids.end(), ids.begin());
+        }
+
+        OpCode ConstantComparisonCode(runtime::CompareOp op) {
+            switch (op) {
+            case runtime::CompareOp::Equal:
+                return OpCode::EqualConst;
+            case runtime::CompareOp::NotEqual:
+                return OpCode::NotEqualConst;
+            case runtime::CompareOp::Less:
+                return OpCode::LessConst;
+            case runtime::CompareOp::Greater:
+                return OpCode::GreaterConst;
+            case runtime::CompareOp::LessOrEqual:
+                return OpCode::LessOrEqualConst;
+            case runtime::CompareOp::GreaterOrEqual:
+                return OpCode::GreaterOrEqualConst;
+            }
+            throw std::runtime_error("Unknown comparison"s);
+        }
+
+        void SaveSlot(image::Writer& writer, const std::optional<size_t>& slot) {
+            writer.WriteU8(slot ? 1 : 0);
+            if (slot) {
+                writer.WriteU32(static_cast<std::uint32_t>(*slot));
+            }
+        }
     }  // namespace
 
+    void OptimizeInPlace(std::unique_ptr<Statement>& node) {
+        if (std::unique_ptr<Statement> replacement = node->Optimize()) {
+            node = std::move(replacement);
+        }
+    }
+
+    std::unique_ptr<Statement> Optimize(std::unique_ptr<Statement> program) {
+        OptimizeInPlace(program);
+        return program;
+    }
+
     /*Assignment*/
     ObjectHolder Assignment::Execute(Closure& closure, Context& context) {
-        closure[var_name_] = value_->Execute(closure, context);
-        return closure.at(var_name_);
+        ObjectHolder value = value_->Execute(closure, context);
+        if (slot_) {
+            context.GetCurrentFrame()->Set(*slot_, value);
+        }
+        else {
+            closure[var_name_] = value;
+        }
+        return value;
+    }
+
+    void Assignment::Compile(Compiler& compiler) {
+        value_->Compile(compiler);
+        if (slot_) {
+            compiler.Emit(OpCode::StoreSlot, static_cast<std::uint32_t>(*slot_));
+        }
+        else {
+            compiler.Emit(OpCode::StoreName, compiler.AddName(var_name_));
+        }
+    }
+
+    std::unique_ptr<Statement> Assignment::Optimize() {
+        OptimizeInPlace(value_);
+        return nullptr;
+    }
+
+    void Assignment::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Assignment);
+        writer.WriteString(var_name_);
+        SaveSlot(writer, slot_);
+        writer.WriteNode(*value_);
     }
 
     Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv) :
@@ -29,6 +181,12 @@ namespace ast {
 
     }
 
+    Assignment::Assignment(std::string var, size_t slot, std::unique_ptr<Statement> rv) :
+        var_name_(std::move(var)), slot_(slot), value_(std::move(rv))
+    {
+
+    }
+
     /*Variable value*/
     VariableValue::VariableValue(const std::string& var_name) 
         : var_name_chain_{ var_name } 
@@ -38,19 +196,30 @@ namespace ast {
 
     VariableValue::VariableValue(std::vector<std::string> dotted_ids) 
         : var_name_chain_{ std::move(dotted_ids) } 
+        , field_caches_(var_name_chain_.size())
+    {
+
+    }
+
+    VariableValue::VariableValue(std::vector<std::string> dotted_ids, size_t slot)
+        : var_name_chain_{ std::move(dotted_ids) }
+        , slot_(slot)
+        , field_caches_(var_name_chain_.size())
     {
 
     }
 
     ObjectHolder VariableValue::FindVariable(Closure& closure, const std::string& name) {
-        if (closure.count(name) == 0) {
+        auto it = closure.find(name);
+        if (it == closure.end()) {
             throw std::runtime_error("Unknown variable"s);
         }
-        return closure.at(name);
+        return it->second;
     }
 
-    ObjectHolder VariableValue::Execute(Closure& closure, Context&) {
-        ObjectHolder obj = VariableValue::FindVariable(closure, var_name_chain_[0]);
+    ObjectHolder VariableValue::Execute(Closure& closure, Context& context) {
+        ObjectHolder obj = slot_ ? context.GetCurrentFrame()->Get(*slot_)
+            : VariableValue::FindVariable(closure, var_name_chain_[0]);
         if (var_name_chain_.size() == 1) {
             return obj;
         }
@@ -60,12 +229,36 @@ namespace ast {
             if (!class_ins_ptr) {
                 throw std::runtime_error("Wrong type"s);
             }
-            Closure& fields_closure = class_ins_ptr->Fields();
-            obj = VariableValue::FindVariable(fields_closure, var_name_chain_[i]);
+            runtime::ObjectHolder* field = class_ins_ptr->FindField(var_name_chain_[i], field_caches_[i]);
+            if (!field) {
+                throw std::runtime_error("Unknown variable"s);
+            }
+            obj = *field;
         }
         return obj;
     }
 
+    void VariableValue::Compile(Compiler& compiler) {
+        if (slot_) {
+            compiler.Emit(OpCode::LoadSlot, static_cast<std::uint32_t>(*slot_));
+        }
+        else {
+            compiler.Emit(OpCode::LoadName, compiler.AddName(var_name_chain_[0]));
+        }
+        for (size_t i = 1; i < var_name_chain_.size(); ++i) {
+            compiler.Emit(OpCode::LoadField, compiler.AddFieldSite(var_name_chain_[i]));
+        }
+    }
+
+    void VariableValue::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::VariableValue);
+        writer.WriteU32(static_cast<std::uint32_t>(var_name_chain_.size()));
+        for (const std::string& name : var_name_chain_) {
+            writer.WriteString(name);
+        }
+        SaveSlot(writer, slot_);
+    }
+
     /*Print*/
     unique_ptr<Print> Print::Variable(const std::string& name) {
         unique_ptr<Statement> ptr(new VariableValue(name));
@@ -82,24 +275,42 @@ namespace ast {
     }
 
     ObjectHolder Print::Execute(Closure& closure, Context& context) {
-        auto& os = context.GetOutputStream();
+        runtime::OutputSink& output = context.GetOutput();
         bool is_not_first = false;
         for (auto& arg_ptr : args_) {
             if (is_not_first) {
-                os << " ";
-            }
-            if (ObjectHolder holder = arg_ptr->Execute(closure, context); holder) {
-                holder->Print(os, context);
-            }
-            else {
-                os << "None";
+                output.Write(' ');
             }
+            runtime::PrintObject(arg_ptr->Execute(closure, context), context);
             is_not_first = true;
         }
-        os << "\n";
+        output.Write('\n');
         return {};
     }
 
+    void Print::Compile(Compiler& compiler) {
+        bool is_not_first = false;
+        for (auto& arg_ptr : args_) {
+            if (is_not_first) {
+                compiler.Emit(OpCode::PrintSeparator);
+            }
+            arg_ptr->Compile(compiler);
+            compiler.Emit(OpCode::PrintValue);
+            is_not_first = true;
+        }
+        compiler.Emit(OpCode::PrintEnd);
+    }
+
+    std::unique_ptr<Statement> Print::Optimize() {
+        OptimizeAll(args_);
+        return nullptr;
+    }
+
+    void Print::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Print);
+        SaveAll(writer, args_);
+    }
+
     
     /*Method call*/
     MethodCall::MethodCall(std::unique_ptr<Statement> object, std::string method,
@@ -112,38 +323,71 @@ namespace ast {
     }
 
     ObjectHolder MethodCall::Execute(Closure& closure, Context& context) {
-        std::vector<ObjectHolder> arg_values;
-        for (auto& ptr : args_) {
-            arg_values.push_back(ptr->Execute(closure, context));
+        runtime::StackValues arg_values(context.GetValueStack(), args_.size());
+        for (size_t i = 0; i < args_.size(); ++i) {
+            arg_values[i] = args_[i]->Execute(closure, context);
         }
         ObjectHolder holder = obj_->Execute(closure, context);
-        if (auto obj = holder.TryAs<runtime::ClassInstance>(); 
-            obj && obj->HasMethod(method_name_, arg_values.size())) {
-            return obj->Call(method_name_, arg_values, context);
+        if (auto obj = holder.TryAs<runtime::ClassInstance>()) {
+            const runtime::Method* method = method_cache_.Find(obj->GetClass(), method_name_);
+            if (method && method->formal_params.size() == arg_values.Size()) {
+                return obj->Call(*method, arg_values.Data(), arg_values.Size(), context);
+            }
         }
         throw std::runtime_error("Wrong method call"s);
     }
 
+    void MethodCall::Compile(Compiler& compiler) {
+        for (auto& ptr : args_) {
+            ptr->Compile(compiler);
+        }
+        obj_->Compile(compiler);
+        compiler.Emit(OpCode::CallMethod, compiler.AddCallSite(method_name_),
+            static_cast<std::uint16_t>(args_.size()));
+    }
+
+    std::unique_ptr<Statement> MethodCall::Optimize() {
+        OptimizeInPlace(obj_);
+        OptimizeAll(args_);
+        // parser gives slot 0 to self
+        if (const auto* object = dynamic_cast<const VariableValue*>(obj_.get());
+            object && object->GetSlot() == size_t{ 0 } && object->GetDottedIds().size() == 1) {
+            return make_unique<SelfMethodCall>(std::move(method_name_), std::move(args_));
+        }
+        return nullptr;
+    }
+
+    void MethodCall::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::MethodCall);
+        writer.WriteNode(*obj_);
+        writer.WriteString(method_name_);
+        SaveAll(writer, args_);
+    }
+
 
     /*Transformation into string*/
     ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
-        ObjectHolder holder = arg_->Execute(closure, context);
-        runtime::Object* res;
-        if (auto obj = holder.TryAs<runtime::ClassInstance>();
-            obj && obj->HasMethod(STR_METHOD, 0)) {
-            res = obj->Call(STR_METHOD, {}, context).Get();
-        }
-        else {
-            res = holder.Get();
-        }
-        std::ostringstream os;
-        if (res) {
-            res->Print(os, context);
-        }
-        else {
-            os << "None";
+        return runtime::Stringify(arg_->Execute(closure, context), context);
+    }
+
+    void Stringify::Compile(Compiler& compiler) {
+        arg_->Compile(compiler);
+        compiler.Emit(OpCode::Stringify);
+    }
+
+    std::unique_ptr<Statement> Stringify::Optimize() {
+        OptimizeInPlace(arg_);
+        std::optional<ObjectHolder> value = ConstantValue(*arg_);
+        if (!value) {
+            return nullptr;
         }
-        return ObjectHolder::Own(std::move(runtime::String{os.str()}));
+        runtime::DummyContext context;
+        return MakeConstant(runtime::Stringify(*value, context));
+    }
+
+    void Stringify::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Stringify);
+        writer.WriteNode(*arg_);
     }
 
 
@@ -151,84 +395,171 @@ namespace ast {
     ObjectHolder Add::Execute(Closure& closure, Context& context) {
         ObjectHolder left = lhs_->Execute(closure, context);
         ObjectHolder right = rhs_->Execute(closure, context);
+        // temporary lhs (result of other operation) is changed in place
+        return runtime::Add(std::move(left), right, context);
+    }
 
-        if (left.TryAs<runtime::Number>() && right.TryAs<runtime::Number>()) {
-            int res = left.TryAs<runtime::Number>()->GetValue() + right.TryAs<runtime::Number>()->GetValue();
-            return ObjectHolder::Own(runtime::Number(res));
-        }
-
-        if (left.TryAs<runtime::String>() && right.TryAs<runtime::String>()) {
-            std::string res = left.TryAs<runtime::String>()->GetValue() + right.TryAs<runtime::String>()->GetValue();
-            return ObjectHolder::Own(runtime::String(res));
-        }
+    void Add::Compile(Compiler& compiler) {
+        lhs_->Compile(compiler);
+        rhs_->Compile(compiler);
+        compiler.Emit(OpCode::Add);
+    }
 
-        if (runtime::ClassInstance* obj_ptr = left.TryAs<runtime::ClassInstance>();
-            obj_ptr && obj_ptr->HasMethod(ADD_METHOD, 1)) {
-            return obj_ptr->Call(ADD_METHOD, { right }, context);
-        }
+    std::unique_ptr<Statement> Add::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        return FoldConstants([](const ObjectHolder& left, const ObjectHolder& right, Context& context) {
+            return runtime::Add(left, right, context);
+        }, *lhs_, *rhs_);
+    }
 
-        throw std::runtime_error("ADD is unavailable"s);
+    void Add::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Add);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
     ObjectHolder Sub::Execute(Closure& closure, Context& context) {
         ObjectHolder left = lhs_->Execute(closure, context);
         ObjectHolder right = rhs_->Execute(closure, context);
+        return runtime::Sub(left, right, context);
+    }
 
-        if (left.TryAs<runtime::Number>() && right.TryAs<runtime::Number>()) {
-            int res = left.TryAs<runtime::Number>()->GetValue() - right.TryAs<runtime::Number>()->GetValue();
-            return ObjectHolder::Own(runtime::Number(res));
-        }
+    void Sub::Compile(Compiler& compiler) {
+        lhs_->Compile(compiler);
+        rhs_->Compile(compiler);
+        compiler.Emit(OpCode::Sub);
+    }
+
+    std::unique_ptr<Statement> Sub::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        return FoldConstants(runtime::Sub, *lhs_, *rhs_);
+    }
 
-        throw std::runtime_error("SUB is unavailable"s);
+    void Sub::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Sub);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
     ObjectHolder Mult::Execute(Closure& closure, Context& context) {
         ObjectHolder left = lhs_->Execute(closure, context);
         ObjectHolder right = rhs_->Execute(closure, context);
+        return runtime::Mult(left, right, context);
+    }
 
-        if (left.TryAs<runtime::Number>() && right.TryAs<runtime::Number>()) {
-            int res = left.TryAs<runtime::Number>()->GetValue() * right.TryAs<runtime::Number>()->GetValue();
-            return ObjectHolder::Own(runtime::Number(res));
-        }
+    void Mult::Compile(Compiler& compiler) {
+        lhs_->Compile(compiler);
+        rhs_->Compile(compiler);
+        compiler.Emit(OpCode::Mult);
+    }
+
+    std::unique_ptr<Statement> Mult::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        return FoldConstants(runtime::Mult, *lhs_, *rhs_);
+    }
 
-        throw std::runtime_error("MULT is unavailable"s);
+    void Mult::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Mult);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
     ObjectHolder Div::Execute(Closure& closure, Context& context) {
         ObjectHolder left = lhs_->Execute(closure, context);
         ObjectHolder right = rhs_->Execute(closure, context);
+        return runtime::Div(left, right, context);
+    }
 
-        if (left.TryAs<runtime::Number>() && right.TryAs<runtime::Number>()) {
-            if (int den = right.TryAs<runtime::Number>()->GetValue(); den != 0) {
-                int res = left.TryAs<runtime::Number>()->GetValue() / right.TryAs<runtime::Number>()->GetValue();
-                return ObjectHolder::Own(runtime::Number(res));
-            }
-            else {
-                throw std::runtime_error("Denominator is 0"s);
-            }
-        }
+    void Div::Compile(Compiler& compiler) {
+        lhs_->Compile(compiler);
+        rhs_->Compile(compiler);
+        compiler.Emit(OpCode::Div);
+    }
+
+    std::unique_ptr<Statement> Div::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        return FoldConstants(runtime::Div, *lhs_, *rhs_);
+    }
 
-        throw std::runtime_error("MULT is unavailable"s);
+    void Div::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Div);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
 
     /*Block of several commands*/
+    void Compound::AddStatement(std::unique_ptr<Statement> stmt, std::uint32_t line) {
+        statements_.push_back(std::move(stmt));
+        lines_.push_back(line);
+    }
+
     ObjectHolder Compound::Execute(Closure& closure, Context& context) {
-        for (auto& ptr : commands_) {
-            ObjectHolder holder = ptr->Execute(closure, context);
-            if (dynamic_cast<Return*>(ptr.get()) || 
-                (dynamic_cast<IfElse*>(ptr.get()) && holder) ||
-                (dynamic_cast<Compound*>(ptr.get()) && holder) ) {
+        runtime::Profiler* profiler = context.GetProfiler();
+        for (size_t i = 0; i < statements_.size(); ++i) {
+            ObjectHolder holder = statements_[i]->Execute(closure, context);
+            if (context.GetCompletion() != Completion::Normal) {
+                // statements which contain return are not sampled after it, like in bytecode
+                if (profiler && dynamic_cast<const Return*>(statements_[i].get())) {
+                    profiler->OnStatement(lines_[i]);
+                }
                 return holder;
             }
+            if (profiler) {
+                profiler->OnStatement(lines_[i]);
+            }
         }
         return {};
     }
 
+    void Compound::Compile(Compiler& compiler) {
+        for (size_t i = 0; i < statements_.size(); ++i) {
+            compiler.SetLine(lines_[i]);
+            statements_[i]->Compile(compiler);
+            compiler.Emit(OpCode::Pop, lines_[i]);
+        }
+        compiler.Emit(OpCode::PushNone);
+    }
+
+    std::unique_ptr<Statement> Compound::Optimize() {
+        OptimizeAll(statements_);
+        return nullptr;
+    }
+
+    void Compound::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Compound);
+        writer.WriteU32(static_cast<std::uint32_t>(statements_.size()));
+        for (size_t i = 0; i < statements_.size(); ++i) {
+            writer.WriteU32(lines_[i]);
+            writer.WriteNode(*statements_[i]);
+        }
+    }
+
 
     /*Return statement*/
     ObjectHolder Return::Execute(Closure& closure, Context& context) {
-        return statement_->Execute(closure, context);
+        ObjectHolder result = statement_->Execute(closure, context);
+        context.SetCompletion(Completion::Return);
+        return result;
+    }
+
+    void Return::Compile(Compiler& compiler) {
+        statement_->Compile(compiler);
+        compiler.Emit(OpCode::Return, compiler.GetLine());
+    }
+
+    std::unique_ptr<Statement> Return::Optimize() {
+        OptimizeInPlace(statement_);
+        return nullptr;
+    }
+
+    void Return::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Return);
+        writer.WriteNode(*statement_);
     }
 
 
@@ -240,9 +571,54 @@ namespace ast {
     }
 
     ObjectHolder ClassDefinition::Execute(Closure& closure, Context&) {
-        closure[class_.TryAs<runtime::Class>()->GetName()] = std::move(class_);
+        // the class stays in the node, so the program can be executed again
+        closure[class_.TryAs<runtime::Class>()->GetName()] = class_;
         return {};
     }
+
+    void ClassDefinition::Compile(Compiler& compiler) {
+        compiler.CompileClass(*class_.TryAs<runtime::Class>());
+        compiler.Emit(OpCode::DefineClass, compiler.AddConstant(class_));
+    }
+
+    std::unique_ptr<Statement> ClassDefinition::Optimize() {
+        for (runtime::Method* method : class_.TryAs<runtime::Class>()->GetOwnMethods()) {
+            if (method->source) {
+                method->source->Defer(*method, [](runtime::Method& loaded) {
+                    OptimizeInPlace(loaded.body);
+                });
+                continue;
+            }
+            OptimizeInPlace(method->body);
+        }
+        return nullptr;
+    }
+
+    void ClassDefinition::Save(image::Writer& writer) const {
+        runtime::Class& cls = *class_.TryAs<runtime::Class>();
+        writer.WriteTag(image::NodeTag::ClassDefinition);
+        writer.WriteString(cls.GetName());
+        writer.WriteU8(cls.GetParent() ? 1 : 0);
+        if (cls.GetParent()) {
+            writer.WriteU32(writer.GetClassIndex(*cls.GetParent()));
+        }
+        std::vector<runtime::Method*> methods = cls.GetOwnMethods();
+        writer.WriteU32(static_cast<std::uint32_t>(methods.size()));
+        for (const runtime::Method* method : methods) {
+            // image keeps the whole tree, so lazy bodies are parsed
+            if (method->source) {
+                method->source->Load(*method);
+            }
+            writer.WriteString(method->name);
+            writer.WriteU32(static_cast<std::uint32_t>(method->formal_params.size()));
+            for (const std::string& param : method->formal_params) {
+                writer.WriteString(param);
+            }
+            writer.WriteU32(static_cast<std::uint32_t>(method->frame_size));
+            writer.WriteNode(*method->body);
+        }
+        writer.AddClass(cls);
+    }
     
 
     /*Assignment value to class field*/
@@ -260,8 +636,38 @@ namespace ast {
         if (!ins_ptr) {
             throw std::runtime_error("Object is not a class instance"s);
         }
-        ins_ptr->Fields()[field_name_] = std::move(value_->Execute(closure, context));
-        return ins_ptr->Fields().at(field_name_);
+        return ins_ptr->SetField(field_name_, value_->Execute(closure, context), field_cache_);
+    }
+
+    void FieldAssignment::Compile(Compiler& compiler) {
+        obj_.Compile(compiler);
+        value_->Compile(compiler);
+        compiler.Emit(OpCode::StoreField, compiler.AddFieldSite(field_name_));
+    }
+
+    std::unique_ptr<Statement> FieldAssignment::Optimize() {
+        OptimizeInPlace(value_);
+        const BinaryOperation* operation = dynamic_cast<const Add*>(value_.get());
+        const bool subtract = !operation;
+        if (subtract) {
+            operation = dynamic_cast<const Sub*>(value_.get());
+        }
+        if (operation && IsFieldOf(operation->GetLhs(), obj_, field_name_)) {
+            if (const auto* number = dynamic_cast<const NumericConst*>(&operation->GetRhs())) {
+                return make_unique<FieldIncrement>(std::move(obj_), std::move(field_name_), number->GetValue(), subtract);
+            }
+        }
+        if (auto* source = dynamic_cast<VariableValue*>(value_.get()); source && source->GetDottedIds().size() > 1) {
+            return make_unique<FieldCopy>(std::move(obj_), std::move(field_name_), std::move(*source));
+        }
+        return nullptr;
+    }
+
+    void FieldAssignment::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::FieldAssignment);
+        obj_.Save(writer);
+        writer.WriteString(field_name_);
+        writer.WriteNode(*value_);
     }
 
 
@@ -289,38 +695,140 @@ namespace ast {
         }
     }
 
+    void IfElse::Compile(Compiler& compiler) {
+        condition_->Compile(compiler);
+        bytecode::JumpLabel to_else = compiler.EmitJump(OpCode::JumpIfFalse);
+        if_body_->Compile(compiler);
+        bytecode::JumpLabel to_end = compiler.EmitJump(OpCode::Jump);
+        compiler.PatchJump(to_else);
+        if (else_body_) {
+            else_body_->Compile(compiler);
+        }
+        else {
+            compiler.Emit(OpCode::PushNone);
+        }
+        compiler.PatchJump(to_end);
+    }
+
+    std::unique_ptr<Statement> IfElse::Optimize() {
+        OptimizeInPlace(condition_);
+        OptimizeInPlace(if_body_);
+        if (else_body_) {
+            OptimizeInPlace(else_body_);
+        }
+
+        // only the taken branch is left if condition is constant
+        std::optional<ObjectHolder> condition = ConstantValue(*condition_);
+        if (!condition) {
+            return nullptr;
+        }
+        if (runtime::IsTrue(*condition)) {
+            return std::move(if_body_);
+        }
+        return else_body_ ? std::move(else_body_) : make_unique<None>();
+    }
+
+    void IfElse::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::IfElse);
+        writer.WriteNode(*condition_);
+        writer.WriteNode(*if_body_);
+        writer.WriteOptionalNode(else_body_.get());
+    }
+
 
     /*Different logic operations*/
     ObjectHolder Or::Execute(Closure& closure, Context& context) {
-        ObjectHolder left = lhs_->Execute(closure, context);
-        ObjectHolder right = rhs_->Execute(closure, context);
-
-        if (runtime::IsTrue(left)) {
+        if (runtime::IsTrue(lhs_->Execute(closure, context))) {
             return ObjectHolder::Own(runtime::Bool(true));
         }
-        else {
-            if (runtime::IsTrue(right)) {
-                return ObjectHolder::Own(runtime::Bool(true));
-            }
+        return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
+    }
+
+    void Or::Compile(Compiler& compiler) {
+        // lhs jumps to True, otherwise the result is Bool value of rhs
+        lhs_->Compile(compiler);
+        bytecode::JumpLabel lhs_true = compiler.EmitJump(OpCode::JumpIfTrue);
+        rhs_->Compile(compiler);
+        bytecode::JumpLabel rhs_true = compiler.EmitJump(OpCode::JumpIfTrue);
+        compiler.Emit(OpCode::PushConst, compiler.AddConstant(ObjectHolder::Own(runtime::Bool(false))));
+        bytecode::JumpLabel to_end = compiler.EmitJump(OpCode::Jump);
+        compiler.PatchJump(lhs_true);
+        compiler.PatchJump(rhs_true);
+        compiler.Emit(OpCode::PushConst, compiler.AddConstant(ObjectHolder::Own(runtime::Bool(true))));
+        compiler.PatchJump(to_end);
+    }
+
+    std::unique_ptr<Statement> Or::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        std::optional<ObjectHolder> left = ConstantValue(*lhs_);
+        if (!left) {
+            return nullptr;
+        }
+        // rhs is not calculated after true lhs
+        if (runtime::IsTrue(*left)) {
+            return make_unique<BoolConst>(runtime::Bool(true));
+        }
+        if (IsBoolean(*rhs_)) {
+            return std::move(rhs_);
         }
+        if (std::optional<ObjectHolder> right = ConstantValue(*rhs_)) {
+            return make_unique<BoolConst>(runtime::Bool(runtime::IsTrue(*right)));
+        }
+        return nullptr;
+    }
 
-        return ObjectHolder::Own(runtime::Bool(false));
+    void Or::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Or);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
     ObjectHolder And::Execute(Closure& closure, Context& context) {
-        ObjectHolder left = lhs_->Execute(closure, context);
-        ObjectHolder right = rhs_->Execute(closure, context);
-
-        if (!runtime::IsTrue(left)) {
+        if (!runtime::IsTrue(lhs_->Execute(closure, context))) {
             return ObjectHolder::Own(runtime::Bool(false));
         }
-        else {
-            if (!runtime::IsTrue(right)) {
-                return ObjectHolder::Own(runtime::Bool(false));
-            }
+        return ObjectHolder::Own(runtime::Bool(runtime::IsTrue(rhs_->Execute(closure, context))));
+    }
+
+    void And::Compile(Compiler& compiler) {
+        // lhs jumps to False, otherwise the result is Bool value of rhs
+        lhs_->Compile(compiler);
+        bytecode::JumpLabel lhs_false = compiler.EmitJump(OpCode::JumpIfFalse);
+        rhs_->Compile(compiler);
+        bytecode::JumpLabel rhs_false = compiler.EmitJump(OpCode::JumpIfFalse);
+        compiler.Emit(OpCode::PushConst, compiler.AddConstant(ObjectHolder::Own(runtime::Bool(true))));
+        bytecode::JumpLabel to_end = compiler.EmitJump(OpCode::Jump);
+        compiler.PatchJump(lhs_false);
+        compiler.PatchJump(rhs_false);
+        compiler.Emit(OpCode::PushConst, compiler.AddConstant(ObjectHolder::Own(runtime::Bool(false))));
+        compiler.PatchJump(to_end);
+    }
+
+    std::unique_ptr<Statement> And::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        std::optional<ObjectHolder> left = ConstantValue(*lhs_);
+        if (!left) {
+            return nullptr;
+        }
+        // rhs is not calculated after false lhs
+        if (!runtime::IsTrue(*left)) {
+            return make_unique<BoolConst>(runtime::Bool(false));
+        }
+        if (IsBoolean(*rhs_)) {
+            return std::move(rhs_);
+        }
+        if (std::optional<ObjectHolder> right = ConstantValue(*rhs_)) {
+            return make_unique<BoolConst>(runtime::Bool(runtime::IsTrue(*right)));
         }
+        return nullptr;
+    }
 
-        return ObjectHolder::Own(runtime::Bool(true));
+    void And::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::And);
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
     }
 
     ObjectHolder Not::Execute(Closure& closure, Context& context) {
@@ -333,20 +841,228 @@ namespace ast {
         return ObjectHolder::Own(runtime::Bool(true));
     }
 
+    void Not::Compile(Compiler& compiler) {
+        arg_->Compile(compiler);
+        compiler.Emit(OpCode::Not);
+    }
+
+    std::unique_ptr<Statement> Not::Optimize() {
+        OptimizeInPlace(arg_);
+        if (std::optional<ObjectHolder> value = ConstantValue(*arg_)) {
+            return make_unique<BoolConst>(runtime::Bool(!runtime::IsTrue(*value)));
+        }
+
+        // not not x is x only if x is Bool, otherwise it is conversion of x to Bool
+        if (auto* inner = dynamic_cast<Not*>(arg_.get()); inner && IsBoolean(*inner->arg_)) {
+            return std::move(inner->arg_);
+        }
+        return nullptr;
+    }
+
+    void Not::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Not);
+        writer.WriteNode(*arg_);
+    }
+
 
     /*Comparison*/
-    Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Statement> rhs)
-        : BinaryOperation(std::move(lhs), std::move(rhs))
-        , cmp_(std::move(cmp))
+    void Comparison::Compile(Compiler& compiler) {
+        lhs_->Compile(compiler);
+        rhs_->Compile(compiler);
+        switch (GetOperator()) {
+        case runtime::CompareOp::Equal:
+            compiler.Emit(OpCode::Equal);
+            break;
+        case runtime::CompareOp::NotEqual:
+            compiler.Emit(OpCode::NotEqual);
+            break;
+        case runtime::CompareOp::Less:
+            compiler.Emit(OpCode::Less);
+            break;
+        case runtime::CompareOp::Greater:
+            compiler.Emit(OpCode::Greater);
+            break;
+        case runtime::CompareOp::LessOrEqual:
+            compiler.Emit(OpCode::LessOrEqual);
+            break;
+        case runtime::CompareOp::GreaterOrEqual:
+            compiler.Emit(OpCode::GreaterOrEqual);
+            break;
+        }
+    }
+
+    std::unique_ptr<Statement> Comparison::Optimize() {
+        OptimizeInPlace(lhs_);
+        OptimizeInPlace(rhs_);
+        if (auto folded = FoldConstants([op = GetOperator()](const ObjectHolder& left, const ObjectHolder& right, Context& context) {
+            return ObjectHolder::Own(runtime::Bool(runtime::CompareObjects(op, left, right, context)));
+        }, *lhs_, *rhs_)) {
+            return folded;
+        }
+        if (const auto* number = dynamic_cast<const NumericConst*>(rhs_.get())) {
+            return MakeConstantComparison(GetOperator(), std::move(lhs_), number->GetValue());
+        }
+        return nullptr;
+    }
+
+    void Comparison::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::Comparison);
+        writer.WriteU8(static_cast<std::uint8_t>(GetOperator()));
+        writer.WriteNode(*lhs_);
+        writer.WriteNode(*rhs_);
+    }
+
+
+    /*Fused nodes*/
+    FieldIncrement::FieldIncrement(VariableValue object, std::string field_name,
+        runtime::Number constant, bool subtract)
+        : obj_(std::move(object))
+        , field_name_(std::move(field_name))
+        , constant_(ObjectHolder::Own(constant))
+        , subtract_(subtract)
     {
 
     }
 
-    ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
-        ObjectHolder left = lhs_->Execute(closure, context);
-        ObjectHolder right = rhs_->Execute(closure, context);
+    ObjectHolder FieldIncrement::Execute(Closure& closure, Context& context) {
+        ObjectHolder object = obj_.Execute(closure, context);
+        runtime::ClassInstance* ins_ptr = object.TryAs<runtime::ClassInstance>();
+        if (!ins_ptr) {
+            throw std::runtime_error("Object is not a class instance"s);
+        }
+        return runtime::AddToField(*ins_ptr, field_name_, field_cache_, constant_, subtract_, context);
+    }
+
+    void FieldIncrement::Compile(Compiler& compiler) {
+        obj_.Compile(compiler);
+        compiler.Emit(OpCode::PushConst, compiler.AddConstant(constant_));
+        compiler.Emit(subtract_ ? OpCode::SubFromField : OpCode::AddToField, compiler.AddFieldSite(field_name_));
+    }
+
+    void FieldIncrement::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::FieldIncrement);
+        obj_.Save(writer);
+        writer.WriteString(field_name_);
+        writer.WriteI32(*constant_.TryAsValue<runtime::Number>());
+        writer.WriteU8(subtract_ ? 1 : 0);
+    }
+
+    FieldCopy::FieldCopy(VariableValue object, std::string field_name, VariableValue source)
+        : obj_(std::move(object))
+        , field_name_(std::move(field_name))
+        , source_(std::move(source))
+    {
+
+    }
+
+    ObjectHolder FieldCopy::Execute(Closure& closure, Context& context) {
+        ObjectHolder object = obj_.Execute(closure, context);
+        runtime::ClassInstance* ins_ptr = object.TryAs<runtime::ClassInstance>();
+        if (!ins_ptr) {
+            throw std::runtime_error("Object is not a class instance"s);
+        }
+        return ins_ptr->SetField(field_name_, source_.Execute(closure, context), field_cache_);
+    }
+
+    void FieldCopy::Compile(Compiler& compiler) {
+        obj_.Compile(compiler);
+        source_.Compile(compiler);
+        compiler.Emit(OpCode::StoreField, compiler.AddFieldSite(field_name_));
+    }
+
+    void FieldCopy::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::FieldCopy);
+        obj_.Save(writer);
+        writer.WriteString(field_name_);
+        source_.Save(writer);
+    }
+
+    template <runtime::CompareOp op>
+    void ConstantComparisonOf<op>::Compile(Compiler& compiler) {
+        this->lhs_->Compile(compiler);
+        compiler.Emit(ConstantComparisonCode(op), compiler.AddConstant(constant_));
+    }
+
+    template <runtime::CompareOp op>
+    std::unique_ptr<Statement> ConstantComparisonOf<op>::Optimize() {
+        OptimizeInPlace(this->lhs_);
+        return nullptr;
+    }
+
+    template <runtime::CompareOp op>
+    void ConstantComparisonOf<op>::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::ConstantComparison);
+        writer.WriteU8(static_cast<std::uint8_t>(op));
+        writer.WriteNode(*this->lhs_);
+        writer.WriteI32(*constant_.TryAsValue<runtime::Number>());
+    }
+
+    template class ConstantComparisonOf<runtime::CompareOp::Equal>;
+    template class ConstantComparisonOf<runtime::CompareOp::NotEqual>;
+    template class ConstantComparisonOf<runtime::CompareOp::Less>;
+    template class ConstantComparisonOf<runtime::CompareOp::Greater>;
+    template class ConstantComparisonOf<runtime::CompareOp::LessOrEqual>;
+    template class ConstantComparisonOf<runtime::CompareOp::GreaterOrEqual>;
+
+    std::unique_ptr<Comparison> MakeConstantComparison(runtime::CompareOp op,
+        std::unique_ptr<Statement> lhs, runtime::Number constant) {
+        switch (op) {
+        case runtime::CompareOp::Equal:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::Equal>>(std::move(lhs), constant);
+        case runtime::CompareOp::NotEqual:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::NotEqual>>(std::move(lhs), constant);
+        case runtime::CompareOp::Less:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::Less>>(std::move(lhs), constant);
+        case runtime::CompareOp::Greater:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::Greater>>(std::move(lhs), constant);
+        case runtime::CompareOp::LessOrEqual:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::LessOrEqual>>(std::move(lhs), constant);
+        case runtime::CompareOp::GreaterOrEqual:
+            return make_unique<ConstantComparisonOf<runtime::CompareOp::GreaterOrEqual>>(std::move(lhs), constant);
+        }
+        throw std::runtime_error("Unknown comparison"s);
+    }
+
+    SelfMethodCall::SelfMethodCall(std::string method, std::vector<std::unique_ptr<Statement>> args)
+        : method_name_(std::move(method))
+        , args_(std::move(args))
+    {
 
-        return ObjectHolder::Own(runtime::Bool(cmp_(left, right, context)));
+    }
+
+    ObjectHolder SelfMethodCall::Execute(Closure& closure, Context& context) {
+        runtime::StackValues arg_values(context.GetValueStack(), args_.size());
+        for (size_t i = 0; i < args_.size(); ++i) {
+            arg_values[i] = args_[i]->Execute(closure, context);
+        }
+        // frame of caller keeps self while the method runs
+        if (auto* self = context.GetCurrentFrame()->Get(0).TryAs<runtime::ClassInstance>()) {
+            const runtime::Method* method = method_cache_.Find(self->GetClass(), method_name_);
+            if (method && method->formal_params.size() == arg_values.Size()) {
+                return self->Call(*method, arg_values.Data(), arg_values.Size(), context);
+            }
+        }
+        throw std::runtime_error("Wrong method call"s);
+    }
+
+    void SelfMethodCall::Compile(Compiler& compiler) {
+        for (auto& ptr : args_) {
+            ptr->Compile(compiler);
+        }
+        compiler.Emit(OpCode::LoadSlot, 0);
+        compiler.Emit(OpCode::CallMethod, compiler.AddCallSite(method_name_),
+            static_cast<std::uint16_t>(args_.size()));
+    }
+
+    std::unique_ptr<Statement> SelfMethodCall::Optimize() {
+        OptimizeAll(args_);
+        return nullptr;
+    }
+
+    void SelfMethodCall::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::SelfMethodCall);
+        writer.WriteString(method_name_);
+        SaveAll(writer, args_);
     }
 
 
@@ -367,18 +1083,44 @@ namespace ast {
     ObjectHolder NewInstance::Execute(Closure& closure, Context& context) {
         ObjectHolder new_obj = ObjectHolder::Own(runtime::ClassInstance(class_));
         
-        if (const runtime::Method* init_ptr = class_.GetMethod(INIT_METHOD);
+        if (const runtime::Method* init_ptr = class_.GetSpecialMethod(runtime::SpecialMethod::Init);
             init_ptr && init_ptr->formal_params.size() == args_.size()) {
-            std::vector<ObjectHolder> args;
-            for (auto& arg : args_) {
-                args.push_back(arg->Execute(closure, context));
+            runtime::StackValues args(context.GetValueStack(), args_.size());
+            for (size_t i = 0; i < args_.size(); ++i) {
+                args[i] = args_[i]->Execute(closure, context);
             }
-            new_obj.TryAs<runtime::ClassInstance>()->Call(INIT_METHOD,  args, context); 
+            new_obj.TryAs<runtime::ClassInstance>()->Call(*init_ptr, args.Data(), args.Size(), context);
         }
        
         return new_obj;
     }
 
+    void NewInstance::Compile(Compiler& compiler) {
+        // methods of class are known, so the call of __init__ is chosen at compile time
+        if (const runtime::Method* init_ptr = class_.GetSpecialMethod(runtime::SpecialMethod::Init);
+            init_ptr && init_ptr->formal_params.size() == args_.size()) {
+            for (auto& arg : args_) {
+                arg->Compile(compiler);
+            }
+            compiler.Emit(OpCode::NewInstanceInit, compiler.AddClass(class_),
+                static_cast<std::uint16_t>(args_.size()));
+        }
+        else {
+            compiler.Emit(OpCode::NewInstance, compiler.AddClass(class_));
+        }
+    }
+
+    std::unique_ptr<Statement> NewInstance::Optimize() {
+        OptimizeAll(args_);
+        return nullptr;
+    }
+
+    void NewInstance::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::NewInstance);
+        writer.WriteU32(writer.GetClassIndex(class_));
+        SaveAll(writer, args_);
+    }
+
 
     /*Method body*/
     MethodBody::MethodBody(std::unique_ptr<Statement>&& body) 
@@ -388,7 +1130,26 @@ namespace ast {
     }
 
     ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
-        return body_->Execute(closure, context);
+        ObjectHolder result = body_->Execute(closure, context);
+        if (context.GetCompletion() == Completion::Return) {
+            context.SetCompletion(Completion::Normal);
+            return result;
+        }
+        return {};
+    }
+
+    void MethodBody::Compile(Compiler& compiler) {
+        body_->Compile(compiler);
+    }
+
+    std::unique_ptr<Statement> MethodBody::Optimize() {
+        OptimizeInPlace(body_);
+        return nullptr;
+    }
+
+    void MethodBody::Save(image::Writer& writer) const {
+        writer.WriteTag(image::NodeTag::MethodBody);
+        writer.WriteNode(*body_);
     }
 
 }  // namespace ast
\ No newline at end of file
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "bytecode.h"
+#include "image.h"
 #include "runtime.h"
 
-#include <functional>
+#include <optional>
+#include <type_traits>
 
 namespace ast {
 
@@ -14,14 +17,55 @@ namespace ast {
     public:
         explicit ValueStatement(T v)
             : value_(std::move(v)) {
+            if constexpr (std::is_same_v<T, runtime::String>) {
+                // constant is shared by threads which execute the program, interned string
+                // counts references atomically, so threads may copy it
+                if (!value_.GetStringValue().IsInterned()) {
+                    value_ = runtime::String(runtime::StringInterner::Global().Intern(value_.GetValue()));
+                }
+            }
         }
 
         runtime::ObjectHolder Execute(runtime::Closure& /*closure*/,
             runtime::Context& /*context*/) override {
-            return runtime::ObjectHolder::Share(value_);
+            return MakeHolder();
+        }
+
+        void Compile(bytecode::Compiler& compiler) override {
+            compiler.Emit(bytecode::OpCode::PushConst, compiler.AddConstant(MakeHolder()));
+        }
+
+        void Save(image::Writer& writer) const override {
+            if constexpr (std::is_same_v<T, runtime::Number>) {
+                writer.WriteTag(image::NodeTag::NumericConst);
+                writer.WriteI32(value_.GetValue());
+            }
+            else if constexpr (std::is_same_v<T, runtime::String>) {
+                writer.WriteTag(image::NodeTag::StringConst);
+                writer.WriteString(value_.GetValue());
+            }
+            else {
+                static_assert(std::is_same_v<T, runtime::Bool>, "unknown type of constant");
+                writer.WriteTag(image::NodeTag::BoolConst);
+                writer.WriteU8(value_.GetValue() ? 1 : 0);
+            }
+        }
+
+        [[nodiscard]] const T& GetValue() const {
+            return value_;
         }
 
     private:
+        // copy of immediate value is cheaper than reference to it
+        runtime::ObjectHolder MakeHolder() {
+            if constexpr (runtime::ObjectHolder::IS_IMMEDIATE<T>) {
+                return runtime::ObjectHolder::Own(T(value_));
+            }
+            else {
+                return runtime::ObjectHolder::Share(value_);
+            }
+        }
+
         T value_;
 
     };
@@ -32,29 +76,51 @@ namespace ast {
 
     /*
     calculates value of variable with certain name or chain of field names of object id1.id2.id3.
+    If slot is set the variable (id1) is taken from slot of current runtime::Frame instead of closure.
     */
     class VariableValue : public Statement {
     public:
         explicit VariableValue(const std::string& var_name);
         explicit VariableValue(std::vector<std::string> dotted_ids);
+        VariableValue(std::vector<std::string> dotted_ids, size_t slot);
         VariableValue(const VariableValue&) = default;
         VariableValue(VariableValue&&) = default;
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        void Save(image::Writer& writer) const override;
+
+        [[nodiscard]] const std::vector<std::string>& GetDottedIds() const {
+            return var_name_chain_;
+        }
+
+        [[nodiscard]] const std::optional<size_t>& GetSlot() const {
+            return slot_;
+        }
+
     private:
         std::vector<std::string> var_name_chain_;
+        std::optional<size_t> slot_;
+        // cache of access to field var_name_chain_[i] is field_caches_[i], the first one is not used
+        std::vector<runtime::FieldCache> field_caches_;
         static runtime::ObjectHolder FindVariable(runtime::Closure& closure, const std::string& name);
     };
 
     // assign variable (which name is var) value of statement rv
+    // if slot is set the value is stored into slot of current runtime::Frame instead of closure
     class Assignment : public Statement {
     public:
         Assignment(std::string var, std::unique_ptr<Statement> rv);
+        Assignment(std::string var, size_t slot, std::unique_ptr<Statement> rv);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
 
     private:
         std::string var_name_;
+        std::optional<size_t> slot_;
         std::unique_ptr<Statement> value_;
     };
 
@@ -64,10 +130,14 @@ namespace ast {
         FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     private:
         VariableValue obj_;
         std::string field_name_;
         std::unique_ptr<Statement> value_;
+        runtime::FieldCache field_cache_;
     };
 
     // value None
@@ -77,6 +147,14 @@ namespace ast {
             [[maybe_unused]] runtime::Context& context) override {
             return {};
         }
+
+        void Compile(bytecode::Compiler& compiler) override {
+            compiler.Emit(bytecode::OpCode::PushNone);
+        }
+
+        void Save(image::Writer& writer) const override {
+            writer.WriteTag(image::NodeTag::None);
+        }
     };
 
     // command print
@@ -86,8 +164,11 @@ namespace ast {
         explicit Print(std::vector<std::unique_ptr<Statement>> args);
         static std::unique_ptr<Print> Variable(const std::string& name);
 
-        // output to stream which is result of context.GetOutputStream()
+        // output to sink which is result of context.GetOutput()
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     private:
         std::vector<std::unique_ptr<Statement>> args_;
     };
@@ -98,11 +179,15 @@ namespace ast {
         MethodCall(std::unique_ptr<Statement> object, std::string method,
             std::vector<std::unique_ptr<Statement>> args);
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     
     private:
         std::unique_ptr<Statement> obj_;
         std::string method_name_;
         std::vector<std::unique_ptr<Statement>> args_;
+        runtime::MethodCache method_cache_;
     };
 
     /*
@@ -115,6 +200,9 @@ namespace ast {
         explicit NewInstance(const runtime::Class& class_);
         NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args);
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
 		
     private:
         const runtime::Class& class_;
@@ -137,6 +225,9 @@ namespace ast {
     public:
         using UnaryOperation::UnaryOperation;
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     class BinaryOperation : public Statement {
@@ -147,6 +238,14 @@ namespace ast {
         
         }
 
+        [[nodiscard]] const Statement& GetLhs() const {
+            return *lhs_;
+        }
+
+        [[nodiscard]] const Statement& GetRhs() const {
+            return *rhs_;
+        }
+
     protected:
         std::unique_ptr<Statement> lhs_;
         std::unique_ptr<Statement> rhs_;    
@@ -163,6 +262,9 @@ namespace ast {
 		// obj1 + obj2 if obj1 has __add__ method
         // else throws runtime_error
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // lhs - rhs
@@ -174,6 +276,9 @@ namespace ast {
 		// number - number
         // else throw runtime_error
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // lhs * rhs
@@ -185,6 +290,9 @@ namespace ast {
 		// number * number
         // else throw runtime_error
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // lhs / rhs
@@ -197,6 +305,9 @@ namespace ast {
         // else throw runtime_error
         // if rhs = 0 throw runtime_error
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // lhs or rhs
@@ -205,6 +316,9 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
         // value of rhs calculates only if lhs transformed into Bool is equal to False
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // lhs and rhs
@@ -213,12 +327,18 @@ namespace ast {
         using BinaryOperation::BinaryOperation;
         // value of rhs calculates only if lhs transformed into Bool is equal to True
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     class Not : public UnaryOperation {
     public:
         using UnaryOperation::UnaryOperation;
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     };
 
     // several commands (for example, method bodey, code of if- or else- branches)
@@ -227,18 +347,22 @@ namespace ast {
         
         template <typename... Args>
         explicit Compound(Args&&... args) {
-            (commands_.push_back(std::move(args)), ...);
+            (AddStatement(std::move(args)), ...);
         }
 		
-		// add new statement to the end of list
-        void AddStatement(std::unique_ptr<Statement> stmt) {
-            commands_.push_back(std::move(stmt));
-        }
+		// add new statement to the end of list, line is line of the statement in text
+		// of program or 0 if it is unknown (see runtime::Profiler)
+        void AddStatement(std::unique_ptr<Statement> stmt, std::uint32_t line = 0);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
 
     private:
-        std::vector<std::unique_ptr<Statement>> commands_;
+        std::vector<std::unique_ptr<Statement>> statements_;
+        // lines_[i] is line of statements_[i]
+        std::vector<std::uint32_t> lines_;
     };
 
     class MethodBody : public Statement {
@@ -246,8 +370,11 @@ namespace ast {
         explicit MethodBody(std::unique_ptr<Statement>&& body);
 
         // if inside body return command was ewecuted then return the result of return command
-        // else return None
+        // else return None. Completion of context is Normal after execution
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     private:
         std::unique_ptr<Statement> body_;
     };
@@ -260,8 +387,12 @@ namespace ast {
 
         }
 
-        // stop execution of current method, it shoud return result of calculation of return statement
+        // stop execution of current method, it shoud return result of calculation of return statement.
+        // Completion of context becomes Return, so enclosing blocks pass the result to MethodBody
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     private:
         std::unique_ptr<Statement> statement_;
     };
@@ -272,6 +403,9 @@ namespace ast {
 
         // creates inside closure new object with name of class and the value which was passed into constructor
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
 
     private:
         runtime::ObjectHolder class_;
@@ -285,6 +419,9 @@ namespace ast {
             std::unique_ptr<Statement> else_body);
 
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
 
     private:
         std::unique_ptr<Statement> condition_;
@@ -292,19 +429,132 @@ namespace ast {
         std::unique_ptr<Statement> else_body_;
     };
 
+    // base of comparisons, every operator has its own node ComparisonOf<op>
     class Comparison : public BinaryOperation {
     public:
-        // function defining comparison
-        using Comparator = std::function<bool(const runtime::ObjectHolder&,
-            const runtime::ObjectHolder&, runtime::Context&)>;
+        using BinaryOperation::BinaryOperation;
+
+        // result of comparison of values of lhs and rhs
+        [[nodiscard]] virtual runtime::CompareOp GetOperator() const = 0;
+
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
+    };
+
+    // calculate lhs and rhs, return result of runtime::Compare<op>(lhs, rhs, context)
+    // transformed into runtime::Bool
+    template <runtime::CompareOp op>
+    class ComparisonOf : public Comparison {
+    public:
+        using Comparison::Comparison;
+
+        [[nodiscard]] runtime::CompareOp GetOperator() const override {
+            return op;
+        }
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+            runtime::ObjectHolder left = lhs_->Execute(closure, context);
+            runtime::ObjectHolder right = rhs_->Execute(closure, context);
+            return runtime::ObjectHolder::Own(runtime::Bool(runtime::Compare<op>(left, right, context)));
+        }
+    };
+
+    using Equal = ComparisonOf<runtime::CompareOp::Equal>;
+    using NotEqual = ComparisonOf<runtime::CompareOp::NotEqual>;
+    using Less = ComparisonOf<runtime::CompareOp::Less>;
+    using Greater = ComparisonOf<runtime::CompareOp::Greater>;
+    using LessOrEqual = ComparisonOf<runtime::CompareOp::LessOrEqual>;
+    using GreaterOrEqual = ComparisonOf<runtime::CompareOp::GreaterOrEqual>;
+
+    /*
+    Fused nodes replace common combinations of nodes (see ast::Optimize), so the combination
+    is one virtual call and one VM instruction, the object is calculated once and
+    fields are found once. Results and errors are the same as of the replaced nodes
+    */
+
+    // obj.field = obj.field + constant or obj.field = obj.field - constant,
+    // number in field is changed in place
+    class FieldIncrement : public Statement {
+    public:
+        FieldIncrement(VariableValue object, std::string field_name, runtime::Number constant, bool subtract);
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        void Save(image::Writer& writer) const override;
+    private:
+        VariableValue obj_;
+        std::string field_name_;
+        runtime::ObjectHolder constant_;
+        bool subtract_;
+        runtime::FieldCache field_cache_;
+    };
+
+    // obj.field = source.id2...idN, value is taken without a node of its own
+    class FieldCopy : public Statement {
+    public:
+        FieldCopy(VariableValue object, std::string field_name, VariableValue source);
+
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        void Save(image::Writer& writer) const override;
+    private:
+        VariableValue obj_;
+        std::string field_name_;
+        VariableValue source_;
+        runtime::FieldCache field_cache_;
+    };
+
+    // lhs <op> number, the constant is compared without execution of its node
+    template <runtime::CompareOp op>
+    class ConstantComparisonOf final : public ComparisonOf<op> {
+    public:
+        ConstantComparisonOf(std::unique_ptr<Statement> lhs, runtime::Number constant)
+            : ComparisonOf<op>(std::move(lhs), std::make_unique<NumericConst>(constant))
+            , constant_(runtime::ObjectHolder::Own(constant)) {
+        }
 
-        Comparison(Comparator cmp, std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs);
+        runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+            runtime::ObjectHolder left = this->lhs_->Execute(closure, context);
+            return runtime::ObjectHolder::Own(runtime::Bool(runtime::Compare<op>(left, constant_, context)));
+        }
+
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
+
+    private:
+        runtime::ObjectHolder constant_;
+    };
+
+    // comparison of lhs with number of the right kind of ConstantComparisonOf
+    std::unique_ptr<Comparison> MakeConstantComparison(runtime::CompareOp op,
+        std::unique_ptr<Statement> lhs, runtime::Number constant);
+
+    // self.method(args) inside method, self is taken from slot 0 of runtime::Frame
+    class SelfMethodCall : public Statement {
+    public:
+        SelfMethodCall(std::string method, std::vector<std::unique_ptr<Statement>> args);
 
-        // calculate lhs and rhs, return result of comparator(lhs, rhs, context) 
-        // transformed into runtime::Bool
         runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+        void Compile(bytecode::Compiler& compiler) override;
+        std::unique_ptr<Statement> Optimize() override;
+        void Save(image::Writer& writer) const override;
     private:
-        Comparator cmp_;
+        std::string method_name_;
+        std::vector<std::unique_ptr<Statement>> args_;
+        runtime::MethodCache method_cache_;
     };
 
+    // replace node with its simplified version if there is one
+    void OptimizeInPlace(std::unique_ptr<Statement>& node);
+
+    // constant folding and peephole simplification of tree between parsing and execution:
+    // arithmetic, comparisons, logic operations and str() of constants are calculated,
+    // not not x becomes x if x is boolean and if with constant condition becomes its branch.
+    // Operations which throw runtime_error (for example, division by zero) are kept,
+    // so the error is raised at execution. Then common combinations are fused: increments
+    // and copies of fields, comparisons with numbers and calls of methods of self
+    std::unique_ptr<Statement> Optimize(std::unique_ptr<Statement> program);
+
 }  // namespace ast
\ No newline at end of file
@@ -79,6 +79,30 @@ namespace ast {
             ASSERT(context.output.str().empty());
         }
 
+        void TestSlotVariables() {
+            runtime::DummyContext context;
+
+            runtime::Frame frame(3);
+            frame.Set(0, ObjectHolder::Own(runtime::Number(42)));
+            context.SetCurrentFrame(&frame);
+
+            Closure closure = { {"x"s, ObjectHolder::Own(runtime::Number(1))} };
+            Assignment assign_y("y"s, 1, make_unique<VariableValue>(vector{"x"s}, 0));
+            {
+                ObjectHolder o = assign_y.Execute(closure, context);
+                ASSERT_OBJECT_VALUE_EQUAL(o, 42);
+            }
+            ASSERT_OBJECT_VALUE_EQUAL(frame.Get(1), 42);
+            ASSERT(closure.find("y"s) == closure.end());
+
+            ASSERT_OBJECT_VALUE_EQUAL(VariableValue(vector{"y"s}, 1).Execute(closure, context), 42);
+            ASSERT_OBJECT_VALUE_EQUAL(VariableValue("x"s).Execute(closure, context), 1);
+            ASSERT_THROWS(VariableValue(vector{"z"s}, 2).Execute(closure, context), std::runtime_error);
+
+            context.SetCurrentFrame(nullptr);
+            ASSERT(context.output.str().empty());
+        }
+
         void TestAssignment() {
             runtime::DummyContext context;
 
@@ -308,6 +332,38 @@ namespace ast {
             ASSERT(context.output.str().empty());
         }
 
+        void TestReturnFromIf() {
+            runtime::DummyContext context;
+            Closure closure;
+
+            // return of None from if body stops the method
+            auto make_body = [](unique_ptr<Statement> if_result) {
+                return make_unique<MethodBody>(make_unique<Compound>(
+                    make_unique<IfElse>(make_unique<VariableValue>("x"s),
+                        make_unique<Compound>(make_unique<Return>(std::move(if_result))), nullptr),
+                    make_unique<Assignment>("y"s, make_unique<NumericConst>(1)),
+                    make_unique<Return>(make_unique<NumericConst>(5))));
+            };
+
+            closure["x"s] = ObjectHolder::Own(runtime::Bool{ true });
+            ASSERT(!make_body(make_unique<None>())->Execute(closure, context));
+            ASSERT_EQUAL(closure.count("y"s), 0U);
+            ASSERT(context.GetCompletion() == runtime::Completion::Normal);
+
+            ObjectHolder result = make_body(make_unique<NumericConst>(3))->Execute(closure, context);
+            ASSERT_OBJECT_VALUE_EQUAL(result, 3);
+
+            closure["x"s] = ObjectHolder::Own(runtime::Bool{ false });
+            result = make_body(make_unique<None>())->Execute(closure, context);
+            ASSERT_OBJECT_VALUE_EQUAL(result, 5);
+            ASSERT_EQUAL(closure.count("y"s), 1U);
+            ASSERT(context.GetCompletion() == runtime::Completion::Normal);
+
+            // block which ends without return gives None
+            MethodBody empty(make_unique<Compound>(make_unique<Assignment>("z"s, make_unique<NumericConst>(2))));
+            ASSERT(!empty.Execute(closure, context));
+        }
+
         void TestFields() {
             runtime::DummyContext context;
 
@@ -439,6 +495,33 @@ namespace ast {
             test_and(false, false);
         }
 
+        void TestShortCircuit() {
+            Closure closure;
+            runtime::DummyContext context;
+            // unknown variable throws if it is calculated
+            And and_statement{ make_unique<NumericConst>(0), make_unique<VariableValue>("unknown"s) };
+            ASSERT_OBJECT_VALUE_EQUAL(and_statement.Execute(closure, context), "False"s);
+            Or or_statement{ make_unique<StringConst>("x"s), make_unique<VariableValue>("unknown"s) };
+            ASSERT_OBJECT_VALUE_EQUAL(or_statement.Execute(closure, context), "True"s);
+
+            // value of rhs is transformed into Bool
+            closure["x"s] = ObjectHolder::Own(runtime::Number(5));
+            And and_value{ make_unique<BoolConst>(true), make_unique<VariableValue>("x"s) };
+            ASSERT_OBJECT_VALUE_EQUAL(and_value.Execute(closure, context), "True"s);
+            Or or_value{ make_unique<None>(), make_unique<StringConst>(""s) };
+            ASSERT_OBJECT_VALUE_EQUAL(or_value.Execute(closure, context), "False"s);
+            ASSERT_THROWS((Or{ make_unique<None>(), make_unique<VariableValue>("unknown"s) }.Execute(closure, context)),
+                runtime_error);
+
+            // constant lhs decides whether rhs is needed
+            unique_ptr<Statement> folded = Optimize(make_unique<And>(
+                make_unique<BoolConst>(false), make_unique<VariableValue>("unknown"s)));
+            ASSERT(dynamic_cast<BoolConst*>(folded.get()));
+            unique_ptr<Statement> rhs_only = Optimize(make_unique<Or>(
+                make_unique<NumericConst>(0), make_unique<Less>(make_unique<VariableValue>("x"s), make_unique<NumericConst>(7))));
+            ASSERT(dynamic_cast<Less*>(rhs_only.get()));
+        }
+
         void TestNot() {
             auto test_not = [](bool arg) {
                 Not not_statement{ make_unique<BoolConst>(arg) };
@@ -453,12 +536,134 @@ namespace ast {
             test_not(false);
         }
 
+        void TestOptimize() {
+            runtime::DummyContext context;
+            Closure closure;
+
+            // (2 + 3) * 4 - 6 / 2
+            unique_ptr<Statement> arithmetic = Optimize(make_unique<Sub>(
+                make_unique<Mult>(make_unique<Add>(make_unique<NumericConst>(2), make_unique<NumericConst>(3)),
+                    make_unique<NumericConst>(4)),
+                make_unique<Div>(make_unique<NumericConst>(6), make_unique<NumericConst>(2))));
+            ASSERT(dynamic_cast<NumericConst*>(arithmetic.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(arithmetic->Execute(closure, context), 17);
+
+            unique_ptr<Statement> concat = Optimize(make_unique<Add>(
+                make_unique<Add>(make_unique<StringConst>("a"s), make_unique<StringConst>("b"s)),
+                make_unique<Stringify>(make_unique<NumericConst>(5))));
+            ASSERT(dynamic_cast<StringConst*>(concat.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(concat->Execute(closure, context), "ab5"s);
+
+            unique_ptr<Statement> comparison = Optimize(make_unique<Not>(make_unique<Less>(
+                make_unique<NumericConst>(1), make_unique<NumericConst>(2))));
+            ASSERT(dynamic_cast<BoolConst*>(comparison.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(comparison->Execute(closure, context), "False"s);
+
+            // division by zero and wrong types are left to throw at execution
+            unique_ptr<Statement> division = Optimize(
+                make_unique<Div>(make_unique<NumericConst>(1), make_unique<NumericConst>(0)));
+            ASSERT(dynamic_cast<Div*>(division.get()));
+            ASSERT_THROWS(division->Execute(closure, context), runtime_error);
+            unique_ptr<Statement> bad_add = Optimize(
+                make_unique<Add>(make_unique<NumericConst>(1), make_unique<StringConst>("a"s)));
+            ASSERT(dynamic_cast<Add*>(bad_add.get()));
+
+            // not not x is removed only if x is Bool
+            unique_ptr<Statement> double_not = Optimize(make_unique<Not>(make_unique<Not>(make_unique<Equal>(
+                make_unique<VariableValue>("x"s), make_unique<NumericConst>(1)))));
+            ASSERT(dynamic_cast<Comparison*>(double_not.get()));
+            unique_ptr<Statement> to_bool = Optimize(make_unique<Not>(make_unique<Not>(make_unique<VariableValue>("x"s))));
+            ASSERT(dynamic_cast<Not*>(to_bool.get()));
+            closure["x"s] = ObjectHolder::Own(runtime::Number(1));
+            ASSERT_OBJECT_VALUE_EQUAL(to_bool->Execute(closure, context), "True"s);
+
+            // only the taken branch of if with constant condition is left
+            unique_ptr<Statement> if_else = Optimize(make_unique<IfElse>(
+                make_unique<Or>(make_unique<BoolConst>(false), make_unique<NumericConst>(0)),
+                make_unique<Print>(make_unique<StringConst>("then"s)),
+                make_unique<Print>(make_unique<StringConst>("else"s))));
+            ASSERT(dynamic_cast<Print*>(if_else.get()));
+            if_else->Execute(closure, context);
+            ASSERT_EQUAL(context.output.str(), "else\n"s);
+        }
+
+        void TestFusedNodes() {
+            runtime::DummyContext context;
+            Closure closure;
+
+            runtime::Class empty("Empty"s, {}, nullptr);
+            ObjectHolder object = ObjectHolder::Own(runtime::ClassInstance(empty));
+            auto& fields = object.TryAs<runtime::ClassInstance>()->Fields();
+            fields["x"s] = ObjectHolder::Own(runtime::Number(1));
+            fields["s"s] = ObjectHolder::Own(runtime::String("a"s));
+            runtime::Frame frame(1);
+            frame.Set(0, object);
+            context.SetCurrentFrame(&frame);
+
+            const VariableValue self(vector{ "self"s }, 0);
+            auto field = [](const string& name) {
+                return make_unique<VariableValue>(vector{ "self"s, name }, 0);
+            };
+
+            // self.x = self.x + 2, self.x = self.x - 5
+            unique_ptr<Statement> increment = Optimize(make_unique<FieldAssignment>(self, "x"s,
+                make_unique<Add>(field("x"s), make_unique<NumericConst>(2))));
+            ASSERT(dynamic_cast<FieldIncrement*>(increment.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(increment->Execute(closure, context), 3);
+            unique_ptr<Statement> decrement = Optimize(make_unique<FieldAssignment>(self, "x"s,
+                make_unique<Sub>(field("x"s), make_unique<NumericConst>(5))));
+            ASSERT(dynamic_cast<FieldIncrement*>(decrement.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(decrement->Execute(closure, context), -2);
+            ASSERT_OBJECT_VALUE_EQUAL(fields.at("x"s), -2);
+
+            // sum of other field or with value which is not constant is not fused
+            unique_ptr<Statement> other_field = Optimize(make_unique<FieldAssignment>(self, "y"s,
+                make_unique<Add>(field("x"s), make_unique<NumericConst>(1))));
+            ASSERT(dynamic_cast<FieldAssignment*>(other_field.get()));
+            unique_ptr<Statement> variable = Optimize(make_unique<FieldAssignment>(self, "x"s,
+                make_unique<Add>(field("x"s), make_unique<VariableValue>("d"s))));
+            ASSERT(dynamic_cast<FieldAssignment*>(variable.get()));
+
+            // errors are the same as of replaced nodes
+            unique_ptr<Statement> add_to_string = Optimize(make_unique<FieldAssignment>(self, "s"s,
+                make_unique<Add>(field("s"s), make_unique<NumericConst>(1))));
+            ASSERT(dynamic_cast<FieldIncrement*>(add_to_string.get()));
+            ASSERT_THROWS(add_to_string->Execute(closure, context), runtime_error);
+            unique_ptr<Statement> missing = Optimize(make_unique<FieldAssignment>(self, "missing"s,
+                make_unique<Add>(field("missing"s), make_unique<NumericConst>(1))));
+            ASSERT_THROWS(missing->Execute(closure, context), runtime_error);
+            ASSERT(fields.find("missing"s) == fields.end());
+
+            // self.y = self.x
+            unique_ptr<Statement> copy = Optimize(make_unique<FieldAssignment>(self, "y"s, field("x"s)));
+            ASSERT(dynamic_cast<FieldCopy*>(copy.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(copy->Execute(closure, context), -2);
+            ASSERT_OBJECT_VALUE_EQUAL(fields.at("y"s), -2);
+
+            // comparison with number keeps its operator
+            unique_ptr<Statement> less = Optimize(make_unique<Less>(field("x"s), make_unique<NumericConst>(0)));
+            ASSERT(dynamic_cast<Less*>(less.get()));
+            ASSERT(dynamic_cast<ConstantComparisonOf<runtime::CompareOp::Less>*>(less.get()));
+            ASSERT_OBJECT_VALUE_EQUAL(less->Execute(closure, context), "True"s);
+            unique_ptr<Statement> not_number = Optimize(make_unique<GreaterOrEqual>(field("s"s), make_unique<NumericConst>(0)));
+            ASSERT_THROWS(not_number->Execute(closure, context), runtime_error);
+
+            // self.method()
+            unique_ptr<Statement> call = Optimize(make_unique<MethodCall>(
+                make_unique<VariableValue>(vector{ "self"s }, 0), "method"s, vector<unique_ptr<Statement>>{}));
+            ASSERT(dynamic_cast<SelfMethodCall*>(call.get()));
+            ASSERT_THROWS(call->Execute(closure, context), runtime_error);
+
+            context.SetCurrentFrame(nullptr);
+        }
+
     }  // namespace
 
     void RunUnitTests(TestRunner& tr) {
         RUN_TEST(tr, ast::TestNumericConst);
         RUN_TEST(tr, ast::TestStringConst);
         RUN_TEST(tr, ast::TestVariable);
+        RUN_TEST(tr, ast::TestSlotVariables);
         RUN_TEST(tr, ast::TestAssignment);
         RUN_TEST(tr, ast::TestFieldAssignment);
         RUN_TEST(tr, ast::TestPrintVariable);
@@ -470,12 +675,16 @@ namespace ast {
         RUN_TEST(tr, ast::TestSuccessfulClassInstanceAdd);
         RUN_TEST(tr, ast::TestClassInstanceAddWithoutMethod);
         RUN_TEST(tr, ast::TestCompound);
+        RUN_TEST(tr, ast::TestReturnFromIf);
         RUN_TEST(tr, ast::TestFields);
         RUN_TEST(tr, ast::TestBaseClass);
         RUN_TEST(tr, ast::TestInheritance);
         RUN_TEST(tr, ast::TestOr);
         RUN_TEST(tr, ast::TestAnd);
+        RUN_TEST(tr, ast::TestShortCircuit);
         RUN_TEST(tr, ast::TestNot);
+        RUN_TEST(tr, ast::TestOptimize);
+        RUN_TEST(tr, ast::TestFusedNodes);
     }
 
 }  // namespace ast
\ No newline at end of file
@@ -0,0 +1,344 @@
+#include "string_value.h"
+
+#include "heap.h"
+
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace runtime {
+
+    struct StringValue::Rep {
+        // counter of interned representation is shared by threads, so it is changed atomically,
+        // other ones are changed by plain load and store. Permanent ones are not counted
+        std::atomic<size_t> refs = 1;
+        // interner whose table has the representation
+        StringInterner* interner = nullptr;
+        bool permanent = false;
+        size_t size = 0;
+        // rope is made of left and right parts until it is flattened into text
+        mutable bool flat = true;
+        mutable std::string text;
+        mutable Rep* left = nullptr;
+        mutable Rep* right = nullptr;
+        mutable bool hashed = false;
+        mutable size_t hash = 0;
+        // pool of thread which representation and its text are charged to, interned ones are not
+        // charged because they are shared by threads
+        mutable ObjectPool* pool = nullptr;
+        mutable size_t charged = 0;
+
+        ~Rep() {
+            if (pool) {
+                pool->Discharge(charged);
+            }
+        }
+
+        // charge memory of representation after its text has changed
+        void Charge() const {
+            if (!pool) {
+                pool = &ObjectPool::ForCurrentThread();
+            }
+            const size_t size = sizeof(Rep) + text.capacity();
+            if (size > charged) {
+                pool->Charge(size - charged);
+            }
+            else {
+                pool->Discharge(charged - size);
+            }
+            charged = size;
+        }
+    };
+
+    namespace {
+        // shorter strings are concatenated by copying, it is cheaper than rope
+        constexpr size_t MAX_COPIED_CONCAT_SIZE = 64;
+    }  // namespace
+
+    /* --- StringValue --- */
+    StringValue::StringValue()
+        : rep_(EmptyRep()) {
+
+    }
+
+    StringValue::StringValue(std::string text)
+        : rep_(new Rep()) {
+        rep_->size = text.size();
+        rep_->text = std::move(text);
+        rep_->Charge();
+    }
+
+    StringValue::StringValue(Rep* rep) noexcept
+        : rep_(rep) {
+
+    }
+
+    StringValue::StringValue(const StringValue& other) noexcept
+        : rep_(other.rep_) {
+        AddRef(rep_);
+    }
+
+    StringValue::StringValue(StringValue&& other) noexcept
+        : rep_(std::exchange(other.rep_, EmptyRep())) {
+
+    }
+
+    StringValue& StringValue::operator=(const StringValue& other) noexcept {
+        AddRef(other.rep_);
+        Release(rep_);
+        rep_ = other.rep_;
+        return *this;
+    }
+
+    StringValue& StringValue::operator=(StringValue&& other) noexcept {
+        std::swap(rep_, other.rep_);
+        return *this;
+    }
+
+    StringValue::~StringValue() {
+        Release(rep_);
+    }
+
+    const std::string& StringValue::Str() const {
+        if (!rep_->flat) {
+            Flatten(*rep_);
+        }
+        return rep_->text;
+    }
+
+    size_t StringValue::Size() const {
+        return rep_->size;
+    }
+
+    bool StringValue::Empty() const {
+        return rep_->size == 0;
+    }
+
+    size_t StringValue::Hash() const {
+        if (!rep_->hashed) {
+            rep_->hash = std::hash<std::string_view>{}(Str());
+            rep_->hashed = true;
+        }
+        return rep_->hash;
+    }
+
+    bool StringValue::IsInterned() const {
+        return rep_->interner != nullptr;
+    }
+
+    StringValue StringValue::Concat(const StringValue& lhs, const StringValue& rhs) {
+        if (rhs.Empty()) {
+            return lhs;
+        }
+        if (lhs.Empty()) {
+            return rhs;
+        }
+
+        if (lhs.Size() + rhs.Size() <= MAX_COPIED_CONCAT_SIZE) {
+            std::string text;
+            text.reserve(lhs.Size() + rhs.Size());
+            text += lhs.Str();
+            text += rhs.Str();
+            return StringValue(std::move(text));
+        }
+
+        Rep* rope = new Rep();
+        rope->size = lhs.Size() + rhs.Size();
+        rope->flat = false;
+        rope->left = lhs.rep_;
+        rope->right = rhs.rep_;
+        AddRef(rope->left);
+        AddRef(rope->right);
+        rope->Charge();
+        return StringValue(rope);
+    }
+
+    void StringValue::Append(const StringValue& tail) {
+        if (tail.Empty()) {
+            return;
+        }
+        if (rep_->interner == nullptr && rep_->flat && rep_->refs.load(std::memory_order_relaxed) == 1) {
+            // tail may be this value itself, append of string to itself is allowed
+            rep_->text += tail.Str();
+            rep_->size = rep_->text.size();
+            rep_->hashed = false;
+            rep_->Charge();
+            return;
+        }
+        *this = Concat(*this, tail);
+    }
+
+    bool StringValue::operator==(const StringValue& other) const {
+        if (rep_ == other.rep_) {
+            return true;
+        }
+        if (rep_->size != other.rep_->size
+            || (rep_->hashed && other.rep_->hashed && rep_->hash != other.rep_->hash)) {
+            return false;
+        }
+        return Str() == other.Str();
+    }
+
+    bool StringValue::operator!=(const StringValue& other) const {
+        return !(*this == other);
+    }
+
+    bool StringValue::operator<(const StringValue& other) const {
+        return Str() < other.Str();
+    }
+
+    StringValue::Rep* StringValue::EmptyRep() {
+        static Rep* const empty = StringInterner::Global().InternPermanent(""sv).rep_;
+        return empty;
+    }
+
+    void StringValue::AddRef(Rep* rep) noexcept {
+        if (rep->permanent) {
+            return;
+        }
+        if (rep->interner) {
+            rep->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            rep->refs.store(rep->refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    bool StringValue::DropRef(Rep* rep) noexcept {
+        if (rep->permanent) {
+            return false;
+        }
+        if (rep->interner) {
+            // the last reference is dropped under lock of interner, so Intern does not find freed string
+            size_t refs = rep->refs.load(std::memory_order_relaxed);
+            while (refs > 1) {
+                if (rep->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel,
+                                                    std::memory_order_relaxed)) {
+                    return false;
+                }
+            }
+            rep->interner->ReleaseLast(rep);
+            return false;
+        }
+        const size_t refs = rep->refs.load(std::memory_order_relaxed) - 1;
+        rep->refs.store(refs, std::memory_order_relaxed);
+        return refs == 0;
+    }
+
+    void StringValue::Release(Rep* rep) noexcept {
+        if (!DropRef(rep)) {
+            return;
+        }
+        if (rep->flat) {
+            delete rep;
+            return;
+        }
+
+        // long ropes are released without recursion
+        std::vector<Rep*> pending{ rep };
+        while (!pending.empty()) {
+            Rep* current = pending.back();
+            pending.pop_back();
+            for (Rep* part : { current->left, current->right }) {
+                if (part && DropRef(part)) {
+                    pending.push_back(part);
+                }
+            }
+            delete current;
+        }
+    }
+
+    void StringValue::Flatten(const Rep& rep) {
+        std::string text;
+        text.reserve(rep.size);
+
+        // parts are visited from left to right, stack is used because ropes can be long
+        std::vector<const Rep*> pending{ rep.right, rep.left };
+        while (!pending.empty()) {
+            const Rep* current = pending.back();
+            pending.pop_back();
+            if (current->flat) {
+                text += current->text;
+            }
+            else {
+                pending.push_back(current->right);
+                pending.push_back(current->left);
+            }
+        }
+
+        rep.text = std::move(text);
+        rep.flat = true;
+        rep.Charge();
+        Release(rep.left);
+        Release(rep.right);
+        rep.left = nullptr;
+        rep.right = nullptr;
+    }
+
+    std::ostream& operator<<(std::ostream& os, const StringValue& value) {
+        return os << value.Str();
+    }
+
+    /* --- StringInterner --- */
+    StringInterner& StringInterner::Global() {
+        // static values may hold interned strings until the end of process, so the interner is never destroyed
+        static StringInterner* interner = new StringInterner();
+        return *interner;
+    }
+
+    StringValue StringInterner::Intern(std::string_view text) {
+        std::lock_guard guard(mutex_);
+        if (auto it = permanent_.find(text); it != permanent_.end()) {
+            return StringValue(it->second);
+        }
+        auto it = strings_.find(text);
+        if (it == strings_.end()) {
+            StringValue::Rep* rep = MakeRep(text);
+            it = strings_.emplace(rep->text, rep).first;
+        }
+        else {
+            it->second->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        return StringValue(it->second);
+    }
+
+    StringValue StringInterner::InternPermanent(std::string_view text) {
+        std::lock_guard guard(mutex_);
+        auto it = permanent_.find(text);
+        if (it == permanent_.end()) {
+            StringValue::Rep* rep = MakeRep(text);
+            rep->permanent = true;
+            it = permanent_.emplace(rep->text, rep).first;
+        }
+        return StringValue(it->second);
+    }
+
+    size_t StringInterner::Size() const {
+        std::lock_guard guard(mutex_);
+        return strings_.size() + permanent_.size();
+    }
+
+    StringValue::Rep* StringInterner::MakeRep(std::string_view text) {
+        auto* rep = new StringValue::Rep();
+        rep->interner = this;
+        rep->size = text.size();
+        rep->text = std::string(text);
+        // interned strings are read by many threads, so hash is computed before sharing
+        rep->hash = std::hash<std::string_view>{}(rep->text);
+        rep->hashed = true;
+        return rep;
+    }
+
+    void StringInterner::ReleaseLast(StringValue::Rep* rep) noexcept {
+        std::lock_guard guard(mutex_);
+        if (rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            strings_.erase(rep->text);
+            delete rep;
+        }
+    }
+
+}  // namespace runtime
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace runtime {
+
+    // immutable string with shared representation: copy costs O(1) and hash is computed once.
+    // Concatenation of long strings makes rope which is flattened on the first access to text,
+    // so chain of additions copies every character once. Memory of strings which are not interned
+    // is charged to the object pool of the thread which made them (see ObjectPool::Charge)
+    class StringValue {
+    public:
+        // create empty string
+        StringValue();
+        explicit StringValue(std::string text);
+
+        StringValue(const StringValue& other) noexcept;
+        StringValue(StringValue&& other) noexcept;
+        StringValue& operator=(const StringValue& other) noexcept;
+        StringValue& operator=(StringValue&& other) noexcept;
+        ~StringValue();
+
+        // return text of string
+        [[nodiscard]] const std::string& Str() const;
+
+        [[nodiscard]] size_t Size() const;
+        [[nodiscard]] bool Empty() const;
+        [[nodiscard]] size_t Hash() const;
+
+        // return true if string is interned (see StringInterner)
+        [[nodiscard]] bool IsInterned() const;
+
+        [[nodiscard]] static StringValue Concat(const StringValue& lhs, const StringValue& rhs);
+
+        // the same as *this = Concat(*this, tail), but text which is not shared with other values
+        // is extended in place, so chain of appends to one value is amortised O(1) per character
+        void Append(const StringValue& tail);
+
+        bool operator==(const StringValue& other) const;
+        bool operator!=(const StringValue& other) const;
+        bool operator<(const StringValue& other) const;
+
+    private:
+        friend class StringInterner;
+
+        struct Rep;
+
+        explicit StringValue(Rep* rep) noexcept;
+
+        // permanent empty string, moved-from values refer to it
+        static Rep* EmptyRep();
+        static void AddRef(Rep* rep) noexcept;
+        static void Release(Rep* rep) noexcept;
+        // drop reference, return true if representation is not interned and is not referenced anymore
+        static bool DropRef(Rep* rep) noexcept;
+        // build text of rope and release its parts
+        static void Flatten(const Rep& rep);
+
+        Rep* rep_;
+    };
+
+    std::ostream& operator<<(std::ostream& os, const StringValue& value);
+
+    // table of unique strings: string literals of programs and constants of their trees.
+    // Interned strings with equal text share one representation whose hash is computed at
+    // interning and whose counter of references is atomic, so they can be used by many threads.
+    // String is removed from the table when the last value which refers to it is destroyed,
+    // so programs which are parsed one after another do not grow the table. Permanent strings
+    // of the interpreter itself are never freed and their copying does not change counters.
+    // Interner itself is thread-safe
+    class StringInterner {
+    public:
+        StringInterner() = default;
+        StringInterner(const StringInterner&) = delete;
+        StringInterner& operator=(const StringInterner&) = delete;
+
+        // interner of process
+        [[nodiscard]] static StringInterner& Global();
+
+        // return permanent string with this text if it exists, otherwise counted one
+        [[nodiscard]] StringValue Intern(std::string_view text);
+        // return string which lives until the end of process, for names which the interpreter uses itself
+        [[nodiscard]] StringValue InternPermanent(std::string_view text);
+
+        // return number of unique strings
+        [[nodiscard]] size_t Size() const;
+
+    private:
+        friend class StringValue;
+
+        [[nodiscard]] StringValue::Rep* MakeRep(std::string_view text);
+        // drop the last reference to interned string, it is removed unless Intern has found it meanwhile
+        void ReleaseLast(StringValue::Rep* rep) noexcept;
+
+        mutable std::mutex mutex_;
+        // keys refer to text of representations
+        std::unordered_map<std::string_view, StringValue::Rep*> strings_;
+        std::unordered_map<std::string_view, StringValue::Rep*> permanent_;
+    };
+
+}  // namespace runtime
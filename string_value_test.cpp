@@ -0,0 +1,187 @@
+#include "runtime.h"
+#include "string_value.h"
+#include "test_runner_p.h"
+
+using namespace std;
+
+namespace runtime {
+
+    namespace {
+
+        void TestSharedText() {
+            StringValue value("some text which is long enough not to fit into small buffer"s);
+            StringValue copy = value;
+            ASSERT_EQUAL(&copy.Str(), &value.Str());
+            ASSERT_EQUAL(copy.Hash(), value.Hash());
+            ASSERT(copy == value);
+
+            StringValue moved = std::move(copy);
+            ASSERT_EQUAL(&moved.Str(), &value.Str());
+            ASSERT(copy.Empty());  // NOLINT(bugprone-use-after-move)
+            ASSERT_EQUAL(StringValue().Str(), ""s);
+
+            StringValue other("some text which is long enough not to fit into small buffer"s);
+            ASSERT(&other.Str() != &value.Str());
+            ASSERT(other == value);
+            ASSERT_EQUAL(other.Hash(), value.Hash());
+            ASSERT(StringValue("a"s) < StringValue("b"s));
+            ASSERT(StringValue("a"s) != StringValue("b"s));
+        }
+
+        void TestConcat() {
+            StringValue hello("hello"s);
+            StringValue space(" "s);
+            StringValue world("world"s);
+            StringValue short_result = StringValue::Concat(StringValue::Concat(hello, space), world);
+            ASSERT_EQUAL(short_result.Str(), "hello world"s);
+            ASSERT_EQUAL(short_result.Size(), 11U);
+            ASSERT_EQUAL(&StringValue::Concat(hello, StringValue()).Str(), &hello.Str());
+
+            // long strings make rope which is flattened on access
+            string part(50, 'x');
+            StringValue left(part);
+            StringValue rope = StringValue::Concat(left, StringValue(string(50, 'y')));
+            rope = StringValue::Concat(StringValue("<"s), rope);
+            ASSERT_EQUAL(rope.Size(), 101U);
+            ASSERT_EQUAL(rope.Str(), "<"s + part + string(50, 'y'));
+            ASSERT_EQUAL(left.Str(), part);
+
+            // concatenation does not change operands
+            ASSERT_EQUAL(StringValue::Concat(rope, rope).Str(), rope.Str() + rope.Str());
+        }
+
+        void TestLongRope() {
+            const size_t count = 100000;
+            StringValue piece(string(70, 'a'));
+            StringValue result;
+            for (size_t i = 0; i < count; ++i) {
+                result = StringValue::Concat(result, piece);
+            }
+            ASSERT_EQUAL(result.Size(), count * 70);
+            ASSERT_EQUAL(result.Str(), string(count * 70, 'a'));
+
+            // release of unflattened long rope does not use recursion
+            StringValue unflattened;
+            for (size_t i = 0; i < count; ++i) {
+                unflattened = StringValue::Concat(piece, unflattened);
+            }
+            ASSERT_EQUAL(unflattened.Size(), count * 70);
+        }
+
+        void TestAppend() {
+            StringValue value("ab"s);
+            const string* text = &value.Str();
+            value.Append(StringValue("cd"s));
+            ASSERT_EQUAL(value.Str(), "abcd"s);
+            ASSERT_EQUAL(&value.Str(), text);
+            value.Append(value);
+            ASSERT_EQUAL(value.Str(), "abcdabcd"s);
+            value.Append(StringValue());
+            ASSERT_EQUAL(value.Size(), 8U);
+
+            // shared and interned texts are not changed
+            const size_t hash = value.Hash();
+            StringValue copy = value;
+            value.Append(StringValue("!"s));
+            ASSERT_EQUAL(copy.Str(), "abcdabcd"s);
+            ASSERT_EQUAL(copy.Hash(), hash);
+            ASSERT_EQUAL(value.Str(), "abcdabcd!"s);
+            ASSERT_EQUAL(value.Hash(), StringValue("abcdabcd!"s).Hash());
+            StringValue interned = StringInterner::Global().Intern("append test"sv);
+            interned.Append(StringValue("?"s));
+            ASSERT_EQUAL(interned.Str(), "append test?"s);
+            ASSERT_EQUAL(StringInterner::Global().Intern("append test"sv).Str(), "append test"s);
+        }
+
+        void TestInterner() {
+            StringInterner& interner = StringInterner::Global();
+            StringValue first = interner.Intern("interner test string"sv);
+            size_t size = interner.Size();
+            StringValue second = interner.Intern("interner test string"s);
+            ASSERT_EQUAL(interner.Size(), size);
+            ASSERT(first.IsInterned());
+            ASSERT_EQUAL(&first.Str(), &second.Str());
+            ASSERT(!StringValue("interner test string"s).IsInterned());
+
+            StringValue third = interner.Intern("other interner test string"sv);
+            ASSERT_EQUAL(interner.Size(), size + 1);
+            ASSERT(third != first);
+
+            // string is removed with the last value which refers to it
+            {
+                StringValue temporary = interner.Intern("temporary interner test string"sv);
+                StringValue copy = temporary;
+                ASSERT_EQUAL(interner.Size(), size + 2);
+            }
+            ASSERT_EQUAL(interner.Size(), size + 1);
+            const std::string* text = &interner.Intern("interner test string"sv).Str();
+            ASSERT_EQUAL(text, &first.Str());
+
+            // permanent string is found by Intern and is not removed
+            const size_t permanent_size = interner.InternPermanent("permanent interner test string"sv).Size();
+            StringValue permanent = interner.Intern("permanent interner test string"sv);
+            ASSERT(permanent.IsInterned());
+            ASSERT_EQUAL(permanent.Size(), permanent_size);
+            ASSERT_EQUAL(&permanent.Str(), &interner.InternPermanent("permanent interner test string"sv).Str());
+            ASSERT_EQUAL(interner.Size(), size + 2);
+        }
+
+        void TestStringObject() {
+            ObjectHolder lhs = ObjectHolder::Own(String(string(40, 'l')));
+            ObjectHolder rhs = ObjectHolder::Own(String(string(40, 'r')));
+            DummyContext context;
+            ObjectHolder sum = Add(lhs, rhs, context);
+            ASSERT_EQUAL(sum.TryAs<String>()->GetValue(), string(40, 'l') + string(40, 'r'));
+
+            // str() of string shares its text
+            ObjectHolder str = Stringify(lhs, context);
+            ASSERT_EQUAL(&str.TryAs<String>()->GetValue(), &lhs.TryAs<String>()->GetValue());
+            ASSERT_EQUAL(Stringify(ObjectHolder::Own(Number{ -15 }), context).TryAs<String>()->GetValue(), "-15"s);
+            ASSERT_EQUAL(Stringify(ObjectHolder::Own(Bool{ false }), context).TryAs<String>()->GetValue(), "False"s);
+            ASSERT_EQUAL(Stringify(ObjectHolder::None(), context).TryAs<String>()->GetValue(), "None"s);
+        }
+
+        void TestTemporaryStrings() {
+            DummyContext context;
+            ObjectHolder rhs = ObjectHolder::Own(String("r"s));
+            ObjectHolder temporary = ObjectHolder::Own(String("l"s));
+            const Object* object = temporary.Get();
+            ASSERT(temporary.IsUnique());
+            ObjectHolder sum = Add(std::move(temporary), rhs, context);
+            ASSERT_EQUAL(sum.Get(), object);
+            ASSERT_EQUAL(sum.TryAs<String>()->GetValue(), "lr"s);
+
+            // string which other holder references is not changed
+            ObjectHolder shared = sum;
+            ASSERT(!sum.IsUnique());
+            ObjectHolder other = Add(std::move(shared), rhs, context);
+            ASSERT(other.Get() != object);
+            ASSERT_EQUAL(sum.TryAs<String>()->GetValue(), "lr"s);
+            ASSERT_EQUAL(other.TryAs<String>()->GetValue(), "lrr"s);
+            String constant("c"s);
+            ASSERT_EQUAL(Add(ObjectHolder::Share(constant), rhs, context).TryAs<String>()->GetValue(), "cr"s);
+            ASSERT_EQUAL(constant.GetValue(), "c"s);
+            ObjectHolder between_threads = ObjectHolder::Own(String("t"s));
+            between_threads.ShareBetweenThreads();
+            ASSERT(!between_threads.IsUnique());
+
+            // str() of temporary string is the string itself
+            const Object* other_object = other.Get();
+            ASSERT_EQUAL(Stringify(std::move(other), context).Get(), other_object);
+            ASSERT(Stringify(sum, context).Get() != sum.Get());
+            ASSERT(!ObjectHolder::Own(Number(1)).IsUnique());
+        }
+
+    }  // namespace
+
+    void RunStringValueTests(TestRunner& tr) {
+        RUN_TEST(tr, runtime::TestSharedText);
+        RUN_TEST(tr, runtime::TestConcat);
+        RUN_TEST(tr, runtime::TestLongRope);
+        RUN_TEST(tr, runtime::TestAppend);
+        RUN_TEST(tr, runtime::TestInterner);
+        RUN_TEST(tr, runtime::TestStringObject);
+        RUN_TEST(tr, runtime::TestTemporaryStrings);
+    }
+
+}  // namespace runtime